@@ -0,0 +1,28 @@
+# Run with cmake -P. Writes every .vert and .frag in SHADER_DIR into OUTPUT
+# as std::string_view constants named after the file, so unlit.frag
+# becomes UNLIT_FRAG_SHADER.
+
+file(GLOB shaders "${SHADER_DIR}/*.vert" "${SHADER_DIR}/*.frag")
+list(SORT shaders)
+
+set(content "// Generated from ${SHADER_DIR} by embed_shaders.cmake, do not edit\n")
+string(APPEND content "#pragma once\n\n#include <string_view>\n")
+foreach (shader IN LISTS shaders)
+    get_filename_component(name "${shader}" NAME)
+    string(TOUPPER "${name}" constant)
+    string(MAKE_C_IDENTIFIER "${constant}_SHADER" constant)
+    file(READ "${shader}" source)
+    string(FIND "${source}" ")glsl\"" clash)
+    if (NOT clash EQUAL -1)
+        message(FATAL_ERROR "${shader} contains the raw string delimiter )glsl\"")
+    endif()
+    string(APPEND content "\nconstexpr const std::string_view ${constant} = R\"glsl(${source})glsl\";\n")
+endforeach()
+
+# Left alone when unchanged, so nothing including it rebuilds
+if (EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if (NOT "${previous}" STREQUAL "${content}")
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
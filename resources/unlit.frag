@@ -2,12 +2,27 @@
 
 in vec2 v_uv;
 
-uniform sampler2D u_main_tex;
+uniform usampler2D u_main_tex;
+uniform ivec2 u_resolution;
+uniform vec3 u_palette[4];
 uniform vec3 u_tint;
 
 out vec4 frag_color;
 
 void main()
 {
-    frag_color = texture(u_main_tex, v_uv);
+    // Display row 0 is the top of the screen
+    ivec2 pixel = min(ivec2(v_uv * vec2(u_resolution)), u_resolution - 1);
+    pixel.y = u_resolution.y - 1 - pixel.y;
+
+    // Rows are little endian uint64 words, so the high half of each
+    // word holds its left 32 pixels, most significant bit first. The
+    // second plane starts 4 texels (two words) into the row.
+    int word = (pixel.x / 64) * 2 + 1 - (pixel.x % 64) / 32;
+    uint shift = uint(31 - pixel.x % 32);
+    uint plane0 = texelFetch(u_main_tex, ivec2(word, pixel.y), 0).r;
+    uint plane1 = texelFetch(u_main_tex, ivec2(word + 4, pixel.y), 0).r;
+    uint color = ((plane0 >> shift) & 1u) | (((plane1 >> shift) & 1u) << 1);
+
+    frag_color = vec4(u_palette[color] * u_tint, 1.0);
 }
@@ -0,0 +1,68 @@
+#include "alsa_sink.h"
+
+#include <alsa/asoundlib.h>
+#include <fmt/core.h>
+
+namespace
+{
+    // Buffered by the device, a few frames so a late wake of the sink
+    // thread does not starve it
+    constexpr const unsigned int deviceLatencyUs = 50000;
+}
+
+AlsaSink::~AlsaSink()
+{
+    close();
+}
+
+auto AlsaSink::open() -> bool
+{
+    int err = snd_pcm_open(&m_pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0)
+    {
+        fmt::print("Could not open the audio device: {}\n", snd_strerror(err));
+        m_pcm = nullptr;
+        return false;
+    }
+    err = snd_pcm_set_params(m_pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED, 1, AUDIO_SAMPLE_RATE, 1,
+        deviceLatencyUs);
+    if (err < 0)
+    {
+        fmt::print("Could not configure the audio device: {}\n", snd_strerror(err));
+        close();
+        return false;
+    }
+    return true;
+}
+
+auto AlsaSink::close() -> void
+{
+    if (m_pcm == nullptr)
+        return;
+    snd_pcm_drain(m_pcm);
+    snd_pcm_close(m_pcm);
+    m_pcm = nullptr;
+}
+
+// Blocks while the device buffer is full. An underrun on the device side
+// is recovered from and the write retried.
+auto AlsaSink::write(std::span<const int16_t> samples) -> bool
+{
+    while (!samples.empty())
+    {
+        snd_pcm_sframes_t written = snd_pcm_writei(m_pcm, samples.data(), samples.size());
+        if (written < 0)
+        {
+            if (snd_pcm_recover(m_pcm, static_cast<int>(written), 1) < 0)
+                return false;
+            continue;
+        }
+        samples = samples.subspan(static_cast<size_t>(written));
+    }
+    return true;
+}
+
+auto AlsaSink::realtime() const -> bool
+{
+    return true;
+}
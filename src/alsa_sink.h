@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "audio.h"
+
+struct _snd_pcm;
+
+// The default ALSA playback device, only built with CHIP8_AUDIO_ALSA
+class AlsaSink : public AudioSink
+{
+public:
+    AlsaSink() = default;
+    ~AlsaSink() override;
+
+    auto open() -> bool;
+    auto close() -> void;
+    auto write(std::span<const int16_t> samples) -> bool override;
+    [[nodiscard]] auto realtime() const -> bool override;
+
+private:
+    _snd_pcm* m_pcm{};
+};
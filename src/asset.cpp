@@ -2,10 +2,99 @@
 
 #include <fmt/core.h>
 #include <glad/glad.h>
+#include <GLFW/glfw3.h>
 
-#include <string>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
-#include <sstream>
+#include <string>
+
+#include "checksum.h"
+
+namespace
+{
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+using TexStorage2DProc = void (APIENTRYP)(GLenum, GLsizei, GLenum, GLsizei, GLsizei);
+using BufferStorageProc = void (APIENTRYP)(GLenum, GLsizeiptr, const void*, GLbitfield);
+
+// Entry points newer than the 4.1 core profile glad was generated for,
+// loaded only when the context advertises them
+struct StorageFunctions
+{
+    TexStorage2DProc texStorage2D{};
+    BufferStorageProc bufferStorage{};
+};
+
+constexpr const uint32_t PROGRAM_CACHE_MAGIC = 0x42503843; // "C8PB"
+// Nothing the driver hands back for two small shaders comes close
+constexpr const uint32_t MAX_PROGRAM_BINARY = 16 * 1024 * 1024;
+
+// Precedes the driver's binary in a cache file
+struct ProgramCacheHeader
+{
+    uint32_t magic;
+    uint32_t format; // from glGetProgramBinary
+    uint64_t key;
+    uint32_t length;
+    uint32_t checksum; // CRC-32C of the binary
+};
+
+// The binary is only valid for the driver that produced it
+auto programKey(std::string_view vertexSrc, std::string_view fragSrc) -> uint64_t
+{
+    // Terminated, so moving text from one part to the next changes the key
+    std::string parts;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+        const auto* value = reinterpret_cast<const char*>(glGetString(name));
+        parts.append(value != nullptr ? value : "").push_back('\0');
+    }
+    parts.append(vertexSrc).push_back('\0');
+    parts.append(fragSrc);
+    return fnv1a64({reinterpret_cast<const uint8_t*>(parts.data()), parts.size()});
+}
+
+auto hasGLSupport(int major, int minor, std::string_view extension) -> bool
+{
+    GLint ctxMajor{}, ctxMinor{};
+    glGetIntegerv(GL_MAJOR_VERSION, &ctxMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &ctxMinor);
+    if (ctxMajor > major || (ctxMajor == major && ctxMinor >= minor))
+        return true;
+
+    GLint count{};
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const auto* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (name != nullptr && extension == name)
+            return true;
+    }
+    return false;
+}
+
+auto storageFunctions() -> const StorageFunctions&
+{
+    static const StorageFunctions functions = []
+    {
+        StorageFunctions f;
+        if (hasGLSupport(4, 2, "GL_ARB_texture_storage"))
+            f.texStorage2D = reinterpret_cast<TexStorage2DProc>(glfwGetProcAddress("glTexStorage2D"));
+        if (hasGLSupport(4, 4, "GL_ARB_buffer_storage"))
+            f.bufferStorage = reinterpret_cast<BufferStorageProc>(glfwGetProcAddress("glBufferStorage"));
+        return f;
+    }();
+    return functions;
+}
+
+}
 
 Model::Model(std::vector<Model::Vertex>& vertices, std::vector<int>& indices) : m_indicesSize(indices.size())
 {
@@ -45,7 +134,8 @@ auto Model::initModel(std::vector<Model::Vertex>& vertices, std::vector<int>& in
     glBindVertexArray(0);
 }
 
-Texture::Texture(int width, int height) : m_width(width), m_height(height)
+Texture::Texture(int width, int height, unsigned int internalFormat, unsigned int format, unsigned int type) :
+    m_width(width), m_height(height), m_internalFormat(internalFormat), m_format(format), m_type(type)
 {
     generate(width, height);
 }
@@ -63,87 +153,143 @@ auto Texture::generate(int width, int height) -> void
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // Storage is allocated once, updates only replace its contents
+    if (storageFunctions().texStorage2D != nullptr)
+        storageFunctions().texStorage2D(GL_TEXTURE_2D, 1, m_internalFormat, width, height);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, m_internalFormat, width, height, 0, m_format, m_type, nullptr);
 
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-auto Texture::update(unsigned char* data) -> void
+auto Texture::update(const void* data) -> void
+{
+    updateRows(data, 0, m_height);
+}
+
+auto Texture::updateRows(const void* data, int firstRow, int rowCount) -> void
 {
     glBindTexture(GL_TEXTURE_2D, m_id);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, firstRow, m_width, rowCount, m_format, m_type, data);
 }
 
-Shader::Shader(std::string_view vertFile, std::string_view fragFile)
+PixelBuffer::PixelBuffer(size_t slotSize) : m_slotSize(slotSize)
 {
-    std::string vertexCode;
-    std::string fragCode;
+    const auto size = static_cast<GLsizeiptr>(m_slotSize * slotCount);
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &m_id);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_id);
+    storageFunctions().bufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+    m_mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
 
-    try
+PixelBuffer::~PixelBuffer()
+{
+    for (void* fence : m_fences)
     {
-        std::ifstream vertexInputStream;
-        vertexInputStream.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        vertexInputStream.open(vertFile);
-
-        std::ifstream fragInputStram;
-        fragInputStram.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fragInputStram.open(fragFile);
+        if (fence != nullptr)
+            glDeleteSync(static_cast<GLsync>(fence));
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_id);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &m_id);
+}
 
-        std::stringstream vertexStream, fragStream;
-        vertexStream << vertexInputStream.rdbuf();
-        fragStream << fragInputStram.rdbuf();
+auto PixelBuffer::supported() -> bool
+{
+    return storageFunctions().bufferStorage != nullptr;
+}
 
-        vertexInputStream.close();
-        fragInputStram.close();
+auto PixelBuffer::valid() const -> bool
+{
+    return m_mapped != nullptr;
+}
 
-        vertexCode = vertexStream.str();
-        fragCode = fragStream.str();
+auto PixelBuffer::acquire() -> unsigned char*
+{
+    m_slot = (m_slot + 1) % slotCount;
+    auto fence = static_cast<GLsync>(m_fences.at(m_slot));
+    if (fence != nullptr)
+    {
+        const GLuint64 timeout = 1'000'000'000;
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        glDeleteSync(fence);
+        m_fences.at(m_slot) = nullptr;
     }
-    catch (std::ifstream::failure& e)
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_id);
+    return m_mapped + slotOffset();
+}
+
+auto PixelBuffer::slotOffset() const -> size_t
+{
+    return m_slotSize * m_slot;
+}
+
+auto PixelBuffer::release() -> void
+{
+    m_fences.at(m_slot) = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+Shader::Shader(std::string_view vertexSrc, std::string_view fragSrc, std::string_view cacheDir)
+{
+    GLint formats{};
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (cacheDir.empty() || formats == 0)
     {
-        fmt::print("Shader file not successfully read!\n");
+        compile(vertexSrc, fragSrc);
+        return;
     }
 
-    compile(vertexCode.c_str(), fragCode.c_str());
+    uint64_t key = programKey(vertexSrc, fragSrc);
+    std::string path = fmt::format("{}/{:016x}.glprog", cacheDir, key);
+    m_fromCache = loadBinary(path, key);
+    if (!m_fromCache && compile(vertexSrc, fragSrc))
+        saveBinary(cacheDir, path, key);
 }
 
-auto Shader::compile(std::string_view vertexSrc, std::string_view fragSrc) -> void
+auto Shader::compile(std::string_view vertexSrc, std::string_view fragSrc) -> bool
 {
     unsigned int vertexID{}, fragID{};
     int success{};
-    std::string infoLog{};
+    std::string infoLog(Shader::logBufferSize, '\0');
     const char* stringSrc{};
+    GLint length{};
 
-    // TODO: check how to get the address of the string view literal string
     stringSrc = vertexSrc.data();
+    length = static_cast<GLint>(vertexSrc.size());
     vertexID = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexID, 1, &stringSrc, nullptr);
+    glShaderSource(vertexID, 1, &stringSrc, &length);
     glCompileShader(vertexID);
 
     glGetShaderiv(vertexID, GL_COMPILE_STATUS, &success);
     if (!success)
     {
         glGetShaderInfoLog(vertexID, Shader::logBufferSize, nullptr, infoLog.data());
-        fmt::print("Vertex shader compilation failed: {}\n", infoLog);
+        fmt::print("Vertex shader compilation failed: {}\n", infoLog.c_str());
     }
 
     stringSrc = fragSrc.data();
+    length = static_cast<GLint>(fragSrc.size());
     fragID = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragID, 1, &stringSrc, nullptr);
+    glShaderSource(fragID, 1, &stringSrc, &length);
     glCompileShader(fragID);
 
     glGetShaderiv(fragID, GL_COMPILE_STATUS, &success);
     if (!success)
     {
         glGetShaderInfoLog(fragID, Shader::logBufferSize, nullptr, infoLog.data());
-        fmt::print("Fragment shader compilation failed: {}\n", infoLog);
+        fmt::print("Fragment shader compilation failed: {}\n", infoLog.c_str());
     }
 
     m_id = glCreateProgram();
     glAttachShader(m_id, vertexID);
     glAttachShader(m_id, fragID);
+    glProgramParameteri(m_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
     glLinkProgram(m_id);
 
@@ -151,11 +297,75 @@ auto Shader::compile(std::string_view vertexSrc, std::string_view fragSrc) -> vo
     if (!success)
     {
         glGetProgramInfoLog(m_id, Shader::logBufferSize, nullptr, infoLog.data());
-        fmt::print("Shader program linking failed: {}\n", infoLog);
+        fmt::print("Shader program linking failed: {}\n", infoLog.c_str());
     }
 
     glDeleteShader(vertexID);
     glDeleteShader(fragID);
+    return success != 0;
+}
+
+// A missing, stale or damaged file, or one the driver no longer accepts,
+// is a miss rather than an error
+auto Shader::loadBinary(const std::string& path, uint64_t key) -> bool
+{
+    std::ifstream in(path, std::ios::binary);
+    ProgramCacheHeader header{};
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+    if (header.magic != PROGRAM_CACHE_MAGIC || header.key != key || header.length > MAX_PROGRAM_BINARY)
+        return false;
+    std::vector<uint8_t> binary(header.length);
+    if (!in.read(reinterpret_cast<char*>(binary.data()), static_cast<std::streamsize>(binary.size()))
+        || crc32c(binary) != header.checksum)
+        return false;
+
+    m_id = glCreateProgram();
+    glProgramBinary(m_id, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+    int success{};
+    glGetProgramiv(m_id, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        // An unknown format also raises GL_INVALID_ENUM
+        while (glGetError() != GL_NO_ERROR)
+            ;
+        glDeleteProgram(m_id);
+        m_id = 0;
+        return false;
+    }
+    return true;
+}
+
+auto Shader::saveBinary(std::string_view cacheDir, const std::string& path, uint64_t key) const -> void
+{
+    GLint length{};
+    glGetProgramiv(m_id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || static_cast<uint32_t>(length) > MAX_PROGRAM_BINARY)
+        return;
+    std::vector<uint8_t> binary(length);
+    GLenum format{};
+    glGetProgramBinary(m_id, length, &length, &format, binary.data());
+    binary.resize(length);
+
+    ProgramCacheHeader header{PROGRAM_CACHE_MAGIC, format, key, static_cast<uint32_t>(binary.size()), crc32c(binary)};
+    std::error_code error;
+    std::filesystem::create_directories(cacheDir, error);
+    // Renamed into place, so another instance starting meanwhile never
+    // reads half a file
+    std::string written = path + ".tmp";
+    {
+        std::ofstream out(written, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(binary.data()), static_cast<std::streamsize>(binary.size()));
+        if (!out)
+        {
+            fmt::print("Could not write the shader cache {}\n", written);
+            return;
+        }
+    }
+    std::filesystem::rename(written, path, error);
+    if (error)
+        fmt::print("Could not write the shader cache {}: {}\n", path, error.message());
 }
 
 auto Shader::use() const -> void
@@ -168,8 +378,17 @@ auto Shader::setInt(std::string_view name, int value) const -> void
     glUniform1i(glGetUniformLocation(m_id, name.data()), value);
 }
 
+auto Shader::setIVec2(std::string_view name, int x, int y) const -> void
+{
+    glUniform2i(glGetUniformLocation(m_id, name.data()), x, y);
+}
+
 auto Shader::setVec3(std::string_view name, float x, float y, float z) const -> void
 {
     glUniform3f(glGetUniformLocation(m_id, name.data()), x, y, z);
 }
 
+auto Shader::fromCache() const -> bool
+{
+    return m_fromCache;
+}
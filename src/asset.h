@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <vector>
 #include <string_view>
 
@@ -40,27 +44,70 @@ private:
 class Texture
 {
 public:
-    Texture(int width, int height);
+    Texture(int width, int height, unsigned int internalFormat, unsigned int format, unsigned int type);
     auto bind() const -> void;
     auto generate(int width, int height) -> void;
-    auto update(unsigned char* data) -> void;
+    auto update(const void* data) -> void;
+    // data is a client pointer, or an offset when a pixel buffer is bound
+    auto updateRows(const void* data, int firstRow, int rowCount) -> void;
 
 private:
     unsigned int m_id;
     int m_width, m_height;
+    unsigned int m_internalFormat, m_format, m_type;
 };
 
+// Persistently mapped pixel unpack buffer split into slots that are
+// written in turn, so the CPU never waits on the upload it just queued
+class PixelBuffer
+{
+public:
+    PixelBuffer(size_t slotSize);
+    PixelBuffer(const PixelBuffer& p) = delete;
+    PixelBuffer(PixelBuffer&& p) = delete;
+    auto operator=(const PixelBuffer& p) -> PixelBuffer& = delete;
+    auto operator=(PixelBuffer&& p) -> PixelBuffer& = delete;
+    ~PixelBuffer();
+
+    static auto supported() -> bool;
+    [[nodiscard]] auto valid() const -> bool;
+    // Waits for the next slot, binds the buffer and returns the slot memory
+    auto acquire() -> unsigned char*;
+    [[nodiscard]] auto slotOffset() const -> size_t;
+    // Fences the slot and unbinds the buffer
+    auto release() -> void;
+
+private:
+    constexpr static int slotCount = 2;
+
+    unsigned int m_id{};
+    size_t m_slotSize;
+    unsigned char* m_mapped{};
+    int m_slot{};
+    std::array<void*, slotCount> m_fences{};
+};
+
+// Links a program from source. Given a cache directory the driver's binary
+// of the linked program is kept there, named by a hash of the driver and
+// both sources; a later start with the same driver loads it instead of
+// compiling, and anything that does not load falls back to the sources.
 class Shader
 {
 public:
-    Shader(std::string_view vertFile, std::string_view fragFile);
-    auto compile(std::string_view vertexSrc, std::string_view fragSrc) -> void;
+    Shader(std::string_view vertexSrc, std::string_view fragSrc, std::string_view cacheDir = {});
+    auto compile(std::string_view vertexSrc, std::string_view fragSrc) -> bool;
     auto use() const -> void;
     auto setInt(std::string_view name, int value) const -> void;
+    auto setIVec2(std::string_view name, int x, int y) const -> void;
     auto setVec3(std::string_view name, float x, float y, float z) const -> void;
+    [[nodiscard]] auto fromCache() const -> bool;
 
 private:
-    unsigned int m_id;
+    auto loadBinary(const std::string& path, uint64_t key) -> bool;
+    auto saveBinary(std::string_view cacheDir, const std::string& path, uint64_t key) const -> void;
+
+    unsigned int m_id{};
+    bool m_fromCache{};
 
     constexpr static int logBufferSize = 512;
 };
@@ -0,0 +1,252 @@
+#include "audio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <fmt/core.h>
+
+#include "chip8.h"
+
+namespace
+{
+    // Four bits on, four off: 500 Hz at the 4000 bits per second of the
+    // default pitch
+    constexpr const std::array<uint8_t, AUDIO_PATTERN_SIZE> squarePattern =
+    {
+        0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+        0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+    };
+    constexpr const double patternBits = AUDIO_PATTERN_SIZE * 8;
+    constexpr const int16_t amplitude = 8192;
+    constexpr const int wavHeaderSize = 44;
+
+    auto putLE(uint8_t* out, uint32_t value, int bytes) -> void
+    {
+        for (int i = 0; i < bytes; i++)
+            out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    auto wavHeader(uint32_t dataBytes) -> std::array<uint8_t, wavHeaderSize>
+    {
+        std::array<uint8_t, wavHeaderSize> header{};
+        uint8_t* p = header.data();
+        std::ranges::copy(std::string_view("RIFF"), p);
+        putLE(p + 4, 36 + dataBytes, 4);
+        std::ranges::copy(std::string_view("WAVEfmt "), p + 8);
+        putLE(p + 16, 16, 4);                        // fmt chunk size
+        putLE(p + 20, 1, 2);                         // PCM
+        putLE(p + 22, 1, 2);                         // mono
+        putLE(p + 24, AUDIO_SAMPLE_RATE, 4);
+        putLE(p + 28, AUDIO_SAMPLE_RATE * 2, 4);     // bytes per second
+        putLE(p + 32, 2, 2);                         // bytes per sample frame
+        putLE(p + 34, 16, 2);                        // bits per sample
+        std::ranges::copy(std::string_view("data"), p + 36);
+        putLE(p + 40, dataBytes, 4);
+        return header;
+    }
+}
+
+auto Synth::render(const Chip8& chip8, std::span<int16_t, SAMPLES_PER_FRAME> out) -> void
+{
+    if (!chip8.buzzing())
+    {
+        std::ranges::fill(out, 0);
+        m_phase = 0.0;
+        return;
+    }
+
+    // The pitch register stays at 64 outside XO-CHIP
+    const std::array<uint8_t, AUDIO_PATTERN_SIZE>& pattern =
+        chip8.variant() == Variant::XOChip ? chip8.audioPattern() : squarePattern;
+    double step = 4000.0 * std::exp2((chip8.pitch() - 64) / 48.0) / AUDIO_SAMPLE_RATE;
+    for (int16_t& sample : out)
+    {
+        auto bit = static_cast<int>(m_phase);
+        bool high = ((pattern[bit / 8] >> (7 - bit % 8)) & 0x1) != 0;
+        sample = high ? amplitude : -amplitude;
+        m_phase += step;
+        if (m_phase >= patternBits)
+            m_phase -= patternBits;
+    }
+}
+
+auto NullSink::write(std::span<const int16_t> /*samples*/) -> bool
+{
+    return true;
+}
+
+WavSink::~WavSink()
+{
+    close();
+}
+
+auto WavSink::open(std::string_view path) -> bool
+{
+    m_out.open(std::string(path), std::ios::binary);
+    if (!m_out.is_open())
+    {
+        fmt::print("Could not open the file {} for writing\n", path);
+        return false;
+    }
+    m_dataBytes = 0;
+    // Rewritten with the real sizes on close
+    std::array<uint8_t, wavHeaderSize> header = wavHeader(0);
+    m_out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    return m_out.good();
+}
+
+auto WavSink::close() -> bool
+{
+    if (!m_out.is_open())
+        return true;
+    std::array<uint8_t, wavHeaderSize> header = wavHeader(m_dataBytes);
+    m_out.seekp(0);
+    m_out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    bool ok = m_out.good();
+    m_out.close();
+    return ok;
+}
+
+// Samples are written as they are in memory, little endian on every host
+// the JIT runs on
+auto WavSink::write(std::span<const int16_t> samples) -> bool
+{
+    m_out.write(reinterpret_cast<const char*>(samples.data()), static_cast<std::streamsize>(samples.size_bytes()));
+    m_dataBytes += static_cast<uint32_t>(samples.size_bytes());
+    return m_out.good();
+}
+
+AudioOutput::AudioOutput(AudioSink& sink) : m_sink(sink), m_thread([this] { run(); })
+{
+}
+
+AudioOutput::~AudioOutput()
+{
+    stop();
+}
+
+auto AudioOutput::submit(const Chip8& chip8) -> void
+{
+    AudioBlock block;
+    m_synth.render(chip8, block.samples);
+    block.queuedNs = steadyNowNs();
+    m_stats.frames++;
+
+    if (m_sink.realtime())
+    {
+        if (!m_queue.push(block))
+        {
+            m_stats.overruns++;
+            return;
+        }
+    }
+    else
+    {
+        // Every frame reaches the file, the emulator waits for room
+        for (;;)
+        {
+            uint64_t played = m_played.load(std::memory_order_acquire);
+            if (m_queue.push(block))
+                break;
+            m_played.wait(played, std::memory_order_acquire);
+        }
+    }
+    m_submitted.fetch_add(1, std::memory_order_release);
+    m_submitted.notify_one();
+}
+
+auto AudioOutput::stop() -> void
+{
+    if (!m_thread.joinable())
+        return;
+    m_running.store(false, std::memory_order_release);
+    m_submitted.fetch_add(1, std::memory_order_release);
+    m_submitted.notify_one();
+    m_thread.join();
+}
+
+auto AudioOutput::stats() const -> const AudioStats&
+{
+    return m_stats;
+}
+
+auto AudioOutput::print() const -> void
+{
+    double seconds = static_cast<double>(m_stats.frames) / TIMER_HZ;
+    fmt::print("audio: {} frames ({:.1f} s at {} Hz), {} underruns, {} overruns, {} write errors\n",
+        m_stats.frames, seconds, AUDIO_SAMPLE_RATE, m_stats.underruns, m_stats.overruns, m_stats.writeErrors);
+    m_latency.print("audio latency");
+}
+
+auto AudioOutput::play(const AudioBlock& block) -> void
+{
+    m_latency.record(steadyNowNs() - block.queuedNs);
+    if (!m_sink.write(block.samples))
+        m_stats.writeErrors++;
+}
+
+// A real time sink takes one frame per 60 Hz deadline, counted from the
+// first frame like the scheduler's, and plays silence when none is queued.
+// A gap as long as the queue is a pause rather than an underrun: the sink
+// goes idle until the emulator sends the next frame. Other sinks write
+// frames as they arrive and drain the queue on stop.
+auto AudioOutput::run() -> void
+{
+    AudioBlock block{};
+    const std::array<int16_t, SAMPLES_PER_FRAME> silence{};
+    bool realtime = m_sink.realtime();
+    bool playing = false;
+    int64_t originNs = 0;
+    uint64_t frame = 0;
+    uint64_t missed = 0;
+
+    for (;;)
+    {
+        if (realtime && playing)
+        {
+            int64_t deadlineNs = originNs + static_cast<int64_t>(frame) * TIMER_PERIOD_NS;
+            std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadlineNs)));
+            if (!m_running.load(std::memory_order_acquire))
+                return;
+            frame++;
+            if (m_queue.pop(block))
+            {
+                // A gap the emulator came back from was an underrun
+                m_stats.underruns += std::exchange(missed, 0);
+                play(block);
+            }
+            else if (++missed == AUDIO_QUEUE_FRAMES)
+            {
+                playing = false;
+            }
+            else
+            {
+                if (!m_sink.write(silence))
+                    m_stats.writeErrors++;
+            }
+            continue;
+        }
+
+        uint64_t submitted = m_submitted.load(std::memory_order_acquire);
+        bool running = m_running.load(std::memory_order_acquire);
+        if (m_queue.pop(block))
+        {
+            m_played.fetch_add(1, std::memory_order_release);
+            m_played.notify_one();
+            play(block);
+            if (realtime)
+            {
+                playing = true;
+                originNs = steadyNowNs();
+                frame = 1;
+                missed = 0;
+            }
+            continue;
+        }
+        if (!running)
+            return;
+        m_submitted.wait(submitted, std::memory_order_acquire);
+    }
+}
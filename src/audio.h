@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string_view>
+#include <thread>
+
+#include "latency_histogram.h"
+#include "scheduler.h"
+#include "spsc_queue.h"
+
+class Chip8;
+
+constexpr const uint32_t AUDIO_SAMPLE_RATE = 48000;
+// Every emulated frame is exactly this many samples, so audio time is
+// emulated time and a run renders the same samples however fast it goes
+constexpr const int SAMPLES_PER_FRAME = AUDIO_SAMPLE_RATE / TIMER_HZ;
+static_assert(AUDIO_SAMPLE_RATE % TIMER_HZ == 0, "a frame must be a whole number of samples");
+// Frames queued between the emulator and the sink, about a quarter second
+constexpr const size_t AUDIO_QUEUE_FRAMES = 16;
+
+// One 60 Hz frame of mono signed 16 bit samples
+struct AudioBlock
+{
+    int64_t queuedNs; // steady_clock, when the emulator handed it over
+    std::array<int16_t, SAMPLES_PER_FRAME> samples;
+};
+
+// Renders the buzzer. XO-CHIP plays its 128 bit pattern buffer at
+// 4000 * 2^((pitch - 64) / 48) bits per second, the others a fixed 500 Hz
+// square wave. Each tone starts at the beginning of its waveform, so the
+// output depends only on the sequence of frames.
+class Synth
+{
+public:
+    // The frame the last tick of chip8 ran
+    auto render(const Chip8& chip8, std::span<int16_t, SAMPLES_PER_FRAME> out) -> void;
+
+private:
+    // Position in the pattern, in bits
+    double m_phase{};
+};
+
+// Where the samples end up. write is only called on the sink thread.
+class AudioSink
+{
+public:
+    AudioSink() = default;
+    AudioSink(const AudioSink& s) = delete;
+    AudioSink(AudioSink&& s) = delete;
+    auto operator=(const AudioSink& s) -> AudioSink& = delete;
+    auto operator=(AudioSink&& s) -> AudioSink& = delete;
+    virtual ~AudioSink() = default;
+
+    virtual auto write(std::span<const int16_t> samples) -> bool = 0;
+    // Real time sinks play at the sample rate. The emulator never waits
+    // for them and they are fed silence when it falls behind. The others
+    // take every frame, as fast as they are produced.
+    [[nodiscard]] virtual auto realtime() const -> bool
+    {
+        return false;
+    }
+};
+
+// Discards everything, for headless runs and builds without a device
+class NullSink : public AudioSink
+{
+public:
+    auto write(std::span<const int16_t> samples) -> bool override;
+};
+
+// 16 bit mono PCM. The sizes in the header are filled in by close.
+class WavSink : public AudioSink
+{
+public:
+    ~WavSink() override;
+
+    auto open(std::string_view path) -> bool;
+    auto close() -> bool;
+    auto write(std::span<const int16_t> samples) -> bool override;
+
+private:
+    std::ofstream m_out;
+    uint32_t m_dataBytes{};
+};
+
+struct AudioStats
+{
+    uint64_t frames{};
+    // Frames a real time sink played as silence because none was queued,
+    // pauses aside
+    uint64_t underruns{};
+    // Frames dropped because a real time sink's queue was full, in turbo
+    uint64_t overruns{};
+    uint64_t writeErrors{};
+};
+
+// Synthesizes a block per emulated frame on the emulation thread and hands
+// it to a sink thread through a lock-free ring, so the emulator never
+// blocks on the sink. Queue latency, from hand-over to the sink's write,
+// is recorded per block.
+class AudioOutput
+{
+public:
+    explicit AudioOutput(AudioSink& sink);
+    AudioOutput(const AudioOutput& a) = delete;
+    AudioOutput(AudioOutput&& a) = delete;
+    auto operator=(const AudioOutput& a) -> AudioOutput& = delete;
+    auto operator=(AudioOutput&& a) -> AudioOutput& = delete;
+    ~AudioOutput();
+
+    // Emulation thread, once after every tick
+    auto submit(const Chip8& chip8) -> void;
+    // Writes out what is queued and joins the sink thread
+    auto stop() -> void;
+
+    // Only complete after stop
+    [[nodiscard]] auto stats() const -> const AudioStats&;
+    auto print() const -> void;
+
+private:
+    auto run() -> void;
+    auto play(const AudioBlock& block) -> void;
+
+    AudioSink& m_sink;
+    Synth m_synth;
+    SpscQueue<AudioBlock, AUDIO_QUEUE_FRAMES> m_queue;
+    // Counts the sides wait on, the ring itself never blocks
+    std::atomic<uint64_t> m_submitted{0};
+    std::atomic<uint64_t> m_played{0};
+    std::atomic<bool> m_running{true};
+    AudioStats m_stats;
+    LatencyHistogram m_latency;
+    std::thread m_thread;
+};
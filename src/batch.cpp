@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "chip8.h"
+#include "rom_pack.h"
+#include "work_stealing_deque.h"
+
+// Runs a manifest of ROM jobs across all cores. Each manifest line is
+//     <rom> <seed> <frames> [input script]
+// with paths relative to the manifest and '#' starting a comment. Input
+// scripts hold one "<frame> <key> <down|up>" event per line, key in hex,
+// applied before that frame's tick. With --pack, ROMs are looked up in the
+// pack by name, or by content hash given as 16 hex digits, instead of
+// being read from files.
+
+struct ScriptEvent
+{
+    uint64_t frame;
+    uint8_t key;
+    bool pressed;
+};
+
+constexpr const size_t NO_SCRIPT = SIZE_MAX;
+
+struct BatchJob
+{
+    std::string romPath;
+    size_t rom;
+    size_t script;
+    uint32_t seed;
+    uint64_t frames;
+};
+
+struct BatchOptions
+{
+    const char* manifest{};
+    const char* output{"results.csv"};
+    const char* pack{};
+    unsigned threads{};
+    Engine engine{Engine::Cached};
+    Variant variant{Variant::Chip8};
+    // The variant's preset unless given
+    Quirks quirks{};
+    bool quirksSet{};
+};
+
+struct WorkerStats
+{
+    uint64_t jobs{};
+    uint64_t steals{};
+    uint64_t instructions{};
+};
+
+// Everything the workers share. ROMs and scripts are read once up front
+// and are immutable while the workers run. ROMs point into the pack's
+// mapping, or into romFiles without one.
+struct Farm
+{
+    std::vector<BatchJob> jobs;
+    RomPack pack;
+    std::deque<std::vector<uint8_t>> romFiles;
+    std::vector<std::span<const uint8_t>> roms;
+    std::vector<std::vector<ScriptEvent>> scripts;
+    std::vector<std::unique_ptr<WorkStealingDeque<uint32_t>>> queues;
+    std::atomic<size_t> claimed{0};
+
+    std::mutex outputMutex;
+    FILE* output{};
+};
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_batch <manifest> [--threads N] [--engine switch|cached|jit] [--variant chip8|schip|xochip]\n"
+        "       [--quirks default|cosmac|schip|xochip] [--output results.csv] [--pack roms.c8p]\n");
+}
+
+auto parseOptions(int argc, char** argv, BatchOptions& options) -> bool
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+            options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--engine" && i + 1 < argc)
+        {
+            if (!engineFromName(argv[++i], options.engine))
+                return false;
+        }
+        else if (arg == "--variant" && i + 1 < argc)
+        {
+            if (!variantFromName(argv[++i], options.variant))
+                return false;
+        }
+        else if (arg == "--quirks" && i + 1 < argc)
+        {
+            if (!quirksFromName(argv[++i], options.quirks))
+                return false;
+            options.quirksSet = true;
+        }
+        else if (arg == "--output" && i + 1 < argc)
+            options.output = argv[++i];
+        else if (arg == "--pack" && i + 1 < argc)
+            options.pack = argv[++i];
+        else if (options.manifest == nullptr && !arg.starts_with("--"))
+            options.manifest = argv[i];
+        else
+            return false;
+    }
+
+    if (options.threads == 0)
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    if (!options.quirksSet)
+        options.quirks = variantQuirks(options.variant);
+    return options.manifest != nullptr;
+}
+
+auto readFile(const std::filesystem::path& path, std::vector<uint8_t>& data) -> bool
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+    {
+        fmt::print("Could not open the file {} for reading\n", path.string());
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+auto readScript(const std::filesystem::path& path, std::vector<ScriptEvent>& events) -> bool
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+    {
+        fmt::print("Could not open the file {} for reading\n", path.string());
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        uint64_t frame = 0;
+        int key = 0;
+        std::string action;
+        if (!(fields >> frame))
+            continue;
+        if (!(fields >> std::hex >> key >> action) || key < 0 || key >= KEY_SIZE || (action != "down" && action != "up"))
+        {
+            fmt::print("{}:{}: expected <frame> <key> <down|up>\n", path.string(), number);
+            return false;
+        }
+        events.push_back(ScriptEvent{frame, static_cast<uint8_t>(key), action == "down"});
+    }
+    std::ranges::stable_sort(events, {}, &ScriptEvent::frame);
+    return true;
+}
+
+auto findROM(Farm& farm, const std::filesystem::path& base, const std::string& rom) -> bool
+{
+    if (!farm.pack.isOpen())
+    {
+        if (!readFile(base / rom, farm.romFiles.emplace_back()))
+            return false;
+        farm.roms.emplace_back(farm.romFiles.back());
+        return true;
+    }
+
+    size_t index = 0;
+    uint64_t hash = 0;
+    auto [end, error] = std::from_chars(rom.data(), rom.data() + rom.size(), hash, 16);
+    bool isHash = rom.size() == 16 && error == std::errc{} && end == rom.data() + rom.size();
+    if (!farm.pack.findName(rom, index) && !(isHash && farm.pack.findHash(hash, index)))
+    {
+        fmt::print("{} is not in the pack\n", rom);
+        return false;
+    }
+    farm.roms.push_back(farm.pack.rom(index));
+    return true;
+}
+
+// Loads each distinct ROM and script once, however many jobs share them
+auto readManifest(const char* manifest, Farm& farm) -> bool
+{
+    std::ifstream in(manifest);
+    if (!in.is_open())
+    {
+        fmt::print("Could not open the file {} for reading\n", manifest);
+        return false;
+    }
+
+    std::filesystem::path base = std::filesystem::path(manifest).parent_path();
+    std::map<std::string, size_t> romIndex;
+    std::map<std::string, size_t> scriptIndex;
+
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string rom;
+        std::string script;
+        BatchJob job{};
+        if (!(fields >> rom))
+            continue;
+        if (!(fields >> job.seed >> job.frames))
+        {
+            fmt::print("{}:{}: expected <rom> <seed> <frames> [script]\n", manifest, number);
+            return false;
+        }
+        fields >> script;
+
+        auto [romIt, newRom] = romIndex.try_emplace(rom, farm.roms.size());
+        if (newRom && !findROM(farm, base, rom))
+            return false;
+        job.romPath = rom;
+        job.rom = romIt->second;
+
+        job.script = NO_SCRIPT;
+        if (!script.empty())
+        {
+            auto [scriptIt, newScript] = scriptIndex.try_emplace(script, farm.scripts.size());
+            if (newScript && !readScript(base / script, farm.scripts.emplace_back()))
+                return false;
+            job.script = scriptIt->second;
+        }
+
+        farm.jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+// FNV-1a over the visible words of each plane in turn. Only XO-CHIP draws
+// on the second plane, so the other variants leave it out.
+auto screenHash(const Display& display, Variant variant) -> uint64_t
+{
+    int planes = variant == Variant::XOChip ? PLANE_COUNT : 1;
+    int words = display.hires() ? PLANE_WORDS : 1;
+    uint64_t hash = 0xCBF29CE484222325;
+    for (int plane = 0; plane < planes; plane++)
+    {
+        for (int y = 0; y < display.height(); y++)
+        {
+            for (int w = 0; w < words; w++)
+            {
+                uint64_t word = display.rows()[y][plane * PLANE_WORDS + w];
+                for (int byte = 0; byte < 8; byte++)
+                {
+                    hash ^= (word >> (byte * 8)) & 0xFF;
+                    hash *= 0x100000001B3;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+// Own queue first, then steal round the other workers starting with the
+// next one so thieves spread out instead of all hitting worker 0.
+auto takeJob(Farm& farm, size_t worker, uint32_t& job, WorkerStats& stats) -> bool
+{
+    size_t workers = farm.queues.size();
+    while (farm.claimed.load(std::memory_order_relaxed) < farm.jobs.size())
+    {
+        if (farm.queues[worker]->pop(job))
+            return true;
+
+        for (size_t i = 1; i < workers; i++)
+        {
+            if (farm.queues[(worker + i) % workers]->steal(job))
+            {
+                stats.steals++;
+                return true;
+            }
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+// completed counts the frames that ran to the end, also when one throws
+auto runJob(Chip8& chip8, const Farm& farm, const BatchJob& job, uint64_t& completed) -> bool
+{
+    completed = 0;
+    chip8.cpuReset();
+    chip8.seedRandom(job.seed);
+    if (!chip8.loadROM(farm.roms[job.rom]))
+        return false;
+
+    std::span<const ScriptEvent> events;
+    if (job.script != NO_SCRIPT)
+        events = farm.scripts[job.script];
+
+    auto next = events.begin();
+    for (uint64_t frame = 0; frame < job.frames; frame++)
+    {
+        for (; next != events.end() && next->frame == frame; ++next)
+            next->pressed ? chip8.keyPressed(next->key) : chip8.keyReleased(next->key);
+        chip8.tick();
+        completed++;
+    }
+    return true;
+}
+
+auto runWorker(Farm& farm, size_t worker, Engine engine, Variant variant, Quirks quirks, WorkerStats& stats) -> void
+{
+    // One machine per worker, reset between jobs so the JIT arena and
+    // decode cache allocations are reused. Always checked, a bad access is
+    // reported as a fault rather than wrapped.
+    Chip8 chip8;
+    chip8.setVariant(variant);
+    chip8.setQuirks(quirks);
+    chip8.setChecked(true);
+    chip8.setEngine(engine);
+
+    uint32_t index = 0;
+    while (takeJob(farm, worker, index, stats))
+    {
+        farm.claimed.fetch_add(1, std::memory_order_relaxed);
+        const BatchJob& job = farm.jobs[index];
+
+        auto start = std::chrono::steady_clock::now();
+        std::string_view status = "ok";
+        uint64_t completed = 0;
+        try
+        {
+            if (!runJob(chip8, farm, job, completed))
+                status = "load-failed";
+        }
+        catch (const std::exception&)
+        {
+            status = "fault";
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        uint64_t instructions = completed * INSTRUCTIONS_PER_FRAME;
+        stats.jobs++;
+        stats.instructions += instructions;
+
+        std::lock_guard lock(farm.outputMutex);
+        fmt::print(farm.output, "{},{},{},{},{},{:016x},{:.3f},{}\n", index, job.romPath, job.seed, job.frames,
+            instructions, screenHash(chip8.display(), variant), elapsed.count(), status);
+    }
+}
+
+auto main(int argc, char** argv) -> int
+{
+    BatchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    Farm farm;
+    if (options.pack != nullptr && !farm.pack.open(options.pack))
+        return 1;
+    if (!readManifest(options.manifest, farm))
+        return 1;
+
+    farm.output = std::fopen(options.output, "w");
+    if (farm.output == nullptr)
+    {
+        fmt::print("Could not open the file {} for writing\n", options.output);
+        return 1;
+    }
+    fmt::print(farm.output, "job,rom,seed,frames,instructions,screen_hash,wall_ms,status\n");
+
+    // Deal the jobs round robin; stealing evens out whatever imbalance is left
+    size_t workers = options.threads;
+    for (size_t w = 0; w < workers; w++)
+        farm.queues.push_back(std::make_unique<WorkStealingDeque<uint32_t>>(farm.jobs.size() / workers + 1));
+    for (size_t j = 0; j < farm.jobs.size(); j++)
+        farm.queues[j % workers]->push(static_cast<uint32_t>(j));
+
+    std::vector<WorkerStats> stats(workers);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t w = 0; w < workers; w++)
+        threads.emplace_back(runWorker, std::ref(farm), w, options.engine, options.variant, options.quirks, std::ref(stats[w]));
+    for (auto& thread : threads)
+        thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::fclose(farm.output);
+
+    uint64_t instructions = 0;
+    for (size_t w = 0; w < workers; w++)
+    {
+        fmt::print("worker {}: {} jobs, {} stolen\n", w, stats[w].jobs, stats[w].steals);
+        instructions += stats[w].instructions;
+    }
+    double seconds = elapsed.count();
+    fmt::print("{} jobs on {} threads in {:.3f} s ({:.1f} jobs/sec, {:.0f} instructions/sec)\n", farm.jobs.size(),
+        workers, seconds, seconds > 0.0 ? farm.jobs.size() / seconds : 0.0, seconds > 0.0 ? instructions / seconds : 0.0);
+
+    return 0;
+}
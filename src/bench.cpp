@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "chip8.h"
+#include "frame_encoder.h"
+
+#ifndef CHIP8_BENCH_GL
+#define CHIP8_BENCH_GL 0
+#endif
+
+#if CHIP8_BENCH_GL
+#include "window.h"
+#include "renderer.h"
+#endif
+
+// Throughput of the emulator hot paths on synthetic ROMs built below, one
+// JSON result per benchmark so builds can be diffed. Opcode classes and
+// sprites run as whole ticks of a tight loop of that opcode; frames run
+// mixed programs; display covers expanding the packed rows to pixels,
+// high resolution scrolls and, when built with CHIP8_BENCH_GL and a display
+// is available, the texture upload.
+
+struct BenchOptions
+{
+    const char* output{};
+    const char* filter{};
+    double minSeconds{0.25};
+    bool checked{CHECKED_BY_DEFAULT};
+    bool gl{};
+};
+
+struct BenchResult
+{
+    std::string group;
+    std::string name;
+    std::string_view engine;
+    uint64_t ops;
+    uint64_t instructions;
+    double seconds;
+};
+
+struct SyntheticRom
+{
+    std::string_view name;
+    std::initializer_list<uint16_t> setup;
+    std::initializer_list<uint16_t> body;
+    int repeat;
+};
+
+// Subroutine for the call benchmark and sprite data, past the code
+constexpr const uint16_t SUBROUTINE_ADDRESS = 0x3F0;
+constexpr const uint16_t DATA_ADDRESS = 0x400;
+
+// Each body is repeated then closed with a jump back to its start, so the
+// jump is the only opcode outside the class being measured
+const std::array opcodeRoms =
+{
+    SyntheticRom{"alu", {0x6005, 0x6103, 0x6207}, {0x7001, 0x8014, 0x8102, 0x8213, 0x8324, 0x8415, 0x8506, 0x8627,
+        0x870E, 0x8010}, 8},
+    SyntheticRom{"skip", {0x6005}, {0x3005, 0x7101, 0x4005, 0x7101, 0x5010, 0x7101, 0x9010, 0x7101}, 8},
+    SyntheticRom{"index", {0x6003}, {0xA400, 0xF01E, 0xF029, 0xA401}, 16},
+    SyntheticRom{"memory", {0x6012, 0x6134, 0x6256}, {0xA600, 0xF033, 0xA600, 0xF255, 0xA600, 0xF265}, 8},
+    SyntheticRom{"call", {}, {0x23F0}, 32},
+    // V0 stays 0 so the sound timer is never set and the buzzer stays off
+    SyntheticRom{"timer", {0x6000}, {0xF015, 0xF007, 0xF018}, 16},
+    SyntheticRom{"random", {}, {0xC0FF, 0xC1F0, 0xC20F}, 16},
+    SyntheticRom{"keys", {0x6000}, {0xE09E, 0x7101, 0xE0A1, 0x7101}, 16},
+};
+
+const std::array spriteRoms =
+{
+    SyntheticRom{"height_1", {0x6008, 0x6104, 0xA400}, {0xD011}, 32},
+    SyntheticRom{"height_5", {0x6008, 0x6104, 0xA400}, {0xD015}, 32},
+    SyntheticRom{"height_15", {0x6008, 0x6104, 0xA400}, {0xD01F}, 32},
+    SyntheticRom{"wrap_height_8", {0x603C, 0x611C, 0xA400}, {0xD018}, 32},
+};
+
+const std::array frameRoms =
+{
+    SyntheticRom{"alu", {0x6005, 0x6103}, {0x7001, 0x8014, 0x8102, 0x8213, 0x8324, 0x8415, 0x8506, 0x8627}, 8},
+    SyntheticRom{"draw", {0x6000, 0x6100, 0xA400}, {0xD018, 0x7003, 0x7101, 0xD015}, 8},
+    SyntheticRom{"game", {0xA400}, {0xF007, 0x3000, 0x7101, 0xA400, 0xD238, 0x7201, 0x6505, 0xE59E, 0x7301, 0xA600,
+        0xF333, 0xA600, 0xF265, 0x8014, 0xC1FF, 0xF015}, 4},
+};
+
+const std::array engines = {Engine::Interpreter, Engine::Cached, Engine::Jit};
+
+auto engineName(Engine engine) -> std::string_view
+{
+    switch (engine)
+    {
+        case Engine::Interpreter: return "switch";
+        case Engine::Cached: return "cached";
+        case Engine::Jit: return "jit";
+    }
+    return "";
+}
+
+auto buildRom(const SyntheticRom& synthetic) -> std::vector<uint8_t>
+{
+    std::vector<uint8_t> rom;
+    auto emit = [&](uint16_t opcode)
+    {
+        rom.push_back(static_cast<uint8_t>(opcode >> 8));
+        rom.push_back(static_cast<uint8_t>(opcode & 0xFF));
+    };
+
+    for (uint16_t opcode : synthetic.setup)
+        emit(opcode);
+    auto loop = static_cast<uint16_t>(FIRST_MEM_ADDRESS + rom.size());
+    for (int r = 0; r < synthetic.repeat; r++)
+    {
+        for (uint16_t opcode : synthetic.body)
+            emit(opcode);
+    }
+    emit(0x1000 | loop);
+
+    rom.resize(SUBROUTINE_ADDRESS - FIRST_MEM_ADDRESS);
+    emit(0x00EE);
+    rom.resize(DATA_ADDRESS - FIRST_MEM_ADDRESS);
+    for (uint8_t row : {0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF, 0x3C, 0x42, 0x99, 0xA5, 0x99, 0x42, 0x3C})
+        rom.push_back(row);
+    return rom;
+}
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_bench [--output bench.json] [--filter TEXT] [--min-time SECONDS] [--checked | --unchecked] [--gl]\n");
+}
+
+auto parseOptions(int argc, char** argv, BenchOptions& options) -> bool
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--output" && i + 1 < argc)
+            options.output = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc)
+            options.minSeconds = std::strtod(argv[++i], nullptr);
+        else if (arg == "--checked")
+            options.checked = true;
+        else if (arg == "--unchecked")
+            options.checked = false;
+        else if (arg == "--gl")
+            options.gl = true;
+        else
+            return false;
+    }
+    return options.minSeconds > 0.0;
+}
+
+auto selected(const BenchOptions& options, std::string_view group, std::string_view name) -> bool
+{
+    if (options.filter == nullptr)
+        return true;
+    return fmt::format("{}/{}", group, name).find(options.filter) != std::string::npos;
+}
+
+// Doubles the batch until a run takes at least minSeconds, the last run is
+// the measurement. body(count) performs count operations.
+template<typename F>
+auto measure(double minSeconds, F&& body) -> std::pair<uint64_t, double>
+{
+    uint64_t count = 1;
+    while (true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body(count);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() >= minSeconds || count >= (uint64_t{1} << 40))
+            return {count, elapsed.count()};
+        count *= elapsed.count() < minSeconds / 16 ? 8 : 2;
+    }
+}
+
+auto report(std::vector<BenchResult>& results, BenchResult result) -> void
+{
+    double nsPerOp = result.seconds * 1e9 / result.ops;
+    if (result.instructions != 0)
+        fmt::print(stderr, "{:<8} {:<14} {:<7} {:>10.2f} ns/op {:>14.0f} instructions/sec\n", result.group, result.name,
+            result.engine, nsPerOp, result.instructions / result.seconds);
+    else
+        fmt::print(stderr, "{:<8} {:<14} {:<7} {:>10.2f} ns/op\n", result.group, result.name, result.engine, nsPerOp);
+    results.push_back(std::move(result));
+}
+
+// One op per instruction
+auto benchInstructions(const BenchOptions& options, std::string_view group, const SyntheticRom& synthetic,
+    std::vector<BenchResult>& results) -> void
+{
+    if (!selected(options, group, synthetic.name))
+        return;
+
+    auto rom = buildRom(synthetic);
+    for (Engine engine : engines)
+    {
+        Chip8 chip8;
+        chip8.setChecked(options.checked);
+        chip8.setEngine(engine);
+        // Every instruction counted has to have run
+        chip8.setFastForward(false);
+        chip8.cpuReset();
+        chip8.seedRandom(0);
+        chip8.loadROM(rom);
+
+        auto [frames, seconds] = measure(options.minSeconds, [&](uint64_t count)
+        {
+            for (uint64_t f = 0; f < count; f++)
+                chip8.tick();
+        });
+        uint64_t instructions = frames * INSTRUCTIONS_PER_FRAME;
+        report(results, BenchResult{std::string(group), std::string(synthetic.name), engineName(engine), instructions,
+            instructions, seconds});
+    }
+}
+
+// One op per tick
+auto benchFrames(const BenchOptions& options, const SyntheticRom& synthetic, std::vector<BenchResult>& results) -> void
+{
+    if (!selected(options, "frame", synthetic.name))
+        return;
+
+    auto rom = buildRom(synthetic);
+    for (Engine engine : engines)
+    {
+        Chip8 chip8;
+        chip8.setChecked(options.checked);
+        chip8.setEngine(engine);
+        chip8.setFastForward(false);
+        chip8.cpuReset();
+        chip8.seedRandom(0);
+        chip8.loadROM(rom);
+
+        auto [frames, seconds] = measure(options.minSeconds, [&](uint64_t count)
+        {
+            for (uint64_t f = 0; f < count; f++)
+            {
+                chip8.tick();
+                chip8.takeDirtyRows();
+            }
+        });
+        report(results, BenchResult{"frame", std::string(synthetic.name), engineName(engine), frames,
+            frames * INSTRUCTIONS_PER_FRAME, seconds});
+    }
+}
+
+// A screen with something on every row, from a few seconds of the draw ROM
+auto sampleScreen(DisplayRows& screen) -> void
+{
+    Chip8 chip8;
+    chip8.cpuReset();
+    chip8.loadROM(buildRom(frameRoms[1]));
+    for (int f = 0; f < 300; f++)
+        chip8.tick();
+    screen = chip8.display().rows();
+}
+
+// Packed rows to one byte per pixel, as the headless dump and encoders see them
+auto benchDisplay(const BenchOptions& options, std::vector<BenchResult>& results) -> void
+{
+    if (!selected(options, "display", "expand_8bpp"))
+        return;
+
+    DisplayRows screen{};
+    sampleScreen(screen);
+    std::vector<uint8_t> pixels(SCREEN_WIDTH * SCREEN_HEIGHT);
+
+    auto [frames, seconds] = measure(options.minSeconds, [&](uint64_t count)
+    {
+        for (uint64_t f = 0; f < count; f++)
+        {
+            screen[f % SCREEN_HEIGHT][0] ^= f;
+            for (int y = 0; y < SCREEN_HEIGHT; y++)
+            {
+                for (int x = 0; x < SCREEN_WIDTH; x++)
+                    pixels[y * SCREEN_WIDTH + x] = displayPixel(screen, x, y) != 0 ? 0xFF : 0x00;
+            }
+        }
+    });
+    // Keeps the stores alive
+    if (pixels[0] == 0x42)
+        fmt::print(stderr, "\n");
+    report(results, BenchResult{"display", "expand_8bpp", "", frames, 0, seconds});
+}
+
+// SUPER-CHIP and XO-CHIP scrolls of a full 128x64 screen on both planes
+auto benchScroll(const BenchOptions& options, std::vector<BenchResult>& results) -> void
+{
+    DisplayRows sample{};
+    sampleScreen(sample);
+    Display display;
+    display.setHires(true);
+    for (int y = 0; y < HIRES_HEIGHT; y++)
+    {
+        for (int w = 0; w < PLANE_WORDS * PLANE_COUNT; w++)
+            display.drawRow<false>(w / PLANE_WORDS, w % PLANE_WORDS * 64, y, sample[y % SCREEN_HEIGHT][0]);
+    }
+
+    for (std::string_view name : {"scroll_down", "scroll_left"})
+    {
+        if (!selected(options, "display", name))
+            continue;
+        auto [frames, seconds] = measure(options.minSeconds, [&](uint64_t count)
+        {
+            for (uint64_t f = 0; f < count; f++)
+            {
+                // Down then up, or left then right, so the screen never empties
+                if (name == "scroll_down")
+                {
+                    display.scrollDown(4, ALL_PLANES);
+                    display.scrollUp(4, ALL_PLANES);
+                }
+                else
+                {
+                    display.scrollLeft(ALL_PLANES);
+                    display.scrollRight(ALL_PLANES);
+                }
+                display.takeDirtyRows();
+            }
+        });
+        report(results, BenchResult{"display", std::string(name), "", frames, 0, seconds});
+    }
+}
+
+// A 128x64 frame upscaled 8x to palette bytes, as the frame encoder does
+auto benchScale(const BenchOptions& options, std::vector<BenchResult>& results) -> void
+{
+    if (!selected(options, "display", "scale_8x"))
+        return;
+
+    DisplayRows screen{};
+    sampleScreen(screen);
+    constexpr int scale = 8;
+    std::vector<uint8_t> pixels(HIRES_WIDTH * scale * HIRES_HEIGHT * scale);
+    std::array<uint8_t, 4> lut{0x00, 0xFF, 0x73, 0xBF};
+
+    for (bool simd : {false, true})
+    {
+        FrameScaler scaler(simd);
+        if (simd && !scaler.simd())
+            continue;
+        auto [frames, seconds] = measure(options.minSeconds, [&](uint64_t count)
+        {
+            for (uint64_t f = 0; f < count; f++)
+            {
+                screen[f % SCREEN_HEIGHT][0] ^= f;
+                scaler.render(screen, HIRES_WIDTH, HIRES_HEIGHT, HIRES_WIDTH * scale, HIRES_HEIGHT * scale, lut, pixels);
+            }
+        });
+        if (pixels[0] == 0x42)
+            fmt::print(stderr, "\n");
+        report(results, BenchResult{"display", "scale_8x", simd ? "avx2" : "scalar", frames, 0, seconds});
+    }
+}
+
+#if CHIP8_BENCH_GL
+// Full and single row uploads through the renderer, finished each time so
+// the driver's copy is included
+auto benchUpload(const BenchOptions& options, std::vector<BenchResult>& results) -> void
+{
+    Window window;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    window.createWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "chip8_bench");
+    if (window.getWindow() == nullptr)
+    {
+        fmt::print(stderr, "display  upload skipped, no window could be created\n");
+        return;
+    }
+
+    DisplayRows screen{};
+    sampleScreen(screen);
+    Renderer renderer;
+
+    for (auto [name, rows] : {std::pair{"upload_full", ALL_ROWS_DIRTY}, std::pair{"upload_row", uint64_t{1}}})
+    {
+        if (!selected(options, "display", name))
+            continue;
+        auto [frames, seconds] = measure(options.minSeconds, [&](uint64_t count)
+        {
+            for (uint64_t f = 0; f < count; f++)
+            {
+                screen[0][0] ^= f;
+                renderer.render(screen, SCREEN_WIDTH, SCREEN_HEIGHT, rows);
+                glFinish();
+            }
+        });
+        report(results, BenchResult{"display", name, "", frames, 0, seconds});
+    }
+}
+#endif
+
+auto writeJson(FILE* out, const BenchOptions& options, const std::vector<BenchResult>& results) -> void
+{
+    fmt::print(out, "{{\n  \"checked\": {},\n  \"benchmarks\": [\n", options.checked);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        fmt::print(out, "    {{\"group\": \"{}\", \"name\": \"{}\", \"engine\": \"{}\", \"ops\": {}, \"seconds\": {:.6f}, "
+            "\"ns_per_op\": {:.3f}", r.group, r.name, r.engine, r.ops, r.seconds, r.seconds * 1e9 / r.ops);
+        if (r.instructions != 0)
+            fmt::print(out, ", \"instructions_per_sec\": {:.0f}", r.instructions / r.seconds);
+        fmt::print(out, "}}{}\n", i + 1 < results.size() ? "," : "");
+    }
+    fmt::print(out, "  ]\n}}\n");
+}
+
+auto main(int argc, char** argv) -> int
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    for (const auto& synthetic : opcodeRoms)
+        benchInstructions(options, "opcode", synthetic, results);
+    for (const auto& synthetic : spriteRoms)
+        benchInstructions(options, "sprite", synthetic, results);
+    for (const auto& synthetic : frameRoms)
+        benchFrames(options, synthetic, results);
+    benchDisplay(options, results);
+    benchScroll(options, results);
+    benchScale(options, results);
+
+    if (options.gl)
+    {
+#if CHIP8_BENCH_GL
+        benchUpload(options, results);
+#else
+        fmt::print(stderr, "display  upload skipped, built without CHIP8_BENCH_GL\n");
+#endif
+    }
+
+    FILE* out = stdout;
+    if (options.output != nullptr)
+    {
+        out = std::fopen(options.output, "w");
+        if (out == nullptr)
+        {
+            fmt::print("Could not open the file {} for writing\n", options.output);
+            return 1;
+        }
+    }
+    writeJson(out, options, results);
+    if (out != stdout)
+        std::fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "checksum.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_CRC32_SSE42 1
+#include <nmmintrin.h>
+#else
+#define CHIP8_CRC32_SSE42 0
+#endif
+
+namespace
+{
+
+constexpr auto makeTable(uint32_t polynomial) -> std::array<uint32_t, 256>
+{
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr const std::array<uint32_t, 256> crcTable = makeTable(0x82F63B78);
+constexpr const std::array<uint32_t, 256> zlibCrcTable = makeTable(0xEDB88320);
+
+auto crc32cTable(std::span<const uint8_t> data, uint32_t crc) -> uint32_t
+{
+    for (uint8_t byte : data)
+        crc = (crc >> 8) ^ crcTable[(crc ^ byte) & 0xFF];
+    return crc;
+}
+
+#if CHIP8_CRC32_SSE42
+[[gnu::target("sse4.2")]] auto crc32cHardware(std::span<const uint8_t> data, uint32_t crc) -> uint32_t
+{
+    uint64_t wide = crc;
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = static_cast<uint32_t>(wide);
+    for (; i < data.size(); i++)
+        crc = _mm_crc32_u8(crc, data[i]);
+    return crc;
+}
+#endif
+
+}
+
+auto crc32c(std::span<const uint8_t> data, uint32_t crc) -> uint32_t
+{
+    crc = ~crc;
+#if CHIP8_CRC32_SSE42
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware)
+        return ~crc32cHardware(data, crc);
+#endif
+    return ~crc32cTable(data, crc);
+}
+
+auto crc32(std::span<const uint8_t> data, uint32_t crc) -> uint32_t
+{
+    crc = ~crc;
+    for (uint8_t byte : data)
+        crc = (crc >> 8) ^ zlibCrcTable[(crc ^ byte) & 0xFF];
+    return ~crc;
+}
+
+auto fnv1a64(std::span<const uint8_t> data, uint64_t hash) -> uint64_t
+{
+    for (uint8_t byte : data)
+    {
+        hash ^= byte;
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
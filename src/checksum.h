@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it, a table otherwise; both give the same result.
+auto crc32c(std::span<const uint8_t> data, uint32_t crc = 0) -> uint32_t;
+
+// CRC-32 as used by zlib and PNG, table driven
+auto crc32(std::span<const uint8_t> data, uint32_t crc = 0) -> uint32_t;
+
+// FNV-1a, 64 bit. Keys ROMs by content; not meant to detect corruption.
+auto fnv1a64(std::span<const uint8_t> data, uint64_t hash = 0xCBF29CE484222325) -> uint64_t;
@@ -1,273 +1,1216 @@
 #include "chip8.h"
+#include "jit.h"
+#include "checksum.h"
+#include "mapped_file.h"
+#include "profiler.h"
+#include "savestate.h"
 
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
+#include <random>
+#include <utility>
 #include <fmt/core.h>
 
-Chip8::Chip8() : randomEngine(randomDevice()), uniformDistribution(0, 255) {}
+auto engineFromName(std::string_view name, Engine& engine) -> bool
+{
+    if (name == "switch")
+        engine = Engine::Interpreter;
+    else if (name == "cached")
+        engine = Engine::Cached;
+    else if (name == "jit")
+        engine = Engine::Jit;
+    else
+        return false;
+    return true;
+}
+
+auto variantFromName(std::string_view name, Variant& variant) -> bool
+{
+    if (name == "chip8")
+        variant = Variant::Chip8;
+    else if (name == "schip")
+        variant = Variant::SChip;
+    else if (name == "xochip")
+        variant = Variant::XOChip;
+    else
+        return false;
+    return true;
+}
+
+auto quirksFromName(std::string_view name, Quirks& quirks) -> bool
+{
+    if (name == "default")
+        quirks = Quirks{};
+    else if (name == "cosmac")
+        quirks = Quirks{.shiftVY = true, .keepI = false, .clipSprites = true, .resetVF = true};
+    else if (name == "schip")
+        quirks = Quirks{.shiftVY = false, .keepI = true, .clipSprites = true, .resetVF = false};
+    else if (name == "xochip")
+        quirks = Quirks{.shiftVY = true, .keepI = false, .clipSprites = false, .resetVF = false};
+    else
+        return false;
+    return true;
+}
+
+auto variantQuirks(Variant variant) -> Quirks
+{
+    Quirks quirks{};
+    switch (variant)
+    {
+        case Variant::Chip8:
+            break;
+        case Variant::SChip:
+            quirksFromName("schip", quirks);
+            break;
+        case Variant::XOChip:
+            quirksFromName("xochip", quirks);
+            break;
+    }
+    return quirks;
+}
+
+auto quirksToBits(const Quirks& quirks) -> uint32_t
+{
+    return (quirks.shiftVY ? 1u : 0u) | (quirks.keepI ? 2u : 0u) | (quirks.clipSprites ? 4u : 0u)
+        | (quirks.resetVF ? 8u : 0u);
+}
+
+auto quirksFromBits(uint32_t bits) -> Quirks
+{
+    return Quirks{(bits & 1) != 0, (bits & 2) != 0, (bits & 4) != 0, (bits & 8) != 0};
+}
+
+Chip8::Chip8() : core(selectCore(activeVariant, activeQuirks, checked)), random(std::random_device{}()) {}
+
+Chip8::~Chip8() = default;
 
 auto Chip8::cpuReset() -> void
 {
-    std::memset(memory.data(), 0, sizeof(uint8_t) * memory.size());
+    std::memset(memory, 0, sizeof(uint8_t) * addressSpace);
     std::memset(stack.data(), 0, sizeof(uint16_t) * stack.size());
     std::memset(V.data(), 0, sizeof(uint8_t) * V.size());
     std::memset(key.data(), 0, sizeof(uint8_t) * key.size());
-    std::memset(gfx.data(), 0, sizeof(uint8_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+    gfx.reset();
     I = 0;
     PC = FIRST_MEM_ADDRESS;
     SP = 0;
     delayTimer = 0;
     soundTimer = 0;
-    drawFlag = false;
+    planeMask = 1;
+    rplFlags.fill(0);
+    audioBuffer.fill(0);
+    pitchRegister = 64;
+    buzzerOn = false;
+    queuedKeyCount = 0;
+    waitingForKey = false;
+    keyWaitResult = -1;
+    keyPressTime.fill(0);
+    keyLatencyHistogram.reset();
 
     for (int i = 0; i < FONTSET_SIZE; i++)
     {
-        memory.at(i) = fontset.at(i);
+        memory[i] = fontset.at(i);
     }
+    // Plain CHIP-8 memory stays as it always was
+    if (activeVariant != Variant::Chip8)
+        std::ranges::copy(bigFontset, memory + BIG_FONTSET_ADDRESS);
+    invalidateCode(0, MAX_MEM_SIZE);
+}
+
+// Copied straight out of the mapping, no stream or intermediate buffer
+auto Chip8::loadROM(std::string_view filename) -> bool
+{
+    MappedFile file;
+    if (!file.open(filename, MappedFile::Mode::Read))
+        return false;
+    return loadROM(file.data());
 }
 
-auto Chip8::loadROM(std::string_view filename) -> void
+auto Chip8::loadROM(std::span<const uint8_t> rom) -> bool
 {
-    std::ifstream in(filename, std::ios::binary);
-    if (!in.is_open())
+    size_t maxSize = addressSpace - FIRST_MEM_ADDRESS;
+    if (rom.size() > maxSize)
     {
-        fmt::print("Could not open the file {} for reading", filename);
-        return;
+        fmt::print("ROM is {} bytes, at most {} fit in memory\n", rom.size(), maxSize);
+        return false;
+    }
+    std::ranges::copy(rom, memory + FIRST_MEM_ADDRESS);
+    invalidateCode(FIRST_MEM_ADDRESS, addressSpace - FIRST_MEM_ADDRESS);
+    return true;
+}
+
+auto Chip8::seedRandom(uint32_t seed) -> void
+{
+    random.setState(seed);
+}
+
+auto Chip8::saveState(std::span<uint8_t> out) const -> bool
+{
+    if (out.size() < saveStateSize())
+        return false;
+
+    auto state = out.subspan(sizeof(SaveStateHeader), snapshotSize());
+    snapshot(state);
+
+    SaveStateHeader header{SAVESTATE_MAGIC, SAVESTATE_VERSION, sizeof(SaveStatePayload),
+        static_cast<uint32_t>(addressSpace), crc32c(state), 0};
+    std::memcpy(out.data(), &header, sizeof(header));
+    return true;
+}
+
+auto Chip8::loadState(std::span<const uint8_t> in) -> bool
+{
+    SaveStateHeader header{};
+    if (in.size() < sizeof(header))
+    {
+        fmt::print("Savestate is truncated\n");
+        return false;
+    }
+    std::memcpy(&header, in.data(), sizeof(header));
+    if (header.magic != SAVESTATE_MAGIC || header.payloadSize != sizeof(SaveStatePayload))
+    {
+        fmt::print("Not a savestate\n");
+        return false;
+    }
+    if (header.version != SAVESTATE_VERSION)
+    {
+        fmt::print("Savestate version {} is not supported, expected {}\n", header.version, SAVESTATE_VERSION);
+        return false;
     }
-    in.seekg(0, std::ios::end);
-    std::streampos fileSize = in.tellg();
-    in.seekg(0, std::ios::beg);
+    if (header.memorySize != static_cast<uint32_t>(addressSpace))
+    {
+        fmt::print("Savestate holds {} bytes of memory, the variant addresses {}\n", header.memorySize, addressSpace);
+        return false;
+    }
+    if (in.size() < saveStateSize())
+    {
+        fmt::print("Savestate is truncated\n");
+        return false;
+    }
+    auto state = in.subspan(sizeof(header), snapshotSize());
+    if (crc32c(state) != header.checksum)
+    {
+        fmt::print("Savestate checksum mismatch\n");
+        return false;
+    }
+
+    restore(state);
+    return true;
+}
 
-    in.read(reinterpret_cast<char*>(&memory.at(FIRST_MEM_ADDRESS)), fileSize);
-    in.close();
+auto Chip8::saveStateSize() const -> size_t
+{
+    return savestateSize(addressSpace);
+}
+
+auto Chip8::snapshotSize() const -> size_t
+{
+    return sizeof(SaveStatePayload) + addressSpace;
+}
+
+auto Chip8::snapshot(std::span<uint8_t> out) const -> void
+{
+    SaveStatePayload payload{};
+    payload.gfx = gfx.rows();
+    payload.random = random.state();
+    payload.stack = stack;
+    payload.I = I;
+    payload.PC = PC;
+    payload.V = V;
+    payload.key = key;
+    payload.rplFlags = rplFlags;
+    payload.audioPattern = audioBuffer;
+    payload.SP = SP;
+    payload.delayTimer = delayTimer;
+    payload.soundTimer = soundTimer;
+    payload.waitingForKey = waitingForKey ? 1 : 0;
+    payload.keyWaitResult = static_cast<int8_t>(keyWaitResult);
+    payload.hires = gfx.hires() ? 1 : 0;
+    payload.planeMask = planeMask;
+    payload.pitch = pitchRegister;
+    std::memcpy(out.data(), &payload, sizeof(payload));
+    std::memcpy(out.data() + sizeof(payload), memory, addressSpace);
 }
 
-auto Chip8::tick() -> void
+auto Chip8::restore(std::span<const uint8_t> in) -> void
 {
-    const int instructionsPerFrame = 8;
-    for (int i = 0; i < instructionsPerFrame; i++)
-        decodeOpcode(getNextOpcode());
+    SaveStatePayload payload;
+    std::memcpy(&payload, in.data(), sizeof(payload));
+    std::memcpy(memory, in.data() + sizeof(payload), addressSpace);
 
+    gfx.restore(payload.gfx, payload.hires != 0);
+    random.setState(payload.random);
+    stack = payload.stack;
+    I = payload.I;
+    PC = payload.PC;
+    V = payload.V;
+    key = payload.key;
+    rplFlags = payload.rplFlags;
+    audioBuffer = payload.audioPattern;
+    SP = payload.SP;
+    delayTimer = payload.delayTimer;
+    soundTimer = payload.soundTimer;
+    waitingForKey = payload.waitingForKey != 0;
+    keyWaitResult = payload.keyWaitResult;
+    planeMask = payload.planeMask;
+    pitchRegister = payload.pitch;
+    buzzerOn = soundTimer > 0;
+
+    queuedKeyCount = 0;
+    keyPressTime.fill(0);
+    invalidateCode(0, MAX_MEM_SIZE);
+}
+
+auto Chip8::tick(int instructions) -> void
+{
+    // Run up to each queued key's slot, so the ROM sees input at the
+    // instruction boundary matching when it happened
+    int executed = 0;
+    for (int i = 0; i < queuedKeyCount; i++)
+    {
+        const QueuedKey& queued = queuedKeys[i];
+        int slot = std::min(queued.slot, instructions);
+        runInstructions(slot - executed);
+        executed = slot;
+        applyKeyEvent(queued.event);
+    }
+    queuedKeyCount = 0;
+    runInstructions(instructions - executed);
+#if CHIP8_PROFILE
+    if (profiler != nullptr)
+        profiler->endFrame();
+#endif
+
+    // Sampled before the decrement, so FX18 with 1 still sounds a frame
+    buzzerOn = soundTimer > 0;
     if (delayTimer > 0)
         delayTimer--;
     if (soundTimer > 0)
-    {
         soundTimer--;
-        if (soundTimer == 0)
-            fmt::print("beep\n");
+}
+
+auto Chip8::step() -> void
+{
+    runInstructions(1);
+}
+
+auto Chip8::setEngine(Engine e) -> void
+{
+    engine = e;
+    if (engine == Engine::Cached && !decodeCache)
+    {
+        decodeCache = std::make_unique<std::array<Instruction, MAX_MEM_SIZE>>();
+        invalidateCode(0, MAX_MEM_SIZE);
+    }
+    if (engine == Engine::Jit && !jit)
+    {
+        jit = std::make_unique<Jit>(*this);
+        if (!jit->available())
+        {
+            fmt::print("JIT is not available on this platform, using the cached engine\n");
+            jit.reset();
+            setEngine(Engine::Cached);
+        }
+    }
+}
+
+auto Chip8::setQuirks(const Quirks& q) -> void
+{
+    activeQuirks = q;
+    core = selectCore(activeVariant, activeQuirks, checked);
+    invalidateCode(0, MAX_MEM_SIZE);
+}
+
+auto Chip8::setChecked(bool c) -> void
+{
+    checked = c;
+    core = selectCore(activeVariant, activeQuirks, checked);
+    invalidateCode(0, MAX_MEM_SIZE);
+}
+
+auto Chip8::setVariant(Variant v) -> void
+{
+    activeVariant = v;
+    addressSpace = v == Variant::XOChip ? MAX_MEM_SIZE : MEM_SIZE;
+    // The first MEM_SIZE bytes carry over to the other buffer
+    if (addressSpace == MAX_MEM_SIZE && !extendedMemory)
+    {
+        extendedMemory = std::make_unique<std::array<uint8_t, MAX_MEM_SIZE>>();
+        std::copy_n(baseMemory.begin(), MEM_SIZE, extendedMemory->begin());
+        memory = extendedMemory->data();
+    }
+    else if (addressSpace == MEM_SIZE && extendedMemory)
+    {
+        std::copy_n(extendedMemory->begin(), MEM_SIZE, baseMemory.begin());
+        extendedMemory.reset();
+        memory = baseMemory.data();
+    }
+    core = selectCore(activeVariant, activeQuirks, checked);
+    invalidateCode(0, MAX_MEM_SIZE);
+}
+
+auto Chip8::quirks() const -> const Quirks&
+{
+    return activeQuirks;
+}
+
+auto Chip8::variant() const -> Variant
+{
+    return activeVariant;
+}
+
+auto Chip8::setProfiler([[maybe_unused]] ExecutionProfile* profile) -> void
+{
+#if CHIP8_PROFILE
+    profiler = profile;
+#endif
+}
+
+auto Chip8::setFastForward(bool enabled) -> void
+{
+    fastForward = enabled;
+}
+
+auto Chip8::skippedInstructions() const -> uint64_t
+{
+    return skipped;
+}
+
+auto Chip8::runInstructions(int count) -> void
+{
+#if CHIP8_PROFILE
+    if (profiler != nullptr) [[unlikely]]
+    {
+        runProfiled(count);
+        return;
+    }
+#endif
+    if (fastForward)
+        count = skipIdleLoop(count);
+    runEngine(count);
+}
+
+auto Chip8::runEngine(int count) -> void
+{
+    switch (engine)
+    {
+        case Engine::Interpreter:
+            core->interpret(*this, count);
+            break;
+        case Engine::Cached:
+            core->runCached(*this, count);
+            break;
+        case Engine::Jit:
+            jit->run(count);
+            break;
+    }
+}
+
+namespace
+{
+    // Reads and writes only V, I and PC, or for FX0A the key wait. The keys
+    // and the delay timer are read but cannot change within a run of
+    // instructions.
+    auto idleOpcode(uint16_t opcode) -> bool
+    {
+        uint8_t n = opcode & 0x000F;
+        uint8_t nn = opcode & 0x00FF;
+        switch (opcode >> 12)
+        {
+            case 0x1: case 0x3: case 0x4: case 0x6: case 0x7: case 0xA:
+                return true;
+            case 0x5: case 0x9:
+                return n == 0;
+            case 0x8:
+                return n <= 0x7 || n == 0xE;
+            case 0xE:
+                return nn == 0x9E || nn == 0xA1;
+            case 0xF:
+                return nn == 0x07 || nn == 0x0A || nn == 0x1E || nn == 0x29;
+            default:
+                return false;
+        }
+    }
+}
+
+// A ROM waiting on the delay timer or a key spins in a loop like FX07
+// 3X00 1NNN until a timer step or key event, and those only happen
+// between runs of instructions. Once an iteration of such a loop is seen
+// to leave everything it can touch as it found it, every later iteration
+// does the same, so whole iterations are counted as run without running
+// them. The leftover instructions still run, leaving PC exactly where
+// full execution would.
+auto Chip8::skipIdleLoop(int count) -> int
+{
+    int head = idleLoopHead();
+    if (head < 0)
+        return count;
+
+    // Single steps, so no engine overshoots the head
+    for (int i = 0; i < IDLE_LOOP_MAX && PC != head && count > 0; i++, count--)
+        core->interpret(*this, 1);
+    if (PC != head)
+        return count;
+
+    // The first iteration after entering may still be setting registers up
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        IdleState before = idleState();
+        int period = 0;
+        do
+        {
+            // Whatever the loop jumps to has to be idle too
+            if (count == 0)
+                return 0;
+            if (PC >= addressSpace - 1 || !idleOpcode(opcodeAt(PC)))
+                return count;
+            core->interpret(*this, 1);
+            count--;
+            period++;
+        } while (PC != head && period < IDLE_LOOP_MAX);
+        if (PC != head)
+            return count;
+        if (idleState() == before)
+        {
+            int skip = count - count % period;
+            skipped += skip;
+            return count - skip;
+        }
+    }
+    return count;
+}
+
+// The start of the loop PC is in, or -1 if it is not in one made only of
+// idle opcodes that ends in a jump back. Jumps out of the loop may come
+// before that, and FX0A waiting for a key is a loop of its own.
+auto Chip8::idleLoopHead() const -> int
+{
+    for (int i = 0; i < IDLE_LOOP_MAX; i++)
+    {
+        int address = PC + 2 * i;
+        if (address >= addressSpace - 1)
+            return -1;
+        uint16_t opcode = opcodeAt(address);
+        if (i == 0 && (opcode & 0xF0FF) == 0xF00A)
+            return PC;
+        if (!idleOpcode(opcode))
+            return -1;
+
+        int target = opcode & 0x0FFF;
+        if ((opcode & 0xF000) != 0x1000 || target > PC || address - target >= 2 * IDLE_LOOP_MAX)
+            continue;
+        for (int a = target; a < PC; a += 2)
+        {
+            if (!idleOpcode(opcodeAt(a)))
+                return -1;
+        }
+        return target;
+    }
+    return -1;
+}
+
+auto Chip8::opcodeAt(int address) const -> uint16_t
+{
+    return static_cast<uint16_t>(memory[address] << 8 | memory[address + 1]);
+}
+
+auto Chip8::idleState() const -> IdleState
+{
+    return IdleState{V, I, waitingForKey};
+}
+
+// Kept out of line so the unprofiled loops stay as they were. Each engine
+// runs its own code, the JIT with a budget of one instruction.
+[[gnu::noinline]] auto Chip8::runProfiled([[maybe_unused]] int count) -> void
+{
+#if CHIP8_PROFILE
+    for (int i = 0; i < count; i++)
+    {
+        if (PC < addressSpace - 1)
+            profiler->instruction(PC, static_cast<uint16_t>(memory[PC] << 8 | memory[PC + 1]));
+        switch (engine)
+        {
+            case Engine::Interpreter:
+                core->interpret(*this, 1);
+                break;
+            case Engine::Cached:
+                core->runCached(*this, 1);
+                break;
+            case Engine::Jit:
+                jit->run(1);
+                break;
+        }
     }
+#endif
+}
+
+auto Chip8::selectCore(Variant variant, const Quirks& quirks, bool checked) -> const Core*
+{
+    // Indexed by the quirk bits, with checking as the bit above them and the
+    // variant above that
+    constexpr size_t perVariant = 2 << QUIRK_COUNT;
+    static const auto cores = []<size_t... Bits>(std::index_sequence<Bits...>)
+    {
+        return std::array{makeCore<CorePolicy<static_cast<Variant>(Bits / perVariant), (Bits & 1) != 0,
+            (Bits & 2) != 0, (Bits & 4) != 0, (Bits & 8) != 0, (Bits & 16) != 0>>()...};
+    }(std::make_index_sequence<VARIANT_COUNT * perVariant>());
+    return &cores[static_cast<size_t>(variant) * perVariant + quirksToBits(quirks) + (checked ? perVariant / 2 : 0)];
 }
 
-auto Chip8::getNextOpcode() -> uint16_t 
+template<typename P>
+auto Chip8::makeCore() -> Core
+{
+    return Core{&Chip8::interpret<P>, &Chip8::runCached<P>, &Chip8::execute<P>, &Chip8::call<&Chip8::opPredecode<P>>};
+}
+
+// Flattened so the dispatch switch and handlers inline into the loops
+template<typename P>
+[[gnu::flatten]] auto Chip8::interpret(Chip8& chip8, int count) -> void
+{
+    for (int i = 0; i < count; i++)
+        chip8.decodeOpcode<P>(chip8.getNextOpcode<P>());
+}
+
+template<typename P>
+[[gnu::flatten]] auto Chip8::runCached(Chip8& chip8, int count) -> void
+{
+    for (int i = 0; i < count; i++)
+        chip8.stepCached<P>();
+}
+
+template<typename P>
+auto Chip8::execute(Chip8& chip8, uint16_t opcode) -> void
+{
+    chip8.decodeOpcode<P>(opcode);
+}
+
+template<typename P>
+auto Chip8::stepCached() -> void
+{
+    // Out of range PCs take the slow path so they fail or wrap the same way
+    if (PC >= addressSpace - 1)
+    {
+        decodeOpcode<P>(getNextOpcode<P>());
+        return;
+    }
+    // Copied because the handler may invalidate its own entry
+    Instruction ins = (*decodeCache)[PC];
+    PC += 2;
+    ins.handler(*this, ins);
+}
+
+auto Chip8::invalidateCode(int address, int length) -> void
+{
+    // Writes past the end wrap around to the start, like the accesses do
+    // when unchecked
+    address %= addressSpace;
+    length = std::min(length, addressSpace);
+    int last = std::min(address + length, addressSpace);
+    if (address + length > addressSpace)
+        invalidateCode(0, address + length - addressSpace);
+
+    if (jit)
+        jit->invalidate(address, last - address);
+    if (!decodeCache)
+        return;
+
+    // The entry at a - 1 also covers byte a
+    int first = std::max(address - 1, 0);
+    for (int a = first; a < last; a++)
+        (*decodeCache)[a].handler = core->predecode;
+}
+
+template<typename P>
+auto Chip8::getNextOpcode() -> uint16_t
 {
     uint16_t opcode = 0;
-    opcode = memory.at(PC);
+    opcode = P::memoryAt(memory, PC);
     opcode <<= 8;
-    opcode |= memory.at(PC + 1);
+    opcode |= P::memoryAt(memory, PC + 1);
     PC += 2;
     return opcode;
 }
 
-auto Chip8::decodeOpcode(uint16_t opcode) -> void
+auto Chip8::makeInstruction(uint16_t opcode) -> Instruction
+{
+    Instruction ins{};
+    ins.opcode = opcode;
+    ins.nnn = opcode & 0x0FFF;
+    ins.x = (opcode >> 8) & 0x000F;
+    ins.y = (opcode >> 4) & 0x000F;
+    ins.n = opcode & 0x000F;
+    ins.nn = opcode & 0x00FF;
+    return ins;
+}
+
+template<auto Op>
+auto Chip8::call(Chip8& chip8, const Instruction& ins) -> void
+{
+    (chip8.*Op)(ins);
+}
+
+template<auto Op, bool Execute>
+auto Chip8::select(const Instruction& ins) -> Handler
 {
-    uint8_t x = (opcode >> 8) & 0x000F;
-    uint8_t y = (opcode >> 4) & 0x000F;
-    uint8_t n = opcode & 0x000F;
-    uint8_t nn = opcode & 0x00FF;
+    if constexpr (Execute)
+    {
+        (this->*Op)(ins);
+        return nullptr;
+    }
+    else
+    {
+        return &Chip8::call<Op>;
+    }
+}
 
-    switch (opcode & 0xF000)
+// Shared by both engines: executes the opcode directly for the switch
+// interpreter, or returns its handler to fill the decode cache.
+template<typename P, bool Execute>
+auto Chip8::dispatch(const Instruction& ins) -> Handler
+{
+    // Opcodes a variant lacks decode to opUnknown
+    constexpr bool schip = P::variant != Variant::Chip8;
+    constexpr bool xochip = P::variant == Variant::XOChip;
+    constexpr auto unknown = &Chip8::opUnknown;
+
+    switch (ins.opcode & 0xF000)
     {
         case 0x0000:
-            switch (opcode & 0x000F)
+            if constexpr (!schip)
             {
-                case 0x0000: // clear screen
-                    std::memset(gfx.data(), 0, sizeof(uint8_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
-                    drawFlag = true;
-                    break;
-                case 0x000E: // return subroutine
-                    PC = stack.at(--SP);
-                    break;
-                default:
-                    fmt::print("unknown opcode {}", opcode);
-                    break;
+                switch (ins.opcode & 0x000F)
+                {
+                    case 0x0000: return select<&Chip8::opClearScreen, Execute>(ins);
+                    case 0x000E: return select<&Chip8::opReturn<P>, Execute>(ins);
+                    default: return select<unknown, Execute>(ins);
+                }
             }
-            break;
-        case 0x1000: // jump to address NNN
-            PC = opcode & 0x0FFF;
-            break;
-        case 0x2000:
-            stack.at(SP++) = PC;
-            PC = opcode & 0x0FFF;
-            break;
-        case 0x3000:
-            if (V.at(x) == (opcode & nn))
-                PC += 2;
-            break;
-        case 0x4000:
-            if (V.at(x) != (opcode & nn))
-                PC += 2;
-            break;
-        case 0x5000: // skip next if reg[x] == reg[y]
-            if (V.at(x) == V.at(y))
-                PC += 2;
-            break;
-        case 0x6000:
-            V.at(x) = nn;
-            break;
-        case 0x7000:
-            V.at(x) += nn;
-            break;
+            switch (ins.opcode & 0xFFF0)
+            {
+                case 0x00C0: return select<&Chip8::opScrollDown, Execute>(ins);
+                case 0x00D0: return select<xochip ? &Chip8::opScrollUp : unknown, Execute>(ins);
+                default: break;
+            }
+            switch (ins.opcode)
+            {
+                case 0x00E0: return select<&Chip8::opClearScreen, Execute>(ins);
+                case 0x00EE: return select<&Chip8::opReturn<P>, Execute>(ins);
+                case 0x00FB: return select<&Chip8::opScrollRight, Execute>(ins);
+                case 0x00FC: return select<&Chip8::opScrollLeft, Execute>(ins);
+                case 0x00FD: return select<&Chip8::opExit, Execute>(ins);
+                case 0x00FE: return select<&Chip8::opLowRes, Execute>(ins);
+                case 0x00FF: return select<&Chip8::opHighRes, Execute>(ins);
+                default: return select<unknown, Execute>(ins);
+            }
+        case 0x1000: return select<&Chip8::opJump, Execute>(ins);
+        case 0x2000: return select<&Chip8::opCall<P>, Execute>(ins);
+        case 0x3000: return select<&Chip8::opSkipEqualImm<P>, Execute>(ins);
+        case 0x4000: return select<&Chip8::opSkipNotEqualImm<P>, Execute>(ins);
+        case 0x5000:
+            if constexpr (!xochip)
+                return select<&Chip8::opSkipEqualReg<P>, Execute>(ins);
+            switch (ins.n)
+            {
+                case 0x0: return select<&Chip8::opSkipEqualReg<P>, Execute>(ins);
+                case 0x2: return select<&Chip8::opSaveRange<P>, Execute>(ins);
+                case 0x3: return select<&Chip8::opLoadRange<P>, Execute>(ins);
+                default: return select<unknown, Execute>(ins);
+            }
+        case 0x6000: return select<&Chip8::opLoadImm, Execute>(ins);
+        case 0x7000: return select<&Chip8::opAddImm, Execute>(ins);
         case 0x8000:
-            switch (n)
+            switch (ins.n)
             {
-                case 0x0:
-                    V.at(x) = V.at(y);
-                    break;
-                case 0x1:
-                    V.at(x) |= V.at(y);
-                    break;
-                case 0x2:
-                    V.at(x) &= V.at(y);
-                    break;
-                case 0x3:
-                    V.at(x) ^= V.at(y);
-                    break;
-                case 0x4:
-                    V.at(0xF) = (static_cast<int>(V.at(x)) + static_cast<int>(V.at(y)) > 255) ? 1 : 0;
-                    V.at(x) += V.at(y);
-                    break;
-                case 0x5:
-                    V.at(0xF) = (V.at(x) < V.at(y)) ? 0 : 1;
-                    V.at(x) -= V.at(y);
-                    break;
-                case 0x6:
-                    V.at(0xF) = V.at(x) & 0x1;
-                    V.at(x) >>= 1;
-                    break;
-                case 0x7:
-                    V.at(0xF) = (V.at(y) < V.at(x)) ? 0 : 1;
-                    V.at(x) = V.at(y) - V.at(x);
-                    break;
-                case 0xE:
-                    V.at(0xF) = (V.at(x) >> 7) & 0x1;
-                    V.at(x) <<= 1;
-                    break;
-                default:
-                    fmt::print("unknown opcode {}", opcode);
-                    break;
+                case 0x0: return select<&Chip8::opMove, Execute>(ins);
+                case 0x1: return select<&Chip8::opOr<P>, Execute>(ins);
+                case 0x2: return select<&Chip8::opAnd<P>, Execute>(ins);
+                case 0x3: return select<&Chip8::opXor<P>, Execute>(ins);
+                case 0x4: return select<&Chip8::opAdd, Execute>(ins);
+                case 0x5: return select<&Chip8::opSub, Execute>(ins);
+                case 0x6: return select<&Chip8::opShiftRight<P>, Execute>(ins);
+                case 0x7: return select<&Chip8::opSubReversed, Execute>(ins);
+                case 0xE: return select<&Chip8::opShiftLeft<P>, Execute>(ins);
+                default: return select<&Chip8::opUnknown, Execute>(ins);
             }
-            break;
-        case 0x9000:
-            if (V.at(x) != V.at(y))
-                PC += 2;
-            break;
-        case 0xA000:
-            I = opcode & 0x0FFF;
-            break;
-        case 0xB000:
-            PC = (opcode & 0x0FFF) + V.at(0);
-            break;
-        case 0xC000:
-            V.at(x) = uniformDistribution(randomEngine) & (opcode & 0x00FF);
-            break;
-        case 0xD000:
-            drawSprite(V.at(x), V.at(y), n);
-            break;
+        case 0x9000: return select<&Chip8::opSkipNotEqualReg<P>, Execute>(ins);
+        case 0xA000: return select<&Chip8::opLoadIndex, Execute>(ins);
+        case 0xB000: return select<&Chip8::opJumpOffset, Execute>(ins);
+        case 0xC000: return select<&Chip8::opRandom, Execute>(ins);
+        case 0xD000: return select<&Chip8::opDraw<P>, Execute>(ins);
         case 0xE000:
-            switch(n)
+            switch (ins.n)
             {
-                case 0xE:
-                    if (key.at(V.at(x)))
-                        PC += 2;
-                    break;
-                case 0x1:
-                    if (!key.at(V.at(x)))
-                        PC += 2;
-                    break;
-                default:
-                    fmt::print("unknown opcode {}", opcode);
-                    break;
+                case 0xE: return select<&Chip8::opSkipKeyPressed<P>, Execute>(ins);
+                case 0x1: return select<&Chip8::opSkipKeyNotPressed<P>, Execute>(ins);
+                default: return select<&Chip8::opUnknown, Execute>(ins);
             }
-            break;
         case 0xF000:
-            switch(opcode & 0x00FF)
+            switch (ins.nn)
             {
-                case 0x0007:
-                    V.at(x) = delayTimer;
-                    break;
-                case 0x000A:
-                    V.at(x) = waitKeyPress();
-                    break;
-                case 0x0015:
-                    delayTimer = V.at(x);
-                    break;
-                case 0x0018:
-                    soundTimer = V.at(x);
-                    break;
-                case 0x001E:
-                    //V.at(0xF) = (I + V.at(x) > 0xfff) ? 1 : 0;
-                    I += V.at(x);
-                    break;
-                case 0x0029:
-                    I = V.at(x) * 5;
-                    break;
-                case 0x0033:
-                    memory.at(I) = V.at(x) / 100;
-                    memory.at(I + 1) = (V.at(x) % 100) / 10;
-                    memory.at(I + 2) = V.at(x) % 10;
-                    break;
-                case 0x0055:
-                    for (int i = 0; i <= x; i++)
-                    {
-                        memory.at(I + i) = V.at(i);
-                    }
-                    I += x + 1;
-                    break;
-                case 0x0065:
-                    for (int i = 0; i <= x; i++)
-                    {
-                        V.at(i) = memory.at(I + i);
-                    }
-                    I += x + 1;
-                    break;
-                default:
-                    fmt::print("unknown opcode {}", opcode);
-                    break;
+                case 0x00:
+                    // F000 NNNN
+                    if (ins.x == 0)
+                        return select<xochip ? &Chip8::opLoadLongIndex<P> : unknown, Execute>(ins);
+                    return select<unknown, Execute>(ins);
+                case 0x01: return select<xochip ? &Chip8::opSelectPlanes : unknown, Execute>(ins);
+                case 0x02: return select<xochip ? &Chip8::opLoadAudio<P> : unknown, Execute>(ins);
+                case 0x07: return select<&Chip8::opLoadDelay, Execute>(ins);
+                case 0x0A: return select<&Chip8::opWaitKey, Execute>(ins);
+                case 0x15: return select<&Chip8::opSetDelay, Execute>(ins);
+                case 0x18: return select<&Chip8::opSetSound, Execute>(ins);
+                case 0x1E: return select<&Chip8::opAddIndex, Execute>(ins);
+                case 0x29: return select<&Chip8::opLoadFont, Execute>(ins);
+                case 0x30: return select<schip ? &Chip8::opLoadBigFont : unknown, Execute>(ins);
+                case 0x33: return select<&Chip8::opStoreBCD<P>, Execute>(ins);
+                case 0x3A: return select<xochip ? &Chip8::opSetPitch : unknown, Execute>(ins);
+                case 0x55: return select<&Chip8::opStoreRegisters<P>, Execute>(ins);
+                case 0x65: return select<&Chip8::opLoadRegisters<P>, Execute>(ins);
+                case 0x75: return select<schip ? &Chip8::opStoreFlags : unknown, Execute>(ins);
+                case 0x85: return select<schip ? &Chip8::opLoadFlags : unknown, Execute>(ins);
+                default: return select<unknown, Execute>(ins);
             }
-            break;
         default:
-            fmt::print("unknown opcode {}", opcode);
-            break;
+            return select<&Chip8::opUnknown, Execute>(ins);
     }
 }
 
-auto Chip8::drawSprite(uint8_t x, uint8_t y, uint8_t n) -> void
+template<typename P>
+auto Chip8::decodeOpcode(uint16_t opcode) -> void
+{
+    dispatch<P, true>(makeInstruction(opcode));
+}
+
+template<typename P>
+auto Chip8::opPredecode(const Instruction& /*ins*/) -> void
+{
+    // PC already points past this entry
+    uint16_t address = PC - 2;
+    uint16_t opcode = P::memoryAt(memory, address);
+    opcode <<= 8;
+    opcode |= P::memoryAt(memory, address + 1);
+
+    Instruction decoded = makeInstruction(opcode);
+    decoded.handler = dispatch<P, false>(decoded);
+    (*decodeCache)[address] = decoded;
+    decoded.handler(*this, decoded);
+}
+
+auto Chip8::opClearScreen(const Instruction& /*ins*/) -> void
+{
+    gfx.clear(planeMask);
+}
+
+template<typename P>
+auto Chip8::opReturn(const Instruction& /*ins*/) -> void
+{
+    PC = P::at(stack, --SP);
+}
+
+auto Chip8::opScrollDown(const Instruction& ins) -> void
 {
-    V.at(0xF) = 0;
-    for (int yLine = 0; yLine < n; yLine++)
+    gfx.scrollDown(ins.n, planeMask);
+}
+
+auto Chip8::opScrollUp(const Instruction& ins) -> void
+{
+    gfx.scrollUp(ins.n, planeMask);
+}
+
+auto Chip8::opScrollRight(const Instruction& /*ins*/) -> void
+{
+    gfx.scrollRight(planeMask);
+}
+
+auto Chip8::opScrollLeft(const Instruction& /*ins*/) -> void
+{
+    gfx.scrollLeft(planeMask);
+}
+
+// Spins on itself like FX0A does, there is nothing to exit to
+auto Chip8::opExit(const Instruction& /*ins*/) -> void
+{
+    PC -= 2;
+}
+
+auto Chip8::opLowRes(const Instruction& /*ins*/) -> void
+{
+    gfx.setHires(false);
+}
+
+auto Chip8::opHighRes(const Instruction& /*ins*/) -> void
+{
+    gfx.setHires(true);
+}
+
+auto Chip8::opJump(const Instruction& ins) -> void
+{
+    PC = ins.nnn;
+}
+
+template<typename P>
+auto Chip8::opCall(const Instruction& ins) -> void
+{
+    P::at(stack, SP++) = PC;
+    PC = ins.nnn;
+}
+
+template<typename P>
+auto Chip8::skipNext() -> void
+{
+    // F000 NNNN is the one four byte instruction
+    if constexpr (P::variant == Variant::XOChip)
     {
-        uint8_t byte = memory.at(I + yLine);
-        for (int xPixel = 0; xPixel < 8; xPixel++)
+        if (P::memoryAt(memory, PC) == 0xF0 && P::memoryAt(memory, PC + 1) == 0x00)
         {
-            uint8_t bit = (byte >> xPixel) & 0x1;
-            auto pos = ((yLine + y) % SCREEN_HEIGHT) * SCREEN_WIDTH +
-                ((7 - xPixel) + x) % SCREEN_WIDTH;
+            PC += 4;
+            return;
+        }
+    }
+    PC += 2;
+}
+
+template<typename P>
+auto Chip8::opSkipEqualImm(const Instruction& ins) -> void
+{
+    if (V[ins.x] == ins.nn)
+        skipNext<P>();
+}
+
+template<typename P>
+auto Chip8::opSkipNotEqualImm(const Instruction& ins) -> void
+{
+    if (V[ins.x] != ins.nn)
+        skipNext<P>();
+}
+
+template<typename P>
+auto Chip8::opSkipEqualReg(const Instruction& ins) -> void
+{
+    if (V[ins.x] == V[ins.y])
+        skipNext<P>();
+}
+
+// 5XY2 and 5XY3 walk from VX to VY, downwards when X > Y, and leave I alone
+template<typename P>
+auto Chip8::opSaveRange(const Instruction& ins) -> void
+{
+    int count = std::abs(ins.x - ins.y) + 1;
+    int step = ins.x <= ins.y ? 1 : -1;
+    invalidateCode(I, count);
+    for (int i = 0; i < count; i++)
+        P::memoryAt(memory, I + i) = V[ins.x + i * step];
+}
+
+template<typename P>
+auto Chip8::opLoadRange(const Instruction& ins) -> void
+{
+    int count = std::abs(ins.x - ins.y) + 1;
+    int step = ins.x <= ins.y ? 1 : -1;
+    for (int i = 0; i < count; i++)
+        V[ins.x + i * step] = P::memoryAt(memory, I + i);
+}
+
+auto Chip8::opLoadImm(const Instruction& ins) -> void
+{
+    V[ins.x] = ins.nn;
+}
+
+auto Chip8::opAddImm(const Instruction& ins) -> void
+{
+    V[ins.x] += ins.nn;
+}
+
+auto Chip8::opMove(const Instruction& ins) -> void
+{
+    V[ins.x] = V[ins.y];
+}
+
+template<typename P>
+auto Chip8::opOr(const Instruction& ins) -> void
+{
+    V[ins.x] |= V[ins.y];
+    if constexpr (P::quirks.resetVF)
+        V[0xF] = 0;
+}
+
+template<typename P>
+auto Chip8::opAnd(const Instruction& ins) -> void
+{
+    V[ins.x] &= V[ins.y];
+    if constexpr (P::quirks.resetVF)
+        V[0xF] = 0;
+}
+
+template<typename P>
+auto Chip8::opXor(const Instruction& ins) -> void
+{
+    V[ins.x] ^= V[ins.y];
+    if constexpr (P::quirks.resetVF)
+        V[0xF] = 0;
+}
+
+auto Chip8::opAdd(const Instruction& ins) -> void
+{
+    V[0xF] = (static_cast<int>(V[ins.x]) + static_cast<int>(V[ins.y]) > 255) ? 1 : 0;
+    V[ins.x] += V[ins.y];
+}
+
+auto Chip8::opSub(const Instruction& ins) -> void
+{
+    V[0xF] = (V[ins.x] < V[ins.y]) ? 0 : 1;
+    V[ins.x] -= V[ins.y];
+}
+
+template<typename P>
+auto Chip8::opShiftRight(const Instruction& ins) -> void
+{
+    if constexpr (P::quirks.shiftVY)
+    {
+        V[0xF] = V[ins.y] & 0x1;
+        V[ins.x] = V[ins.y] >> 1;
+    }
+    else
+    {
+        V[0xF] = V[ins.x] & 0x1;
+        V[ins.x] >>= 1;
+    }
+}
+
+auto Chip8::opSubReversed(const Instruction& ins) -> void
+{
+    V[0xF] = (V[ins.y] < V[ins.x]) ? 0 : 1;
+    V[ins.x] = V[ins.y] - V[ins.x];
+}
+
+template<typename P>
+auto Chip8::opShiftLeft(const Instruction& ins) -> void
+{
+    if constexpr (P::quirks.shiftVY)
+    {
+        V[0xF] = (V[ins.y] >> 7) & 0x1;
+        V[ins.x] = V[ins.y] << 1;
+    }
+    else
+    {
+        V[0xF] = (V[ins.x] >> 7) & 0x1;
+        V[ins.x] <<= 1;
+    }
+}
+
+template<typename P>
+auto Chip8::opSkipNotEqualReg(const Instruction& ins) -> void
+{
+    if (V[ins.x] != V[ins.y])
+        skipNext<P>();
+}
+
+auto Chip8::opLoadIndex(const Instruction& ins) -> void
+{
+    I = ins.nnn;
+}
+
+template<typename P>
+auto Chip8::opLoadLongIndex(const Instruction& /*ins*/) -> void
+{
+    I = static_cast<uint16_t>(P::memoryAt(memory, PC) << 8 | P::memoryAt(memory, PC + 1));
+    PC += 2;
+}
+
+auto Chip8::opJumpOffset(const Instruction& ins) -> void
+{
+    PC = ins.nnn + V[0];
+}
+
+auto Chip8::opRandom(const Instruction& ins) -> void
+{
+    V[ins.x] = random.nextByte() & ins.nn;
+}
+
+template<typename P>
+auto Chip8::opDraw(const Instruction& ins) -> void
+{
+    drawSprite<P>(V[ins.x], V[ins.y], ins.n);
+}
+
+template<typename P>
+auto Chip8::opSkipKeyPressed(const Instruction& ins) -> void
+{
+    observeKey(V[ins.x]);
+    if (P::at(key, V[ins.x]))
+        skipNext<P>();
+}
+
+template<typename P>
+auto Chip8::opSkipKeyNotPressed(const Instruction& ins) -> void
+{
+    observeKey(V[ins.x]);
+    if (!P::at(key, V[ins.x]))
+        skipNext<P>();
+}
+
+auto Chip8::opSelectPlanes(const Instruction& ins) -> void
+{
+    planeMask = ins.x & ALL_PLANES;
+}
+
+template<typename P>
+auto Chip8::opLoadAudio(const Instruction& /*ins*/) -> void
+{
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++)
+        audioBuffer[i] = P::memoryAt(memory, I + i);
+}
+
+auto Chip8::opLoadDelay(const Instruction& ins) -> void
+{
+    V[ins.x] = delayTimer;
+}
+
+auto Chip8::opWaitKey(const Instruction& ins) -> void
+{
+    if (keyWaitResult < 0)
+    {
+        waitingForKey = true;
+        PC -= 2;
+        return;
+    }
+    V[ins.x] = keyWaitResult;
+    observeKey(keyWaitResult);
+    waitingForKey = false;
+    keyWaitResult = -1;
+}
+
+auto Chip8::opSetDelay(const Instruction& ins) -> void
+{
+    delayTimer = V[ins.x];
+}
+
+auto Chip8::opSetSound(const Instruction& ins) -> void
+{
+    soundTimer = V[ins.x];
+}
+
+auto Chip8::opAddIndex(const Instruction& ins) -> void
+{
+    //V[0xF] = (I + V[x] > 0xfff) ? 1 : 0;
+    I += V[ins.x];
+}
+
+auto Chip8::opLoadFont(const Instruction& ins) -> void
+{
+    I = V[ins.x] * 5;
+}
 
-            uint8_t& pixel = gfx.at(pos);
-            if (bit == 1 && pixel == 1)
-                V.at(0xF) = 1;
+auto Chip8::opLoadBigFont(const Instruction& ins) -> void
+{
+    I = BIG_FONTSET_ADDRESS + V[ins.x] * 10;
+}
 
-            pixel ^= bit;
+auto Chip8::opSetPitch(const Instruction& ins) -> void
+{
+    pitchRegister = V[ins.x];
+}
+
+template<typename P>
+auto Chip8::opStoreBCD(const Instruction& ins) -> void
+{
+    invalidateCode(I, 3);
+    P::memoryAt(memory, I) = V[ins.x] / 100;
+    P::memoryAt(memory, I + 1) = (V[ins.x] % 100) / 10;
+    P::memoryAt(memory, I + 2) = V[ins.x] % 10;
+}
+
+template<typename P>
+auto Chip8::opStoreRegisters(const Instruction& ins) -> void
+{
+    invalidateCode(I, ins.x + 1);
+    for (int i = 0; i <= ins.x; i++)
+    {
+        P::memoryAt(memory, I + i) = V[i];
+    }
+    if constexpr (!P::quirks.keepI)
+        I += ins.x + 1;
+}
+
+template<typename P>
+auto Chip8::opLoadRegisters(const Instruction& ins) -> void
+{
+    for (int i = 0; i <= ins.x; i++)
+    {
+        V[i] = P::memoryAt(memory, I + i);
+    }
+    if constexpr (!P::quirks.keepI)
+        I += ins.x + 1;
+}
+
+auto Chip8::opStoreFlags(const Instruction& ins) -> void
+{
+    for (int i = 0; i <= ins.x; i++)
+        rplFlags[i] = V[i];
+}
+
+auto Chip8::opLoadFlags(const Instruction& ins) -> void
+{
+    for (int i = 0; i <= ins.x; i++)
+        V[i] = rplFlags[i];
+}
+
+auto Chip8::opUnknown(const Instruction& ins) -> void
+{
+    fmt::print("unknown opcode {}", ins.opcode);
+}
+
+// DXY0 is a 16x16 sprite of two bytes per row past CHIP-8. With several
+// XO-CHIP planes selected the sprite holds one image per plane, back to
+// back. VF is set on any collision, in every resolution.
+template<typename P>
+auto Chip8::drawSprite(uint8_t x, uint8_t y, uint8_t n) -> void
+{
+    constexpr int planes = P::variant == Variant::XOChip ? PLANE_COUNT : 1;
+    bool wide = P::variant != Variant::Chip8 && n == 0;
+    int rows = wide ? 16 : n;
+    int rowBytes = wide ? 2 : 1;
+    int width = gfx.width();
+    int height = gfx.height();
+
+    V[0xF] = 0;
+    int address = I;
+    for (int plane = 0; plane < planes; plane++)
+    {
+        if (!(planeMask & (1 << plane)))
+            continue;
+        for (int yLine = 0; yLine < rows; yLine++)
+        {
+            // The position always wraps, only the pixels past the edge clip
+            int lineIndex = y % height + yLine;
+            if constexpr (P::quirks.clipSprites)
+            {
+                if (lineIndex >= height)
+                    break;
+            }
+            else
+            {
+                lineIndex %= height;
+            }
+
+            // Sprite bit 7 lands on bit 63
+            int rowAddress = address + yLine * rowBytes;
+            uint64_t row = static_cast<uint64_t>(P::memoryAt(memory, rowAddress)) << 56;
+            if (wide)
+                row |= static_cast<uint64_t>(P::memoryAt(memory, rowAddress + 1)) << 48;
+            if (gfx.drawRow<P::quirks.clipSprites>(plane, x % width, lineIndex, row))
+                V[0xF] = 1;
         }
+        address += rows * rowBytes;
     }
-    drawFlag = true;
 }
 
 auto Chip8::debugDraw() -> void
 {
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
-            if (gfx.at(y * SCREEN_WIDTH + x) == 0) fmt::print("0");
+    for (int y = 0; y < gfx.height(); y++) {
+        for (int x = 0; x < gfx.width(); x++) {
+            if (!displayPixel(gfx.rows(), x, y)) fmt::print("0");
             else fmt::print(" ");
         }
         fmt::print("\n");
@@ -275,33 +1218,78 @@ auto Chip8::debugDraw() -> void
     fmt::print("\n");
 }
 
-auto Chip8::waitKeyPress() -> uint8_t
+auto Chip8::keyPressed(int k) -> void
 {
-    const int nkeys = 16;
-    for (int i = 0; i < nkeys; i++)
+    applyKeyEvent(KeyEvent{0, static_cast<uint8_t>(k), true});
+}
+
+auto Chip8::keyReleased(int k) -> void
+{
+    applyKeyEvent(KeyEvent{0, static_cast<uint8_t>(k), false});
+}
+
+auto Chip8::queueKeyEvent(const KeyEvent& event, int slot) -> void
+{
+    if (queuedKeyCount == MAX_QUEUED_KEYS)
     {
-        if (key.at(i))
-            return i;
+        applyKeyEvent(event);
+        return;
     }
-    return -1;
+    queuedKeys[queuedKeyCount++] = QueuedKey{event, std::max(slot, 0)};
 }
 
-auto Chip8::keyPressed(int k) -> void
+auto Chip8::applyKeyEvent(const KeyEvent& event) -> void
 {
-    key.at(k) = 1;
+    key.at(event.key) = event.pressed ? 1 : 0;
+    if (!event.pressed)
+        return;
+
+    keyPressTime.at(event.key) = event.timestampNs;
+    if (waitingForKey && keyWaitResult < 0)
+        keyWaitResult = event.key;
 }
 
-auto Chip8::keyReleased(int k) -> void
+// Records press to first read latency the first time a key is read
+auto Chip8::observeKey(uint8_t k) -> void
 {
-    key.at(k) = 0;
+    if (k < KEY_SIZE && keyPressTime[k] != 0)
+    {
+        keyLatencyHistogram.record(steadyNowNs() - keyPressTime[k]);
+        keyPressTime[k] = 0;
+    }
+}
+
+auto Chip8::keyLatency() const -> const LatencyHistogram&
+{
+    return keyLatencyHistogram;
 }
 
 auto Chip8::shouldItDraw() -> bool
 {
-    return drawFlag;
+    return gfx.dirty();
 }
 
-auto Chip8::screenBuffer() -> std::span<uint8_t>
+auto Chip8::takeDirtyRows() -> uint64_t
+{
+    return gfx.takeDirtyRows();
+}
+
+auto Chip8::display() const -> const Display&
 {
     return gfx;
 }
+
+auto Chip8::buzzing() const -> bool
+{
+    return buzzerOn;
+}
+
+auto Chip8::audioPattern() const -> const std::array<uint8_t, AUDIO_PATTERN_SIZE>&
+{
+    return audioBuffer;
+}
+
+auto Chip8::pitch() const -> uint8_t
+{
+    return pitchRegister;
+}
@@ -1,19 +1,50 @@
 #pragma once
 
 #include <array>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <stdexcept>
 #include <string_view>
-#include <random>
 #include <span>
 
+#include "display.h"
+#include "input.h"
+#include "latency_histogram.h"
+#include "random.h"
+
+// Address space of CHIP-8 and SUPER-CHIP, XO-CHIP has MAX_MEM_SIZE
 constexpr const int MEM_SIZE = 4096;
+constexpr const int MAX_MEM_SIZE = 0x10000;
 constexpr const int STACK_SIZE = 16;
 constexpr const int REGISTER_SIZE = 16;
 constexpr const int KEY_SIZE = 16;
-constexpr const int SCREEN_WIDTH = 64;
-constexpr const int SCREEN_HEIGHT = 32;
 constexpr const int FONTSET_SIZE = 80;
+// The SUPER-CHIP 8x10 digits, placed right after the small font
+constexpr const int BIG_FONTSET_ADDRESS = FONTSET_SIZE;
+constexpr const int BIG_FONTSET_SIZE = 160;
+constexpr const int RPL_FLAG_COUNT = 16;
+constexpr const int AUDIO_PATTERN_SIZE = 16;
+// Instructions per 60 Hz frame when nothing else is asked for, 480 Hz
+constexpr const int INSTRUCTIONS_PER_FRAME = 8;
+constexpr const int MAX_QUEUED_KEYS = 32;
+// Longest loop, in instructions, the idle fast-forward looks for
+constexpr const int IDLE_LOOP_MAX = 4;
 constexpr const uint16_t FIRST_MEM_ADDRESS = 0x200;
+// Of a CHIP-8 or SUPER-CHIP ROM, XO-CHIP ROMs can fill the whole 64 KB
+constexpr const int MAX_ROM_SIZE = MEM_SIZE - FIRST_MEM_ADDRESS;
+// Set by CMake; 0 compiles the profiling hooks away
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 1
+#endif
+// Release builds wrap bad addresses, debug builds throw on them
+#ifdef NDEBUG
+constexpr const bool CHECKED_BY_DEFAULT = false;
+#else
+constexpr const bool CHECKED_BY_DEFAULT = true;
+#endif
+
 constexpr const std::array<uint8_t, FONTSET_SIZE> fontset =
 {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -33,40 +64,386 @@ constexpr const std::array<uint8_t, FONTSET_SIZE> fontset =
     0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F 
 };
+constexpr const std::array<uint8_t, BIG_FONTSET_SIZE> bigFontset =
+{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+enum class Engine
+{
+    Interpreter, // decode every opcode through the switch
+    Cached,      // run from a table of predecoded handlers
+    Jit,         // translate basic blocks to x86-64, Cached elsewhere
+};
+
+// Accepts the names used on the command line: switch, cached and jit
+auto engineFromName(std::string_view name, Engine& engine) -> bool;
+
+// The instruction set a ROM was written for
+enum class Variant
+{
+    Chip8,  // the original 64x32 machine
+    SChip,  // SUPER-CHIP 1.1: 128x64, scrolling, 16x16 sprites, big font
+    XOChip, // SUPER-CHIP plus two bitplanes, 64 KB of memory and audio
+};
+
+constexpr const int VARIANT_COUNT = 3;
+
+// Accepts the names used on the command line: chip8, schip and xochip
+auto variantFromName(std::string_view name, Variant& variant) -> bool;
+
+// Behaviours ROMs disagree on. All false is what this emulator has always
+// done, each flag switches to the other common interpretation.
+struct Quirks
+{
+    bool shiftVY{};     // 8XY6/8XYE shift VY into VX instead of VX in place
+    bool keepI{};       // FX55/FX65 leave I alone instead of past the last register
+    bool clipSprites{}; // DXYN clips at the screen edges instead of wrapping
+    bool resetVF{};     // 8XY1/8XY2/8XY3 clear VF
+
+    auto operator==(const Quirks& q) const -> bool = default;
+};
+
+constexpr const int QUIRK_COUNT = 4;
+
+// Accepts the presets used on the command line: default, cosmac, schip and
+// xochip
+auto quirksFromName(std::string_view name, Quirks& quirks) -> bool;
+// The preset ROMs written for variant expect
+auto variantQuirks(Variant variant) -> Quirks;
+// One bit per flag in declaration order, so the default set is 0
+auto quirksToBits(const Quirks& quirks) -> uint32_t;
+auto quirksFromBits(uint32_t bits) -> Quirks;
+
+// One interpreter configuration, fixed at compile time. Every handler that
+// depends on a quirk or touches memory, the stack or the keys is
+// instantiated per policy, so a configuration pays for neither the quirks
+// it does not use nor a branch on the ones it does.
+template<Variant V, bool ShiftVY, bool KeepI, bool ClipSprites, bool ResetVF, bool Checked>
+struct CorePolicy
+{
+    constexpr static Variant variant = V;
+    constexpr static Quirks quirks{ShiftVY, KeepI, ClipSprites, ResetVF};
+    constexpr static bool checked = Checked;
+    constexpr static int memorySize = V == Variant::XOChip ? MAX_MEM_SIZE : MEM_SIZE;
+
+    // Checked accesses throw std::out_of_range past the end, unchecked ones
+    // wrap around like the address bus would
+    template<typename T, size_t N>
+    static auto at(std::array<T, N>& array, size_t index) -> T&
+    {
+        static_assert(std::has_single_bit(N));
+        if constexpr (Checked)
+            return array.at(index);
+        else
+            return array[index & (N - 1)];
+    }
+
+    // memory holds memorySize bytes, the variant's address space
+    static auto memoryAt(uint8_t* memory, size_t index) -> uint8_t&
+    {
+        if constexpr (Checked)
+        {
+            if (index >= memorySize)
+                throw std::out_of_range("memory address out of range");
+            return memory[index];
+        }
+        else
+        {
+            return memory[index & (memorySize - 1)];
+        }
+    }
+};
+
+class ExecutionProfile;
+class Jit;
+struct SaveStatePayload;
 
 class Chip8
 {
 public:
     Chip8();
+    Chip8(const Chip8& c) = delete;
+    Chip8(Chip8&& c) = delete;
+    auto operator=(const Chip8& c) -> Chip8& = delete;
+    auto operator=(Chip8&& c) -> Chip8& = delete;
+    ~Chip8();
+
     auto cpuReset() -> void;
-    auto loadROM(std::string_view filename) -> void;
-    auto tick() -> void;
+    auto loadROM(std::string_view filename) -> bool;
+    auto loadROM(std::span<const uint8_t> rom) -> bool;
+    // CXNN draws from this sequence, fixed seeds make runs reproducible
+    auto seedRandom(uint32_t seed) -> void;
+    // Versioned, checksummed snapshot, see savestate.h for the layout.
+    // out must hold saveStateSize() bytes; in must come from a machine
+    // running a variant with the same address space.
+    auto saveState(std::span<uint8_t> out) const -> bool;
+    auto loadState(std::span<const uint8_t> in) -> bool;
+    [[nodiscard]] auto saveStateSize() const -> size_t;
+    // The bare payload and the addressable memory, no header or checksum,
+    // for in-process history. Both spans hold snapshotSize() bytes, which
+    // depends on the variant.
+    [[nodiscard]] auto snapshotSize() const -> size_t;
+    auto snapshot(std::span<uint8_t> out) const -> void;
+    auto restore(std::span<const uint8_t> in) -> void;
+    // Runs instructions, then steps the 60 Hz timers once
+    auto tick(int instructions = INSTRUCTIONS_PER_FRAME) -> void;
+    auto step() -> void;
+    auto setEngine(Engine e) -> void;
+    // Both pick the CorePolicy instantiation that runs from now on and drop
+    // any decoded or translated code
+    auto setQuirks(const Quirks& q) -> void;
+    auto setChecked(bool c) -> void;
+    // Like setQuirks, call before cpuReset, which loads the fonts the
+    // variant has
+    auto setVariant(Variant v) -> void;
+    [[nodiscard]] auto quirks() const -> const Quirks&;
+    [[nodiscard]] auto variant() const -> Variant;
+    // While attached every instruction is counted, which runs them one at a
+    // time; null detaches. Ignored when profiling is compiled out.
+    auto setProfiler(ExecutionProfile* profile) -> void;
+    // On by default. Short loops that spin on the delay timer, the keys or
+    // themselves are skipped to the end of the run of instructions instead
+    // of executed; the resulting state is the same either way.
+    auto setFastForward(bool enabled) -> void;
+    // Instructions counted as executed that the fast-forward skipped
+    [[nodiscard]] auto skippedInstructions() const -> uint64_t;
     auto keyPressed(int k) -> void;
     auto keyReleased(int k) -> void;
+    // Applies the event during the next tick, right before instruction
+    // slot runs. Slots must not decrease between calls.
+    auto queueKeyEvent(const KeyEvent& event, int slot) -> void;
+    [[nodiscard]] auto keyLatency() const -> const LatencyHistogram&;
     auto shouldItDraw() -> bool;
-    auto screenBuffer() -> std::span<uint8_t>;
+    // One bit per display row changed since the last call
+    auto takeDirtyRows() -> uint64_t;
+    [[nodiscard]] auto display() const -> const Display&;
+    // Whether the sound timer was running during the last tick, the
+    // buzzer state of that 1/60 s of audio
+    [[nodiscard]] auto buzzing() const -> bool;
+    // XO-CHIP sound, F002 and FX3A
+    [[nodiscard]] auto audioPattern() const -> const std::array<uint8_t, AUDIO_PATTERN_SIZE>&;
+    [[nodiscard]] auto pitch() const -> uint8_t;
 
 private:
+    friend class Jit;
+
+    struct Instruction;
+    using Handler = void (*)(Chip8&, const Instruction&);
+
+    struct Instruction
+    {
+        Handler handler;
+        uint16_t opcode;
+        uint16_t nnn;
+        uint8_t x, y, n, nn;
+    };
+
+    // Entry points of one CorePolicy instantiation
+    struct Core
+    {
+        void (*interpret)(Chip8&, int count);
+        void (*runCached)(Chip8&, int count);
+        void (*execute)(Chip8&, uint16_t opcode);
+        Handler predecode;
+    };
+
+    // The factory: one Core per combination of variant, quirks and checking
+    static auto selectCore(Variant variant, const Quirks& quirks, bool checked) -> const Core*;
+    template<typename P>
+    static auto makeCore() -> Core;
+    template<typename P>
+    static auto interpret(Chip8& chip8, int count) -> void;
+    template<typename P>
+    static auto runCached(Chip8& chip8, int count) -> void;
+    template<typename P>
+    static auto execute(Chip8& chip8, uint16_t opcode) -> void;
+
+    static auto makeInstruction(uint16_t opcode) -> Instruction;
+    template<auto Op>
+    static auto call(Chip8& chip8, const Instruction& ins) -> void;
+    template<auto Op, bool Execute>
+    auto select(const Instruction& ins) -> Handler;
+    template<typename P, bool Execute>
+    auto dispatch(const Instruction& ins) -> Handler;
+
+    // What an iteration of an idle loop may change
+    struct IdleState
+    {
+        std::array<uint8_t, REGISTER_SIZE> V;
+        uint16_t I;
+        bool waitingForKey;
+
+        auto operator==(const IdleState& s) const -> bool = default;
+    };
+
+    auto runInstructions(int count) -> void;
+    auto runEngine(int count) -> void;
+    auto runProfiled(int count) -> void;
+    auto skipIdleLoop(int count) -> int;
+    [[nodiscard]] auto idleLoopHead() const -> int;
+    [[nodiscard]] auto idleState() const -> IdleState;
+    // Below addressSpace - 1
+    [[nodiscard]] auto opcodeAt(int address) const -> uint16_t;
+    auto invalidateCode(int address, int length) -> void;
+
+    template<typename P>
+    auto stepCached() -> void;
+    template<typename P>
     auto getNextOpcode() -> uint16_t;
+    template<typename P>
     auto decodeOpcode(uint16_t opcode) -> void;
+    template<typename P>
+    auto skipNext() -> void;
+    template<typename P>
     auto drawSprite(uint8_t x, uint8_t y, uint8_t n) -> void;
-    auto waitKeyPress() -> uint8_t;
+    auto applyKeyEvent(const KeyEvent& event) -> void;
+    auto observeKey(uint8_t k) -> void;
     auto debugDraw() -> void;
 
-    std::array<uint8_t, MEM_SIZE> memory;
+    template<typename P>
+    auto opPredecode(const Instruction& ins) -> void;
+    auto opClearScreen(const Instruction& ins) -> void;
+    template<typename P>
+    auto opReturn(const Instruction& ins) -> void;
+    auto opScrollDown(const Instruction& ins) -> void;
+    auto opScrollUp(const Instruction& ins) -> void;
+    auto opScrollRight(const Instruction& ins) -> void;
+    auto opScrollLeft(const Instruction& ins) -> void;
+    auto opExit(const Instruction& ins) -> void;
+    auto opLowRes(const Instruction& ins) -> void;
+    auto opHighRes(const Instruction& ins) -> void;
+    auto opJump(const Instruction& ins) -> void;
+    template<typename P>
+    auto opCall(const Instruction& ins) -> void;
+    template<typename P>
+    auto opSkipEqualImm(const Instruction& ins) -> void;
+    template<typename P>
+    auto opSkipNotEqualImm(const Instruction& ins) -> void;
+    template<typename P>
+    auto opSkipEqualReg(const Instruction& ins) -> void;
+    template<typename P>
+    auto opSaveRange(const Instruction& ins) -> void;
+    template<typename P>
+    auto opLoadRange(const Instruction& ins) -> void;
+    auto opLoadImm(const Instruction& ins) -> void;
+    auto opAddImm(const Instruction& ins) -> void;
+    auto opMove(const Instruction& ins) -> void;
+    template<typename P>
+    auto opOr(const Instruction& ins) -> void;
+    template<typename P>
+    auto opAnd(const Instruction& ins) -> void;
+    template<typename P>
+    auto opXor(const Instruction& ins) -> void;
+    auto opAdd(const Instruction& ins) -> void;
+    auto opSub(const Instruction& ins) -> void;
+    template<typename P>
+    auto opShiftRight(const Instruction& ins) -> void;
+    auto opSubReversed(const Instruction& ins) -> void;
+    template<typename P>
+    auto opShiftLeft(const Instruction& ins) -> void;
+    template<typename P>
+    auto opSkipNotEqualReg(const Instruction& ins) -> void;
+    auto opLoadIndex(const Instruction& ins) -> void;
+    template<typename P>
+    auto opLoadLongIndex(const Instruction& ins) -> void;
+    auto opJumpOffset(const Instruction& ins) -> void;
+    auto opRandom(const Instruction& ins) -> void;
+    template<typename P>
+    auto opDraw(const Instruction& ins) -> void;
+    template<typename P>
+    auto opSkipKeyPressed(const Instruction& ins) -> void;
+    template<typename P>
+    auto opSkipKeyNotPressed(const Instruction& ins) -> void;
+    auto opSelectPlanes(const Instruction& ins) -> void;
+    template<typename P>
+    auto opLoadAudio(const Instruction& ins) -> void;
+    auto opLoadDelay(const Instruction& ins) -> void;
+    auto opWaitKey(const Instruction& ins) -> void;
+    auto opSetDelay(const Instruction& ins) -> void;
+    auto opSetSound(const Instruction& ins) -> void;
+    auto opAddIndex(const Instruction& ins) -> void;
+    auto opLoadFont(const Instruction& ins) -> void;
+    auto opLoadBigFont(const Instruction& ins) -> void;
+    auto opSetPitch(const Instruction& ins) -> void;
+    template<typename P>
+    auto opStoreBCD(const Instruction& ins) -> void;
+    template<typename P>
+    auto opStoreRegisters(const Instruction& ins) -> void;
+    template<typename P>
+    auto opLoadRegisters(const Instruction& ins) -> void;
+    auto opStoreFlags(const Instruction& ins) -> void;
+    auto opLoadFlags(const Instruction& ins) -> void;
+    auto opUnknown(const Instruction& ins) -> void;
+
+    // CHIP-8 and SUPER-CHIP run in baseMemory. XO-CHIP's 64 KB are only
+    // allocated when setVariant selects it; memory points at whichever of
+    // the two is live and holds addressSpace bytes.
+    std::array<uint8_t, MEM_SIZE> baseMemory;
+    std::unique_ptr<std::array<uint8_t, MAX_MEM_SIZE>> extendedMemory;
+    uint8_t* memory{baseMemory.data()};
     std::array<uint16_t, STACK_SIZE> stack;
     std::array<uint8_t, REGISTER_SIZE> V;
     std::array<uint8_t, KEY_SIZE> key;
-    std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT> gfx;
+    Display gfx;
     uint16_t I;
     uint16_t PC;
     uint8_t SP;
     uint8_t delayTimer;
     uint8_t soundTimer;
-    bool drawFlag;
+    // XO-CHIP bitplanes drawn, cleared and scrolled, always 1 otherwise
+    uint8_t planeMask;
+    // SUPER-CHIP FX75/FX85 storage, the HP-48 RPL user flags
+    std::array<uint8_t, RPL_FLAG_COUNT> rplFlags;
+    std::array<uint8_t, AUDIO_PATTERN_SIZE> audioBuffer;
+    uint8_t pitchRegister;
+    bool buzzerOn;
+
+    struct QueuedKey
+    {
+        KeyEvent event;
+        int slot;
+    };
+    std::array<QueuedKey, MAX_QUEUED_KEYS> queuedKeys;
+    int queuedKeyCount;
+    // FX0A spins on itself until a press arrives while waiting
+    bool waitingForKey;
+    int keyWaitResult;
+    std::array<int64_t, KEY_SIZE> keyPressTime;
+    LatencyHistogram keyLatencyHistogram;
+
+    Engine engine{Engine::Interpreter};
+    Variant activeVariant{Variant::Chip8};
+    Quirks activeQuirks{};
+    bool checked{CHECKED_BY_DEFAULT};
+    const Core* core;
+    // MEM_SIZE or MAX_MEM_SIZE, the addresses the running variant can reach
+    int addressSpace{MEM_SIZE};
+    // One entry per address, allocated when the cached engine is selected.
+    // Stale entries point at opPredecode, which decodes on first execution.
+    std::unique_ptr<std::array<Instruction, MAX_MEM_SIZE>> decodeCache;
+    std::unique_ptr<Jit> jit;
+    bool fastForward{true};
+    uint64_t skipped{};
+#if CHIP8_PROFILE
+    ExecutionProfile* profiler{};
+#endif
 
-    std::random_device randomDevice;
-    std::default_random_engine randomEngine;
-    std::uniform_int_distribution<uint8_t> uniformDistribution;
+    Random random;
 };
 
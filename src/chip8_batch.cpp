@@ -0,0 +1,832 @@
+#include "chip8_batch.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fmt/core.h>
+
+#if CHIP8_BATCH_AVX2
+#include <immintrin.h>
+#endif
+
+Chip8Batch::Chip8Batch(size_t lanes)
+    : m_lanes(lanes),
+      m_stride((lanes + laneAlign - 1) / laneAlign * laneAlign),
+      m_V(REGISTER_SIZE * m_stride),
+      m_stack(STACK_SIZE * m_stride),
+      m_I(m_stride),
+      m_PC(m_stride),
+      m_SP(m_stride),
+      m_delayTimer(m_stride),
+      m_soundTimer(m_stride),
+      m_keys(m_stride),
+      m_waitingForKey(m_stride),
+      m_keyWaitResult(m_stride),
+      m_gfx(SCREEN_HEIGHT * m_stride),
+      m_memory(MEM_SIZE * m_stride),
+      m_active(m_stride),
+      m_group(m_stride),
+      m_faulted(m_stride),
+      m_random(m_stride)
+{
+#if CHIP8_BATCH_AVX2
+    m_simd = __builtin_cpu_supports("avx2");
+#endif
+    // Distinct default sequences so lanes diverge even without seeding
+    for (size_t lane = 0; lane < m_lanes; lane++)
+        m_random[lane].setState(lane + 1);
+    cpuReset();
+}
+
+Chip8Batch::~Chip8Batch() = default;
+
+auto Chip8Batch::cpuReset() -> void
+{
+    std::ranges::fill(m_V, 0);
+    std::ranges::fill(m_stack, 0);
+    std::ranges::fill(m_I, 0);
+    std::ranges::fill(m_PC, FIRST_MEM_ADDRESS);
+    std::ranges::fill(m_SP, 0);
+    std::ranges::fill(m_delayTimer, 0);
+    std::ranges::fill(m_soundTimer, 0);
+    std::ranges::fill(m_keys, 0);
+    std::ranges::fill(m_waitingForKey, 0);
+    std::ranges::fill(m_keyWaitResult, -1);
+    std::ranges::fill(m_gfx, 0);
+
+    m_image.fill(0);
+    std::ranges::copy(fontset, m_image.begin());
+    m_written.fill(false);
+    for (size_t lane = 0; lane < m_stride; lane++)
+        std::ranges::copy(m_image, m_memory.begin() + lane * MEM_SIZE);
+
+    std::ranges::fill(m_faulted, 0xFF);
+    std::fill_n(m_faulted.begin(), m_lanes, 0);
+}
+
+auto Chip8Batch::loadROM(std::span<const uint8_t> rom) -> bool
+{
+    if (rom.size() > MAX_ROM_SIZE)
+    {
+        fmt::print("ROM is {} bytes, at most {} fit in memory\n", rom.size(), MAX_ROM_SIZE);
+        return false;
+    }
+    std::ranges::copy(rom, m_image.begin() + FIRST_MEM_ADDRESS);
+    m_written.fill(false);
+    for (size_t lane = 0; lane < m_stride; lane++)
+        std::ranges::copy(m_image, m_memory.begin() + lane * MEM_SIZE);
+    return true;
+}
+
+auto Chip8Batch::seedRandom(size_t lane, uint32_t seed) -> void
+{
+    m_random.at(lane).setState(seed);
+}
+
+auto Chip8Batch::keyPressed(size_t lane, int k) -> void
+{
+    m_keys.at(lane) |= 1 << k;
+    if (m_waitingForKey[lane] && m_keyWaitResult[lane] < 0)
+        m_keyWaitResult[lane] = static_cast<int8_t>(k);
+}
+
+auto Chip8Batch::keyReleased(size_t lane, int k) -> void
+{
+    m_keys.at(lane) &= ~(1 << k);
+}
+
+auto Chip8Batch::tick() -> void
+{
+    for (int i = 0; i < INSTRUCTIONS_PER_FRAME; i++)
+        step();
+    decrementTimers();
+}
+
+auto Chip8Batch::step() -> void
+{
+    m_stats.steps++;
+    for (size_t lane = 0; lane < m_stride; lane++)
+        m_active[lane] = ~m_faulted[lane];
+
+    size_t first = 0;
+    for (int g = 0; g < maxGroupsPerStep; g++)
+    {
+        while (first < m_lanes && !m_active[first])
+            first++;
+        if (first == m_lanes)
+            return;
+
+        // Out of range PCs fault, which is per lane work anyway
+        uint16_t pc = m_PC[first];
+        if (pc >= MEM_SIZE - 1)
+            break;
+
+        uint16_t opcode = opcodeAt(first, pc);
+        size_t members = buildGroup(pc);
+        if (m_written[pc] || m_written[pc + 1])
+            members = filterGroup(pc, opcode);
+
+        executeGroup(pc, opcode);
+        m_stats.groups++;
+        m_stats.groupedLanes += members;
+    }
+
+    for (size_t lane = first; lane < m_lanes; lane++)
+    {
+        if (m_active[lane])
+        {
+            executeLane(lane);
+            m_stats.scalarLanes++;
+        }
+    }
+}
+
+auto Chip8Batch::lanes() const -> size_t
+{
+    return m_lanes;
+}
+
+auto Chip8Batch::simd() const -> bool
+{
+    return m_simd;
+}
+
+auto Chip8Batch::faulted(size_t lane) const -> bool
+{
+    return m_faulted.at(lane) != 0;
+}
+
+auto Chip8Batch::laneState(size_t lane) const -> LaneState
+{
+    LaneState state{};
+    for (int r = 0; r < REGISTER_SIZE; r++)
+        state.V[r] = m_V[r * m_stride + lane];
+    for (int s = 0; s < STACK_SIZE; s++)
+        state.stack[s] = m_stack[s * m_stride + lane];
+    state.I = m_I.at(lane);
+    state.PC = m_PC[lane];
+    state.SP = m_SP[lane];
+    state.delayTimer = m_delayTimer[lane];
+    state.soundTimer = m_soundTimer[lane];
+    state.faulted = m_faulted[lane] != 0;
+    return state;
+}
+
+auto Chip8Batch::memory(size_t lane) const -> std::span<const uint8_t, MEM_SIZE>
+{
+    return std::span<const uint8_t, MEM_SIZE>(&m_memory.at(lane * MEM_SIZE), MEM_SIZE);
+}
+
+auto Chip8Batch::screenBuffer(size_t lane) const -> std::span<const uint64_t, SCREEN_HEIGHT>
+{
+    return std::span<const uint64_t, SCREEN_HEIGHT>(&m_gfx.at(lane * SCREEN_HEIGHT), SCREEN_HEIGHT);
+}
+
+auto Chip8Batch::stats() const -> const BatchStats&
+{
+    return m_stats;
+}
+
+auto Chip8Batch::reg(uint8_t r) -> uint8_t*
+{
+    return &m_V[r * m_stride];
+}
+
+auto Chip8Batch::opcodeAt(size_t lane, uint16_t pc) const -> uint16_t
+{
+    const uint8_t* memory = &m_memory[lane * MEM_SIZE];
+    return static_cast<uint16_t>(memory[pc] << 8 | memory[pc + 1]);
+}
+
+// Some lane wrote to the code at pc, drop the members whose copy differs
+auto Chip8Batch::filterGroup(uint16_t pc, uint16_t opcode) -> size_t
+{
+    size_t members = 0;
+    for (size_t lane = 0; lane < m_lanes; lane++)
+    {
+        if (!m_group[lane])
+            continue;
+        if (opcodeAt(lane, pc) == opcode)
+        {
+            members++;
+            continue;
+        }
+        m_group[lane] = 0;
+        m_active[lane] = 0xFF;
+    }
+    return members;
+}
+
+// Mirrors Chip8::dispatch. Ops that can fault or that touch memory, the
+// screen, the stack, keys or the RNG run per member lane.
+auto Chip8Batch::executeGroup(uint16_t pc, uint16_t opcode) -> void
+{
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t x = (opcode >> 8) & 0x000F;
+    uint8_t y = (opcode >> 4) & 0x000F;
+    uint8_t n = opcode & 0x000F;
+    uint8_t nn = opcode & 0x00FF;
+    uint16_t next = pc + 2;
+
+    switch (opcode & 0xF000)
+    {
+        case 0x1000: wordKernel<WordOp::Set>(m_PC.data(), 0, nnn); return;
+        case 0x3000: skipKernel<SkipOp::EqualImm>(x, y, nn, pc); return;
+        case 0x4000: skipKernel<SkipOp::NotEqualImm>(x, y, nn, pc); return;
+        case 0x5000: skipKernel<SkipOp::EqualReg>(x, y, nn, pc); return;
+        case 0x9000: skipKernel<SkipOp::NotEqualReg>(x, y, nn, pc); return;
+        case 0xB000: wordKernel<WordOp::SetPlusReg>(m_PC.data(), 0, nnn); return;
+        case 0x6000:
+            wordKernel<WordOp::Set>(m_PC.data(), 0, next);
+            byteKernel<ByteOp::LoadImm>(reg(x), nullptr, nn);
+            return;
+        case 0x7000:
+            wordKernel<WordOp::Set>(m_PC.data(), 0, next);
+            byteKernel<ByteOp::AddImm>(reg(x), nullptr, nn);
+            return;
+        case 0xA000:
+            wordKernel<WordOp::Set>(m_PC.data(), 0, next);
+            wordKernel<WordOp::Set>(m_I.data(), 0, nnn);
+            return;
+        case 0x8000:
+            switch (n)
+            {
+                case 0x0: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Move>(reg(x), reg(y), 0); return;
+                case 0x1: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Or>(reg(x), reg(y), 0); return;
+                case 0x2: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::And>(reg(x), reg(y), 0); return;
+                case 0x3: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Xor>(reg(x), reg(y), 0); return;
+                case 0x4: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Add>(reg(x), reg(y), 0); return;
+                case 0x5: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Sub>(reg(x), reg(y), 0); return;
+                case 0x6: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::ShiftRight>(reg(x), reg(y), 0); return;
+                case 0x7: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::SubReversed>(reg(x), reg(y), 0); return;
+                case 0xE: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::ShiftLeft>(reg(x), reg(y), 0); return;
+                default: break;
+            }
+            break;
+        case 0xF000:
+            switch (nn)
+            {
+                case 0x07: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Move>(reg(x), m_delayTimer.data(), 0); return;
+                case 0x15: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Move>(m_delayTimer.data(), reg(x), 0); return;
+                case 0x18: wordKernel<WordOp::Set>(m_PC.data(), 0, next); byteKernel<ByteOp::Move>(m_soundTimer.data(), reg(x), 0); return;
+                case 0x1E: wordKernel<WordOp::Set>(m_PC.data(), 0, next); wordKernel<WordOp::AddReg>(m_I.data(), x, 0); return;
+                case 0x29: wordKernel<WordOp::Set>(m_PC.data(), 0, next); wordKernel<WordOp::FontAddress>(m_I.data(), x, 0); return;
+                default: break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    for (size_t lane = 0; lane < m_lanes; lane++)
+    {
+        if (m_group[lane])
+        {
+            m_PC[lane] = next;
+            executeOp(lane, opcode);
+        }
+    }
+}
+
+auto Chip8Batch::executeLane(size_t lane) -> void
+{
+    // Same order as Chip8::getNextOpcode: PC only advances once both bytes
+    // were read
+    uint16_t pc = m_PC[lane];
+    if (pc >= MEM_SIZE - 1)
+    {
+        m_faulted[lane] = 0xFF;
+        return;
+    }
+    m_PC[lane] = pc + 2;
+    executeOp(lane, opcodeAt(lane, pc));
+}
+
+// Per lane reference path, op for op the same as the Chip8 handlers. Where
+// Chip8 would throw from a bounds check, the lane faults after the same
+// partial updates.
+auto Chip8Batch::executeOp(size_t lane, uint16_t opcode) -> void
+{
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t x = (opcode >> 8) & 0x000F;
+    uint8_t y = (opcode >> 4) & 0x000F;
+    uint8_t n = opcode & 0x000F;
+    uint8_t nn = opcode & 0x00FF;
+
+    auto V = [&](uint8_t r) -> uint8_t& { return m_V[r * m_stride + lane]; };
+    uint16_t& I = m_I[lane];
+    uint16_t& PC = m_PC[lane];
+    uint8_t& SP = m_SP[lane];
+
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (n == 0x0)
+            {
+                std::fill_n(m_gfx.begin() + lane * SCREEN_HEIGHT, SCREEN_HEIGHT, 0);
+            }
+            else if (n == 0xE)
+            {
+                --SP;
+                if (SP >= STACK_SIZE)
+                {
+                    m_faulted[lane] = 0xFF;
+                    return;
+                }
+                PC = m_stack[SP * m_stride + lane];
+            }
+            break;
+        case 0x1000: PC = nnn; break;
+        case 0x2000:
+        {
+            uint8_t level = SP++;
+            if (level >= STACK_SIZE)
+            {
+                m_faulted[lane] = 0xFF;
+                return;
+            }
+            m_stack[level * m_stride + lane] = PC;
+            PC = nnn;
+            break;
+        }
+        case 0x3000: if (V(x) == nn) PC += 2; break;
+        case 0x4000: if (V(x) != nn) PC += 2; break;
+        case 0x5000: if (V(x) == V(y)) PC += 2; break;
+        case 0x6000: V(x) = nn; break;
+        case 0x7000: V(x) += nn; break;
+        case 0x8000:
+            switch (n)
+            {
+                case 0x0: V(x) = V(y); break;
+                case 0x1: V(x) |= V(y); break;
+                case 0x2: V(x) &= V(y); break;
+                case 0x3: V(x) ^= V(y); break;
+                case 0x4:
+                    V(0xF) = (static_cast<int>(V(x)) + static_cast<int>(V(y)) > 255) ? 1 : 0;
+                    V(x) += V(y);
+                    break;
+                case 0x5:
+                    V(0xF) = (V(x) < V(y)) ? 0 : 1;
+                    V(x) -= V(y);
+                    break;
+                case 0x6:
+                    V(0xF) = V(x) & 0x1;
+                    V(x) >>= 1;
+                    break;
+                case 0x7:
+                    V(0xF) = (V(y) < V(x)) ? 0 : 1;
+                    V(x) = V(y) - V(x);
+                    break;
+                case 0xE:
+                    V(0xF) = (V(x) >> 7) & 0x1;
+                    V(x) <<= 1;
+                    break;
+                default: break;
+            }
+            break;
+        case 0x9000: if (V(x) != V(y)) PC += 2; break;
+        case 0xA000: I = nnn; break;
+        case 0xB000: PC = nnn + V(0); break;
+        case 0xC000: V(x) = m_random[lane].nextByte() & nn; break;
+        case 0xD000: drawSprite(lane, V(x), V(y), n); break;
+        case 0xE000:
+            if (n == 0xE || n == 0x1)
+            {
+                if (V(x) >= KEY_SIZE)
+                {
+                    m_faulted[lane] = 0xFF;
+                    return;
+                }
+                bool pressed = (m_keys[lane] >> V(x)) & 0x1;
+                if (pressed == (n == 0xE))
+                    PC += 2;
+            }
+            break;
+        case 0xF000:
+            switch (nn)
+            {
+                case 0x07: V(x) = m_delayTimer[lane]; break;
+                case 0x0A:
+                    if (m_keyWaitResult[lane] < 0)
+                    {
+                        m_waitingForKey[lane] = 1;
+                        PC -= 2;
+                        break;
+                    }
+                    V(x) = m_keyWaitResult[lane];
+                    m_waitingForKey[lane] = 0;
+                    m_keyWaitResult[lane] = -1;
+                    break;
+                case 0x15: m_delayTimer[lane] = V(x); break;
+                case 0x18: m_soundTimer[lane] = V(x); break;
+                case 0x1E: I += V(x); break;
+                case 0x29: I = V(x) * 5; break;
+                case 0x33:
+                    if (!writeMemory(lane, I, V(x) / 100) ||
+                        !writeMemory(lane, I + 1, (V(x) % 100) / 10) ||
+                        !writeMemory(lane, I + 2, V(x) % 10))
+                        return;
+                    break;
+                case 0x55:
+                    for (int i = 0; i <= x; i++)
+                    {
+                        if (!writeMemory(lane, I + i, V(i)))
+                            return;
+                    }
+                    I += x + 1;
+                    break;
+                case 0x65:
+                    for (int i = 0; i <= x; i++)
+                    {
+                        if (!readMemory(lane, I + i, V(i)))
+                            return;
+                    }
+                    I += x + 1;
+                    break;
+                default: break;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+auto Chip8Batch::drawSprite(size_t lane, uint8_t x, uint8_t y, uint8_t n) -> void
+{
+    uint8_t& VF = m_V[0xF * m_stride + lane];
+    uint64_t* gfx = &m_gfx[lane * SCREEN_HEIGHT];
+    VF = 0;
+    for (int yLine = 0; yLine < n; yLine++)
+    {
+        uint8_t sprite = 0;
+        if (!readMemory(lane, m_I[lane] + yLine, sprite))
+            return;
+        uint64_t row = std::rotr(static_cast<uint64_t>(sprite) << (SCREEN_WIDTH - 8), x % SCREEN_WIDTH);
+
+        uint64_t& line = gfx[(y + yLine) % SCREEN_HEIGHT];
+        if (line & row)
+            VF = 1;
+        line ^= row;
+    }
+}
+
+auto Chip8Batch::readMemory(size_t lane, uint32_t address, uint8_t& value) -> bool
+{
+    if (address >= MEM_SIZE)
+    {
+        m_faulted[lane] = 0xFF;
+        return false;
+    }
+    value = m_memory[lane * MEM_SIZE + address];
+    return true;
+}
+
+auto Chip8Batch::writeMemory(size_t lane, uint32_t address, uint8_t value) -> bool
+{
+    if (address >= MEM_SIZE)
+    {
+        m_faulted[lane] = 0xFF;
+        return false;
+    }
+    m_memory[lane * MEM_SIZE + address] = value;
+    m_written[address] = true;
+    return true;
+}
+
+// Scalar kernels, also the reference for the AVX2 ones below. Each only
+// touches lanes in the current group.
+
+template<Chip8Batch::ByteOp Op>
+auto Chip8Batch::byteKernel(uint8_t* dst, const uint8_t* src, uint8_t nn) -> void
+{
+#if CHIP8_BATCH_AVX2
+    if (m_simd)
+    {
+        byteKernelAvx2<Op>(dst, src, nn);
+        return;
+    }
+#endif
+    uint8_t* VF = reg(0xF);
+    for (size_t lane = 0; lane < m_lanes; lane++)
+    {
+        if (!m_group[lane])
+            continue;
+        // Flag first, then the result from the registers as they are now,
+        // which matters when x or y is F
+        switch (Op)
+        {
+            case ByteOp::Add: VF[lane] = (dst[lane] + src[lane] > 255) ? 1 : 0; break;
+            case ByteOp::Sub: VF[lane] = (dst[lane] < src[lane]) ? 0 : 1; break;
+            case ByteOp::ShiftRight: VF[lane] = dst[lane] & 0x1; break;
+            case ByteOp::SubReversed: VF[lane] = (src[lane] < dst[lane]) ? 0 : 1; break;
+            case ByteOp::ShiftLeft: VF[lane] = (dst[lane] >> 7) & 0x1; break;
+            default: break;
+        }
+        switch (Op)
+        {
+            case ByteOp::LoadImm: dst[lane] = nn; break;
+            case ByteOp::AddImm: dst[lane] += nn; break;
+            case ByteOp::Move: dst[lane] = src[lane]; break;
+            case ByteOp::Or: dst[lane] |= src[lane]; break;
+            case ByteOp::And: dst[lane] &= src[lane]; break;
+            case ByteOp::Xor: dst[lane] ^= src[lane]; break;
+            case ByteOp::Add: dst[lane] += src[lane]; break;
+            case ByteOp::Sub: dst[lane] -= src[lane]; break;
+            case ByteOp::ShiftRight: dst[lane] >>= 1; break;
+            case ByteOp::SubReversed: dst[lane] = src[lane] - dst[lane]; break;
+            case ByteOp::ShiftLeft: dst[lane] <<= 1; break;
+        }
+    }
+}
+
+template<Chip8Batch::WordOp Op>
+auto Chip8Batch::wordKernel(uint16_t* dst, uint8_t x, uint16_t value) -> void
+{
+#if CHIP8_BATCH_AVX2
+    if (m_simd)
+    {
+        wordKernelAvx2<Op>(dst, x, value);
+        return;
+    }
+#endif
+    const uint8_t* Vx = reg(x);
+    for (size_t lane = 0; lane < m_lanes; lane++)
+    {
+        if (!m_group[lane])
+            continue;
+        switch (Op)
+        {
+            case WordOp::Set: dst[lane] = value; break;
+            case WordOp::AddReg: dst[lane] += Vx[lane]; break;
+            case WordOp::SetPlusReg: dst[lane] = value + Vx[lane]; break;
+            case WordOp::FontAddress: dst[lane] = Vx[lane] * 5; break;
+        }
+    }
+}
+
+template<Chip8Batch::SkipOp Op>
+auto Chip8Batch::skipKernel(uint8_t x, uint8_t y, uint8_t nn, uint16_t pc) -> void
+{
+#if CHIP8_BATCH_AVX2
+    if (m_simd)
+    {
+        skipKernelAvx2<Op>(x, y, nn, pc);
+        return;
+    }
+#endif
+    const uint8_t* Vx = reg(x);
+    const uint8_t* Vy = reg(y);
+    for (size_t lane = 0; lane < m_lanes; lane++)
+    {
+        if (!m_group[lane])
+            continue;
+        bool skip = false;
+        switch (Op)
+        {
+            case SkipOp::EqualImm: skip = Vx[lane] == nn; break;
+            case SkipOp::NotEqualImm: skip = Vx[lane] != nn; break;
+            case SkipOp::EqualReg: skip = Vx[lane] == Vy[lane]; break;
+            case SkipOp::NotEqualReg: skip = Vx[lane] != Vy[lane]; break;
+        }
+        m_PC[lane] = pc + (skip ? 4 : 2);
+    }
+}
+
+// Moves the active lanes at pc into the group
+auto Chip8Batch::buildGroup(uint16_t pc) -> size_t
+{
+#if CHIP8_BATCH_AVX2
+    if (m_simd)
+        return buildGroupAvx2(pc);
+#endif
+    size_t members = 0;
+    for (size_t lane = 0; lane < m_stride; lane++)
+    {
+        uint8_t member = (m_PC[lane] == pc) ? m_active[lane] : 0;
+        m_group[lane] = member;
+        m_active[lane] &= ~member;
+        members += member & 0x1;
+    }
+    return members;
+}
+
+auto Chip8Batch::decrementTimers() -> void
+{
+#if CHIP8_BATCH_AVX2
+    if (m_simd)
+    {
+        decrementTimersAvx2();
+        return;
+    }
+#endif
+    for (size_t lane = 0; lane < m_lanes; lane++)
+    {
+        if (m_faulted[lane])
+            continue;
+        if (m_delayTimer[lane] > 0)
+            m_delayTimer[lane]--;
+        if (m_soundTimer[lane] > 0)
+            m_soundTimer[lane]--;
+    }
+}
+
+#if CHIP8_BATCH_AVX2
+
+// 32 lanes per iteration; m_stride is a multiple of 32 and padding lanes
+// are never in a group, so there is no tail.
+
+namespace
+{
+
+[[gnu::target("avx2")]] inline auto load(const void* p) -> __m256i
+{
+    return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+}
+
+[[gnu::target("avx2")]] inline auto store(void* p, __m256i v) -> void
+{
+    _mm256_storeu_si256(static_cast<__m256i*>(p), v);
+}
+
+// Widens the byte mask for 16 lanes to a word mask
+[[gnu::target("avx2")]] inline auto widenMask(__m256i mask, int half) -> __m256i
+{
+    __m128i bytes = half == 0 ? _mm256_castsi256_si128(mask) : _mm256_extracti128_si256(mask, 1);
+    return _mm256_cvtepi8_epi16(bytes);
+}
+
+[[gnu::target("avx2")]] inline auto widenBytes(__m256i v, int half) -> __m256i
+{
+    __m128i bytes = half == 0 ? _mm256_castsi256_si128(v) : _mm256_extracti128_si256(v, 1);
+    return _mm256_cvtepu8_epi16(bytes);
+}
+
+}
+
+template<Chip8Batch::ByteOp Op>
+[[gnu::target("avx2")]] auto Chip8Batch::byteKernelAvx2(uint8_t* dst, const uint8_t* src, uint8_t nn) -> void
+{
+    uint8_t* VF = reg(0xF);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i imm = _mm256_set1_epi8(static_cast<char>(nn));
+    const __m256i low7 = _mm256_set1_epi8(0x7F);
+    constexpr bool setsFlag = Op == ByteOp::Add || Op == ByteOp::Sub || Op == ByteOp::ShiftRight ||
+        Op == ByteOp::SubReversed || Op == ByteOp::ShiftLeft;
+
+    for (size_t lane = 0; lane < m_stride; lane += laneAlign)
+    {
+        __m256i group = load(&m_group[lane]);
+        if (_mm256_testz_si256(group, group))
+            continue;
+
+        __m256i a = load(dst + lane);
+        __m256i b = src != nullptr ? load(src + lane) : _mm256_setzero_si256();
+        if constexpr (setsFlag)
+        {
+            __m256i flag;
+            if constexpr (Op == ByteOp::Add)
+            {
+                // a + b > 255 exactly when a > ~b
+                __m256i notB = _mm256_xor_si256(b, _mm256_set1_epi8(-1));
+                flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, notB), notB), one);
+            }
+            else if constexpr (Op == ByteOp::Sub)
+                flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one);
+            else if constexpr (Op == ByteOp::SubReversed)
+                flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), one);
+            else if constexpr (Op == ByteOp::ShiftRight)
+                flag = _mm256_and_si256(a, one);
+            else
+                flag = _mm256_and_si256(_mm256_srli_epi16(a, 7), one);
+            store(VF + lane, _mm256_blendv_epi8(load(VF + lane), flag, group));
+
+            a = load(dst + lane);
+            b = load(src + lane);
+        }
+
+        __m256i result;
+        if constexpr (Op == ByteOp::LoadImm)
+            result = imm;
+        else if constexpr (Op == ByteOp::AddImm)
+            result = _mm256_add_epi8(a, imm);
+        else if constexpr (Op == ByteOp::Move)
+            result = b;
+        else if constexpr (Op == ByteOp::Or)
+            result = _mm256_or_si256(a, b);
+        else if constexpr (Op == ByteOp::And)
+            result = _mm256_and_si256(a, b);
+        else if constexpr (Op == ByteOp::Xor)
+            result = _mm256_xor_si256(a, b);
+        else if constexpr (Op == ByteOp::Add)
+            result = _mm256_add_epi8(a, b);
+        else if constexpr (Op == ByteOp::Sub)
+            result = _mm256_sub_epi8(a, b);
+        else if constexpr (Op == ByteOp::ShiftRight)
+            result = _mm256_and_si256(_mm256_srli_epi16(a, 1), low7);
+        else if constexpr (Op == ByteOp::SubReversed)
+            result = _mm256_sub_epi8(b, a);
+        else
+            result = _mm256_add_epi8(a, a);
+        store(dst + lane, _mm256_blendv_epi8(a, result, group));
+    }
+}
+
+template<Chip8Batch::WordOp Op>
+[[gnu::target("avx2")]] auto Chip8Batch::wordKernelAvx2(uint16_t* dst, uint8_t x, uint16_t value) -> void
+{
+    const uint8_t* Vx = reg(x);
+    const __m256i imm = _mm256_set1_epi16(static_cast<short>(value));
+
+    for (size_t lane = 0; lane < m_stride; lane += laneAlign)
+    {
+        __m256i group = load(&m_group[lane]);
+        if (_mm256_testz_si256(group, group))
+            continue;
+
+        __m256i regs = load(Vx + lane);
+        for (int half = 0; half < 2; half++)
+        {
+            uint16_t* words = dst + lane + half * 16;
+            __m256i old = load(words);
+            __m256i vx = widenBytes(regs, half);
+            __m256i result;
+            if constexpr (Op == WordOp::Set)
+                result = imm;
+            else if constexpr (Op == WordOp::AddReg)
+                result = _mm256_add_epi16(old, vx);
+            else if constexpr (Op == WordOp::SetPlusReg)
+                result = _mm256_add_epi16(imm, vx);
+            else
+                result = _mm256_add_epi16(_mm256_slli_epi16(vx, 2), vx);
+            store(words, _mm256_blendv_epi8(old, result, widenMask(group, half)));
+        }
+    }
+}
+
+template<Chip8Batch::SkipOp Op>
+[[gnu::target("avx2")]] auto Chip8Batch::skipKernelAvx2(uint8_t x, uint8_t y, uint8_t nn, uint16_t pc) -> void
+{
+    const uint8_t* Vx = reg(x);
+    const uint8_t* Vy = reg(y);
+    const __m256i imm = _mm256_set1_epi8(static_cast<char>(nn));
+    const __m256i next = _mm256_set1_epi16(static_cast<short>(pc + 2));
+    const __m256i two = _mm256_set1_epi16(2);
+
+    for (size_t lane = 0; lane < m_stride; lane += laneAlign)
+    {
+        __m256i group = load(&m_group[lane]);
+        if (_mm256_testz_si256(group, group))
+            continue;
+
+        __m256i a = load(Vx + lane);
+        __m256i skip;
+        if constexpr (Op == SkipOp::EqualImm || Op == SkipOp::NotEqualImm)
+            skip = _mm256_cmpeq_epi8(a, imm);
+        else
+            skip = _mm256_cmpeq_epi8(a, load(Vy + lane));
+        if constexpr (Op == SkipOp::NotEqualImm || Op == SkipOp::NotEqualReg)
+            skip = _mm256_xor_si256(skip, _mm256_set1_epi8(-1));
+
+        for (int half = 0; half < 2; half++)
+        {
+            uint16_t* words = &m_PC[lane + half * 16];
+            __m256i target = _mm256_add_epi16(next, _mm256_and_si256(widenMask(skip, half), two));
+            store(words, _mm256_blendv_epi8(load(words), target, widenMask(group, half)));
+        }
+    }
+}
+
+[[gnu::target("avx2")]] auto Chip8Batch::buildGroupAvx2(uint16_t pc) -> size_t
+{
+    const __m256i target = _mm256_set1_epi16(static_cast<short>(pc));
+    size_t members = 0;
+
+    for (size_t lane = 0; lane < m_stride; lane += laneAlign)
+    {
+        __m256i low = _mm256_cmpeq_epi16(load(&m_PC[lane]), target);
+        __m256i high = _mm256_cmpeq_epi16(load(&m_PC[lane + 16]), target);
+        // packs works within 128 bit halves, the permute puts lanes back in order
+        __m256i same = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+
+        __m256i active = load(&m_active[lane]);
+        __m256i group = _mm256_and_si256(same, active);
+        store(&m_group[lane], group);
+        store(&m_active[lane], _mm256_andnot_si256(group, active));
+        members += std::popcount(static_cast<uint32_t>(_mm256_movemask_epi8(group)));
+    }
+    return members;
+}
+
+[[gnu::target("avx2")]] auto Chip8Batch::decrementTimersAvx2() -> void
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    for (size_t lane = 0; lane < m_stride; lane += laneAlign)
+    {
+        // Saturating subtract stops at zero; faulted lanes subtract nothing
+        __m256i step = _mm256_andnot_si256(load(&m_faulted[lane]), one);
+        store(&m_delayTimer[lane], _mm256_subs_epu8(load(&m_delayTimer[lane]), step));
+        store(&m_soundTimer[lane], _mm256_subs_epu8(load(&m_soundTimer[lane]), step));
+    }
+}
+
+#endif
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "chip8.h"
+#include "random.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_BATCH_AVX2 1
+#else
+#define CHIP8_BATCH_AVX2 0
+#endif
+
+struct LaneState
+{
+    std::array<uint8_t, REGISTER_SIZE> V;
+    std::array<uint16_t, STACK_SIZE> stack;
+    uint16_t I;
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    bool faulted;
+};
+
+struct BatchStats
+{
+    uint64_t steps{};
+    uint64_t groups{};
+    uint64_t groupedLanes{};
+    uint64_t scalarLanes{};
+};
+
+// Many instances of one ROM stepped in lockstep, each register stored as an
+// array over lanes. Every step picks the lanes sharing a PC and opcode and
+// runs that opcode once for the whole group, 32 lanes per AVX2 instruction
+// for the ALU, skip, index and timer ops. Lanes that have drifted off the
+// common paths run one at a time. Lanes end up in the same state as a
+// checked Chip8 with the default quirks fed the same seed and keys; a lane
+// stops where Chip8 would throw and keeps its state from that point.
+class Chip8Batch
+{
+public:
+    explicit Chip8Batch(size_t lanes);
+    Chip8Batch(const Chip8Batch& b) = delete;
+    Chip8Batch(Chip8Batch&& b) = delete;
+    auto operator=(const Chip8Batch& b) -> Chip8Batch& = delete;
+    auto operator=(Chip8Batch&& b) -> Chip8Batch& = delete;
+    ~Chip8Batch();
+
+    auto cpuReset() -> void;
+    auto loadROM(std::span<const uint8_t> rom) -> bool;
+    auto seedRandom(size_t lane, uint32_t seed) -> void;
+    auto keyPressed(size_t lane, int k) -> void;
+    auto keyReleased(size_t lane, int k) -> void;
+    auto tick() -> void;
+    auto step() -> void;
+
+    [[nodiscard]] auto lanes() const -> size_t;
+    // True when the AVX2 kernels are in use
+    [[nodiscard]] auto simd() const -> bool;
+    [[nodiscard]] auto faulted(size_t lane) const -> bool;
+    [[nodiscard]] auto laneState(size_t lane) const -> LaneState;
+    [[nodiscard]] auto memory(size_t lane) const -> std::span<const uint8_t, MEM_SIZE>;
+    [[nodiscard]] auto screenBuffer(size_t lane) const -> std::span<const uint64_t, SCREEN_HEIGHT>;
+    [[nodiscard]] auto stats() const -> const BatchStats&;
+
+private:
+    enum class ByteOp
+    {
+        LoadImm,
+        AddImm,
+        Move,
+        Or,
+        And,
+        Xor,
+        Add,
+        Sub,
+        ShiftRight,
+        SubReversed,
+        ShiftLeft,
+    };
+
+    enum class WordOp
+    {
+        Set,         // value
+        AddReg,      // word + Vx
+        SetPlusReg,  // value + Vx
+        FontAddress, // Vx * 5
+    };
+
+    enum class SkipOp
+    {
+        EqualImm,
+        NotEqualImm,
+        EqualReg,
+        NotEqualReg,
+    };
+
+    template<ByteOp Op>
+    auto byteKernel(uint8_t* dst, const uint8_t* src, uint8_t nn) -> void;
+    template<WordOp Op>
+    auto wordKernel(uint16_t* dst, uint8_t x, uint16_t value) -> void;
+    template<SkipOp Op>
+    auto skipKernel(uint8_t x, uint8_t y, uint8_t nn, uint16_t pc) -> void;
+    auto buildGroup(uint16_t pc) -> size_t;
+    auto decrementTimers() -> void;
+
+#if CHIP8_BATCH_AVX2
+    template<ByteOp Op>
+    auto byteKernelAvx2(uint8_t* dst, const uint8_t* src, uint8_t nn) -> void;
+    template<WordOp Op>
+    auto wordKernelAvx2(uint16_t* dst, uint8_t x, uint16_t value) -> void;
+    template<SkipOp Op>
+    auto skipKernelAvx2(uint8_t x, uint8_t y, uint8_t nn, uint16_t pc) -> void;
+    auto buildGroupAvx2(uint16_t pc) -> size_t;
+    auto decrementTimersAvx2() -> void;
+#endif
+
+    auto filterGroup(uint16_t pc, uint16_t opcode) -> size_t;
+    auto executeGroup(uint16_t pc, uint16_t opcode) -> void;
+    auto executeLane(size_t lane) -> void;
+    auto executeOp(size_t lane, uint16_t opcode) -> void;
+    auto drawSprite(size_t lane, uint8_t x, uint8_t y, uint8_t n) -> void;
+    auto readMemory(size_t lane, uint32_t address, uint8_t& value) -> bool;
+    auto writeMemory(size_t lane, uint32_t address, uint8_t value) -> bool;
+
+    auto reg(uint8_t r) -> uint8_t*;
+    auto opcodeAt(size_t lane, uint16_t pc) const -> uint16_t;
+
+    // Groups tried per step before the remaining lanes go one at a time
+    constexpr static int maxGroupsPerStep = 4;
+    constexpr static size_t laneAlign = 32;
+
+    size_t m_lanes;
+    size_t m_stride;
+    bool m_simd{};
+
+    // [register * m_stride + lane]
+    std::vector<uint8_t> m_V;
+    // [level * m_stride + lane]
+    std::vector<uint16_t> m_stack;
+    std::vector<uint16_t> m_I;
+    std::vector<uint16_t> m_PC;
+    std::vector<uint8_t> m_SP;
+    std::vector<uint8_t> m_delayTimer;
+    std::vector<uint8_t> m_soundTimer;
+    std::vector<uint16_t> m_keys;
+    std::vector<uint8_t> m_waitingForKey;
+    std::vector<int8_t> m_keyWaitResult;
+    // [lane * SCREEN_HEIGHT + row] and [lane * MEM_SIZE + address]
+    std::vector<uint64_t> m_gfx;
+    std::vector<uint8_t> m_memory;
+
+    // Memory as loaded; bytes no lane has written since are the same in
+    // every lane, so opcodes there are fetched once per group
+    std::array<uint8_t, MEM_SIZE> m_image{};
+    std::array<bool, MEM_SIZE> m_written{};
+
+    // 0xFF per lane: still to run this step, in the current group, faulted.
+    // Padding lanes past m_lanes are permanently faulted.
+    std::vector<uint8_t> m_active;
+    std::vector<uint8_t> m_group;
+    std::vector<uint8_t> m_faulted;
+
+    std::vector<Random> m_random;
+
+    BatchStats m_stats;
+};
@@ -0,0 +1,248 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "chip8.h"
+#include "display.h"
+#include "frame_delta.h"
+#include "random.h"
+#include "stream_protocol.h"
+
+// Watches sessions of chip8_daemon. One viewer shows what it sees; many
+// at once load the daemon and report how much it sends. With --keys every
+// viewer presses a random key now and then, releasing the last one in the
+// same message.
+
+struct ClientOptions
+{
+    std::string_view address;
+    uint32_t session{};
+    int clients{1};
+    double seconds{5.0};
+    bool keys{};
+    bool show{};
+};
+
+struct Viewer
+{
+    int socket{-1};
+    StreamReader input;
+    FrameDeltaDecoder decoder;
+    uint32_t session{};
+    uint32_t frame{};
+    bool attached{};
+    uint64_t frames{};
+    uint64_t keyFrames{};
+    uint64_t bytes{};
+    int heldKey{-1};
+};
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_client <unix:PATH|host:port> [--session N] [--clients N] [--seconds S] [--keys] [--show]\n");
+}
+
+auto parseOptions(int argc, char** argv, ClientOptions& options) -> bool
+{
+    if (argc < 2)
+        return false;
+    options.address = argv[1];
+    for (int i = 2; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--keys")
+            options.keys = true;
+        else if (arg == "--show")
+            options.show = true;
+        else if (i + 1 >= argc)
+            return false;
+        else if (arg == "--session")
+            options.session = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--clients")
+            options.clients = std::atoi(argv[++i]);
+        else if (arg == "--seconds")
+            options.seconds = std::atof(argv[++i]);
+        else
+            return false;
+    }
+    return options.clients > 0 && options.seconds > 0.0;
+}
+
+// Messages are small and the socket buffer is empty when they go out, a
+// short write means the daemon has stopped reading
+auto sendMessage(const Viewer& viewer, const std::vector<uint8_t>& message) -> bool
+{
+    ssize_t sent = ::send(viewer.socket, message.data(), message.size(), MSG_NOSIGNAL);
+    if (sent != static_cast<ssize_t>(message.size()))
+    {
+        fmt::print("Could not send to the daemon\n");
+        return false;
+    }
+    return true;
+}
+
+auto handleMessage(Viewer& viewer, const ClientOptions& options, int index, const StreamHeader& header,
+    std::span<const uint8_t> payload) -> bool
+{
+    viewer.bytes += sizeof(header) + payload.size();
+    switch (static_cast<StreamMessage>(header.type))
+    {
+    case StreamMessage::Welcome:
+    {
+        StreamWelcome welcome{};
+        if (payload.size() != sizeof(welcome))
+            return false;
+        std::memcpy(&welcome, payload.data(), sizeof(welcome));
+        if (welcome.magic != STREAM_MAGIC || welcome.version != STREAM_VERSION || welcome.sessions == 0)
+        {
+            fmt::print("The daemon speaks another protocol or has no sessions\n");
+            return false;
+        }
+        viewer.session = (options.session + static_cast<uint32_t>(index)) % welcome.sessions;
+        std::vector<uint8_t> message;
+        appendStreamMessage(message, StreamMessage::Attach, 0, {streamBytes(StreamAttach{viewer.session})});
+        return sendMessage(viewer, message);
+    }
+    case StreamMessage::Frame:
+    {
+        StreamFrame frame{};
+        if (payload.size() < sizeof(frame))
+            return false;
+        std::memcpy(&frame, payload.data(), sizeof(frame));
+        bool keyFrame = (header.flags & FRAME_KEY) != 0;
+        // Until the key frame the display is unknown
+        if (!viewer.attached && !keyFrame)
+            return true;
+        if (!viewer.decoder.apply(payload.subspan(sizeof(frame)), (header.flags & FRAME_HIRES) != 0, keyFrame))
+        {
+            fmt::print("Frame {} of session {} does not decode\n", frame.frame, viewer.session);
+            return false;
+        }
+        viewer.attached = true;
+        viewer.frame = frame.frame;
+        viewer.frames++;
+        viewer.keyFrames += keyFrame ? 1 : 0;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+auto pressRandomKey(Viewer& viewer, Random& random) -> bool
+{
+    std::vector<StreamKey> keys;
+    if (viewer.heldKey >= 0)
+        keys.push_back(StreamKey{static_cast<uint8_t>(viewer.heldKey), 0});
+    viewer.heldKey = static_cast<int>(random.next() % KEY_SIZE);
+    keys.push_back(StreamKey{static_cast<uint8_t>(viewer.heldKey), 1});
+    std::vector<uint8_t> message;
+    appendStreamMessage(message, StreamMessage::Keys, 0,
+        {{reinterpret_cast<const uint8_t*>(keys.data()), keys.size() * sizeof(StreamKey)}});
+    return sendMessage(viewer, message);
+}
+
+auto show(const Viewer& viewer) -> void
+{
+    const DisplayRows& rows = viewer.decoder.rows();
+    bool hires = viewer.decoder.hires();
+    int width = hires ? HIRES_WIDTH : SCREEN_WIDTH;
+    int height = hires ? HIRES_HEIGHT : SCREEN_HEIGHT;
+    constexpr std::string_view shades = " #+*";
+    for (int y = 0; y < height; y++)
+    {
+        std::string line;
+        for (int x = 0; x < width; x++)
+            line += shades[displayPixel(rows, x, y)];
+        fmt::print("{}\n", line);
+    }
+}
+
+auto main(int argc, char** argv) -> int
+{
+    ClientOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<Viewer> viewers(options.clients);
+    std::vector<pollfd> polls(options.clients);
+    for (int i = 0; i < options.clients; i++)
+    {
+        viewers[i].socket = connectStream(options.address);
+        if (viewers[i].socket < 0)
+            return 1;
+        polls[i] = pollfd{viewers[i].socket, POLLIN, 0};
+    }
+
+    using Clock = std::chrono::steady_clock;
+    Random random(1);
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    auto nextPress = start + std::chrono::milliseconds(500);
+    bool ok = true;
+    while (ok && Clock::now() < end)
+    {
+        if (::poll(polls.data(), polls.size(), 10) < 0)
+            continue;
+        for (int i = 0; i < options.clients && ok; i++)
+        {
+            if (polls[i].revents == 0)
+                continue;
+            Viewer& viewer = viewers[i];
+            bool open = viewer.input.fill(viewer.socket);
+            StreamHeader header{};
+            std::span<const uint8_t> payload;
+            while (ok && viewer.input.next(header, payload))
+                ok = handleMessage(viewer, options, i, header, payload);
+            if (ok && (!open || viewer.input.bad()))
+            {
+                fmt::print("The daemon closed the connection\n");
+                ok = false;
+            }
+        }
+        if (ok && options.keys && Clock::now() >= nextPress)
+        {
+            for (Viewer& viewer : viewers)
+                ok = ok && (!viewer.attached || pressRandomKey(viewer, random));
+            nextPress += std::chrono::milliseconds(500);
+        }
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    uint64_t frames = 0;
+    uint64_t keyFrames = 0;
+    uint64_t bytes = 0;
+    for (const Viewer& viewer : viewers)
+    {
+        frames += viewer.frames;
+        keyFrames += viewer.keyFrames;
+        bytes += viewer.bytes;
+        ::close(viewer.socket);
+    }
+    double perViewer = elapsed.count() * options.clients;
+    fmt::print("client: {} viewers for {:.1f} s, {} frames ({} key frames), {:.1f} frames/s and {:.1f} B/s per viewer, "
+        "{:.1f} bytes per frame\n", options.clients, elapsed.count(), frames, keyFrames, frames / perViewer,
+        bytes / perViewer, frames > 0 ? static_cast<double>(bytes) / frames : 0.0);
+
+    const Viewer& first = viewers.front();
+    const DisplayRows& rows = first.decoder.rows();
+    fmt::print("client: session {} at frame {}, display {:016x}\n", first.session, first.frame,
+        fnv1a64({reinterpret_cast<const uint8_t*>(rows.data()), sizeof(rows)}));
+    if (options.show)
+        show(first);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "chip8.h"
+#include "mapped_file.h"
+#include "rom_pack.h"
+#include "scheduler.h"
+#include "session_server.h"
+
+// Hosts headless sessions and streams their displays to chip8_client or
+// any other viewer speaking stream_protocol.h. The ROMs are given as files
+// or a ROM pack and handed out to the sessions in turn.
+
+struct DaemonOptions
+{
+    std::string_view listen{"unix:/tmp/chip8_daemon.sock"};
+    std::vector<const char*> roms;
+    const char* pack{};
+    int sessions{};
+    uint32_t cpuHz{DEFAULT_CPU_HZ};
+    Variant variant{Variant::Chip8};
+    uint32_t seed{1};
+    int statsSeconds{10};
+};
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_daemon [--listen unix:PATH|host:port] [--sessions N] [--pack <pack.c8p>] [--hz N]\n"
+        "       [--variant chip8|schip|xochip] [--seed N] [--stats SECONDS] [rom...]\n");
+}
+
+auto parseOptions(int argc, char** argv, DaemonOptions& options) -> bool
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (!arg.starts_with("--"))
+        {
+            options.roms.push_back(argv[i]);
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        if (arg == "--listen")
+            options.listen = argv[++i];
+        else if (arg == "--sessions")
+            options.sessions = std::atoi(argv[++i]);
+        else if (arg == "--pack")
+            options.pack = argv[++i];
+        else if (arg == "--hz")
+            options.cpuHz = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--variant")
+        {
+            if (!variantFromName(argv[++i], options.variant))
+                return false;
+        }
+        else if (arg == "--seed")
+            options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--stats")
+            options.statsSeconds = std::atoi(argv[++i]);
+        else
+            return false;
+    }
+    return (!options.roms.empty() || options.pack != nullptr) && options.sessions >= 0
+        && options.cpuHz >= TIMER_HZ && options.cpuHz <= MAX_CPU_HZ && options.statsSeconds >= 0;
+}
+
+auto main(int argc, char** argv) -> int
+{
+    DaemonOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<std::span<const uint8_t>> roms;
+    for (const char* path : options.roms)
+    {
+        auto file = std::make_unique<MappedFile>();
+        if (!file->open(path, MappedFile::Mode::Read))
+            return 1;
+        roms.push_back(file->data());
+        files.push_back(std::move(file));
+    }
+    RomPack pack;
+    if (options.pack != nullptr)
+    {
+        if (!pack.open(options.pack))
+            return 1;
+        for (size_t i = 0; i < pack.size(); i++)
+            roms.push_back(pack.rom(i));
+    }
+    if (roms.empty())
+    {
+        fmt::print("There are no ROMs to run\n");
+        return 1;
+    }
+
+    // One session per ROM unless told otherwise; each gets its own seed
+    size_t sessions = options.sessions > 0 ? static_cast<size_t>(options.sessions) : roms.size();
+    SessionServer server(options.cpuHz);
+    for (size_t i = 0; i < sessions; i++)
+    {
+        if (!server.addSession(roms[i % roms.size()], options.variant, options.seed + static_cast<uint32_t>(i)))
+        {
+            fmt::print("Could not load ROM {} into session {}\n", i % roms.size(), i);
+            return 1;
+        }
+    }
+    if (!server.listen(options.listen))
+        return 1;
+
+    fmt::print("daemon: {} sessions on {}\n", sessions, options.listen);
+    if (!server.run(options.statsSeconds))
+        return 1;
+    server.print();
+    return 0;
+}
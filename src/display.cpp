@@ -0,0 +1,146 @@
+#include "display.h"
+
+#include <algorithm>
+#include <utility>
+
+auto Display::reset() -> void
+{
+    m_rows = {};
+    m_hires = false;
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
+
+auto Display::setHires(bool hires) -> void
+{
+    m_hires = hires;
+    m_rows = {};
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
+
+auto Display::hires() const -> bool
+{
+    return m_hires;
+}
+
+auto Display::width() const -> int
+{
+    return m_hires ? HIRES_WIDTH : SCREEN_WIDTH;
+}
+
+auto Display::height() const -> int
+{
+    return m_hires ? HIRES_HEIGHT : SCREEN_HEIGHT;
+}
+
+auto Display::rows() const -> const DisplayRows&
+{
+    return m_rows;
+}
+
+auto Display::restore(const DisplayRows& rows, bool hires) -> void
+{
+    m_rows = rows;
+    m_hires = hires;
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
+
+auto Display::dirty() const -> bool
+{
+    return m_dirtyRows != 0;
+}
+
+auto Display::takeDirtyRows() -> uint64_t
+{
+    return std::exchange(m_dirtyRows, 0);
+}
+
+// All ones over the words of the selected planes
+auto Display::planeMask(uint8_t planes) -> DisplayRow
+{
+    DisplayRow mask{};
+    for (int plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (planes & (1 << plane))
+            std::fill_n(mask.begin() + plane * PLANE_WORDS, PLANE_WORDS, ~uint64_t{0});
+    }
+    return mask;
+}
+
+auto Display::clear(uint8_t planes) -> void
+{
+    DisplayRow mask = planeMask(planes);
+    for (DisplayRow& row : m_rows)
+    {
+        for (size_t w = 0; w < row.size(); w++)
+            row[w] &= ~mask[w];
+    }
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
+
+// Whole words move between rows, masked to the selected planes; with every
+// plane selected that is a plain row copy.
+auto Display::scrollDown(int lines, uint8_t planes) -> void
+{
+    int rows = height();
+    lines = std::min(lines, rows);
+    DisplayRow mask = planeMask(planes);
+    for (int y = rows - 1; y >= 0; y--)
+    {
+        DisplayRow source = y >= lines ? m_rows[y - lines] : DisplayRow{};
+        for (size_t w = 0; w < mask.size(); w++)
+            m_rows[y][w] = (m_rows[y][w] & ~mask[w]) | (source[w] & mask[w]);
+    }
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
+
+auto Display::scrollUp(int lines, uint8_t planes) -> void
+{
+    int rows = height();
+    lines = std::min(lines, rows);
+    DisplayRow mask = planeMask(planes);
+    for (int y = 0; y < rows; y++)
+    {
+        DisplayRow source = y + lines < rows ? m_rows[y + lines] : DisplayRow{};
+        for (size_t w = 0; w < mask.size(); w++)
+            m_rows[y][w] = (m_rows[y][w] & ~mask[w]) | (source[w] & mask[w]);
+    }
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
+
+// Four pixels, shifted across the word boundary in high resolution
+auto Display::scrollRight(uint8_t planes) -> void
+{
+    for (int y = 0; y < height(); y++)
+    {
+        for (int plane = 0; plane < PLANE_COUNT; plane++)
+        {
+            if (!(planes & (1 << plane)))
+                continue;
+            uint64_t* words = &m_rows[y][plane * PLANE_WORDS];
+            if (m_hires)
+                words[1] = (words[1] >> 4) | (words[0] << 60);
+            words[0] >>= 4;
+        }
+    }
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
+
+auto Display::scrollLeft(uint8_t planes) -> void
+{
+    for (int y = 0; y < height(); y++)
+    {
+        for (int plane = 0; plane < PLANE_COUNT; plane++)
+        {
+            if (!(planes & (1 << plane)))
+                continue;
+            uint64_t* words = &m_rows[y][plane * PLANE_WORDS];
+            words[0] <<= 4;
+            if (m_hires)
+            {
+                words[0] |= words[1] >> 60;
+                words[1] <<= 4;
+            }
+        }
+    }
+    m_dirtyRows = ALL_ROWS_DIRTY;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// Low resolution, the only mode of the original CHIP-8
+constexpr const int SCREEN_WIDTH = 64;
+constexpr const int SCREEN_HEIGHT = 32;
+// SUPER-CHIP and XO-CHIP high resolution
+constexpr const int HIRES_WIDTH = 128;
+constexpr const int HIRES_HEIGHT = 64;
+// XO-CHIP draws on two bitplanes, the others only use the first
+constexpr const int PLANE_COUNT = 2;
+constexpr const int PLANE_WORDS = HIRES_WIDTH / 64;
+constexpr const uint8_t ALL_PLANES = (1 << PLANE_COUNT) - 1;
+
+constexpr const uint64_t ALL_ROWS_DIRTY = ~uint64_t{0};
+
+// One line of the display: PLANE_WORDS words per plane, plane 0 first. Bit
+// 63 of a plane's first word is its leftmost pixel. Low resolution only
+// uses the first word of each plane and the first SCREEN_HEIGHT lines.
+using DisplayRow = std::array<uint64_t, PLANE_WORDS * PLANE_COUNT>;
+using DisplayRows = std::array<DisplayRow, HIRES_HEIGHT>;
+
+// Palette index of a pixel, one bit per plane
+constexpr auto displayPixel(const DisplayRows& rows, int x, int y) -> int
+{
+    const DisplayRow& row = rows[y];
+    int word = x / 64;
+    int shift = 63 - x % 64;
+    return static_cast<int>((row[word] >> shift) & 0x1) | static_cast<int>(((row[PLANE_WORDS + word] >> shift) & 0x1) << 1);
+}
+
+// The framebuffer, packed one bit per pixel per plane so that sprites are
+// drawn with one XOR per word and scrolls move whole words. Every change
+// marks its rows dirty for the renderer.
+class Display
+{
+public:
+    // Low resolution, blank, every row dirty
+    auto reset() -> void;
+    // Switching resolution clears the screen
+    auto setHires(bool hires) -> void;
+    [[nodiscard]] auto hires() const -> bool;
+    [[nodiscard]] auto width() const -> int;
+    [[nodiscard]] auto height() const -> int;
+    [[nodiscard]] auto rows() const -> const DisplayRows&;
+    // Replaces the contents, for savestates
+    auto restore(const DisplayRows& rows, bool hires) -> void;
+
+    [[nodiscard]] auto dirty() const -> bool;
+    // One bit per row changed since the last call
+    auto takeDirtyRows() -> uint64_t;
+
+    auto clear(uint8_t planes) -> void;
+    // XORs bits, a sprite row left aligned at bit 63, onto line y of plane
+    // starting at column x, which must be on screen. Clip drops the pixels
+    // past the right edge instead of wrapping them. True on a collision.
+    template<bool Clip>
+    auto drawRow(int plane, int x, int y, uint64_t bits) -> bool;
+
+    // Scrolls move pixels of the current resolution
+    auto scrollDown(int lines, uint8_t planes) -> void;
+    auto scrollUp(int lines, uint8_t planes) -> void;
+    auto scrollRight(uint8_t planes) -> void;
+    auto scrollLeft(uint8_t planes) -> void;
+
+private:
+    static auto planeMask(uint8_t planes) -> DisplayRow;
+
+    DisplayRows m_rows{};
+    bool m_hires{};
+    uint64_t m_dirtyRows{ALL_ROWS_DIRTY};
+};
+
+template<bool Clip>
+auto Display::drawRow(int plane, int x, int y, uint64_t bits) -> bool
+{
+    uint64_t* words = &m_rows[y][plane * PLANE_WORDS];
+    uint64_t left = 0;
+    uint64_t right = 0;
+    if (!m_hires)
+    {
+        left = Clip ? bits >> x : std::rotr(bits, x);
+    }
+    else if (x < 64)
+    {
+        // The 128 bit row (bits, 0) shifted right, nothing reaches the end
+        left = bits >> x;
+        right = x == 0 ? 0 : bits << (64 - x);
+    }
+    else
+    {
+        // Past the end of the right word is the start of the left one
+        right = bits >> (x - 64);
+        if (!Clip && x != 64)
+            left = bits << (128 - x);
+    }
+    if ((left | right) == 0)
+        return false;
+
+    bool collision = ((words[0] & left) | (words[1] & right)) != 0;
+    words[0] ^= left;
+    words[1] ^= right;
+    m_dirtyRows |= uint64_t{1} << y;
+    return collision;
+}
@@ -0,0 +1,184 @@
+#include "frame_delta.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+namespace
+{
+    using RowBytes = std::array<uint8_t, PLANE_WORDS * PLANE_COUNT * 8>;
+
+    constexpr const int maxRun = 0x80;
+
+    auto rowSize(bool hires) -> int
+    {
+        return (hires ? PLANE_WORDS : 1) * PLANE_COUNT * 8;
+    }
+
+    // Low resolution only uses the first word of each plane
+    auto xorRow(const DisplayRow& before, const DisplayRow& after, bool hires, RowBytes& out) -> void
+    {
+        int words = hires ? PLANE_WORDS : 1;
+        uint8_t* bytes = out.data();
+        for (int plane = 0; plane < PLANE_COUNT; plane++)
+        {
+            for (int w = 0; w < words; w++)
+            {
+                uint64_t word = before[plane * PLANE_WORDS + w] ^ after[plane * PLANE_WORDS + w];
+                for (int shift = 56; shift >= 0; shift -= 8)
+                    *bytes++ = static_cast<uint8_t>(word >> shift);
+            }
+        }
+    }
+
+    auto encodeRow(const RowBytes& bytes, int size, std::vector<uint8_t>& out) -> void
+    {
+        int i = 0;
+        while (i < size)
+        {
+            int end = i;
+            if (bytes[i] == 0)
+            {
+                while (end < size && end - i < maxRun && bytes[end] == 0)
+                    end++;
+                out.push_back(static_cast<uint8_t>(0x80 + end - i - 1));
+            }
+            else
+            {
+                // A lone zero costs less inside the literal than as a run
+                while (end < size && end - i < maxRun && !(bytes[end] == 0 && end + 1 < size && bytes[end + 1] == 0))
+                    end++;
+                out.push_back(static_cast<uint8_t>(end - i - 1));
+                out.insert(out.end(), bytes.begin() + i, bytes.begin() + end);
+            }
+            i = end;
+        }
+    }
+
+    auto encodeRows(const DisplayRows& before, const DisplayRows& after, bool hires, uint64_t rows,
+        std::vector<uint8_t>& out) -> bool
+    {
+        size_t maskAt = out.size();
+        out.resize(maskAt + sizeof(uint64_t));
+        int size = rowSize(hires);
+        uint64_t mask = 0;
+        RowBytes bytes{};
+        for (uint64_t left = rows; left != 0; left &= left - 1)
+        {
+            int y = std::countr_zero(left);
+            xorRow(before[y], after[y], hires, bytes);
+            if (std::all_of(bytes.begin(), bytes.begin() + size, [](uint8_t b) { return b == 0; }))
+                continue;
+            mask |= uint64_t{1} << y;
+            encodeRow(bytes, size, out);
+        }
+        std::memcpy(out.data() + maskAt, &mask, sizeof(mask));
+        return mask != 0;
+    }
+
+    // The rows a display of this resolution has
+    auto screenRows(bool hires) -> uint64_t
+    {
+        return hires ? ALL_ROWS_DIRTY : (uint64_t{1} << SCREEN_HEIGHT) - 1;
+    }
+}
+
+auto FrameDeltaEncoder::encode(const Display& display, uint64_t dirtyRows, std::vector<uint8_t>& out) -> bool
+{
+    if (display.hires() != m_hires)
+    {
+        m_rows = {};
+        m_hires = display.hires();
+        dirtyRows = ALL_ROWS_DIRTY;
+    }
+    dirtyRows &= screenRows(m_hires);
+    bool changed = encodeRows(m_rows, display.rows(), m_hires, dirtyRows, out);
+    for (uint64_t left = dirtyRows; left != 0; left &= left - 1)
+    {
+        int y = std::countr_zero(left);
+        m_rows[y] = display.rows()[y];
+    }
+    return changed;
+}
+
+auto FrameDeltaEncoder::reset(const Display& display) -> void
+{
+    m_rows = display.rows();
+    m_hires = display.hires();
+}
+
+auto encodeKeyFrame(const Display& display, std::vector<uint8_t>& out) -> void
+{
+    static const DisplayRows blank{};
+    encodeRows(blank, display.rows(), display.hires(), screenRows(display.hires()), out);
+}
+
+auto FrameDeltaDecoder::apply(std::span<const uint8_t> delta, bool hires, bool keyFrame) -> bool
+{
+    if (keyFrame || hires != m_hires)
+    {
+        m_rows = {};
+        m_hires = hires;
+    }
+
+    uint64_t mask = 0;
+    if (delta.size() < sizeof(mask))
+        return false;
+    std::memcpy(&mask, delta.data(), sizeof(mask));
+    if ((mask & ~screenRows(hires)) != 0)
+        return false;
+
+    int size = rowSize(hires);
+    size_t at = sizeof(mask);
+    RowBytes bytes{};
+    for (; mask != 0; mask &= mask - 1)
+    {
+        int filled = 0;
+        while (filled < size)
+        {
+            if (at == delta.size())
+                return false;
+            uint8_t control = delta[at++];
+            int count = (control & 0x7F) + 1;
+            if (filled + count > size)
+                return false;
+            if (control >= 0x80)
+            {
+                std::fill_n(bytes.begin() + filled, count, 0);
+            }
+            else
+            {
+                if (delta.size() - at < static_cast<size_t>(count))
+                    return false;
+                std::copy_n(delta.begin() + at, count, bytes.begin() + filled);
+                at += count;
+            }
+            filled += count;
+        }
+
+        DisplayRow& row = m_rows[std::countr_zero(mask)];
+        const uint8_t* in = bytes.data();
+        for (int plane = 0; plane < PLANE_COUNT; plane++)
+        {
+            for (int w = 0; w < size / PLANE_COUNT / 8; w++)
+            {
+                uint64_t word = 0;
+                for (int i = 0; i < 8; i++)
+                    word = word << 8 | *in++;
+                row[plane * PLANE_WORDS + w] ^= word;
+            }
+        }
+    }
+    return at == delta.size();
+}
+
+auto FrameDeltaDecoder::rows() const -> const DisplayRows&
+{
+    return m_rows;
+}
+
+auto FrameDeltaDecoder::hires() const -> bool
+{
+    return m_hires;
+}
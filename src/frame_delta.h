@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "display.h"
+
+// A delta is a 64-bit mask of the rows it carries, bit y for row y, then
+// for each of those rows in order the XOR of its old and new contents,
+// run-length encoded. A row is its plane words one after the other, plane
+// 0 first, each written most significant byte first, so 16 bytes in low
+// resolution and 32 in high. The run-length code is a control byte c
+// followed by c + 1 literal bytes when c is below 0x80, or standing for
+// c - 0x80 + 1 zero bytes otherwise; a row's codes cover exactly its bytes.
+// An unchanged row is not sent, and a row where a sprite moved is mostly
+// zero runs.
+constexpr const int MAX_ROW_DELTA_BYTES = PLANE_WORDS * PLANE_COUNT * 8 + 1;
+constexpr const size_t MAX_FRAME_DELTA_BYTES = sizeof(uint64_t) + HIRES_HEIGHT * MAX_ROW_DELTA_BYTES;
+
+// Deltas of one display from frame to frame. After a resolution change
+// the display is blank, and so is the frame the delta starts from.
+class FrameDeltaEncoder
+{
+public:
+    // Appends the delta from the last frame to display; rows not in
+    // dirtyRows are taken as unchanged. False when the mask is empty.
+    auto encode(const Display& display, uint64_t dirtyRows, std::vector<uint8_t>& out) -> bool;
+    // The next delta starts from display
+    auto reset(const Display& display) -> void;
+
+private:
+    DisplayRows m_rows{};
+    bool m_hires{};
+};
+
+// The delta from a blank screen to display, for a viewer starting out
+auto encodeKeyFrame(const Display& display, std::vector<uint8_t>& out) -> void;
+
+// Rebuilds the display from a stream of deltas
+class FrameDeltaDecoder
+{
+public:
+    // keyFrame deltas, and those that change the resolution, start from a
+    // blank screen. False, leaving the frame undefined until the next key
+    // frame, when delta is malformed.
+    auto apply(std::span<const uint8_t> delta, bool hires, bool keyFrame) -> bool;
+
+    [[nodiscard]] auto rows() const -> const DisplayRows&;
+    [[nodiscard]] auto hires() const -> bool;
+
+private:
+    DisplayRows m_rows{};
+    bool m_hires{};
+};
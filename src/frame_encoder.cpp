@@ -0,0 +1,411 @@
+#include "frame_encoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fmt/core.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "input.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_ENCODER_AVX2 1
+#include <immintrin.h>
+#else
+#define CHIP8_ENCODER_AVX2 0
+#endif
+
+namespace
+{
+    constexpr const std::array<uint8_t, 4> identityLut = {0, 1, 2, 3};
+    constexpr const std::array<uint8_t, 8> pngSignature = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    // Largest stored deflate block
+    constexpr const size_t storedBlockSize = 65535;
+
+    auto putBE32(std::vector<uint8_t>& out, uint32_t value) -> void
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back(static_cast<uint8_t>(value >> shift));
+    }
+
+    // Length, type, data and the CRC-32 of type and data
+    auto pngChunk(std::vector<uint8_t>& out, std::string_view type, std::span<const uint8_t> data) -> void
+    {
+        putBE32(out, static_cast<uint32_t>(data.size()));
+        size_t start = out.size();
+        out.insert(out.end(), type.begin(), type.end());
+        out.insert(out.end(), data.begin(), data.end());
+        putBE32(out, crc32(std::span(out).subspan(start)));
+    }
+
+    auto adler32(std::span<const uint8_t> data, uint32_t adler) -> uint32_t
+    {
+        uint32_t a = adler & 0xFFFF;
+        uint32_t b = adler >> 16;
+        // 5552 bytes is the most that cannot overflow b before the modulo
+        while (!data.empty())
+        {
+            size_t n = std::min<size_t>(data.size(), 5552);
+            for (uint8_t byte : data.first(n))
+            {
+                a += byte;
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data = data.subspan(n);
+        }
+        return (b << 16) | a;
+    }
+
+    // BT.601 studio range
+    auto toYCbCr(const std::array<uint8_t, 3>& rgb) -> std::array<uint8_t, 3>
+    {
+        double r = rgb[0];
+        double g = rgb[1];
+        double b = rgb[2];
+        auto clamp = [](double v) { return static_cast<uint8_t>(std::clamp(std::lround(v), 0L, 255L)); };
+        return {
+            clamp(16.0 + (65.481 * r + 128.553 * g + 24.966 * b) / 255.0),
+            clamp(128.0 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255.0),
+            clamp(128.0 + (112.0 * r - 93.786 * g - 18.214 * b) / 255.0),
+        };
+    }
+}
+
+auto frameFormatFromName(std::string_view name, FrameFormat& format) -> bool
+{
+    if (name == "raw")
+        format = FrameFormat::Raw;
+    else if (name == "y4m")
+        format = FrameFormat::Y4M;
+    else if (name == "png")
+        format = FrameFormat::Png;
+    else
+        return false;
+    return true;
+}
+
+FrameScaler::FrameScaler(bool allowSimd)
+{
+#if CHIP8_ENCODER_AVX2
+    m_simd = allowSimd && __builtin_cpu_supports("avx2");
+#else
+    (void)allowSimd;
+#endif
+}
+
+auto FrameScaler::simd() const -> bool
+{
+    return m_simd;
+}
+
+// A plane's row is 16 bytes in memory, two little endian words with the
+// leftmost pixel in bit 63 of the first
+auto FrameScaler::prepare(int width, int outWidth) -> void
+{
+    m_width = width;
+    m_outWidth = outWidth;
+    m_sourceByte.resize(outWidth);
+    m_sourceBit.resize(outWidth);
+    int factor = outWidth / width;
+    for (int x = 0; x < outWidth; x++)
+    {
+        int source = x / factor;
+        int bit = 63 - source % 64;
+        m_sourceByte[x] = static_cast<uint8_t>(source / 64 * 8 + bit / 8);
+        m_sourceBit[x] = static_cast<uint8_t>(1 << (bit % 8));
+    }
+}
+
+auto FrameScaler::render(const DisplayRows& rows, int width, int height, int outWidth, int outHeight,
+    const std::array<uint8_t, 4>& lut, std::span<uint8_t> out) -> void
+{
+    if (width != m_width || outWidth != m_outWidth)
+        prepare(width, outWidth);
+    std::array<uint8_t, 16> table{};
+    std::ranges::copy(lut, table.begin());
+
+    int factor = outHeight / height;
+    auto stride = static_cast<size_t>(outWidth);
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t* line = out.data() + static_cast<size_t>(y) * factor * stride;
+#if CHIP8_ENCODER_AVX2
+        if (m_simd)
+            renderRowAvx2(rows[y], table, line);
+        else
+#endif
+            renderRow(rows[y], table, line);
+        for (int copy = 1; copy < factor; copy++)
+            std::memcpy(line + copy * stride, line, stride);
+    }
+}
+
+auto FrameScaler::renderRow(const DisplayRow& row, const std::array<uint8_t, 16>& lut, uint8_t* out) const -> void
+{
+    auto plane0 = reinterpret_cast<const uint8_t*>(&row[0]);
+    auto plane1 = reinterpret_cast<const uint8_t*>(&row[PLANE_WORDS]);
+    for (int x = 0; x < m_outWidth; x++)
+    {
+        uint8_t byte = m_sourceByte[x];
+        uint8_t bit = m_sourceBit[x];
+        int index = ((plane0[byte] & bit) != 0 ? 1 : 0) | ((plane1[byte] & bit) != 0 ? 2 : 0);
+        out[x] = lut[index];
+    }
+}
+
+#if CHIP8_ENCODER_AVX2
+// Both planes of the row sit in every 128 bit lane, so the per column byte
+// shuffle reaches any of their 16 bytes
+[[gnu::target("avx2")]] auto FrameScaler::renderRowAvx2(const DisplayRow& row, const std::array<uint8_t, 16>& lut,
+    uint8_t* out) const -> void
+{
+    __m256i plane0 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&row[0])));
+    __m256i plane1 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&row[PLANE_WORDS])));
+    __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lut.data())));
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    for (int x = 0; x < m_outWidth; x += 32)
+    {
+        __m256i byte = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m_sourceByte.data() + x));
+        __m256i bit = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m_sourceBit.data() + x));
+        __m256i set0 = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(plane0, byte), bit), bit);
+        __m256i set1 = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(plane1, byte), bit), bit);
+        __m256i index = _mm256_or_si256(_mm256_and_si256(set0, one), _mm256_and_si256(set1, two));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_shuffle_epi8(table, index));
+    }
+}
+#else
+auto FrameScaler::renderRowAvx2(const DisplayRow& row, const std::array<uint8_t, 16>& lut, uint8_t* out) const -> void
+{
+    renderRow(row, lut, out);
+}
+#endif
+
+FrameEncoder::~FrameEncoder()
+{
+    close();
+}
+
+auto FrameEncoder::open(FrameFormat format, std::string_view path, bool hires, int scale) -> bool
+{
+    close();
+    m_format = format;
+    m_path = path;
+    m_width = (hires ? HIRES_WIDTH : SCREEN_WIDTH) * scale;
+    m_height = (hires ? HIRES_HEIGHT : SCREEN_HEIGHT) * scale;
+    m_pixels.resize(static_cast<size_t>(m_width) * m_height * (format == FrameFormat::Y4M ? 3 : 1));
+    m_stats = EncoderStats{};
+    for (size_t i = 0; i < FRAME_PALETTE.size(); i++)
+    {
+        std::array<uint8_t, 3> ycbcr = toYCbCr(FRAME_PALETTE[i]);
+        for (size_t plane = 0; plane < m_planeLuts.size(); plane++)
+            m_planeLuts[plane][i] = ycbcr[plane];
+    }
+
+    if (format != FrameFormat::Png)
+    {
+        if (path == "-")
+        {
+            // The frames keep the real stdout to themselves and everything
+            // else printed from here on lands on stderr
+            std::fflush(stdout);
+            int fd = ::dup(STDOUT_FILENO);
+            m_out = fd >= 0 ? ::fdopen(fd, "wb") : nullptr;
+            if (m_out != nullptr)
+                ::dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+        else
+            m_out = std::fopen(m_path.c_str(), "wb");
+        if (m_out == nullptr)
+        {
+            fmt::print("Could not open the file {} for writing\n", path);
+            return false;
+        }
+        if (format == FrameFormat::Y4M)
+        {
+            std::string header = fmt::format("YUV4MPEG2 W{} H{} F60:1 Ip A1:1 C444\n", m_width, m_height);
+            if (!write({reinterpret_cast<const uint8_t*>(header.data()), header.size()}))
+                return false;
+        }
+    }
+
+    m_running.store(true, std::memory_order_release);
+    m_thread = std::thread([this] { run(); });
+    return true;
+}
+
+auto FrameEncoder::submit(const Display& display) -> void
+{
+    EncoderFrame frame{display.rows(), display.hires()};
+    uint64_t encoded = m_encoded.load(std::memory_order_acquire);
+    if (!m_queue.push(frame))
+    {
+        int64_t start = steadyNowNs();
+        m_stats.stalls++;
+        while (!m_queue.push(frame))
+        {
+            m_encoded.wait(encoded, std::memory_order_acquire);
+            encoded = m_encoded.load(std::memory_order_acquire);
+        }
+        m_stats.stallNs += steadyNowNs() - start;
+    }
+    m_submitted.fetch_add(1, std::memory_order_release);
+    m_submitted.notify_one();
+}
+
+auto FrameEncoder::close() -> bool
+{
+    if (m_thread.joinable())
+    {
+        m_running.store(false, std::memory_order_release);
+        m_submitted.fetch_add(1, std::memory_order_release);
+        m_submitted.notify_one();
+        m_thread.join();
+    }
+    if (m_out == nullptr)
+        return m_stats.writeErrors == 0;
+    bool ok = std::fflush(m_out) == 0;
+    ok = std::fclose(m_out) == 0 && ok;
+    m_out = nullptr;
+    return ok && m_stats.writeErrors == 0;
+}
+
+auto FrameEncoder::stats() const -> const EncoderStats&
+{
+    return m_stats;
+}
+
+auto FrameEncoder::print() const -> void
+{
+    double seconds = m_stats.encodeNs / 1e9;
+    fmt::print("encoder: {} frames {}x{} ({} scaler), {:.1f} MB, {:.0f} frames/sec encoding, {} write errors\n",
+        m_stats.frames, m_width, m_height, m_scaler.simd() ? "avx2" : "scalar", m_stats.bytes / 1e6,
+        seconds > 0.0 ? m_stats.frames / seconds : 0.0, m_stats.writeErrors);
+    fmt::print("encoder: emulation stalled on a full queue {} times, {:.3f} ms\n", m_stats.stalls, m_stats.stallNs / 1e6);
+}
+
+auto FrameEncoder::run() -> void
+{
+    EncoderFrame frame{};
+    for (;;)
+    {
+        uint64_t submitted = m_submitted.load(std::memory_order_acquire);
+        bool running = m_running.load(std::memory_order_acquire);
+        if (m_queue.pop(frame))
+        {
+            m_encoded.fetch_add(1, std::memory_order_release);
+            m_encoded.notify_one();
+            int64_t start = steadyNowNs();
+            if (!encode(frame))
+                m_stats.writeErrors++;
+            m_stats.encodeNs += steadyNowNs() - start;
+            m_stats.frames++;
+            continue;
+        }
+        if (!running)
+            return;
+        m_submitted.wait(submitted, std::memory_order_acquire);
+    }
+}
+
+// Y4M renders each component plane straight through its own table, the
+// others render palette indices
+auto FrameEncoder::encode(const EncoderFrame& frame) -> bool
+{
+    // A stream opened for low resolution shows the top left of a high
+    // resolution frame; that only happens when the variant was wrong
+    int width = std::min(frame.hires ? HIRES_WIDTH : SCREEN_WIDTH, m_width);
+    int height = std::min(frame.hires ? HIRES_HEIGHT : SCREEN_HEIGHT, m_height);
+    if (m_format != FrameFormat::Y4M)
+    {
+        m_scaler.render(frame.rows, width, height, m_width, m_height, identityLut, m_pixels);
+        return m_format == FrameFormat::Raw ? writeRaw() : writePng();
+    }
+
+    auto planeSize = static_cast<size_t>(m_width) * m_height;
+    for (size_t plane = 0; plane < m_planeLuts.size(); plane++)
+    {
+        m_scaler.render(frame.rows, width, height, m_width, m_height, m_planeLuts[plane],
+            std::span(m_pixels).subspan(plane * planeSize, planeSize));
+    }
+    constexpr std::string_view marker = "FRAME\n";
+    return write({reinterpret_cast<const uint8_t*>(marker.data()), marker.size()}) && write(m_pixels);
+}
+
+auto FrameEncoder::write(std::span<const uint8_t> data) -> bool
+{
+    m_stats.bytes += data.size();
+    return std::fwrite(data.data(), 1, data.size(), m_out) == data.size();
+}
+
+auto FrameEncoder::writeRaw() -> bool
+{
+    m_buffer.resize(m_pixels.size() * 3);
+    uint8_t* rgb = m_buffer.data();
+    for (uint8_t index : m_pixels)
+    {
+        std::memcpy(rgb, FRAME_PALETTE[index].data(), 3);
+        rgb += 3;
+    }
+    return write(m_buffer);
+}
+
+// Eight bit palette indices in stored deflate blocks: no compression, the
+// point is to keep up with the emulator. Every line starts with filter 0.
+auto FrameEncoder::writePng() -> bool
+{
+    auto stride = static_cast<size_t>(m_width);
+    std::vector<uint8_t>& raw = m_scanlines;
+    raw.clear();
+    for (int y = 0; y < m_height; y++)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), m_pixels.begin() + y * stride, m_pixels.begin() + (y + 1) * stride);
+    }
+
+    std::vector<uint8_t>& zlib = m_buffer;
+    zlib.assign({0x78, 0x01});
+    for (size_t offset = 0; offset < raw.size(); offset += storedBlockSize)
+    {
+        size_t length = std::min(storedBlockSize, raw.size() - offset);
+        zlib.push_back(offset + length == raw.size() ? 1 : 0);
+        zlib.push_back(static_cast<uint8_t>(length));
+        zlib.push_back(static_cast<uint8_t>(length >> 8));
+        zlib.push_back(static_cast<uint8_t>(~length));
+        zlib.push_back(static_cast<uint8_t>(~length >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+    }
+    putBE32(zlib, adler32(raw, 1));
+
+    std::vector<uint8_t> header;
+    putBE32(header, m_width);
+    putBE32(header, m_height);
+    header.insert(header.end(), {8, 3, 0, 0, 0}); // depth, palette, deflate, filter 0, no interlace
+    std::vector<uint8_t> palette;
+    for (const auto& color : FRAME_PALETTE)
+        palette.insert(palette.end(), color.begin(), color.end());
+
+    // The scanlines are no longer needed, the file is assembled over them
+    std::vector<uint8_t>& png = m_scanlines;
+    png.assign(pngSignature.begin(), pngSignature.end());
+    pngChunk(png, "IHDR", header);
+    pngChunk(png, "PLTE", palette);
+    pngChunk(png, "IDAT", zlib);
+    pngChunk(png, "IEND", {});
+
+    std::string name = fmt::format("{}{:06}.png", m_path, m_stats.frames);
+    m_out = std::fopen(name.c_str(), "wb");
+    if (m_out == nullptr)
+    {
+        fmt::print("Could not open the file {} for writing\n", name);
+        return false;
+    }
+    bool ok = write(png);
+    ok = std::fclose(m_out) == 0 && ok;
+    m_out = nullptr;
+    return ok;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "display.h"
+#include "spsc_queue.h"
+
+enum class FrameFormat
+{
+    Raw, // packed RGB24 frames back to back, no header
+    Y4M, // YUV4MPEG2, 4:4:4, 60 fps
+    Png, // one palette PNG per frame, uncompressed
+};
+
+// Accepts the names used on the command line: raw, y4m and png
+auto frameFormatFromName(std::string_view name, FrameFormat& format) -> bool;
+
+// RGB per palette index, the renderer's colors
+constexpr const std::array<std::array<uint8_t, 3>, 4> FRAME_PALETTE =
+{{
+    {0, 0, 0},
+    {255, 255, 255},
+    {115, 115, 115},
+    {191, 191, 191},
+}};
+// Frames queued between the emulator and the encoder thread
+constexpr const size_t ENCODER_QUEUE_FRAMES = 64;
+
+// Expands the packed display to one byte per pixel at an integer scale,
+// mapping each palette index through a lookup table on the way. The
+// source byte and bit of every output column are computed once per
+// geometry; with AVX2 a row is then a byte shuffle, a compare and a table
+// shuffle per 32 pixels, and each further line of a scaled row is a copy.
+class FrameScaler
+{
+public:
+    explicit FrameScaler(bool allowSimd = true);
+
+    // out holds outHeight rows of outWidth bytes, which must be whole
+    // multiples of width and height, and outWidth of 32
+    auto render(const DisplayRows& rows, int width, int height, int outWidth, int outHeight,
+        const std::array<uint8_t, 4>& lut, std::span<uint8_t> out) -> void;
+    [[nodiscard]] auto simd() const -> bool;
+
+private:
+    auto prepare(int width, int outWidth) -> void;
+    auto renderRow(const DisplayRow& row, const std::array<uint8_t, 16>& lut, uint8_t* out) const -> void;
+    auto renderRowAvx2(const DisplayRow& row, const std::array<uint8_t, 16>& lut, uint8_t* out) const -> void;
+
+    bool m_simd{};
+    int m_width{};
+    int m_outWidth{};
+    std::vector<uint8_t> m_sourceByte;
+    std::vector<uint8_t> m_sourceBit;
+};
+
+struct EncoderFrame
+{
+    DisplayRows rows;
+    bool hires;
+};
+
+struct EncoderStats
+{
+    uint64_t frames{};
+    uint64_t bytes{};
+    int64_t encodeNs{};
+    // Frames the emulator waited for room in the queue, and for how long
+    uint64_t stalls{};
+    int64_t stallNs{};
+    uint64_t writeErrors{};
+};
+
+// Encodes display frames on a background thread fed through a bounded
+// lock-free queue. The emulator only copies the packed rows; it waits
+// only when the encoder falls a whole queue behind, and every frame is
+// kept. Frames are the base resolution given to open times scale; low
+// resolution frames of a high resolution stream are doubled.
+class FrameEncoder
+{
+public:
+    FrameEncoder() = default;
+    FrameEncoder(const FrameEncoder& e) = delete;
+    FrameEncoder(FrameEncoder&& e) = delete;
+    auto operator=(const FrameEncoder& e) -> FrameEncoder& = delete;
+    auto operator=(FrameEncoder&& e) -> FrameEncoder& = delete;
+    ~FrameEncoder();
+
+    // path is a file, - for stdout, or for PNG the prefix of the numbered
+    // frame files. Taking stdout points the process's own stdout at stderr.
+    // hires streams are HIRES_WIDTH wide, others SCREEN_WIDTH.
+    auto open(FrameFormat format, std::string_view path, bool hires, int scale) -> bool;
+    // Emulation thread, once per frame
+    auto submit(const Display& display) -> void;
+    // Encodes what is queued and joins the encoder thread
+    auto close() -> bool;
+
+    // Only complete after close
+    [[nodiscard]] auto stats() const -> const EncoderStats&;
+    auto print() const -> void;
+
+private:
+    auto run() -> void;
+    auto encode(const EncoderFrame& frame) -> bool;
+    auto writeRaw() -> bool;
+    auto writePng() -> bool;
+    auto write(std::span<const uint8_t> data) -> bool;
+
+    FrameFormat m_format{FrameFormat::Y4M};
+    std::string m_path;
+    FILE* m_out{};
+    int m_width{};
+    int m_height{};
+    FrameScaler m_scaler;
+    // Palette to Y, Cb and Cr
+    std::array<std::array<uint8_t, 4>, 3> m_planeLuts{};
+    // One byte per output pixel, per plane for Y4M
+    std::vector<uint8_t> m_pixels;
+    std::vector<uint8_t> m_scanlines;
+    std::vector<uint8_t> m_buffer;
+
+    SpscQueue<EncoderFrame, ENCODER_QUEUE_FRAMES> m_queue;
+    std::atomic<uint64_t> m_submitted{0};
+    std::atomic<uint64_t> m_encoded{0};
+    std::atomic<bool> m_running{false};
+    EncoderStats m_stats;
+    std::thread m_thread;
+};
@@ -0,0 +1,73 @@
+#include "frame_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fmt/core.h>
+
+auto FrameStats::mark() -> void
+{
+    mark(Clock::now());
+}
+
+auto FrameStats::mark(Clock::time_point now) -> void
+{
+    if (m_started)
+        addInterval(std::chrono::duration<double, std::milli>(now - m_last).count());
+    m_last = now;
+    m_started = true;
+}
+
+auto FrameStats::addInterval(double ms) -> void
+{
+    m_min = m_count == 0 ? ms : std::min(m_min, ms);
+    m_max = m_count == 0 ? ms : std::max(m_max, ms);
+    m_count++;
+    m_sum += ms;
+    m_sumSquares += ms * ms;
+
+    auto bucket = static_cast<int>(ms / bucketMs);
+    m_histogram.at(std::clamp(bucket, 0, bucketCount))++;
+}
+
+auto FrameStats::count() const -> uint64_t
+{
+    return m_count;
+}
+
+auto FrameStats::meanMs() const -> double
+{
+    return m_count > 0 ? m_sum / m_count : 0.0;
+}
+
+auto FrameStats::stddevMs() const -> double
+{
+    if (m_count == 0)
+        return 0.0;
+    double mean = meanMs();
+    return std::sqrt(std::max(m_sumSquares / m_count - mean * mean, 0.0));
+}
+
+auto FrameStats::percentileMs(double p) const -> double
+{
+    auto target = static_cast<uint64_t>(std::ceil(p / 100.0 * m_count));
+    uint64_t seen = 0;
+    for (int i = 0; i <= bucketCount; i++)
+    {
+        seen += m_histogram.at(i);
+        if (seen >= target && seen > 0)
+            return i == bucketCount ? m_max : (i + 1) * bucketMs;
+    }
+    return m_max;
+}
+
+auto FrameStats::print(std::string_view name) const -> void
+{
+    if (m_count == 0)
+    {
+        fmt::print("{}: no frames\n", name);
+        return;
+    }
+    fmt::print("{}: {} frames, mean {:.3f} ms ({:.2f} Hz), stddev {:.3f} ms, min {:.3f} ms, "
+        "p99 {:.2f} ms, max {:.3f} ms\n", name, m_count, meanMs(), 1000.0 / meanMs(),
+        stddevMs(), m_min, percentileMs(99.0), m_max);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+// Interval statistics for a periodic loop. Not thread safe, each thread
+// keeps its own instance.
+class FrameStats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    auto mark() -> void;
+    auto mark(Clock::time_point now) -> void;
+    auto addInterval(double ms) -> void;
+
+    [[nodiscard]] auto count() const -> uint64_t;
+    [[nodiscard]] auto meanMs() const -> double;
+    [[nodiscard]] auto stddevMs() const -> double;
+    [[nodiscard]] auto percentileMs(double p) const -> double;
+    auto print(std::string_view name) const -> void;
+
+private:
+    constexpr static double bucketMs = 0.05;
+    constexpr static int bucketCount = 2000;
+
+    Clock::time_point m_last{};
+    bool m_started{};
+    uint64_t m_count{};
+    double m_sum{};
+    double m_sumSquares{};
+    double m_min{};
+    double m_max{};
+    std::array<uint32_t, bucketCount + 1> m_histogram{};
+};
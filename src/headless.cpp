@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "audio.h"
+#include "chip8.h"
+#include "chip8_batch.h"
+#include "frame_encoder.h"
+#include "movie.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "scheduler.h"
+
+struct HeadlessOptions
+{
+    const char* rom{};
+    uint64_t frames{};
+    uint64_t instructions{};
+    Engine engine{Engine::Interpreter};
+    Variant variant{Variant::Chip8};
+    bool variantSet{};
+    // The variant's preset unless given
+    Quirks quirks{};
+    bool quirksSet{};
+    bool checked{CHECKED_BY_DEFAULT};
+    uint64_t lanes{};
+    uint64_t rewindBytes{};
+    const char* replay{};
+    const char* profile{};
+    // null or a WAV file
+    const char* audio{};
+    // A file, - for stdout, or the prefix of numbered PNGs
+    const char* video{};
+    FrameFormat videoFormat{FrameFormat::Y4M};
+    int scale{1};
+    uint64_t repeat{1};
+    uint32_t seed{};
+    uint32_t cpuHz{DEFAULT_CPU_HZ};
+    bool fastForward{true};
+    bool dump{true};
+};
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_headless <rom> [--frames N | --instructions N] [--engine switch|cached|jit] [--hz N] [--lanes N]\n"
+        "       [--variant chip8|schip|xochip] [--quirks default|cosmac|schip|xochip] [--checked | --unchecked]\n"
+        "       [--rewind BYTES] [--seed N] [--replay movie.c8m [--repeat N]] [--profile trace.json] [--no-dump]\n"
+        "       [--audio null|out.wav] [--video out.y4m|- [--video-format y4m|raw|png] [--scale N]]\n"
+        "       [--no-fast-forward]\n");
+}
+
+auto parseOptions(int argc, char** argv, HeadlessOptions& options) -> bool
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc)
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--instructions" && i + 1 < argc)
+            options.instructions = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--engine" && i + 1 < argc)
+        {
+            if (!engineFromName(argv[++i], options.engine))
+                return false;
+        }
+        else if (arg == "--variant" && i + 1 < argc)
+        {
+            if (!variantFromName(argv[++i], options.variant))
+                return false;
+            options.variantSet = true;
+        }
+        else if (arg == "--quirks" && i + 1 < argc)
+        {
+            if (!quirksFromName(argv[++i], options.quirks))
+                return false;
+            options.quirksSet = true;
+        }
+        else if (arg == "--checked")
+            options.checked = true;
+        else if (arg == "--unchecked")
+            options.checked = false;
+        else if (arg == "--lanes" && i + 1 < argc)
+            options.lanes = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--rewind" && i + 1 < argc)
+            options.rewindBytes = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--replay" && i + 1 < argc)
+            options.replay = argv[++i];
+        else if (arg == "--repeat" && i + 1 < argc)
+            options.repeat = std::max<uint64_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        else if (arg == "--profile" && i + 1 < argc)
+            options.profile = argv[++i];
+        else if (arg == "--audio" && i + 1 < argc)
+            options.audio = argv[++i];
+        else if (arg == "--video" && i + 1 < argc)
+            options.video = argv[++i];
+        else if (arg == "--video-format" && i + 1 < argc)
+        {
+            if (!frameFormatFromName(argv[++i], options.videoFormat))
+                return false;
+        }
+        else if (arg == "--scale" && i + 1 < argc)
+            options.scale = std::atoi(argv[++i]);
+        else if (arg == "--hz" && i + 1 < argc)
+            options.cpuHz = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--seed" && i + 1 < argc)
+            options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--no-dump")
+            options.dump = false;
+        else if (arg == "--no-fast-forward")
+            options.fastForward = false;
+        else if (options.rom == nullptr && !arg.starts_with("--"))
+            options.rom = argv[i];
+        else
+            return false;
+    }
+
+    if (options.rom == nullptr || (options.frames != 0 && options.instructions != 0))
+        return false;
+    if (options.lanes != 0 && options.instructions != 0)
+        return false;
+    if (options.rewindBytes != 0 && (options.lanes != 0 || options.instructions != 0))
+        return false;
+    if (options.profile != nullptr && (options.lanes != 0 || options.rewindBytes != 0))
+        return false;
+    // Sound and video come in whole frames, one run of them
+    if ((options.audio != nullptr || options.video != nullptr) && (options.lanes != 0 || options.rewindBytes != 0
+        || options.instructions != 0 || options.repeat != 1))
+        return false;
+    if (options.scale < 1 || options.scale > 16)
+        return false;
+    // A movie brings its own frame count, seed, variant and quirks
+    if (options.replay != nullptr && (options.lanes != 0 || options.rewindBytes != 0 || options.frames != 0
+        || options.instructions != 0 || options.variantSet || options.quirksSet))
+        return false;
+    if (!options.quirksSet)
+        options.quirks = variantQuirks(options.variant);
+    // Lanes only implement CHIP-8 with the default quirks
+    if (options.lanes != 0 && (options.variant != Variant::Chip8 || options.quirks != Quirks{}))
+        return false;
+    if (options.frames == 0 && options.instructions == 0)
+        options.frames = 600;
+    // One instruction per timer step at least; lanes always run 8 per frame
+    if (options.cpuHz < TIMER_HZ || options.cpuHz > MAX_CPU_HZ || (options.lanes != 0 && options.cpuHz != DEFAULT_CPU_HZ))
+        return false;
+    return true;
+}
+
+auto readROM(const char* path, std::vector<uint8_t>& rom) -> bool
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+    {
+        fmt::print("Could not open the file {} for reading\n", path);
+        return false;
+    }
+    rom.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// One character per pixel, the XO-CHIP plane combinations get their own
+auto dumpScreen(const DisplayRows& rows, int width, int height) -> void
+{
+    constexpr std::string_view colors = ".#+*";
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+            fmt::print("{}", colors[displayPixel(rows, x, y)]);
+        fmt::print("\n");
+    }
+}
+
+auto dumpScreen(const Display& display) -> void
+{
+    dumpScreen(display.rows(), display.width(), display.height());
+}
+
+auto openAudioSink(const char* name, std::unique_ptr<AudioSink>& sink) -> bool
+{
+    if (std::string_view(name) == "null")
+    {
+        sink = std::make_unique<NullSink>();
+        return true;
+    }
+    auto wav = std::make_unique<WavSink>();
+    if (!wav->open(name))
+        return false;
+    sink = std::move(wav);
+    return true;
+}
+
+// Every frame of a SUPER-CHIP or XO-CHIP run is encoded at high resolution
+auto openEncoder(const HeadlessOptions& options, Variant variant, FrameEncoder& encoder) -> bool
+{
+    return encoder.open(options.videoFormat, options.video, variant != Variant::Chip8, options.scale);
+}
+
+auto printRate(uint64_t executed, std::chrono::duration<double> elapsed) -> void
+{
+    double ips = elapsed.count() > 0.0 ? static_cast<double>(executed) / elapsed.count() : 0.0;
+    fmt::print("instructions: {}\n", executed);
+    fmt::print("elapsed: {:.6f} s\n", elapsed.count());
+    fmt::print("instructions/sec: {:.0f}\n", ips);
+}
+
+auto printSkipped(const Chip8& chip8, uint64_t executed) -> void
+{
+    uint64_t skipped = chip8.skippedInstructions();
+    fmt::print("fast-forward: {} idle instructions skipped ({:.1f}%)\n", skipped,
+        executed > 0 ? 100.0 * static_cast<double>(skipped) / static_cast<double>(executed) : 0.0);
+}
+
+// Plays the movie back as fast as the engine goes and checks each run ends
+// in the recorded state
+auto runReplay(const HeadlessOptions& options, Chip8& chip8, AudioOutput* audio) -> int
+{
+    Movie movie;
+    std::vector<uint8_t> rom;
+    if (!movie.load(options.replay) || !readROM(options.rom, rom))
+        return 1;
+    FrameEncoder encoder;
+    if (options.video != nullptr && !openEncoder(options, movie.variant(), encoder))
+        return 1;
+
+    uint64_t mismatches = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t run = 0; run < options.repeat; run++)
+    {
+        if (!movie.prepare(chip8, rom))
+            return 1;
+        for (uint64_t f = 0; f < movie.frames(); f++)
+        {
+            movie.playFrame(f, chip8);
+            if (audio != nullptr)
+                audio->submit(chip8);
+            if (options.video != nullptr)
+                encoder.submit(chip8.display());
+        }
+        if (!movie.matches(chip8))
+            mismatches++;
+    }
+    bool encoded = encoder.close();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t frames = movie.frames() * options.repeat;
+    uint64_t instructions = 0;
+    for (uint64_t f = 0; f < movie.frames(); f++)
+        instructions += instructionsInFrame(f, movie.cpuHz());
+    printRate(instructions * options.repeat, elapsed);
+    printSkipped(chip8, instructions * options.repeat);
+    fmt::print("replay: {} frames, {} key events, seed {}, {} Hz, {} runs\n", movie.frames(), movie.events().size(),
+        movie.seed(), movie.cpuHz(), options.repeat);
+    fmt::print("replay: {:.0f}x real time\n", elapsed.count() > 0.0 ? frames / 60.0 / elapsed.count() : 0.0);
+    if (options.video != nullptr)
+        encoder.print();
+    if (!encoded)
+        return 1;
+    if (mismatches != 0)
+    {
+        fmt::print("replay: {} of {} runs diverged from the recording\n", mismatches, options.repeat);
+        return 1;
+    }
+    fmt::print("replay: final state matches the recording\n");
+
+    if (options.dump)
+        dumpScreen(chip8.display());
+    return 0;
+}
+
+// Records every frame, then seeks across the whole window on a second
+// machine to time restores
+auto runRewind(const HeadlessOptions& options, Chip8& chip8) -> void
+{
+    Rewind rewind(options.rewindBytes);
+
+    uint64_t executed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t f = 0; f < options.frames; f++)
+    {
+        int instructions = instructionsInFrame(f, options.cpuHz);
+        chip8.tick(instructions);
+        rewind.record(chip8);
+        executed += instructions;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    Chip8 probe;
+    probe.setVariant(chip8.variant());
+    uint64_t span = rewind.lastFrame() - rewind.firstFrame();
+    for (uint64_t i = 0; i <= 1000; i++)
+        rewind.seek(rewind.firstFrame() + span * i / 1000, probe);
+
+    const RewindStats& stats = rewind.stats();
+    double frameNs = elapsed.count() * 1e9 / options.frames;
+    double recordNs = static_cast<double>(stats.recordNs) / stats.recorded;
+    printRate(executed, elapsed);
+    rewind.print();
+    fmt::print("rewind: {:.0f} of {:.0f} ns per frame spent recording ({:.1f}%, {:.4f}% of a 60 Hz frame)\n",
+        recordNs, frameNs, frameNs > 0.0 ? 100.0 * recordNs / frameNs : 0.0, recordNs / (1e9 / 60.0) * 100.0);
+}
+
+// Lane i is seeded with i, so lanes only diverge through CXNN
+auto runLanes(const HeadlessOptions& options) -> int
+{
+    std::vector<uint8_t> rom;
+    if (!readROM(options.rom, rom))
+        return 1;
+
+    Chip8Batch batch(options.lanes);
+    if (!batch.loadROM(rom))
+        return 1;
+    for (size_t lane = 0; lane < batch.lanes(); lane++)
+        batch.seedRandom(lane, static_cast<uint32_t>(lane));
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t f = 0; f < options.frames; f++)
+        batch.tick();
+    auto end = std::chrono::steady_clock::now();
+
+    const BatchStats& stats = batch.stats();
+    uint64_t executed = stats.groupedLanes + stats.scalarLanes;
+    fmt::print("lanes: {} ({})\n", batch.lanes(), batch.simd() ? "avx2" : "scalar");
+    fmt::print("grouped: {} in {} groups, per lane: {}\n", stats.groupedLanes, stats.groups, stats.scalarLanes);
+    printRate(executed, end - start);
+
+    if (options.dump)
+    {
+        DisplayRows rows{};
+        std::span<const uint64_t, SCREEN_HEIGHT> screen = batch.screenBuffer(0);
+        for (int y = 0; y < SCREEN_HEIGHT; y++)
+            rows[y][0] = screen[y];
+        dumpScreen(rows, SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+    return 0;
+}
+
+auto main(int argc, char** argv) -> int
+{
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (options.lanes != 0)
+        return runLanes(options);
+
+    Chip8 chip8;
+    chip8.setVariant(options.variant);
+    chip8.setQuirks(options.quirks);
+    chip8.setChecked(options.checked);
+    chip8.setEngine(options.engine);
+    chip8.setFastForward(options.fastForward);
+
+    std::unique_ptr<Profiler> profiler;
+    ProfileTrack* track = nullptr;
+    if (options.profile != nullptr)
+    {
+        profiler = std::make_unique<Profiler>();
+        track = &profiler->track("headless");
+        chip8.setProfiler(&profiler->execution());
+    }
+
+    std::unique_ptr<AudioSink> sink;
+    std::unique_ptr<AudioOutput> audio;
+    if (options.audio != nullptr)
+    {
+        if (!openAudioSink(options.audio, sink))
+            return 1;
+        audio = std::make_unique<AudioOutput>(*sink);
+    }
+
+    if (options.replay != nullptr)
+    {
+        int status = runReplay(options, chip8, audio.get());
+        if (audio)
+        {
+            audio->stop();
+            audio->print();
+        }
+        if (profiler)
+        {
+            profiler->print();
+            profiler->writeTrace(options.profile);
+        }
+        return status;
+    }
+
+    chip8.cpuReset();
+    chip8.seedRandom(options.seed);
+    if (!chip8.loadROM(options.rom))
+        return 1;
+
+    FrameEncoder encoder;
+    if (options.video != nullptr && !openEncoder(options, options.variant, encoder))
+        return 1;
+
+    if (options.rewindBytes != 0)
+    {
+        runRewind(options, chip8);
+        if (options.dump)
+            dumpScreen(chip8.display());
+        return 0;
+    }
+
+    // Frames run whole ticks so timers advance as in the windowed build;
+    // an instruction budget finishes with a partial frame.
+    uint64_t executed = 0;
+    auto start = std::chrono::steady_clock::now();
+    if (options.frames != 0)
+    {
+        for (uint64_t f = 0; f < options.frames; f++)
+        {
+            ProfileScope scope(track, "tick");
+            int instructions = instructionsInFrame(f, options.cpuHz);
+            chip8.tick(instructions);
+            if (audio)
+                audio->submit(chip8);
+            if (options.video != nullptr)
+                encoder.submit(chip8.display());
+            executed += instructions;
+        }
+    }
+    else
+    {
+        for (uint64_t f = 0; executed + instructionsInFrame(f, options.cpuHz) <= options.instructions; f++)
+        {
+            int instructions = instructionsInFrame(f, options.cpuHz);
+            chip8.tick(instructions);
+            executed += instructions;
+        }
+        for (; executed < options.instructions; executed++)
+            chip8.step();
+    }
+    if (audio)
+        audio->stop();
+    bool encoded = encoder.close();
+    auto end = std::chrono::steady_clock::now();
+
+    printRate(executed, end - start);
+    printSkipped(chip8, executed);
+    if (audio)
+        audio->print();
+    if (options.video != nullptr)
+        encoder.print();
+    if (!encoded)
+        return 1;
+
+    if (profiler)
+    {
+        profiler->print();
+        if (!profiler->writeTrace(options.profile))
+            return 1;
+    }
+
+    if (options.dump)
+        dumpScreen(chip8.display());
+
+    return 0;
+}
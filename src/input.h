@@ -0,0 +1,21 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "spsc_queue.h"
+
+struct KeyEvent
+{
+    int64_t timestampNs; // steady_clock, 0 when unknown
+    uint8_t key;
+    bool pressed;
+};
+
+using KeyEventQueue = SpscQueue<KeyEvent, 256>;
+
+inline auto steadyNowNs() -> int64_t
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,472 @@
+#include "jit.h"
+
+#include "chip8.h"
+
+#if CHIP8_JIT_X64
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+
+class Emitter
+{
+public:
+    auto bytes(std::initializer_list<uint8_t> b) -> void
+    {
+        m_code.insert(m_code.end(), b);
+    }
+
+    auto imm32(uint32_t v) -> void
+    {
+        for (int i = 0; i < 4; i++)
+            m_code.push_back((v >> (i * 8)) & 0xFF);
+    }
+
+    auto imm64(uint64_t v) -> void
+    {
+        for (int i = 0; i < 8; i++)
+            m_code.push_back((v >> (i * 8)) & 0xFF);
+    }
+
+    // mov eax, pc; jmp epilogue
+    auto exitWith(uint32_t pc) -> void
+    {
+        bytes({0xB8});
+        imm32(pc);
+        jumpToEpilogue();
+    }
+
+    auto jumpToEpilogue() -> void
+    {
+        bytes({0xE9});
+        m_epilogueJumps.push_back(m_code.size());
+        imm32(0);
+    }
+
+    // cmp eax, -1; je epilogue
+    auto exitOnFault() -> void
+    {
+        bytes({0x83, 0xF8, 0xFF, 0x0F, 0x84});
+        m_epilogueJumps.push_back(m_code.size());
+        imm32(0);
+    }
+
+    auto finish() -> std::vector<uint8_t>&
+    {
+        size_t epilogue = m_code.size();
+        for (size_t at : m_epilogueJumps)
+        {
+            uint32_t rel = static_cast<uint32_t>(epilogue - (at + 4));
+            std::memcpy(&m_code[at], &rel, sizeof(rel));
+        }
+        // mov [r13], r12w; pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+        bytes({0x66, 0x45, 0x89, 0x65, 0x00});
+        bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+        return m_code;
+    }
+
+private:
+    std::vector<uint8_t> m_code;
+    std::vector<size_t> m_epilogueJumps;
+};
+
+// Ops whose flag semantics depend on the order of the VF write fall back
+// to the interpreter when VF is also an operand.
+auto touchesVF(uint8_t x, uint8_t y) -> bool
+{
+    return x == 0xF || y == 0xF;
+}
+
+}
+
+// The arena is never writable and executable at once. It stays read and
+// execute, and compile opens only the pages a block is copied into for
+// the copy. Where the system refuses to make the pages executable the JIT
+// is unavailable.
+Jit::Jit(Chip8& chip8) : m_chip8(chip8), m_blocks(MAX_MEM_SIZE), m_codeBytes(MAX_MEM_SIZE)
+{
+    void* arena = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena != MAP_FAILED)
+    {
+        if (mprotect(arena, arenaSize, PROT_READ | PROT_EXEC) == 0)
+            m_arena = static_cast<uint8_t*>(arena);
+        else
+            munmap(arena, arenaSize);
+    }
+    flush();
+}
+
+Jit::~Jit()
+{
+    if (m_arena != nullptr)
+        munmap(m_arena, arenaSize);
+}
+
+auto Jit::available() const -> bool
+{
+    return m_arena != nullptr;
+}
+
+auto Jit::run(int count) -> void
+{
+    int remaining = count;
+    while (remaining > 0)
+    {
+        uint16_t pc = m_chip8.PC;
+        if (pc >= m_chip8.addressSpace - 1 || (m_blocks[pc].code == nullptr && !compile(pc)))
+        {
+            m_chip8.core->interpret(m_chip8, 1);
+            remaining--;
+            continue;
+        }
+
+        // Read before running, a write to translated code flushes m_blocks
+        Block block = m_blocks[pc];
+        uint32_t next = block.code(&m_chip8, m_chip8.V.data(), &m_chip8.I, remaining);
+        if (m_error)
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+
+        m_chip8.PC = next;
+        remaining -= std::min(static_cast<int>(block.length), remaining);
+    }
+}
+
+auto Jit::invalidate(int address, int length) -> void
+{
+    int first = std::max(address, 0);
+    int last = std::min(address + length, MAX_MEM_SIZE);
+    for (int a = first; a < last; a++)
+    {
+        if (m_codeBytes[a])
+        {
+            flush();
+            return;
+        }
+    }
+}
+
+auto Jit::flush() -> void
+{
+    std::fill(m_blocks.begin(), m_blocks.end(), Block{nullptr, 0});
+    std::fill(m_codeBytes.begin(), m_codeBytes.end(), false);
+    m_arenaUsed = 0;
+}
+
+auto Jit::helper(Chip8* chip8, uint32_t opcode, uint32_t pc) -> uint32_t
+{
+    // Exceptions can't unwind through translated code, so they are parked
+    // here and the block exits straight away with PC left as the
+    // interpreter would leave it; run() then rethrows.
+    try
+    {
+        chip8->PC = pc;
+        chip8->core->execute(*chip8, opcode);
+    }
+    catch (...)
+    {
+        chip8->jit->m_error = std::current_exception();
+        return faultPC;
+    }
+    return chip8->PC;
+}
+
+auto Jit::compile(uint16_t pc) -> bool
+{
+    if (m_arena == nullptr)
+        return false;
+
+    Emitter e;
+    // push rbx; push r12; push r13; push r14; push r15
+    e.bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    // mov r14, rdi; mov rbx, rsi; mov r13, rdx; mov r15d, ecx
+    e.bytes({0x49, 0x89, 0xFE, 0x48, 0x89, 0xF3, 0x49, 0x89, 0xD5, 0x41, 0x89, 0xCF});
+    // movzx r12d, word [r13]
+    e.bytes({0x45, 0x0F, 0xB7, 0x65, 0x00});
+
+    // Quirks and the variant are translation time constants, changing
+    // them flushes
+    const Quirks& quirks = m_chip8.activeQuirks;
+    bool xochip = m_chip8.activeVariant == Variant::XOChip;
+    uint32_t addressSpace = m_chip8.addressSpace;
+    uint32_t address = pc;
+    uint32_t length = 0;
+    // Past address, bytes the block depends on without running them
+    uint32_t lookahead = 0;
+    bool terminal = false;
+    while (!terminal && length < maxBlockLength && address < addressSpace - 1)
+    {
+        if (length > 0)
+        {
+            // cmp r15d, length; jne +10; mov eax, address; jmp epilogue
+            e.bytes({0x41, 0x83, 0xFF, static_cast<uint8_t>(length), 0x75, 0x0A});
+            e.exitWith(address);
+        }
+
+        uint16_t opcode = (m_chip8.memory[address] << 8) | m_chip8.memory[address + 1];
+        uint8_t x = (opcode >> 8) & 0x000F;
+        uint8_t y = (opcode >> 4) & 0x000F;
+        uint8_t n = opcode & 0x000F;
+        uint8_t nn = opcode & 0x00FF;
+        uint32_t next = address + 2;
+
+        auto skipIf = [&](uint8_t cmovcc)
+        {
+            // XO-CHIP skips all of F000 NNNN, so the block also depends on
+            // the instruction it skips
+            uint32_t skipped = next + 2;
+            if (xochip && next < addressSpace - 1)
+            {
+                lookahead = 2;
+                if (m_chip8.memory[next] == 0xF0 && m_chip8.memory[next + 1] == 0x00)
+                    skipped = next + 4;
+            }
+            // mov eax, next; mov ecx, skipped; cmovcc eax, ecx
+            e.bytes({0xB8});
+            e.imm32(next);
+            e.bytes({0xB9});
+            e.imm32(skipped);
+            e.bytes({0x0F, cmovcc, 0xC1});
+            e.jumpToEpilogue();
+            terminal = true;
+        };
+        auto callHelper = [&](bool endsBlock)
+        {
+            // mov [r13], r12w; mov rdi, r14; mov esi, opcode; mov edx, next
+            e.bytes({0x66, 0x45, 0x89, 0x65, 0x00, 0x4C, 0x89, 0xF7, 0xBE});
+            e.imm32(opcode);
+            e.bytes({0xBA});
+            e.imm32(next);
+            // mov rax, helper; call rax; movzx r12d, word [r13]
+            e.bytes({0x48, 0xB8});
+            e.imm64(reinterpret_cast<uint64_t>(&Jit::helper));
+            e.bytes({0xFF, 0xD0, 0x45, 0x0F, 0xB7, 0x65, 0x00});
+            if (endsBlock)
+            {
+                e.jumpToEpilogue();
+                terminal = true;
+            }
+            else
+            {
+                e.exitOnFault();
+            }
+        };
+        // mov [rbx + 15], cl
+        auto storeCarry = [&]() { e.bytes({0x88, 0x4B, 0x0F}); };
+        // mov byte [rbx + 15], 0
+        auto resetVF = [&]()
+        {
+            if (quirks.resetVF)
+                e.bytes({0xC6, 0x43, 0x0F, 0x00});
+        };
+
+        switch (opcode & 0xF000)
+        {
+            case 0x1000:
+                e.exitWith(opcode & 0x0FFF);
+                terminal = true;
+                break;
+            case 0x3000: // cmp byte [rbx + x], nn
+                e.bytes({0x80, 0x7B, x, nn});
+                skipIf(0x44);
+                break;
+            case 0x4000:
+                e.bytes({0x80, 0x7B, x, nn});
+                skipIf(0x45);
+                break;
+            case 0x5000: // mov al, [rbx + x]; cmp al, [rbx + y]
+                if (xochip && n == 0x2)
+                    callHelper(true);
+                else if (xochip && n != 0x0)
+                    callHelper(false);
+                else
+                {
+                    e.bytes({0x8A, 0x43, x, 0x3A, 0x43, y});
+                    skipIf(0x44);
+                }
+                break;
+            case 0x9000:
+                e.bytes({0x8A, 0x43, x, 0x3A, 0x43, y});
+                skipIf(0x45);
+                break;
+            case 0x6000: // mov byte [rbx + x], nn
+                e.bytes({0xC6, 0x43, x, nn});
+                break;
+            case 0x7000: // add byte [rbx + x], nn
+                e.bytes({0x80, 0x43, x, nn});
+                break;
+            case 0x8000:
+                switch (n)
+                {
+                    case 0x0: // mov al, [rbx + y]; mov [rbx + x], al
+                        e.bytes({0x8A, 0x43, y, 0x88, 0x43, x});
+                        break;
+                    case 0x1: // or [rbx + x], al
+                        e.bytes({0x8A, 0x43, y, 0x08, 0x43, x});
+                        resetVF();
+                        break;
+                    case 0x2: // and [rbx + x], al
+                        e.bytes({0x8A, 0x43, y, 0x20, 0x43, x});
+                        resetVF();
+                        break;
+                    case 0x3: // xor [rbx + x], al
+                        e.bytes({0x8A, 0x43, y, 0x30, 0x43, x});
+                        resetVF();
+                        break;
+                    case 0x4: // mov al, [x]; add al, [y]; setc cl; mov [x], al
+                        if (touchesVF(x, y))
+                            callHelper(false);
+                        else
+                        {
+                            e.bytes({0x8A, 0x43, x, 0x02, 0x43, y, 0x0F, 0x92, 0xC1, 0x88, 0x43, x});
+                            storeCarry();
+                        }
+                        break;
+                    case 0x5: // mov al, [x]; sub al, [y]; setae cl; mov [x], al
+                        if (touchesVF(x, y))
+                            callHelper(false);
+                        else
+                        {
+                            e.bytes({0x8A, 0x43, x, 0x2A, 0x43, y, 0x0F, 0x93, 0xC1, 0x88, 0x43, x});
+                            storeCarry();
+                        }
+                        break;
+                    case 0x6: // shr byte [rbx + x], 1; setc cl
+                        if (touchesVF(x, y))
+                            callHelper(false);
+                        else if (quirks.shiftVY)
+                        {
+                            // mov al, [rbx + y]; shr al, 1; setc cl; mov [rbx + x], al
+                            e.bytes({0x8A, 0x43, y, 0xD0, 0xE8, 0x0F, 0x92, 0xC1, 0x88, 0x43, x});
+                            storeCarry();
+                        }
+                        else
+                        {
+                            e.bytes({0xD0, 0x6B, x, 0x0F, 0x92, 0xC1});
+                            storeCarry();
+                        }
+                        break;
+                    case 0x7: // mov al, [y]; sub al, [x]; setae cl; mov [x], al
+                        if (touchesVF(x, y))
+                            callHelper(false);
+                        else
+                        {
+                            e.bytes({0x8A, 0x43, y, 0x2A, 0x43, x, 0x0F, 0x93, 0xC1, 0x88, 0x43, x});
+                            storeCarry();
+                        }
+                        break;
+                    case 0xE: // shl byte [rbx + x], 1; setc cl
+                        if (touchesVF(x, y))
+                            callHelper(false);
+                        else if (quirks.shiftVY)
+                        {
+                            // mov al, [rbx + y]; shl al, 1; setc cl; mov [rbx + x], al
+                            e.bytes({0x8A, 0x43, y, 0xD0, 0xE0, 0x0F, 0x92, 0xC1, 0x88, 0x43, x});
+                            storeCarry();
+                        }
+                        else
+                        {
+                            e.bytes({0xD0, 0x63, x, 0x0F, 0x92, 0xC1});
+                            storeCarry();
+                        }
+                        break;
+                    default:
+                        callHelper(false);
+                        break;
+                }
+                break;
+            case 0xA000: // mov r12d, nnn
+                e.bytes({0x41, 0xBC});
+                e.imm32(opcode & 0x0FFF);
+                break;
+            case 0x2000:
+            case 0xB000:
+            case 0xE000:
+                callHelper(true);
+                break;
+            case 0xF000:
+                switch (nn)
+                {
+                    case 0x1E: // movzx eax, byte [rbx + x]; add r12w, ax
+                        e.bytes({0x0F, 0xB6, 0x43, x, 0x66, 0x41, 0x01, 0xC4});
+                        break;
+                    case 0x29: // movzx eax, byte [rbx + x]; lea eax, [rax + rax * 4]; mov r12d, eax
+                        e.bytes({0x0F, 0xB6, 0x43, x, 0x8D, 0x04, 0x80, 0x41, 0x89, 0xC4});
+                        break;
+                    case 0x0A:
+                    case 0x33:
+                    case 0x55:
+                        callHelper(true);
+                        break;
+                    case 0x00: // F000 NNNN moves PC past its operand
+                        callHelper(xochip && x == 0);
+                        break;
+                    default:
+                        callHelper(false);
+                        break;
+                }
+                break;
+            default: // 0NNN, CXNN, DXYN and unknown opcodes
+                // The interpreter returns on any 0NNE, 00FD spins in place
+                callHelper((opcode & 0xF00F) == 0x000E || opcode == 0x00FD);
+                break;
+        }
+
+        length++;
+        address = next;
+    }
+    if (!terminal)
+        e.exitWith(address);
+
+    std::vector<uint8_t>& code = e.finish();
+    if (m_arenaUsed + code.size() > arenaSize)
+    {
+        flush();
+        if (code.size() > arenaSize)
+            return false;
+    }
+
+    // No block runs while another is copied in, so pages shared with
+    // earlier blocks can be closed to execution for the copy
+    uint8_t* dest = m_arena + m_arenaUsed;
+    static const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t first = reinterpret_cast<uintptr_t>(dest) & ~(pageSize - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(dest) + code.size() + pageSize - 1) & ~(pageSize - 1);
+    auto* pages = reinterpret_cast<void*>(first);
+    if (mprotect(pages, end - first, PROT_READ | PROT_WRITE) != 0)
+        return false;
+    std::memcpy(dest, code.data(), code.size());
+    if (mprotect(pages, end - first, PROT_READ | PROT_EXEC) != 0)
+    {
+        // Blocks on these pages can no longer run
+        flush();
+        return false;
+    }
+    m_arenaUsed += code.size();
+
+    m_blocks[pc] = Block{reinterpret_cast<BlockFn>(dest), length};
+    for (uint32_t a = pc; a < address + lookahead && a < addressSpace; a++)
+        m_codeBytes[a] = true;
+    return true;
+}
+
+#else
+
+Jit::Jit(Chip8& chip8) : m_chip8(chip8) {}
+
+Jit::~Jit() = default;
+
+auto Jit::available() const -> bool
+{
+    return false;
+}
+
+auto Jit::run(int /*count*/) -> void {}
+
+auto Jit::invalidate(int /*address*/, int /*length*/) -> void {}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CHIP8_JIT_X64 1
+#else
+#define CHIP8_JIT_X64 0
+#endif
+
+class Chip8;
+
+// Translates straight-line runs of CHIP-8 code into x86-64. A block ends at
+// the first instruction that can change control flow or write memory.
+// V is addressed through rbx, I lives in r12 for the whole block and PC is
+// a translation-time constant; everything that touches other state calls
+// back into the interpreter.
+class Jit
+{
+public:
+    explicit Jit(Chip8& chip8);
+    Jit(const Jit& j) = delete;
+    Jit(Jit&& j) = delete;
+    auto operator=(const Jit& j) -> Jit& = delete;
+    auto operator=(Jit&& j) -> Jit& = delete;
+    ~Jit();
+
+    [[nodiscard]] auto available() const -> bool;
+    auto run(int count) -> void;
+    auto invalidate(int address, int length) -> void;
+
+private:
+    // (chip8, V, &I, budget) -> next PC. Runs min(length, budget) instructions.
+    using BlockFn = uint32_t (*)(Chip8*, uint8_t*, uint16_t*, int);
+
+    struct Block
+    {
+        BlockFn code;
+        uint32_t length;
+    };
+
+    static auto helper(Chip8* chip8, uint32_t opcode, uint32_t pc) -> uint32_t;
+
+    auto compile(uint16_t pc) -> bool;
+    auto flush() -> void;
+
+    Chip8& m_chip8;
+    uint8_t* m_arena{};
+    size_t m_arenaUsed{};
+    std::vector<Block> m_blocks;
+    std::vector<bool> m_codeBytes;
+    std::exception_ptr m_error;
+
+    constexpr static uint32_t faultPC = 0xFFFFFFFF;
+    constexpr static size_t arenaSize = 1 << 20;
+    constexpr static int maxBlockLength = 64;
+};
@@ -0,0 +1,56 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <fmt/core.h>
+
+auto LatencyHistogram::record(int64_t ns) -> void
+{
+    ns = std::max<int64_t>(ns, 0);
+    auto us = static_cast<uint64_t>(ns / 1000);
+    int bucket = us == 0 ? 0 : std::bit_width(us) - 1;
+    m_buckets.at(std::min(bucket, bucketCount - 1))++;
+    m_count++;
+    m_sumNs += ns;
+    m_maxNs = std::max(m_maxNs, ns);
+}
+
+auto LatencyHistogram::reset() -> void
+{
+    *this = LatencyHistogram{};
+}
+
+auto LatencyHistogram::count() const -> uint64_t
+{
+    return m_count;
+}
+
+auto LatencyHistogram::percentileUs(double p) const -> double
+{
+    auto target = static_cast<uint64_t>(std::ceil(p / 100.0 * m_count));
+    uint64_t seen = 0;
+    for (int i = 0; i < bucketCount; i++)
+    {
+        seen += m_buckets.at(i);
+        if (seen >= target && seen > 0)
+            return std::ldexp(1.0, i + 1);
+    }
+    return m_maxNs / 1000.0;
+}
+
+auto LatencyHistogram::print(std::string_view name) const -> void
+{
+    if (m_count == 0)
+    {
+        fmt::print("{}: no samples\n", name);
+        return;
+    }
+    fmt::print("{}: {} samples, mean {:.1f} us, p50 < {:.0f} us, p99 < {:.0f} us, max {:.1f} us\n",
+        name, m_count, m_sumNs / 1000.0 / m_count, percentileUs(50.0), percentileUs(99.0), m_maxNs / 1000.0);
+    for (int i = 0; i < bucketCount; i++)
+    {
+        if (m_buckets.at(i) != 0)
+            fmt::print("  [{:>8.0f}, {:>8.0f}) us: {}\n", i == 0 ? 0.0 : std::ldexp(1.0, i), std::ldexp(1.0, i + 1), m_buckets.at(i));
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+// Power of two buckets in microseconds: bucket i holds [2^i, 2^(i+1)) us
+class LatencyHistogram
+{
+public:
+    auto record(int64_t ns) -> void;
+    auto reset() -> void;
+
+    [[nodiscard]] auto count() const -> uint64_t;
+    // Upper bound of the bucket holding the p-th percentile
+    [[nodiscard]] auto percentileUs(double p) const -> double;
+    auto print(std::string_view name) const -> void;
+
+private:
+    constexpr static int bucketCount = 32;
+
+    std::array<uint64_t, bucketCount> m_buckets{};
+    uint64_t m_count{};
+    int64_t m_sumNs{};
+    int64_t m_maxNs{};
+};
@@ -1,58 +1,420 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
 #include <thread>
-#include <span>
+#include <utility>
+#include <vector>
 
 #include <fmt/core.h>
 
 #include "window.h"
 #include "renderer.h"
+#include "audio.h"
 #include "chip8.h"
+#include "frame_stats.h"
+#include "movie.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include "triple_buffer.h"
 
-std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT * 4> screen;
+// Set by CMake when the ALSA sink is built
+#ifndef CHIP8_AUDIO_ALSA
+#define CHIP8_AUDIO_ALSA 0
+#endif
+#if CHIP8_AUDIO_ALSA
+#include "alsa_sink.h"
+#endif
 
 const int WIDTH = 640;
 const int HEIGHT = 320;
 
-auto updateScreen(std::span<uint8_t> chip8screen) -> void
+constexpr const double fps = 60.0;
+constexpr const double idleFps = 5.0;
+constexpr std::chrono::duration<double, std::milli> frameTime(1000 / fps);
+constexpr std::chrono::duration<double, std::milli> idleFrameTime(1000 / idleFps);
+// Minutes of history at typical delta sizes
+constexpr const size_t rewindBudget = 4 * 1024 * 1024;
+constexpr const int rewindKey = GLFW_KEY_BACKSPACE;
+// Runs uncapped while held
+constexpr const int turboKey = GLFW_KEY_TAB;
+
+// Taken during static initialization, as close to process start as the
+// program itself can see
+const int64_t processStartNs = steadyNowNs();
+
+struct Options
+{
+    const char* rom{};
+    const char* record{};
+    const char* profile{};
+    // device, null or a WAV file, the device when there is one by default
+    const char* audio{};
+    // A directory, or off
+    const char* shaderCache{};
+    // Exits after the first presented frame
+    bool startup{};
+    bool threaded{};
+    bool turbo{};
+    bool checked{CHECKED_BY_DEFAULT};
+    Variant variant{Variant::Chip8};
+    // The variant's preset unless given
+    Quirks quirks{};
+    bool quirksSet{};
+    bool seeded{};
+    uint32_t seed{};
+    uint32_t cpuHz{DEFAULT_CPU_HZ};
+};
+
+// Process start to the first presented frame, and the setup inside it
+struct Startup
+{
+    int64_t windowNs{};
+    int64_t rendererNs{};
+    int64_t firstFrameNs{};
+    bool shaderFromCache{};
+    bool exitAfterFirstFrame{};
+};
+
+struct Frame
+{
+    DisplayRows rows;
+    bool hires;
+    uint64_t number;
+};
+
+// Drains the input queue into the next tick. Each event lands on the
+// instruction slot matching its offset into the frame it arrived in, so
+// presses keep their order and relative timing instead of all snapping to
+// the frame boundary. The movie gets the same slots, so a replay applies
+// every event exactly where this run did.
+auto scheduleKeyEvents(KeyEventQueue& queue, Chip8& chip8, Movie& movie, int64_t frameStartNs, int instructions) -> void
+{
+    KeyEvent event;
+    while (queue.pop(event))
+    {
+        int64_t offset = event.timestampNs - frameStartNs;
+        auto slot = static_cast<int>(std::clamp<int64_t>(offset * instructions / TIMER_PERIOD_NS, 0, instructions - 1));
+        chip8.queueKeyEvent(event, slot);
+        movie.record(event, slot);
+    }
+}
+
+// One emulated frame, run by the scheduler: a step back through history
+// while the rewind key is held, otherwise the queued input and a tick,
+// whose sound goes to audio when there is any. Rewinding is silent.
+// Returns the instructions executed.
+auto emulateFrame(Chip8& chip8, Movie& movie, Rewind& rewind, AudioOutput* audio, KeyEventQueue& keys,
+    bool rewinding, int64_t& lastTickNs, uint32_t cpuHz) -> int
+{
+    if (rewinding && rewind.stepBack(chip8))
+    {
+        movie.dropLastFrame();
+        return 0;
+    }
+    // Numbered by the movie so the split matches a replay after rewinding
+    int instructions = instructionsInFrame(movie.frames(), cpuHz);
+    scheduleKeyEvents(keys, chip8, movie, lastTickNs, instructions);
+    lastTickNs = steadyNowNs();
+    chip8.tick(instructions);
+    if (audio != nullptr)
+        audio->submit(chip8);
+    movie.endFrame();
+    rewind.record(chip8);
+    return instructions;
+}
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8 <rom> [--threaded] [--hz N] [--turbo] [--variant chip8|schip|xochip]\n"
+        "       [--quirks default|cosmac|schip|xochip] [--checked | --unchecked] [--seed N]\n"
+        "       [--record movie.c8m] [--profile trace.json] [--audio device|null|out.wav]\n"
+        "       [--shader-cache DIR|off] [--startup]\n");
+}
+
+auto parseOptions(int argc, char** argv, Options& options) -> bool
 {
-    for (int i = 0; i < SCREEN_HEIGHT; i++)
+    for (int i = 1; i < argc; i++)
     {
-        for (int j = 0; j < SCREEN_WIDTH; j++)
+        std::string_view arg = argv[i];
+        if (arg == "--threaded")
+            options.threaded = true;
+        else if (arg == "--turbo")
+            options.turbo = true;
+        else if (arg == "--variant" && i + 1 < argc)
+        {
+            if (!variantFromName(argv[++i], options.variant))
+                return false;
+        }
+        else if (arg == "--quirks" && i + 1 < argc)
         {
-            int index = (i * SCREEN_WIDTH + j) * 4;
-            screen[index] = screen[index + 1] = screen[index + 2] = chip8screen[(31 - i) * SCREEN_WIDTH + j] * 255;
-            screen[index + 3] = 0xff; 
+            if (!quirksFromName(argv[++i], options.quirks))
+                return false;
+            options.quirksSet = true;
         }
+        else if (arg == "--checked")
+            options.checked = true;
+        else if (arg == "--unchecked")
+            options.checked = false;
+        else if (arg == "--hz" && i + 1 < argc)
+            options.cpuHz = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            options.seeded = true;
+        }
+        else if (arg == "--record" && i + 1 < argc)
+            options.record = argv[++i];
+        else if (arg == "--profile" && i + 1 < argc)
+            options.profile = argv[++i];
+        else if (arg == "--audio" && i + 1 < argc)
+            options.audio = argv[++i];
+        else if (arg == "--shader-cache" && i + 1 < argc)
+            options.shaderCache = argv[++i];
+        else if (arg == "--startup")
+            options.startup = true;
+        else if (options.rom == nullptr && !arg.starts_with("--"))
+            options.rom = argv[i];
+        else
+            return false;
     }
+    if (!options.quirksSet)
+        options.quirks = variantQuirks(options.variant);
+    return options.rom != nullptr && options.cpuHz >= TIMER_HZ && options.cpuHz <= MAX_CPU_HZ;
 }
 
-auto main(int argc, char** argv) -> int
+auto readROM(const char* path, std::vector<uint8_t>& rom) -> bool
 {
-    if (argc != 2)
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
     {
-        fmt::print("Usage: ./chip8 <rom>\n");
-        return 0;
+        fmt::print("Could not open the file {} for reading\n", path);
+        return false;
+    }
+    rom.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Without --audio a missing device only means no sound
+auto openAudioSink(const char* name, std::unique_ptr<AudioSink>& sink) -> bool
+{
+    std::string_view target = name != nullptr ? name : "device";
+    if (target == "null")
+    {
+        sink = std::make_unique<NullSink>();
+        return true;
+    }
+    if (target == "device")
+    {
+#if CHIP8_AUDIO_ALSA
+        auto device = std::make_unique<AlsaSink>();
+        if (!device->open())
+            return name == nullptr;
+        sink = std::move(device);
+#else
+        if (name != nullptr)
+            fmt::print("Built without an audio device, see CHIP8_AUDIO_ALSA\n");
+#endif
+        return name == nullptr || sink != nullptr;
     }
+    auto wav = std::make_unique<WavSink>();
+    if (!wav->open(target))
+        return false;
+    sink = std::move(wav);
+    return true;
+}
 
-    constexpr const double fps = 60.0;
-    constexpr const double idleFps = 5.0;
-    constexpr std::chrono::duration<double, std::milli> frameTime(1000 / fps);
-    constexpr std::chrono::duration<double, std::milli> idleFrameTime(1000 / idleFps);
+// $XDG_CACHE_HOME/chip8, or ~/.cache/chip8; empty when neither is set
+auto shaderCacheDir(const char* option) -> std::string
+{
+    if (option != nullptr)
+        return std::string_view(option) == "off" ? std::string() : std::string(option);
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache != nullptr && *cache != '\0')
+        return fmt::format("{}/chip8", cache);
+    if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0')
+        return fmt::format("{}/.cache/chip8", home);
+    return {};
+}
 
-    Window window;
-    window.createWindow(WIDTH, HEIGHT, "Chip 8 Emulator");
-    
-    Chip8 chip8;
-    chip8.cpuReset();
-    chip8.loadROM(argv[1]);
+// After every swap, only the first one counts
+auto markPresented(Startup& startup, Window& window) -> void
+{
+    if (startup.firstFrameNs != 0)
+        return;
+    startup.firstFrameNs = steadyNowNs() - processStartNs;
+    if (startup.exitAfterFirstFrame)
+        window.close();
+}
+
+auto printStartup(const Startup& startup) -> void
+{
+    fmt::print("startup: {:.2f} ms to the first frame (window {:.2f} ms, renderer {:.2f} ms, shader program {})\n",
+        startup.firstFrameNs / 1e6, startup.windowNs / 1e6, startup.rendererNs / 1e6,
+        startup.shaderFromCache ? "from the cache" : "compiled");
+}
+
+auto printUploadStats(const Renderer& renderer) -> void
+{
+    const auto& stats = renderer.uploadStats();
+    double bytesPerFrame = stats.frames > 0 ? static_cast<double>(stats.totalBytes) / stats.frames : 0.0;
+    fmt::print("texture upload: {} bytes over {} frames ({:.1f} bytes/frame, max {}, {} frames skipped)\n",
+        stats.totalBytes, stats.frames, bytesPerFrame, stats.maxFrameBytes, stats.skippedFrames);
+}
+
+auto deadlineTime(int64_t ns) -> std::chrono::steady_clock::time_point
+{
+    return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns));
+}
+
+auto runSingleThreaded(Window& window, Chip8& chip8, Renderer& renderer, Movie& movie, Scheduler& scheduler,
+    bool turbo, Profiler* profiler, AudioOutput* audio, Startup& startup) -> void
+{
+    FrameStats frameStats;
+    Rewind rewind(rewindBudget);
+    ProfileTrack* track = profiler != nullptr ? &profiler->track("main") : nullptr;
+    int64_t lastTickNs = steadyNowNs();
+    bool resync = false;
 
-    Renderer renderer(SCREEN_WIDTH, SCREEN_HEIGHT);
-    
     while (!window.shouldClose())
     {
-        auto target_fps = std::chrono::steady_clock::now() + frameTime;
         if (!window.isFocused())
+        {
+            window.pollEvents();
+            // Limit fps when out of focus
+            std::this_thread::sleep_for(frameTime + idleFrameTime);
+            resync = true;
+            continue;
+        }
+        // Time spent paused is not a stall to catch up on
+        if (std::exchange(resync, false))
+            scheduler.resync(steadyNowNs());
+        scheduler.setTurbo(turbo || window.isKeyDown(turboKey));
+
+        {
+            ProfileScope scope(track, "tick");
+            // Holding the rewind key plays recent history backwards
+            bool rewinding = window.isKeyDown(rewindKey);
+            scheduler.run(steadyNowNs(), [&]
+            {
+                return emulateFrame(chip8, movie, rewind, audio, window.keyEvents(), rewinding, lastTickNs,
+                    scheduler.cpuHz());
+            });
+        }
+        {
+            ProfileScope scope(track, "render");
+            const Display& display = chip8.display();
+            renderer.render(display.rows(), display.width(), display.height(), chip8.takeDirtyRows());
+        }
+        {
+            ProfileScope scope(track, "swap");
+            window.swapBuffers();
+            markPresented(startup, window);
+        }
+        {
+            ProfileScope scope(track, "poll");
+            window.pollEvents();
+        }
+        frameStats.mark();
+
+        // Woken by the scheduler's deadlines rather than a fixed sleep, so
+        // loop overhead never slows the emulated clock. Turbo does not sleep.
+        ProfileScope scope(track, "sleep");
+        if (!scheduler.turbo())
+            std::this_thread::sleep_until(deadlineTime(scheduler.nextDeadlineNs()));
+    }
+
+    frameStats.print("frame");
+    chip8.keyLatency().print("key latency");
+    rewind.print();
+}
+
+// The emulator ticks on its own thread against absolute deadlines and
+// publishes every frame; the render thread presents the newest one
+// without ever waiting for the emulator. Key events go the other way
+// through the window's queue, which the emulation thread drains.
+auto runThreaded(Window& window, Chip8& chip8, Renderer& renderer, Movie& movie, Scheduler& scheduler,
+    bool turbo, Profiler* profiler, AudioOutput* audio, Startup& startup) -> void
+{
+    TripleBuffer<Frame> frames;
+    std::atomic<bool> running{true};
+    std::atomic<bool> paused{false};
+    // Key state can only be read on the main thread
+    std::atomic<bool> rewinding{false};
+    std::atomic<bool> turboHeld{false};
+    FrameStats emulationStats;
+    Rewind rewind(rewindBudget);
+    ProfileTrack* emulationTrack = profiler != nullptr ? &profiler->track("emulation") : nullptr;
+    ProfileTrack* renderTrack = profiler != nullptr ? &profiler->track("render") : nullptr;
+
+    std::thread emulation([&]
+    {
+        int64_t lastTickNs = steadyNowNs();
+        uint64_t number = 0;
+        bool resync = false;
+
+        while (running.load(std::memory_order_relaxed))
+        {
+            if (paused.load(std::memory_order_relaxed))
+            {
+                std::this_thread::sleep_for(frameTime);
+                resync = true;
+                continue;
+            }
+            if (std::exchange(resync, false))
+                scheduler.resync(steadyNowNs());
+            scheduler.setTurbo(turbo || turboHeld.load(std::memory_order_relaxed));
+
+            uint64_t ran = 0;
+            {
+                ProfileScope scope(emulationTrack, "tick");
+                bool stepBack = rewinding.load(std::memory_order_relaxed);
+                ran = scheduler.run(steadyNowNs(), [&]
+                {
+                    return emulateFrame(chip8, movie, rewind, audio, window.keyEvents(), stepBack, lastTickNs,
+                        scheduler.cpuHz());
+                });
+            }
+            if (ran > 0)
+            {
+                ProfileScope scope(emulationTrack, "publish");
+                Frame& frame = frames.back();
+                frame.rows = chip8.display().rows();
+                frame.hires = chip8.display().hires();
+                frame.number = ++number;
+                frames.publish();
+            }
+            emulationStats.mark();
+
+            ProfileScope scope(emulationTrack, "sleep");
+            if (!scheduler.turbo())
+                std::this_thread::sleep_until(deadlineTime(scheduler.nextDeadlineNs()));
+        }
+    });
+
+    FrameStats renderStats;
+    DisplayRows shown{};
+    bool shownHires = false;
+    uint64_t shownNumber = 0;
+    uint64_t dropped = 0;
+    uint64_t repeated = 0;
+    // The texture has no contents until the first full upload
+    uint64_t pendingRows = ALL_ROWS_DIRTY;
+
+    while (!window.shouldClose())
+    {
+        auto target_fps = std::chrono::steady_clock::now() + frameTime;
+        paused.store(!window.isFocused(), std::memory_order_relaxed);
+        rewinding.store(window.isKeyDown(rewindKey), std::memory_order_relaxed);
+        turboHeld.store(window.isKeyDown(turboKey), std::memory_order_relaxed);
+        if (paused.load(std::memory_order_relaxed))
         {
             window.pollEvents();
             // Limit fps when out of focus
@@ -61,28 +423,145 @@ auto main(int argc, char** argv) -> int
             continue;
         }
 
-        if (Window::keyPressed != -1)
+        uint64_t dirtyRows = std::exchange(pendingRows, 0);
+        {
+            ProfileScope scope(renderTrack, "consume");
+            if (frames.consume())
+            {
+                const Frame& frame = frames.front();
+                if (shownNumber != 0)
+                    dropped += frame.number - shownNumber - 1;
+                shownNumber = frame.number;
+
+                for (int row = 0; row < HIRES_HEIGHT; row++)
+                {
+                    if (frame.rows[row] != shown[row])
+                        dirtyRows |= uint64_t{1} << row;
+                }
+                shown = frame.rows;
+                shownHires = frame.hires;
+            }
+            else
+            {
+                repeated++;
+            }
+        }
         {
-            chip8.keyPressed(Window::keyPressed);
-            Window::keyPressed = -1;
+            ProfileScope scope(renderTrack, "render");
+            renderer.render(shown, shownHires ? HIRES_WIDTH : SCREEN_WIDTH, shownHires ? HIRES_HEIGHT : SCREEN_HEIGHT,
+                dirtyRows);
         }
-        else if (Window::keyReleased != -1)
         {
-            chip8.keyReleased(Window::keyReleased);
-            Window::keyReleased = -1;
+            ProfileScope scope(renderTrack, "swap");
+            window.swapBuffers();
+            markPresented(startup, window);
         }
+        {
+            ProfileScope scope(renderTrack, "poll");
+            window.pollEvents();
+        }
+        renderStats.mark();
 
-        chip8.tick();
+        ProfileScope scope(renderTrack, "sleep");
+        std::this_thread::sleep_until(target_fps);
+    }
 
-        if (chip8.shouldItDraw())
-            updateScreen(chip8.screenBuffer());
-        renderer.render(screen.data());
+    running.store(false, std::memory_order_relaxed);
+    emulation.join();
 
-        window.swapBuffers();
-        window.pollEvents();
+    emulationStats.print("emulation");
+    renderStats.print("render");
+    fmt::print("frames dropped: {}, frames repeated: {}\n", dropped, repeated);
+    chip8.keyLatency().print("key latency");
+    rewind.print();
+}
 
-        std::this_thread::sleep_until(target_fps);
+auto main(int argc, char** argv) -> int
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 0;
     }
-    
+
+    std::vector<uint8_t> rom;
+    if (!readROM(options.rom, rom))
+        return 1;
+    // Every run is seeded explicitly so any of them can be recorded
+    uint32_t seed = options.seeded ? options.seed : std::random_device{}();
+
+    Startup startup;
+    startup.exitAfterFirstFrame = options.startup;
+    int64_t setupNs = steadyNowNs();
+    Window window;
+    window.createWindow(WIDTH, HEIGHT, "Chip 8 Emulator");
+    startup.windowNs = steadyNowNs() - setupNs;
+
+    Chip8 chip8;
+    chip8.setVariant(options.variant);
+    chip8.setQuirks(options.quirks);
+    chip8.setChecked(options.checked);
+    chip8.cpuReset();
+    chip8.seedRandom(seed);
+    if (!chip8.loadROM(rom))
+        return 1;
+
+    Movie movie;
+    movie.start(seed, options.cpuHz, options.variant, options.quirks, rom);
+
+    setupNs = steadyNowNs();
+    Renderer renderer(shaderCacheDir(options.shaderCache));
+    startup.rendererNs = steadyNowNs() - setupNs;
+    startup.shaderFromCache = renderer.shaderFromCache();
+
+    std::unique_ptr<Profiler> profiler;
+    if (options.profile != nullptr)
+    {
+        profiler = std::make_unique<Profiler>();
+        chip8.setProfiler(&profiler->execution());
+    }
+
+    std::unique_ptr<AudioSink> sink;
+    if (!openAudioSink(options.audio, sink))
+        return 1;
+    std::unique_ptr<AudioOutput> audio;
+    if (sink)
+        audio = std::make_unique<AudioOutput>(*sink);
+
+    Scheduler scheduler(options.cpuHz);
+    if (options.threaded)
+        runThreaded(window, chip8, renderer, movie, scheduler, options.turbo, profiler.get(), audio.get(), startup);
+    else
+        runSingleThreaded(window, chip8, renderer, movie, scheduler, options.turbo, profiler.get(), audio.get(),
+            startup);
+
+    printStartup(startup);
+    scheduler.print();
+    fmt::print("fast-forward: {} idle instructions skipped\n", chip8.skippedInstructions());
+    printUploadStats(renderer);
+    if (audio)
+    {
+        audio->stop();
+        audio->print();
+    }
+
+    if (profiler)
+    {
+        chip8.setProfiler(nullptr);
+        profiler->print();
+        if (!profiler->writeTrace(options.profile))
+            return 1;
+    }
+
+    if (options.record != nullptr)
+    {
+        movie.finish(chip8);
+        if (!movie.save(options.record))
+            return 1;
+        fmt::print("recorded {} frames and {} key events with seed {} to {}\n", movie.frames(),
+            movie.events().size(), seed, options.record);
+    }
+
     return 0;
 }
@@ -0,0 +1,103 @@
+#include "mapped_file.h"
+
+#include <string>
+#include <fmt/core.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+auto MappedFile::open(std::string_view path, Mode mode, size_t size) -> bool
+{
+    close();
+
+    std::string name(path);
+    bool write = mode == Mode::ReadWrite;
+    int fd = ::open(name.c_str(), write ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0)
+    {
+        fmt::print("Could not open the file {} for {}\n", path, write ? "writing" : "reading");
+        return false;
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    if (write && size != 0 && static_cast<size_t>(info.st_size) != size)
+    {
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            fmt::print("Could not resize {} to {} bytes\n", path, size);
+            ::close(fd);
+            return false;
+        }
+        info.st_size = static_cast<off_t>(size);
+    }
+    if (info.st_size == 0)
+    {
+        fmt::print("{} is empty\n", path);
+        ::close(fd);
+        return false;
+    }
+
+    int protection = write ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* data = mmap(nullptr, info.st_size, protection, write ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        fmt::print("Could not map {}\n", path);
+        return false;
+    }
+
+    m_data = static_cast<uint8_t*>(data);
+    m_size = static_cast<size_t>(info.st_size);
+    m_mode = mode;
+    return true;
+}
+
+auto MappedFile::close() -> void
+{
+    if (m_data != nullptr)
+        munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+auto MappedFile::flush() -> bool
+{
+    if (m_data == nullptr || m_mode != Mode::ReadWrite)
+        return false;
+    return msync(m_data, m_size, MS_SYNC) == 0;
+}
+
+auto MappedFile::isOpen() const -> bool
+{
+    return m_data != nullptr;
+}
+
+auto MappedFile::size() const -> size_t
+{
+    return m_size;
+}
+
+auto MappedFile::data() const -> std::span<const uint8_t>
+{
+    return {m_data, m_size};
+}
+
+auto MappedFile::writable() -> std::span<uint8_t>
+{
+    if (m_mode != Mode::ReadWrite)
+        return {};
+    return {m_data, m_size};
+}
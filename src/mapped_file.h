@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// A whole file mapped into memory. Read mappings are private and read only;
+// ReadWrite creates the file if needed, sizes it and maps it shared, so
+// stores land in the page cache without any write calls.
+class MappedFile
+{
+public:
+    enum class Mode
+    {
+        Read,
+        ReadWrite,
+    };
+
+    MappedFile() = default;
+    MappedFile(const MappedFile& f) = delete;
+    MappedFile(MappedFile&& f) = delete;
+    auto operator=(const MappedFile& f) -> MappedFile& = delete;
+    auto operator=(MappedFile&& f) -> MappedFile& = delete;
+    ~MappedFile();
+
+    // size is only used for ReadWrite, 0 keeps the current file size
+    auto open(std::string_view path, Mode mode, size_t size = 0) -> bool;
+    auto close() -> void;
+    // Writes dirty pages back to the file
+    auto flush() -> bool;
+
+    [[nodiscard]] auto isOpen() const -> bool;
+    [[nodiscard]] auto size() const -> size_t;
+    [[nodiscard]] auto data() const -> std::span<const uint8_t>;
+    [[nodiscard]] auto writable() -> std::span<uint8_t>;
+
+private:
+    uint8_t* m_data{};
+    size_t m_size{};
+    Mode m_mode{Mode::Read};
+};
@@ -0,0 +1,186 @@
+#include "movie.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#include <fmt/core.h>
+
+#include "checksum.h"
+#include "scheduler.h"
+
+auto stateChecksum(const Chip8& chip8) -> uint32_t
+{
+    std::vector<uint8_t> state(chip8.snapshotSize());
+    chip8.snapshot(state);
+    return crc32c(state);
+}
+
+auto Movie::start(uint32_t seed, uint32_t cpuHz, Variant variant, const Quirks& quirks, std::span<const uint8_t> rom)
+    -> void
+{
+    m_header = MovieHeader{MOVIE_MAGIC, MOVIE_VERSION, seed, crc32c(rom), 0, 0, 0, cpuHz,
+        static_cast<uint16_t>(quirksToBits(quirks)), static_cast<uint8_t>(variant), 0};
+    m_events.clear();
+}
+
+auto Movie::record(const KeyEvent& event, int slot) -> void
+{
+    m_events.push_back(MovieEvent{static_cast<uint32_t>(m_header.frames),
+        static_cast<uint16_t>(slot), event.key, event.pressed ? uint8_t{1} : uint8_t{0}});
+}
+
+auto Movie::endFrame() -> void
+{
+    m_header.frames++;
+}
+
+auto Movie::dropLastFrame() -> void
+{
+    if (m_header.frames == 0)
+        return;
+    m_header.frames--;
+    while (!m_events.empty() && m_events.back().frame >= m_header.frames)
+        m_events.pop_back();
+}
+
+auto Movie::finish(const Chip8& chip8) -> void
+{
+    m_header.events = static_cast<uint32_t>(m_events.size());
+    m_header.finalChecksum = stateChecksum(chip8);
+}
+
+auto Movie::save(std::string_view path) const -> bool
+{
+    std::ofstream out(std::string(path), std::ios::binary);
+    if (!out.is_open())
+    {
+        fmt::print("Could not open the file {} for writing\n", path);
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+    out.write(reinterpret_cast<const char*>(m_events.data()), static_cast<std::streamsize>(m_events.size() * sizeof(MovieEvent)));
+    if (!out.good())
+    {
+        fmt::print("Could not write the movie {}\n", path);
+        return false;
+    }
+    return true;
+}
+
+auto Movie::load(std::string_view path) -> bool
+{
+    std::ifstream in(std::string(path), std::ios::binary);
+    if (!in.is_open())
+    {
+        fmt::print("Could not open the file {} for reading\n", path);
+        return false;
+    }
+
+    MovieHeader header{};
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != MOVIE_MAGIC)
+    {
+        fmt::print("{} is not a movie\n", path);
+        return false;
+    }
+    if (header.version != MOVIE_VERSION)
+    {
+        fmt::print("Movie version {} is not supported, expected {}\n", header.version, MOVIE_VERSION);
+        return false;
+    }
+
+    // The header is not trusted to size the allocation
+    std::streampos start = in.tellg();
+    in.seekg(0, std::ios::end);
+    auto remaining = static_cast<uint64_t>(in.tellg() - start);
+    in.seekg(start);
+    if (!in || header.events > remaining / sizeof(MovieEvent))
+    {
+        fmt::print("Movie {} is truncated\n", path);
+        return false;
+    }
+
+    std::vector<MovieEvent> events(header.events);
+    if (!in.read(reinterpret_cast<char*>(events.data()), static_cast<std::streamsize>(events.size() * sizeof(MovieEvent))))
+    {
+        fmt::print("Movie {} is truncated\n", path);
+        return false;
+    }
+    bool ordered = std::ranges::is_sorted(events, {}, &MovieEvent::frame);
+    bool valid = std::ranges::all_of(events, [&](const MovieEvent& e)
+    {
+        return e.frame < header.frames && e.key < KEY_SIZE;
+    });
+    if (!ordered || !valid || header.cpuHz < TIMER_HZ || header.cpuHz > MAX_CPU_HZ || header.quirks >= (1u << QUIRK_COUNT)
+        || header.variant >= VARIANT_COUNT)
+    {
+        fmt::print("Movie {} is invalid\n", path);
+        return false;
+    }
+
+    m_header = header;
+    m_events = std::move(events);
+    return true;
+}
+
+auto Movie::prepare(Chip8& chip8, std::span<const uint8_t> rom) const -> bool
+{
+    if (crc32c(rom) != m_header.romChecksum)
+    {
+        fmt::print("ROM checksum {:08x} does not match the movie's {:08x}\n", crc32c(rom), m_header.romChecksum);
+        return false;
+    }
+    chip8.setVariant(variant());
+    chip8.setQuirks(quirks());
+    chip8.cpuReset();
+    chip8.seedRandom(m_header.seed);
+    return chip8.loadROM(rom);
+}
+
+auto Movie::queueFrame(uint64_t frame, Chip8& chip8) const -> void
+{
+    auto first = std::ranges::lower_bound(m_events, frame, {}, &MovieEvent::frame);
+    for (auto it = first; it != m_events.end() && it->frame == frame; ++it)
+        chip8.queueKeyEvent(KeyEvent{0, it->key, it->pressed != 0}, it->slot);
+}
+
+auto Movie::playFrame(uint64_t frame, Chip8& chip8) const -> void
+{
+    queueFrame(frame, chip8);
+    chip8.tick(instructionsInFrame(frame, m_header.cpuHz));
+}
+
+auto Movie::matches(const Chip8& chip8) const -> bool
+{
+    return stateChecksum(chip8) == m_header.finalChecksum;
+}
+
+auto Movie::seed() const -> uint32_t
+{
+    return m_header.seed;
+}
+
+auto Movie::cpuHz() const -> uint32_t
+{
+    return m_header.cpuHz;
+}
+
+auto Movie::variant() const -> Variant
+{
+    return static_cast<Variant>(m_header.variant);
+}
+
+auto Movie::quirks() const -> Quirks
+{
+    return quirksFromBits(m_header.quirks);
+}
+
+auto Movie::frames() const -> uint64_t
+{
+    return m_header.frames;
+}
+
+auto Movie::events() const -> std::span<const MovieEvent>
+{
+    return m_events;
+}
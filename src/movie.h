@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "chip8.h"
+#include "input.h"
+
+constexpr const uint32_t MOVIE_MAGIC = 0x4D563843; // "C8VM"
+constexpr const uint32_t MOVIE_VERSION = 4;
+
+struct MovieHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed;
+    uint32_t romChecksum;  // CRC-32C of the ROM the movie was recorded on
+    uint64_t frames;
+    uint32_t events;
+    uint32_t finalChecksum; // CRC-32C of the snapshot after the last frame
+    uint32_t cpuHz;         // frame f ran instructionsInFrame(f, cpuHz)
+    uint16_t quirks;        // quirksToBits of the core the movie ran on
+    uint8_t variant;        // the Variant it ran
+    uint8_t reserved;
+};
+
+// One key event, applied before instruction slot of frame
+struct MovieEvent
+{
+    uint32_t frame;
+    uint16_t slot;
+    uint8_t key;
+    uint8_t pressed;
+};
+
+static_assert(std::is_trivially_copyable_v<MovieHeader> && sizeof(MovieHeader) == 40);
+static_assert(std::is_trivially_copyable_v<MovieEvent> && sizeof(MovieEvent) == 8);
+
+// Everything needed to repeat a run exactly: the RNG seed, the CPU clock,
+// the variant and quirks, the ROM checksum and each key event with the
+// frame and instruction slot it was applied at. Frames without input cost
+// nothing, so hours of play are a few kilobytes. Replaying feeds the events
+// back through queueKeyEvent in the same slots, which makes the run
+// independent of wall clock time.
+class Movie
+{
+public:
+    auto start(uint32_t seed, uint32_t cpuHz, Variant variant, const Quirks& quirks, std::span<const uint8_t> rom)
+        -> void;
+    // Call alongside every Chip8::queueKeyEvent of the recorded run. With
+    // cpuHz at most MAX_CPU_HZ every slot fits the event's 16 bits.
+    auto record(const KeyEvent& event, int slot) -> void;
+    // Call after every tick
+    auto endFrame() -> void;
+    // Forgets the newest frame and its input, after a rewind step
+    auto dropLastFrame() -> void;
+    auto finish(const Chip8& chip8) -> void;
+
+    auto save(std::string_view path) const -> bool;
+    auto load(std::string_view path) -> bool;
+
+    // Seeds chip8, sets its variant and quirks and checks that rom is the one the
+    // movie was recorded on
+    auto prepare(Chip8& chip8, std::span<const uint8_t> rom) const -> bool;
+    // Queues the input of frame, call before that frame's tick
+    auto queueFrame(uint64_t frame, Chip8& chip8) const -> void;
+    // Runs frame as recorded: its input, then tick
+    auto playFrame(uint64_t frame, Chip8& chip8) const -> void;
+    // True when chip8 ended up where the recording did
+    [[nodiscard]] auto matches(const Chip8& chip8) const -> bool;
+
+    [[nodiscard]] auto seed() const -> uint32_t;
+    [[nodiscard]] auto cpuHz() const -> uint32_t;
+    [[nodiscard]] auto variant() const -> Variant;
+    [[nodiscard]] auto quirks() const -> Quirks;
+    [[nodiscard]] auto frames() const -> uint64_t;
+    [[nodiscard]] auto events() const -> std::span<const MovieEvent>;
+
+private:
+    MovieHeader m_header{};
+    std::vector<MovieEvent> m_events;
+};
+
+auto stateChecksum(const Chip8& chip8) -> uint32_t;
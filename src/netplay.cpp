@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "chip8.h"
+#include "movie.h"
+#include "random.h"
+#include "rollback.h"
+#include "scheduler.h"
+#include "udp_transport.h"
+
+// Two player rollback sessions over UDP. sim runs both players in this
+// process over localhost with a simulated link in between and checks they
+// end in the state a run without any network reaches; peer is one player
+// of a real session, started once per side.
+
+struct NetplayOptions
+{
+    std::string_view command;
+    const char* rom{};
+    uint64_t frames{3600};
+    double latencyMs{60.0};
+    double jitterMs{10.0};
+    double lossPercent{5.0};
+    int delay{};
+    int player{-1};
+    uint16_t port{};
+    std::string_view remoteHost;
+    uint16_t remotePort{};
+    uint32_t cpuHz{DEFAULT_CPU_HZ};
+    Variant variant{Variant::Chip8};
+    uint64_t seed{1};
+};
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_netplay sim <rom> [--frames N] [--latency MS] [--jitter MS] [--loss PERCENT] [--delay N]\n"
+        "       ./chip8_netplay peer <rom> --player 0|1 --port N --remote host:port [--frames N] [--delay N]\n"
+        "       both take [--hz N] [--variant chip8|schip|xochip] [--seed N]\n");
+}
+
+auto parseOptions(int argc, char** argv, NetplayOptions& options) -> bool
+{
+    if (argc < 3)
+        return false;
+    options.command = argv[1];
+    options.rom = argv[2];
+    for (int i = 3; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        if (arg == "--frames")
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--latency")
+            options.latencyMs = std::atof(argv[++i]);
+        else if (arg == "--jitter")
+            options.jitterMs = std::atof(argv[++i]);
+        else if (arg == "--loss")
+            options.lossPercent = std::atof(argv[++i]);
+        else if (arg == "--delay")
+            options.delay = std::atoi(argv[++i]);
+        else if (arg == "--player")
+            options.player = std::atoi(argv[++i]);
+        else if (arg == "--port")
+            options.port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        else if (arg == "--remote")
+        {
+            if (!parseHostPort(argv[++i], options.remoteHost, options.remotePort))
+                return false;
+        }
+        else if (arg == "--hz")
+            options.cpuHz = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--variant")
+        {
+            if (!variantFromName(argv[++i], options.variant))
+                return false;
+        }
+        else if (arg == "--seed")
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else
+            return false;
+    }
+
+    if (options.frames == 0 || options.cpuHz < TIMER_HZ || options.cpuHz > MAX_CPU_HZ || options.delay < 0 || options.delay > MAX_INPUT_DELAY)
+        return false;
+    if (options.command == "sim")
+        return options.latencyMs >= 0.0 && options.jitterMs >= 0.0 && options.lossPercent >= 0.0
+            && options.lossPercent < 100.0;
+    if (options.command == "peer")
+        return (options.player == 0 || options.player == 1) && options.port != 0 && options.remotePort != 0;
+    return false;
+}
+
+// Uniform in [0, 1)
+auto unit(Random& random) -> double
+{
+    return static_cast<double>(random.next() >> 11) * 0x1.0p-53;
+}
+
+// What a player holds each frame: nothing or one key, for a few frames to
+// most of a second at a time
+auto scriptInputs(uint64_t frames, uint64_t seed) -> std::vector<uint16_t>
+{
+    Random random(seed);
+    std::vector<uint16_t> inputs;
+    inputs.reserve(frames);
+    while (inputs.size() < frames)
+    {
+        auto keys = static_cast<uint16_t>(random.next() % 2 == 0 ? 0 : 1 << random.next() % KEY_SIZE);
+        uint64_t hold = 5 + random.next() % 40;
+        for (uint64_t i = 0; i < hold && inputs.size() < frames; i++)
+            inputs.push_back(keys);
+    }
+    return inputs;
+}
+
+// Input a session runs in frame, read delay frames earlier
+auto scriptedKeys(const std::vector<uint16_t>& inputs, uint64_t frame, int delay) -> uint16_t
+{
+    return frame < static_cast<uint64_t>(delay) ? 0 : inputs[frame - delay];
+}
+
+auto prepare(const NetplayOptions& options, Chip8& chip8) -> bool
+{
+    chip8.setVariant(options.variant);
+    chip8.setQuirks(variantQuirks(options.variant));
+    chip8.cpuReset();
+    chip8.seedRandom(static_cast<uint32_t>(options.seed));
+    return chip8.loadROM(options.rom);
+}
+
+// Holds every outgoing packet for the latency plus up to the jitter, so
+// packets also overtake each other, and drops a share of them. Time is
+// the harness's frame clock rather than the wall clock.
+class LossyLink : public NetTransport
+{
+public:
+    LossyLink(NetTransport& inner, const NetplayOptions& options, uint64_t seed)
+        : m_inner(inner), m_latencyMs(options.latencyMs), m_jitterMs(options.jitterMs),
+          m_loss(options.lossPercent / 100.0), m_random(seed)
+    {
+    }
+
+    // Hands every packet due by nowMs to the socket
+    auto setTime(double nowMs) -> void
+    {
+        m_nowMs = nowMs;
+        std::ranges::sort(m_queue, {}, &Delayed::dueMs);
+        auto due = std::ranges::find_if(m_queue, [&](const Delayed& d) { return d.dueMs > m_nowMs; });
+        for (auto it = m_queue.begin(); it != due; ++it)
+            m_inner.send(it->bytes);
+        m_queue.erase(m_queue.begin(), due);
+    }
+
+    auto send(std::span<const uint8_t> packet) -> bool override
+    {
+        m_sent++;
+        if (unit(m_random) < m_loss)
+        {
+            m_dropped++;
+            return true;
+        }
+        double dueMs = m_nowMs + m_latencyMs + m_jitterMs * unit(m_random);
+        m_queue.push_back(Delayed{dueMs, std::vector<uint8_t>(packet.begin(), packet.end())});
+        return true;
+    }
+
+    auto receive(std::span<uint8_t> buffer) -> size_t override
+    {
+        return m_inner.receive(buffer);
+    }
+
+    auto print(std::string_view name) const -> void
+    {
+        fmt::print("link {}: {} packets, {} dropped\n", name, m_sent, m_dropped);
+    }
+
+private:
+    struct Delayed
+    {
+        double dueMs;
+        std::vector<uint8_t> bytes;
+    };
+
+    NetTransport& m_inner;
+    double m_latencyMs;
+    double m_jitterMs;
+    double m_loss;
+    Random m_random;
+    double m_nowMs{};
+    std::vector<Delayed> m_queue;
+    uint64_t m_sent{};
+    uint64_t m_dropped{};
+};
+
+// Both players step once per simulated 60 Hz frame. A stalled player
+// retries the same input on the next one.
+auto simulate(const NetplayOptions& options) -> int
+{
+    UdpTransport udp0, udp1;
+    if (!udp0.open(0) || !udp1.open(0) || !udp0.connect("127.0.0.1", udp1.localPort())
+        || !udp1.connect("127.0.0.1", udp0.localPort()))
+        return 1;
+    LossyLink link0(udp0, options, options.seed * 2);
+    LossyLink link1(udp1, options, options.seed * 2 + 1);
+
+    Chip8 chip0, chip1, reference;
+    if (!prepare(options, chip0) || !prepare(options, chip1) || !prepare(options, reference))
+        return 1;
+    RollbackSession session0(chip0, link0, 0, options.cpuHz, options.delay);
+    RollbackSession session1(chip1, link1, 1, options.cpuHz, options.delay);
+    std::vector<uint16_t> inputs0 = scriptInputs(options.frames, options.seed * 2);
+    std::vector<uint16_t> inputs1 = scriptInputs(options.frames, options.seed * 2 + 1);
+
+    // Until both have run every frame, then until the last input of each
+    // has reached the other
+    const uint64_t limit = options.frames * 10 + 600;
+    uint64_t tick = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (; tick < limit; tick++)
+    {
+        bool done = session0.frame() == options.frames && session1.frame() == options.frames;
+        if (done && session0.confirmedFrame() == options.frames && session1.confirmedFrame() == options.frames)
+            break;
+        double nowMs = static_cast<double>(tick) * 1000.0 / TIMER_HZ;
+        link0.setTime(nowMs);
+        link1.setTime(nowMs);
+        if (session0.frame() < options.frames)
+            session0.advance(inputs0[session0.frame()]);
+        else
+            session0.poll();
+        if (session1.frame() < options.frames)
+            session1.advance(inputs1[session1.frame()]);
+        else
+            session1.poll();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (tick == limit)
+    {
+        fmt::print("The session did not finish in {} frames\n", limit);
+        return 1;
+    }
+
+    for (uint64_t f = 0; f < options.frames; f++)
+    {
+        uint16_t previous = f == 0 ? 0 : scriptedKeys(inputs0, f - 1, options.delay) | scriptedKeys(inputs1, f - 1,
+            options.delay);
+        applyNetplayInput(reference, previous, scriptedKeys(inputs0, f, options.delay) | scriptedKeys(inputs1, f,
+            options.delay));
+        reference.tick(instructionsInFrame(f, options.cpuHz));
+    }
+
+    fmt::print("simulated {} frames over {} ms +{} ms jitter with {}% loss, input delay {}, in {:.3f} s ({} frame steps)\n",
+        options.frames, options.latencyMs, options.jitterMs, options.lossPercent, options.delay, elapsed.count(),
+        tick);
+    link0.print("0->1");
+    link1.print("1->0");
+    fmt::print("player 0:\n");
+    session0.print();
+    fmt::print("player 1:\n");
+    session1.print();
+
+    uint32_t state0 = stateChecksum(chip0);
+    uint32_t state1 = stateChecksum(chip1);
+    uint32_t expected = stateChecksum(reference);
+    bool match = state0 == expected && state1 == expected;
+    fmt::print("final state: player 0 {:08x}, player 1 {:08x}, without network {:08x}: {}\n", state0, state1, expected,
+        match ? "match" : "MISMATCH");
+    return match && session0.stats().desyncs == 0 && session1.stats().desyncs == 0 ? 0 : 1;
+}
+
+// Paced at 60 Hz; time lost to a stall is caught up with frames back to
+// back. After the last frame the session keeps answering for a while so
+// the other side can settle too.
+auto runPeer(const NetplayOptions& options) -> int
+{
+    UdpTransport udp;
+    if (!udp.open(options.port) || !udp.connect(options.remoteHost, options.remotePort))
+        return 1;
+    Chip8 chip8;
+    if (!prepare(options, chip8))
+        return 1;
+    RollbackSession session(chip8, udp, options.player, options.cpuHz, options.delay);
+    std::vector<uint16_t> inputs = scriptInputs(options.frames, options.seed * 2 + options.player);
+
+    using Clock = std::chrono::steady_clock;
+    const auto frameTime = std::chrono::nanoseconds(TIMER_PERIOD_NS);
+    const auto pollTime = std::chrono::milliseconds(1);
+    auto next = Clock::now();
+    while (session.frame() < options.frames)
+    {
+        if (!session.advance(inputs[session.frame()]))
+        {
+            std::this_thread::sleep_for(pollTime);
+            continue;
+        }
+        next += frameTime;
+        std::this_thread::sleep_until(next);
+    }
+
+    auto deadline = Clock::now() + std::chrono::seconds(5);
+    while (session.confirmedFrame() < options.frames && Clock::now() < deadline)
+    {
+        session.poll();
+        std::this_thread::sleep_for(pollTime);
+    }
+    auto linger = Clock::now() + std::chrono::seconds(1);
+    while (Clock::now() < linger)
+    {
+        session.poll();
+        std::this_thread::sleep_for(pollTime);
+    }
+
+    session.print();
+    if (session.confirmedFrame() < options.frames)
+    {
+        fmt::print("player {}: the other side stopped answering at frame {}\n", options.player,
+            session.confirmedFrame());
+        return 1;
+    }
+    fmt::print("player {}: final state {:08x}\n", options.player, stateChecksum(chip8));
+    return session.stats().desyncs == 0 ? 0 : 1;
+}
+
+auto main(int argc, char** argv) -> int
+{
+    NetplayOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+    return options.command == "sim" ? simulate(options) : runPeer(options);
+}
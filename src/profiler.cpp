@@ -0,0 +1,185 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <string>
+
+#include <fmt/core.h>
+
+namespace
+{
+
+constexpr const std::array<const char*, 16> classNames =
+{
+    "00E0/00EE", "1NNN jump", "2NNN call", "3XNN skip", "4XNN skip", "5XY0 skip", "6XNN load", "7XNN add",
+    "8XYN alu", "9XY0 skip", "ANNN index", "BNNN jump", "CXNN random", "DXYN draw", "EXNN keys", "FXNN misc",
+};
+
+// Trace timestamps are microseconds
+auto micros(int64_t ns) -> double
+{
+    return static_cast<double>(ns) / 1000.0;
+}
+
+}
+
+auto ExecutionProfile::endFrame() -> void
+{
+    drawsPerFrame[std::min<uint32_t>(drawsThisFrame, maxDrawBucket)]++;
+    if (frameSamples.size() < maxFrameSamples)
+        frameSamples.push_back(FrameSample{steadyNowNs(), drawsThisFrame});
+    drawsThisFrame = 0;
+    frames++;
+}
+
+auto ExecutionProfile::print(int hotPCs) const -> void
+{
+    uint64_t total = std::accumulate(classCounts.begin(), classCounts.end(), uint64_t{0});
+    fmt::print("{} instructions over {} frames\n", total, frames);
+    if (total == 0)
+        return;
+
+    fmt::print("{:<12} {:>14} {:>7}\n", "class", "count", "share");
+    for (size_t c = 0; c < classCounts.size(); c++)
+    {
+        if (classCounts[c] != 0)
+            fmt::print("{:<12} {:>14} {:>6.2f}%\n", classNames[c], classCounts[c], 100.0 * classCounts[c] / total);
+    }
+
+    std::vector<uint16_t> pcs;
+    for (int pc = 0; pc < MAX_MEM_SIZE; pc++)
+    {
+        if (pcCounts[pc] != 0)
+            pcs.push_back(static_cast<uint16_t>(pc));
+    }
+    auto shown = std::min<size_t>(pcs.size(), hotPCs);
+    std::partial_sort(pcs.begin(), pcs.begin() + shown, pcs.end(),
+        [&](uint16_t a, uint16_t b) { return pcCounts[a] > pcCounts[b]; });
+    fmt::print("{:<12} {:>14} {:>7}  opcode\n", "hot pc", "count", "share");
+    for (size_t i = 0; i < shown; i++)
+    {
+        uint16_t pc = pcs[i];
+        fmt::print("0x{:04X}       {:>14} {:>6.2f}%  {:04X}\n", pc, pcCounts[pc], 100.0 * pcCounts[pc] / total,
+            pcOpcodes[pc]);
+    }
+
+    uint64_t draws = 0;
+    int maxDraws = 0;
+    for (int d = 0; d <= maxDrawBucket; d++)
+    {
+        draws += drawsPerFrame[d] * d;
+        if (drawsPerFrame[d] != 0)
+            maxDraws = d;
+    }
+    fmt::print("sprite draws per frame: mean {:.2f}, max {}{}\n", frames > 0 ? static_cast<double>(draws) / frames : 0.0,
+        maxDraws, maxDraws == maxDrawBucket ? "+" : "");
+}
+
+ProfileTrack::ProfileTrack(std::string name) : m_name(std::move(name))
+{
+}
+
+auto ProfileTrack::record(const char* name, int64_t startNs, int64_t endNs) -> void
+{
+    int64_t duration = endNs - startNs;
+    if (m_events.size() < maxEvents)
+        m_events.push_back(TraceEvent{name, startNs, duration});
+    else
+        m_dropped++;
+
+    auto it = std::ranges::find(m_totals, name, &PhaseTotals::name);
+    if (it == m_totals.end())
+        it = m_totals.insert(it, PhaseTotals{name, 0, 0, 0});
+    it->count++;
+    it->totalNs += duration;
+    it->maxNs = std::max(it->maxNs, duration);
+}
+
+auto ProfileTrack::name() const -> std::string_view
+{
+    return m_name;
+}
+
+auto ProfileTrack::events() const -> const std::vector<TraceEvent>&
+{
+    return m_events;
+}
+
+auto ProfileTrack::totals() const -> const std::vector<PhaseTotals>&
+{
+    return m_totals;
+}
+
+auto ProfileTrack::dropped() const -> uint64_t
+{
+    return m_dropped;
+}
+
+Profiler::Profiler() : m_startNs(steadyNowNs())
+{
+}
+
+auto Profiler::execution() -> ExecutionProfile&
+{
+    return m_execution;
+}
+
+auto Profiler::track(std::string name) -> ProfileTrack&
+{
+    return m_tracks.emplace_back(std::move(name));
+}
+
+auto Profiler::writeTrace(std::string_view path) const -> bool
+{
+    FILE* out = std::fopen(std::string(path).c_str(), "w");
+    if (out == nullptr)
+    {
+        fmt::print("Could not open the file {} for writing\n", path);
+        return false;
+    }
+
+    fmt::print(out, "{{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fmt::print(out, "{{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {{\"name\": \"chip8\"}}}}");
+    for (size_t t = 0; t < m_tracks.size(); t++)
+    {
+        const ProfileTrack& track = m_tracks[t];
+        fmt::print(out, ",\n{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, \"args\": {{\"name\": \"{}\"}}}}",
+            t, track.name());
+        for (const TraceEvent& e : track.events())
+        {
+            fmt::print(out, ",\n{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}}}",
+                e.name, t, micros(e.startNs - m_startNs), micros(e.durationNs));
+        }
+    }
+    for (const auto& sample : m_execution.frameSamples)
+    {
+        fmt::print(out, ",\n{{\"name\": \"sprite draws\", \"ph\": \"C\", \"pid\": 1, \"ts\": {:.3f}, \"args\": {{\"draws\": {}}}}}",
+            micros(sample.timeNs - m_startNs), sample.draws);
+    }
+    fmt::print(out, "\n]}}\n");
+
+    bool ok = std::ferror(out) == 0;
+    std::fclose(out);
+    if (!ok)
+        fmt::print("Could not write the trace {}\n", path);
+    return ok;
+}
+
+auto Profiler::print() const -> void
+{
+    m_execution.print();
+    for (const ProfileTrack& track : m_tracks)
+    {
+        if (track.totals().empty())
+            continue;
+        fmt::print("{:<12} {:>10} {:>12} {:>10} {:>10}\n", track.name(), "count", "total ms", "mean us", "max us");
+        for (const PhaseTotals& phase : track.totals())
+        {
+            fmt::print("  {:<10} {:>10} {:>12.2f} {:>10.2f} {:>10.2f}\n", phase.name, phase.count, phase.totalNs / 1e6,
+                micros(phase.totalNs) / phase.count, micros(phase.maxNs));
+        }
+        if (track.dropped() != 0)
+            fmt::print("  {} events not kept for the trace\n", track.dropped());
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chip8.h"
+#include "input.h"
+
+struct TraceEvent
+{
+    const char* name;
+    int64_t startNs;
+    int64_t durationNs;
+};
+
+struct PhaseTotals
+{
+    const char* name;
+    uint64_t count;
+    int64_t totalNs;
+    int64_t maxNs;
+};
+
+// What the ROM executes: counts per opcode class (the top nibble), per
+// address and sprite draws per frame. Filled by Chip8 only while attached
+// with setProfiler; an instance belongs to the emulation thread.
+class ExecutionProfile
+{
+public:
+    auto instruction(uint16_t pc, uint16_t opcode) -> void
+    {
+        classCounts[opcode >> 12]++;
+        pcCounts[pc]++;
+        pcOpcodes[pc] = opcode;
+        if ((opcode >> 12) == 0xD)
+            drawsThisFrame++;
+    }
+
+    auto endFrame() -> void;
+    auto print(int hotPCs = 16) const -> void;
+
+private:
+    friend class Profiler;
+
+    constexpr static int maxDrawBucket = 64;
+    // Per frame counters kept for the trace, older frames only count
+    // towards the totals
+    constexpr static size_t maxFrameSamples = 1 << 20;
+
+    struct FrameSample
+    {
+        int64_t timeNs;
+        uint32_t draws;
+    };
+
+    std::array<uint64_t, 16> classCounts{};
+    std::array<uint64_t, MAX_MEM_SIZE> pcCounts{};
+    std::array<uint16_t, MAX_MEM_SIZE> pcOpcodes{};
+    std::array<uint64_t, maxDrawBucket + 1> drawsPerFrame{};
+    std::vector<FrameSample> frameSamples;
+    uint32_t drawsThisFrame{};
+    uint64_t frames{};
+};
+
+// Timed spans from one thread, shown as one row of the trace
+class ProfileTrack
+{
+public:
+    explicit ProfileTrack(std::string name);
+
+    auto record(const char* name, int64_t startNs, int64_t endNs) -> void;
+
+    [[nodiscard]] auto name() const -> std::string_view;
+    [[nodiscard]] auto events() const -> const std::vector<TraceEvent>&;
+    [[nodiscard]] auto totals() const -> const std::vector<PhaseTotals>&;
+    [[nodiscard]] auto dropped() const -> uint64_t;
+
+private:
+    constexpr static size_t maxEvents = 1 << 20;
+
+    std::string m_name;
+    std::vector<TraceEvent> m_events;
+    // Phase names are string literals, so totals are keyed by pointer
+    std::vector<PhaseTotals> m_totals;
+    uint64_t m_dropped{};
+};
+
+// Owns the execution profile and one track per thread. Create every track
+// before the threads start; export once they have stopped.
+class Profiler
+{
+public:
+    Profiler();
+    Profiler(const Profiler& p) = delete;
+    Profiler(Profiler&& p) = delete;
+    auto operator=(const Profiler& p) -> Profiler& = delete;
+    auto operator=(Profiler&& p) -> Profiler& = delete;
+    ~Profiler() = default;
+
+    auto execution() -> ExecutionProfile&;
+    auto track(std::string name) -> ProfileTrack&;
+
+    // Chrome trace_event JSON, for chrome://tracing or Perfetto
+    auto writeTrace(std::string_view path) const -> bool;
+    auto print() const -> void;
+
+private:
+    int64_t m_startNs;
+    ExecutionProfile m_execution;
+    std::deque<ProfileTrack> m_tracks;
+};
+
+#if CHIP8_PROFILE
+
+// Times its own lifetime onto track, does nothing when track is null
+class ProfileScope
+{
+public:
+    ProfileScope(ProfileTrack* track, const char* name)
+        : m_track(track), m_name(name), m_startNs(track != nullptr ? steadyNowNs() : 0)
+    {
+    }
+    ProfileScope(const ProfileScope& s) = delete;
+    ProfileScope(ProfileScope&& s) = delete;
+    auto operator=(const ProfileScope& s) -> ProfileScope& = delete;
+    auto operator=(ProfileScope&& s) -> ProfileScope& = delete;
+    ~ProfileScope()
+    {
+        if (m_track != nullptr)
+            m_track->record(m_name, m_startNs, steadyNowNs());
+    }
+
+private:
+    ProfileTrack* m_track;
+    const char* m_name;
+    int64_t m_startNs;
+};
+
+#else
+
+class ProfileScope
+{
+public:
+    ProfileScope(ProfileTrack* /*track*/, const char* /*name*/) {}
+};
+
+#endif
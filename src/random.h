@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// SplitMix64. The whole generator state is one word, so savestates and
+// replays capture it exactly; the standard engines only expose theirs
+// through stream operators.
+class Random
+{
+public:
+    explicit Random(uint64_t seed = 0) : m_state(seed) {}
+
+    auto next() -> uint64_t
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        return z ^ (z >> 31);
+    }
+
+    auto nextByte() -> uint8_t
+    {
+        return static_cast<uint8_t>(next() >> 56);
+    }
+
+    [[nodiscard]] auto state() const -> uint64_t
+    {
+        return m_state;
+    }
+
+    auto setState(uint64_t state) -> void
+    {
+        m_state = state;
+    }
+
+private:
+    uint64_t m_state;
+};
@@ -2,14 +2,19 @@
 
 #include <glad/glad.h>
 #include "window.h"
+#include "embedded_shaders.h"
 
-Renderer::Renderer(int width, int height) : m_width(width), m_height(height)
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+Renderer::Renderer(std::string_view shaderCache)
 {
-    loadAssets();
+    loadAssets(shaderCache);
     setUniformsAndBindVao();
 }
 
-auto Renderer::loadAssets() -> void
+auto Renderer::loadAssets(std::string_view shaderCache) -> void
 {
     std::vector<Model::Vertex> v{
         {{{-1.0f}, {-1.0f}}, {{0.0f}, {0.0f}}},
@@ -20,8 +25,17 @@ auto Renderer::loadAssets() -> void
     std::vector<int> i{0, 1, 2, 2, 3, 0};
 
     m_model = std::make_unique<Model>(v, i);
-    m_texture = std::make_unique<Texture>(m_width, m_height);
-    m_shader = std::make_unique<Shader>("../resources/unlit.vert", "../resources/unlit.frag");
+    // The packed rows are uploaded as is and unpacked in unlit.frag
+    const int texelsPerRow = sizeof(DisplayRow) / sizeof(uint32_t);
+    m_texture = std::make_unique<Texture>(texelsPerRow, HIRES_HEIGHT, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT);
+
+    if (PixelBuffer::supported())
+    {
+        m_pixelBuffer = std::make_unique<PixelBuffer>(sizeof(DisplayRows));
+        if (!m_pixelBuffer->valid())
+            m_pixelBuffer.reset();
+    }
+    m_shader = std::make_unique<Shader>(UNLIT_VERT_SHADER, UNLIT_FRAG_SHADER, shaderCache);
 }
 
 auto Renderer::setUniformsAndBindVao() -> void
@@ -35,18 +49,82 @@ auto Renderer::setUniformsAndBindVao() -> void
 
     m_shader->use();
     m_shader->setInt("u_main_tex", 0);
+    m_shader->setIVec2("u_resolution", m_width, m_height);
+    // Indexed by the plane bits of a pixel, XO-CHIP can use all four
+    m_shader->setVec3("u_palette[0]", 0.0f, 0.0f, 0.0f);
+    m_shader->setVec3("u_palette[1]", 1.0f, 1.0f, 1.0f);
+    m_shader->setVec3("u_palette[2]", 0.45f, 0.45f, 0.45f);
+    m_shader->setVec3("u_palette[3]", 0.75f, 0.75f, 0.75f);
     m_shader->setVec3("u_tint", r, g, b);
 
     glBindVertexArray(m_model->vao());
 }
 
-auto Renderer::render(unsigned char* screen) -> void
+auto Renderer::render(const DisplayRows& display, int width, int height, uint64_t dirtyRows) -> void
 {
-    m_texture->update(screen);
+    if (width != m_width || height != m_height)
+    {
+        m_width = width;
+        m_height = height;
+        m_shader->setIVec2("u_resolution", m_width, m_height);
+    }
+    upload(display, dirtyRows);
     clear();
     renderScreen();
 }
 
+auto Renderer::uploadStats() const -> const UploadStats&
+{
+    return m_stats;
+}
+
+auto Renderer::shaderFromCache() const -> bool
+{
+    return m_shader->fromCache();
+}
+
+auto Renderer::upload(const DisplayRows& display, uint64_t dirtyRows) -> void
+{
+    m_stats.frames++;
+    m_stats.lastFrameBytes = 0;
+    if (m_height < 64)
+        dirtyRows &= (uint64_t{1} << m_height) - 1;
+    if (dirtyRows == 0)
+    {
+        m_stats.skippedFrames++;
+        return;
+    }
+
+    const size_t rowBytes = sizeof(DisplayRow);
+    const auto* source = reinterpret_cast<const unsigned char*>(display.data());
+    unsigned char* staging = m_pixelBuffer ? m_pixelBuffer->acquire() : nullptr;
+
+    // One glTexSubImage2D per run of consecutive dirty rows
+    while (dirtyRows != 0)
+    {
+        const int first = std::countr_zero(dirtyRows);
+        const int count = std::countr_one(dirtyRows >> first);
+        dirtyRows &= count + first < 64 ? ~((uint64_t{1} << (count + first)) - 1) : 0;
+
+        const size_t offset = first * rowBytes;
+        const size_t bytes = count * rowBytes;
+        const void* pixels = source + offset;
+        if (staging != nullptr)
+        {
+            std::memcpy(staging + offset, source + offset, bytes);
+            pixels = reinterpret_cast<const void*>(m_pixelBuffer->slotOffset() + offset);
+        }
+        m_texture->updateRows(pixels, first, count);
+        m_stats.lastFrameBytes += bytes;
+    }
+
+    if (staging != nullptr)
+        m_pixelBuffer->release();
+
+    m_stats.totalBytes += m_stats.lastFrameBytes;
+    m_stats.maxFrameBytes = std::max(m_stats.maxFrameBytes, m_stats.lastFrameBytes);
+}
+
 auto Renderer::renderScreen() -> void
 {
     glDrawElements(GL_TRIANGLES, m_model->indicesSize(), GL_UNSIGNED_INT, nullptr);
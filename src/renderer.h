@@ -1,20 +1,39 @@
 #pragma once
 
 #include "asset.h"
+#include "display.h"
 
+#include <cstdint>
 #include <memory>
+#include <string_view>
 #include <vector>
 
 
 class Renderer
 {
 public:
-
-    Renderer(int width, int height);
-    auto render(unsigned char* screen) -> void;
+    struct UploadStats
+    {
+        uint64_t frames;
+        uint64_t skippedFrames;
+        uint64_t totalBytes;
+        uint64_t lastFrameBytes;
+        uint64_t maxFrameBytes;
+    };
+
+    // The texture holds the largest display, lower resolutions use its top
+    // left corner. The shader program is cached in shaderCache unless empty.
+    explicit Renderer(std::string_view shaderCache = {});
+    // Shows the width x height pixels of display. Only rows set in
+    // dirtyRows are uploaded, a change of resolution only sets a uniform.
+    auto render(const DisplayRows& display, int width, int height, uint64_t dirtyRows) -> void;
+    [[nodiscard]] auto uploadStats() const -> const UploadStats&;
+    // Whether the program came out of the shader cache
+    [[nodiscard]] auto shaderFromCache() const -> bool;
 
 private:
-    auto loadAssets() -> void;
+    auto loadAssets(std::string_view shaderCache) -> void;
+    auto upload(const DisplayRows& display, uint64_t dirtyRows) -> void;
     auto setUniformsAndBindVao() -> void;
     auto renderScreen() -> void;
     auto clear() -> void;
@@ -22,6 +41,9 @@ private:
     std::unique_ptr<Model> m_model;
     std::unique_ptr<Texture> m_texture;
     std::unique_ptr<Shader> m_shader;
+    std::unique_ptr<PixelBuffer> m_pixelBuffer;
+    UploadStats m_stats{};
 
-    int m_width, m_height;
+    int m_width{SCREEN_WIDTH};
+    int m_height{SCREEN_HEIGHT};
 };
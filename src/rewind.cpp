@@ -0,0 +1,294 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fmt/core.h>
+
+namespace
+{
+
+// Run header: words left unchanged, then changed words that follow
+struct Run
+{
+    uint16_t skip;
+    uint16_t count;
+};
+
+auto wordAt(std::span<const uint8_t> state, size_t word) -> uint64_t
+{
+    uint64_t value;
+    std::memcpy(&value, state.data() + word * sizeof(value), sizeof(value));
+    return value;
+}
+
+auto nanosecondsSince(std::chrono::steady_clock::time_point start) -> uint64_t
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+Rewind::Rewind(size_t budgetBytes, int keyframeInterval)
+    : m_ring(std::max(budgetBytes, 4 * SAVESTATE_SIZE)),
+      m_keyframeInterval(std::max(keyframeInterval, 1))
+{
+}
+
+auto Rewind::record(const Chip8& chip8) -> void
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if (chip8.snapshotSize() != m_stateWords * sizeof(uint64_t))
+    {
+        clear();
+        resize(chip8.snapshotSize());
+    }
+    std::vector<uint8_t>& current = m_states[m_newest ^ 1];
+    chip8.snapshot(current);
+
+    bool keyframe = m_entries.empty() || m_sinceKeyframe >= m_keyframeInterval;
+    size_t size = encode(current, keyframe ? m_zero : m_states[m_newest]);
+    append(size, keyframe);
+    // The budget couldn't hold the delta and its keyframe together
+    if (!m_entries.back().keyframe && m_entries.size() == 1)
+    {
+        m_entries.clear();
+        m_used = 0;
+        append(encode(current, m_zero), true);
+    }
+
+    m_newest ^= 1;
+    m_stats.recorded++;
+    m_stats.encodedBytes += m_entries.back().size;
+    m_stats.recordNs += nanosecondsSince(start);
+}
+
+auto Rewind::seek(uint64_t frame, Chip8& chip8) -> bool
+{
+    if (m_entries.empty() || frame < firstFrame() || frame > lastFrame()
+        || chip8.snapshotSize() != m_stateWords * sizeof(uint64_t))
+        return false;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t>& state = m_states[m_newest ^ 1];
+    decodeFrame(frame - m_firstFrame, state);
+    chip8.restore(state);
+
+    uint64_t ns = nanosecondsSince(start);
+    m_stats.seeks++;
+    m_stats.seekNs += ns;
+    m_stats.maxSeekNs = std::max(m_stats.maxSeekNs, ns);
+    return true;
+}
+
+auto Rewind::stepBack(Chip8& chip8) -> bool
+{
+    if (m_entries.size() < 2)
+        return false;
+
+    m_head = m_entries.back().offset;
+    m_used -= m_entries.back().size;
+    m_entries.pop_back();
+
+    if (!seek(lastFrame(), chip8))
+        return false;
+    // Recording resumes against the restored frame
+    m_newest ^= 1;
+
+    m_sinceKeyframe = 0;
+    for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it)
+    {
+        m_sinceKeyframe++;
+        if (it->keyframe)
+            break;
+    }
+    return true;
+}
+
+auto Rewind::clear() -> void
+{
+    m_entries.clear();
+    m_head = 0;
+    m_used = 0;
+    m_firstFrame = 0;
+    m_sinceKeyframe = 0;
+}
+
+auto Rewind::empty() const -> bool
+{
+    return m_entries.empty();
+}
+
+auto Rewind::firstFrame() const -> uint64_t
+{
+    return m_firstFrame;
+}
+
+auto Rewind::lastFrame() const -> uint64_t
+{
+    return m_firstFrame + m_entries.size() - 1;
+}
+
+auto Rewind::frames() const -> size_t
+{
+    return m_entries.size();
+}
+
+auto Rewind::bytesUsed() const -> size_t
+{
+    return m_used;
+}
+
+auto Rewind::bytesPerFrame() const -> double
+{
+    return m_entries.empty() ? 0.0 : static_cast<double>(m_used) / m_entries.size();
+}
+
+auto Rewind::stats() const -> const RewindStats&
+{
+    return m_stats;
+}
+
+auto Rewind::print() const -> void
+{
+    double recordNs = m_stats.recorded > 0 ? static_cast<double>(m_stats.recordNs) / m_stats.recorded : 0.0;
+    double seekUs = m_stats.seeks > 0 ? m_stats.seekNs / 1000.0 / m_stats.seeks : 0.0;
+    fmt::print("rewind: {} frames ({:.1f} s at 60 Hz) in {} of {} bytes, {:.1f} bytes/frame, {} keyframes, {} evicted\n",
+        frames(), frames() / 60.0, m_used, m_ring.size(), bytesPerFrame(), m_stats.keyframes, m_stats.evicted);
+    fmt::print("rewind: record {:.0f} ns/frame, {} seeks, mean {:.2f} us, max {:.2f} us\n",
+        recordNs, m_stats.seeks, seekUs, m_stats.maxSeekNs / 1000.0);
+}
+
+// Sizes the states and the scratch space for snapshots of stateSize bytes
+auto Rewind::resize(size_t stateSize) -> void
+{
+    m_stateWords = stateSize / sizeof(uint64_t);
+    for (std::vector<uint8_t>& state : m_states)
+        state.assign(stateSize, 0);
+    m_zero.assign(stateSize, 0);
+    m_encoded.resize(stateSize + (m_stateWords / 2 + 1) * sizeof(Run));
+}
+
+// XOR against base, coded as runs of unchanged and changed words
+auto Rewind::encode(std::span<const uint8_t> current, std::span<const uint8_t> base) -> size_t
+{
+    const size_t stateWords = m_stateWords;
+    uint8_t* out = m_encoded.data();
+    size_t i = 0;
+    while (i < stateWords)
+    {
+        size_t start = i;
+        while (i < stateWords && wordAt(current, i) == wordAt(base, i))
+            i++;
+        if (i == stateWords)
+            break;
+
+        size_t literal = i;
+        while (i < stateWords && wordAt(current, i) != wordAt(base, i))
+            i++;
+
+        Run run{static_cast<uint16_t>(literal - start), static_cast<uint16_t>(i - literal)};
+        std::memcpy(out, &run, sizeof(run));
+        out += sizeof(run);
+        for (size_t w = literal; w < i; w++)
+        {
+            uint64_t diff = wordAt(current, w) ^ wordAt(base, w);
+            std::memcpy(out, &diff, sizeof(diff));
+            out += sizeof(diff);
+        }
+    }
+    return out - m_encoded.data();
+}
+
+auto Rewind::apply(const Entry& entry, std::span<uint8_t> state) const -> void
+{
+    uint8_t* words = state.data();
+    const uint8_t* in = m_ring.data() + entry.offset;
+    const uint8_t* end = in + entry.size;
+    size_t word = 0;
+    while (in < end)
+    {
+        Run run;
+        std::memcpy(&run, in, sizeof(run));
+        in += sizeof(run);
+        word += run.skip;
+        for (int w = 0; w < run.count; w++, word++)
+        {
+            uint64_t diff;
+            std::memcpy(&diff, in, sizeof(diff));
+            in += sizeof(diff);
+            diff ^= wordAt(state, word);
+            std::memcpy(words + word * sizeof(diff), &diff, sizeof(diff));
+        }
+    }
+}
+
+// Rebuilds the state of the entry at index
+auto Rewind::decodeFrame(size_t index, std::span<uint8_t> state) const -> void
+{
+    size_t key = index;
+    while (!m_entries[key].keyframe)
+        key--;
+
+    std::ranges::fill(state, 0);
+    for (size_t i = key; i <= index; i++)
+        apply(m_entries[i], state);
+}
+
+// Copies m_encoded into the ring as the newest entry, evicting the oldest
+// segments until it fits. Entries never wrap; the tail end of the ring is
+// skipped instead.
+auto Rewind::append(size_t size, bool keyframe) -> void
+{
+    size_t offset = 0;
+    while (true)
+    {
+        if (m_entries.empty())
+        {
+            offset = 0;
+            break;
+        }
+        size_t tail = m_entries.front().offset;
+        bool wrapped = m_entries.back().offset < tail;
+        if (!wrapped && m_head + size <= m_ring.size())
+        {
+            offset = m_head;
+            break;
+        }
+        if (!wrapped && size <= tail)
+        {
+            offset = 0;
+            break;
+        }
+        if (wrapped && m_head + size <= tail)
+        {
+            offset = m_head;
+            break;
+        }
+        evictSegment();
+    }
+
+    std::memcpy(m_ring.data() + offset, m_encoded.data(), size);
+    m_entries.push_back(Entry{offset, static_cast<uint32_t>(size), keyframe});
+    m_head = offset + size;
+    m_used += size;
+    if (keyframe)
+    {
+        m_stats.keyframes++;
+        m_sinceKeyframe = 0;
+    }
+    m_sinceKeyframe++;
+}
+
+// Drops the oldest keyframe and the deltas that depend on it
+auto Rewind::evictSegment() -> void
+{
+    do
+    {
+        m_used -= m_entries.front().size;
+        m_entries.pop_front();
+        m_firstFrame++;
+        m_stats.evicted++;
+    } while (!m_entries.empty() && !m_entries.front().keyframe);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <vector>
+
+#include "chip8.h"
+#include "savestate.h"
+
+struct RewindStats
+{
+    uint64_t recorded{};
+    uint64_t keyframes{};
+    uint64_t evicted{};
+    uint64_t encodedBytes{};
+    uint64_t recordNs{};
+    uint64_t seeks{};
+    uint64_t seekNs{};
+    uint64_t maxSeekNs{};
+};
+
+// History of recent frames in a fixed byte budget. Every frame is stored
+// as the XOR of its snapshot against the previous frame's, run length
+// coded over 64-bit words, so a frame that changed a handful of bytes costs
+// a few dozen. Every keyframeInterval frames the state is stored against
+// zero instead. The oldest segment, a keyframe and its deltas, is dropped
+// when the budget runs out. Seeking decodes one keyframe and at most
+// keyframeInterval - 1 deltas. Snapshots only cover the memory the variant
+// addresses, so a change of variant starts the history over.
+class Rewind
+{
+public:
+    explicit Rewind(size_t budgetBytes, int keyframeInterval = 60);
+    Rewind(const Rewind& r) = delete;
+    Rewind(Rewind&& r) = delete;
+    auto operator=(const Rewind& r) -> Rewind& = delete;
+    auto operator=(Rewind&& r) -> Rewind& = delete;
+    ~Rewind() = default;
+
+    // Call once per frame, after tick()
+    auto record(const Chip8& chip8) -> void;
+    // Restores the state recorded for frame
+    auto seek(uint64_t frame, Chip8& chip8) -> bool;
+    // Restores the previous frame and forgets the newest one, so recording
+    // continues from there
+    auto stepBack(Chip8& chip8) -> bool;
+    auto clear() -> void;
+
+    [[nodiscard]] auto empty() const -> bool;
+    [[nodiscard]] auto firstFrame() const -> uint64_t;
+    [[nodiscard]] auto lastFrame() const -> uint64_t;
+    [[nodiscard]] auto frames() const -> size_t;
+    [[nodiscard]] auto bytesUsed() const -> size_t;
+    [[nodiscard]] auto bytesPerFrame() const -> double;
+    [[nodiscard]] auto stats() const -> const RewindStats&;
+    auto print() const -> void;
+
+private:
+    struct Entry
+    {
+        size_t offset;
+        uint32_t size;
+        bool keyframe;
+    };
+
+    static_assert(sizeof(SaveStatePayload) % sizeof(uint64_t) == 0 && MEM_SIZE % sizeof(uint64_t) == 0);
+
+    auto resize(size_t stateSize) -> void;
+    auto encode(std::span<const uint8_t> current, std::span<const uint8_t> base) -> size_t;
+    auto apply(const Entry& entry, std::span<uint8_t> state) const -> void;
+    auto append(size_t size, bool keyframe) -> void;
+    auto evictSegment() -> void;
+    auto decodeFrame(size_t index, std::span<uint8_t> state) const -> void;
+
+    std::vector<uint8_t> m_ring;
+    size_t m_head{};
+    size_t m_used{};
+    std::deque<Entry> m_entries;
+    uint64_t m_firstFrame{};
+    int m_keyframeInterval;
+    int m_sinceKeyframe{};
+
+    // The newest recorded frame and scratch space for the next one; they
+    // trade places instead of being copied. All three hold m_stateWords
+    // words, the snapshot size of the variant being recorded.
+    std::array<std::vector<uint8_t>, 2> m_states;
+    size_t m_newest{};
+    std::vector<uint8_t> m_zero;
+    size_t m_stateWords{};
+    std::vector<uint8_t> m_encoded;
+
+    RewindStats m_stats;
+};
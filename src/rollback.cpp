@@ -0,0 +1,246 @@
+#include "rollback.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <fmt/core.h>
+
+#include "checksum.h"
+#include "input.h"
+#include "scheduler.h"
+
+auto applyNetplayInput(Chip8& chip8, uint16_t previous, uint16_t current) -> void
+{
+    uint16_t changed = previous ^ current;
+    for (bool pressed : {false, true})
+    {
+        for (int k = 0; k < KEY_SIZE; k++)
+        {
+            bool down = (current >> k & 1) != 0;
+            if ((changed >> k & 1) != 0 && down == pressed)
+                chip8.queueKeyEvent(KeyEvent{0, static_cast<uint8_t>(k), pressed}, 0);
+        }
+    }
+}
+
+RollbackSession::RollbackSession(Chip8& chip8, NetTransport& transport, int localPlayer, uint32_t cpuHz,
+    int inputDelay)
+    : m_chip8(chip8), m_transport(transport), m_local(localPlayer), m_remote(1 - localPlayer), m_cpuHz(cpuHz),
+      m_inputDelay(std::clamp(inputDelay, 0, MAX_INPUT_DELAY)),
+      m_states(MAX_ROLLBACK_FRAMES + 1, std::vector<uint8_t>(chip8.snapshotSize())), m_packet(MAX_NET_PACKET)
+{
+    // Nobody presses anything during the delay, on either side
+    m_localNext = m_inputDelay;
+    m_remoteConfirmed = m_inputDelay;
+}
+
+auto RollbackSession::advance(uint16_t localKeys) -> bool
+{
+    receive();
+    rollback();
+    // Any further and the state a late remote input has to go back to
+    // would no longer be kept
+    bool run = m_frame < m_remoteConfirmed + MAX_ROLLBACK_FRAMES;
+    if (run)
+    {
+        keys(m_local, m_localNext++) = localKeys;
+        runFrame();
+    }
+    else
+    {
+        m_stats.stalls++;
+    }
+    checkConfirmed();
+    send();
+    return run;
+}
+
+auto RollbackSession::poll() -> void
+{
+    receive();
+    rollback();
+    checkConfirmed();
+    send();
+}
+
+auto RollbackSession::frame() const -> uint64_t
+{
+    return m_frame;
+}
+
+auto RollbackSession::confirmedFrame() const -> uint64_t
+{
+    return std::min(m_frame, m_remoteConfirmed);
+}
+
+auto RollbackSession::stats() const -> const NetplayStats&
+{
+    return m_stats;
+}
+
+auto RollbackSession::print() const -> void
+{
+    const NetplayStats& s = m_stats;
+    double resimulated = static_cast<double>(s.resimulatedFrames);
+    double rollbacks = static_cast<double>(s.rollbacks);
+    double runs = static_cast<double>(m_frame + s.resimulatedFrames);
+    fmt::print("netplay: {} frames, {} rollbacks ({:.2f} frames average, {} max), {} frames re-simulated\n", m_frame,
+        s.rollbacks, s.rollbacks > 0 ? resimulated / rollbacks : 0.0, s.maxRollback, s.resimulatedFrames);
+    fmt::print("netplay: re-simulation {:.2f} us per rolled back frame, restore {:.2f} us per rollback, "
+        "snapshot {:.2f} us per frame\n", s.resimulatedFrames > 0 ? s.resimulateNs / resimulated / 1e3 : 0.0,
+        s.rollbacks > 0 ? s.restoreNs / rollbacks / 1e3 : 0.0, runs > 0.0 ? s.snapshotNs / runs / 1e3 : 0.0);
+    fmt::print("netplay: {} of {} predicted frames wrong, {} stalls\n", s.mispredictions, s.predictions, s.stalls);
+    fmt::print("netplay: {} packets sent, {} received, {} bad, {} checksums compared, {} desyncs\n", s.packetsSent,
+        s.packetsReceived, s.badPackets, s.checks, s.desyncs);
+}
+
+auto RollbackSession::receive() -> void
+{
+    std::array<uint8_t, MAX_NET_PACKET> buffer;
+    while (size_t size = m_transport.receive(buffer))
+    {
+        m_stats.packetsReceived++;
+        if (!handlePacket({buffer.data(), size}))
+            m_stats.badPackets++;
+    }
+}
+
+// Packets may come late, twice or out of order; input already known is
+// skipped, and the ack only moves forward
+auto RollbackSession::handlePacket(std::span<const uint8_t> packet) -> bool
+{
+    NetPacketHeader header{};
+    if (packet.size() < sizeof(header))
+        return false;
+    std::memcpy(&header, packet.data(), sizeof(header));
+    if (header.magic != NETPLAY_MAGIC || header.player != m_remote || header.inputCount > MAX_PACKET_INPUTS
+        || packet.size() != sizeof(header) + header.inputCount * sizeof(uint16_t) || header.ackFrame > m_localNext)
+        return false;
+
+    m_remoteAck = std::max<uint64_t>(m_remoteAck, header.ackFrame);
+    for (int i = 0; i < header.inputCount; i++)
+    {
+        uint64_t f = uint64_t{header.firstFrame} + i;
+        // Only the next unknown frame; a sender never gets further ahead
+        // than the window, but a broken one could
+        if (f < m_remoteConfirmed)
+            continue;
+        if (f > m_remoteConfirmed || f >= m_frame + NETPLAY_INPUT_WINDOW - MAX_ROLLBACK_FRAMES)
+            break;
+
+        uint16_t remote{};
+        std::memcpy(&remote, packet.data() + sizeof(header) + i * sizeof(uint16_t), sizeof(remote));
+        uint16_t& slot = keys(m_remote, f);
+        if (f < m_frame)
+        {
+            m_stats.predictions++;
+            if (slot != remote)
+            {
+                m_stats.mispredictions++;
+                m_rollbackFrame = std::min(m_rollbackFrame, f);
+            }
+        }
+        slot = remote;
+        m_remoteConfirmed++;
+    }
+    if (header.checkFrame != NO_CHECK_FRAME)
+        compareCheck(header.checkFrame, header.checksum);
+    return true;
+}
+
+auto RollbackSession::send() -> void
+{
+    uint64_t first = m_remoteAck;
+    auto count = static_cast<int>(std::min<uint64_t>(m_localNext - first, MAX_PACKET_INPUTS));
+    bool checked = m_localCheck.frame != ~uint64_t{0};
+    NetPacketHeader header{NETPLAY_MAGIC, static_cast<uint8_t>(m_local), static_cast<uint8_t>(count), 0,
+        static_cast<uint32_t>(first), static_cast<uint32_t>(m_remoteConfirmed),
+        checked ? static_cast<uint32_t>(m_localCheck.frame) : NO_CHECK_FRAME, m_localCheck.checksum};
+
+    std::memcpy(m_packet.data(), &header, sizeof(header));
+    for (int i = 0; i < count; i++)
+        std::memcpy(m_packet.data() + sizeof(header) + i * sizeof(uint16_t), &keys(m_local, first + i), sizeof(uint16_t));
+    if (m_transport.send({m_packet.data(), sizeof(header) + count * sizeof(uint16_t)}))
+        m_stats.packetsSent++;
+}
+
+// Everything before the first wrong frame matched, so its state is
+// correct; every frame from there runs again on the input known now
+auto RollbackSession::rollback() -> void
+{
+    if (m_rollbackFrame == noRollback)
+        return;
+    uint64_t first = std::exchange(m_rollbackFrame, noRollback);
+    uint64_t target = m_frame;
+
+    int64_t start = steadyNowNs();
+    m_chip8.restore(m_states[first % m_states.size()]);
+    m_stats.restoreNs += steadyNowNs() - start;
+    m_frame = first;
+    while (m_frame < target)
+        runFrame();
+    m_stats.resimulateNs += steadyNowNs() - start;
+
+    auto depth = static_cast<int>(target - first);
+    m_stats.rollbacks++;
+    m_stats.resimulatedFrames += depth;
+    m_stats.maxRollback = std::max(m_stats.maxRollback, depth);
+}
+
+auto RollbackSession::runFrame() -> void
+{
+    int64_t start = steadyNowNs();
+    m_chip8.snapshot(m_states[m_frame % m_states.size()]);
+    m_stats.snapshotNs += steadyNowNs() - start;
+
+    // The frame before has run, so its remote input is in the slot
+    uint16_t previous = m_frame == 0 ? 0 : keys(m_local, m_frame - 1) | keys(m_remote, m_frame - 1);
+    uint16_t current = keys(m_local, m_frame) | remoteKeys(m_frame);
+    applyNetplayInput(m_chip8, previous, current);
+    m_chip8.tick(instructionsInFrame(m_frame, m_cpuHz));
+    m_frame++;
+}
+
+// Keys stay held far longer than a frame, so the last known input is the
+// best guess for the ones still on their way
+auto RollbackSession::remoteKeys(uint64_t frame) -> uint16_t
+{
+    uint16_t& slot = keys(m_remote, frame);
+    if (frame >= m_remoteConfirmed)
+        slot = m_remoteConfirmed == 0 ? 0 : keys(m_remote, m_remoteConfirmed - 1);
+    return slot;
+}
+
+// The state before frame f is final once every input before f is known
+// and has run, which after a rollback is everything up to m_remoteConfirmed
+auto RollbackSession::checkConfirmed() -> void
+{
+    while (m_nextCheck <= m_remoteConfirmed && m_nextCheck < m_frame)
+    {
+        if (m_frame - m_nextCheck < m_states.size())
+        {
+            m_localCheck = Check{m_nextCheck, crc32c(m_states[m_nextCheck % m_states.size()])};
+            m_checks[m_nextCheck / NETPLAY_CHECK_INTERVAL % m_checks.size()] = m_localCheck;
+        }
+        m_nextCheck += NETPLAY_CHECK_INTERVAL;
+    }
+}
+
+auto RollbackSession::compareCheck(uint64_t frame, uint32_t checksum) -> void
+{
+    const Check& local = m_checks[frame / NETPLAY_CHECK_INTERVAL % m_checks.size()];
+    if (local.frame != frame || frame <= m_lastCompared)
+        return;
+    m_lastCompared = frame;
+    m_stats.checks++;
+    if (local.checksum != checksum)
+    {
+        m_stats.desyncs++;
+        fmt::print("netplay: desync, the states before frame {} differ\n", frame);
+    }
+}
+
+auto RollbackSession::keys(int player, uint64_t frame) -> uint16_t&
+{
+    return m_inputs[player][frame % NETPLAY_INPUT_WINDOW];
+}
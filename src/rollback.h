@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "chip8.h"
+
+constexpr const uint32_t NETPLAY_MAGIC = 0x4E503843; // "C8NP"
+constexpr const int NETPLAY_PLAYERS = 2;
+// Frames a session runs ahead of the newest remote input it has, and so
+// the deepest rollback
+constexpr const int MAX_ROLLBACK_FRAMES = 12;
+constexpr const int MAX_INPUT_DELAY = 8;
+// Unacknowledged local input resent in every packet, at most
+constexpr const int MAX_PACKET_INPUTS = 2 * MAX_ROLLBACK_FRAMES + MAX_INPUT_DELAY;
+// Frames of input kept per player; a power of two that covers the
+// rollback window and every input still in flight
+constexpr const int NETPLAY_INPUT_WINDOW = 64;
+// Confirmed states are checksummed and compared every this many frames
+constexpr const int NETPLAY_CHECK_INTERVAL = 30;
+constexpr const uint32_t NO_CHECK_FRAME = 0xFFFFFFFF;
+
+// One UDP datagram, followed by inputCount 16-bit key masks for the frames
+// from firstFrame on. Every packet repeats all the sender's input the
+// receiver has not acknowledged yet, so a lost packet costs nothing once
+// the next one arrives.
+struct NetPacketHeader
+{
+    uint32_t magic;
+    uint8_t player; // of the sender
+    uint8_t inputCount;
+    uint16_t reserved;
+    uint32_t firstFrame;
+    uint32_t ackFrame;   // the sender has the receiver's input for every frame before this
+    uint32_t checkFrame; // NO_CHECK_FRAME when there is no checksum yet
+    uint32_t checksum;   // CRC-32C of the snapshot before checkFrame ran
+};
+
+static_assert(std::is_trivially_copyable_v<NetPacketHeader> && sizeof(NetPacketHeader) == 24);
+
+constexpr const size_t MAX_NET_PACKET = sizeof(NetPacketHeader) + MAX_PACKET_INPUTS * sizeof(uint16_t);
+
+// Carries packets between the two sessions, unreliable and unordered like
+// UDP. Neither call may block.
+class NetTransport
+{
+public:
+    NetTransport() = default;
+    NetTransport(const NetTransport& t) = delete;
+    NetTransport(NetTransport&& t) = delete;
+    auto operator=(const NetTransport& t) -> NetTransport& = delete;
+    auto operator=(NetTransport&& t) -> NetTransport& = delete;
+    virtual ~NetTransport() = default;
+
+    virtual auto send(std::span<const uint8_t> packet) -> bool = 0;
+    // The size of the next waiting packet, copied into buffer, or 0 when
+    // there is none
+    virtual auto receive(std::span<uint8_t> buffer) -> size_t = 0;
+};
+
+// Both players share the one keypad, a key is down while either holds it.
+// Queues the difference from previous to current at the start of the next
+// tick, releases before presses.
+auto applyNetplayInput(Chip8& chip8, uint16_t previous, uint16_t current) -> void;
+
+struct NetplayStats
+{
+    uint64_t rollbacks{};
+    uint64_t resimulatedFrames{};
+    int maxRollback{};
+    // Restoring and running every rolled back frame again
+    int64_t resimulateNs{};
+    int64_t restoreNs{};
+    int64_t snapshotNs{};
+    // Frames that had run on a prediction when their remote input arrived,
+    // and how many of those guessed wrong
+    uint64_t predictions{};
+    uint64_t mispredictions{};
+    // advance calls that could not run a frame
+    uint64_t stalls{};
+    uint64_t packetsSent{};
+    uint64_t packetsReceived{};
+    uint64_t badPackets{};
+    uint64_t checks{};
+    uint64_t desyncs{};
+};
+
+// Rollback netplay for two players on one machine. Every frame runs at
+// once with the local input and a prediction of the remote one, the last
+// remote input seen. The state before each recent frame is kept, so when
+// remote input arrives that differs from what was predicted, the session
+// restores the state before the first wrong frame and runs forward again
+// with the real input before the next frame is shown. Both sides run the
+// same deterministic frames on the same input, so they agree once every
+// input is known; checksums of confirmed states are exchanged to catch it
+// when they do not. chip8 must be reset, seeded and loaded the same way on
+// both sides, and only the session may queue its keys.
+class RollbackSession
+{
+public:
+    // inputDelay frames pass between reading local input and running it,
+    // trading latency for fewer rollbacks; both sides must use the same.
+    // chip8 keeps the variant it has now for the whole session.
+    RollbackSession(Chip8& chip8, NetTransport& transport, int localPlayer, uint32_t cpuHz, int inputDelay = 0);
+
+    // Exchanges packets and rolls back if needed, then runs the next frame
+    // with localKeys, bit k for key k. False without running a frame when
+    // the remote side is too far behind to keep predicting.
+    auto advance(uint16_t localKeys) -> bool;
+    // Only exchanges packets and rolls back, for waiting out a stall or
+    // settling the last frames
+    auto poll() -> void;
+
+    // Frames run
+    [[nodiscard]] auto frame() const -> uint64_t;
+    // Every input before this frame is known and has been run
+    [[nodiscard]] auto confirmedFrame() const -> uint64_t;
+    [[nodiscard]] auto stats() const -> const NetplayStats&;
+    auto print() const -> void;
+
+private:
+    constexpr static uint64_t noRollback = ~uint64_t{0};
+
+    struct Check
+    {
+        uint64_t frame{~uint64_t{0}};
+        uint32_t checksum{};
+    };
+
+    auto receive() -> void;
+    auto handlePacket(std::span<const uint8_t> packet) -> bool;
+    auto send() -> void;
+    auto rollback() -> void;
+    auto runFrame() -> void;
+    auto remoteKeys(uint64_t frame) -> uint16_t;
+    auto checkConfirmed() -> void;
+    auto compareCheck(uint64_t frame, uint32_t checksum) -> void;
+    auto keys(int player, uint64_t frame) -> uint16_t&;
+
+    Chip8& m_chip8;
+    NetTransport& m_transport;
+    int m_local;
+    int m_remote;
+    uint32_t m_cpuHz;
+    int m_inputDelay;
+
+    uint64_t m_frame{};
+    // Local input is known up to here, remote input up to m_remoteConfirmed
+    uint64_t m_localNext{};
+    uint64_t m_remoteConfirmed{};
+    // The remote side has local input for every frame before this
+    uint64_t m_remoteAck{};
+    // The first frame that ran on a wrong prediction
+    uint64_t m_rollbackFrame{noRollback};
+
+    // Key masks by frame % NETPLAY_INPUT_WINDOW. Remote input from
+    // m_remoteConfirmed on is the prediction the frame last ran with.
+    std::array<std::array<uint16_t, NETPLAY_INPUT_WINDOW>, NETPLAY_PLAYERS> m_inputs{};
+    // The snapshot before frame f is at f % the size
+    std::vector<std::vector<uint8_t>> m_states;
+
+    uint64_t m_nextCheck{NETPLAY_CHECK_INTERVAL};
+    // The newest local check goes out in every packet, older ones wait
+    // for the remote side's to arrive
+    Check m_localCheck;
+    std::array<Check, 8> m_checks{};
+    uint64_t m_lastCompared{};
+    std::vector<uint8_t> m_packet;
+    NetplayStats m_stats;
+};
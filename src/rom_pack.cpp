@@ -0,0 +1,289 @@
+#include "rom_pack.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <unordered_map>
+#include <fmt/core.h>
+
+#include "checksum.h"
+
+namespace
+{
+    auto alignUp(uint64_t offset) -> uint64_t
+    {
+        return (offset + ROMPACK_ALIGNMENT - 1) / ROMPACK_ALIGNMENT * ROMPACK_ALIGNMENT;
+    }
+
+    auto nameHash(std::string_view name) -> uint64_t
+    {
+        return fnv1a64({reinterpret_cast<const uint8_t*>(name.data()), name.size()});
+    }
+
+    auto insert(std::vector<uint32_t>& buckets, uint64_t key, uint32_t value) -> void
+    {
+        size_t mask = buckets.size() - 1;
+        size_t slot = key & mask;
+        while (buckets[slot] != 0)
+            slot = (slot + 1) & mask;
+        buckets[slot] = value;
+    }
+
+    // Entry index + 1 of the first bucket from key's slot that matches, 0
+    // at the first empty one
+    template<typename Match>
+    auto probe(const uint32_t* buckets, uint32_t bucketCount, uint64_t key, Match&& match) -> uint32_t
+    {
+        size_t mask = bucketCount - 1;
+        size_t slot = key & mask;
+        for (uint32_t i = 0; i < bucketCount && buckets[slot] != 0; i++)
+        {
+            if (match(buckets[slot] - 1))
+                return buckets[slot];
+            slot = (slot + 1) & mask;
+        }
+        return 0;
+    }
+}
+
+auto RomPack::open(std::string_view path) -> bool
+{
+    close();
+    if (!m_file.open(path, MappedFile::Mode::Read))
+        return false;
+
+    const uint8_t* data = m_file.data().data();
+    if (m_file.size() < sizeof(RomPackHeader))
+    {
+        fmt::print("{} is not a ROM pack\n", path);
+        close();
+        return false;
+    }
+    m_header = reinterpret_cast<const RomPackHeader*>(data);
+    if (!validate(path))
+    {
+        close();
+        return false;
+    }
+    m_entries = reinterpret_cast<const RomPackEntry*>(data + m_header->entriesOffset);
+    m_hashBuckets = reinterpret_cast<const uint32_t*>(data + m_header->hashBucketsOffset);
+    m_nameBuckets = reinterpret_cast<const uint32_t*>(data + m_header->nameBucketsOffset);
+    m_names = reinterpret_cast<const char*>(data + m_header->namesOffset);
+    return true;
+}
+
+// The layout has to be exactly what the builder writes, so every offset
+// read later is known to be inside the file
+auto RomPack::validate(std::string_view path) const -> bool
+{
+    const RomPackHeader& header = *m_header;
+    if (header.magic != ROMPACK_MAGIC)
+    {
+        fmt::print("{} is not a ROM pack\n", path);
+        return false;
+    }
+    if (header.version != ROMPACK_VERSION)
+    {
+        fmt::print("{} is a version {} ROM pack, expected version {}\n", path, header.version, ROMPACK_VERSION);
+        return false;
+    }
+
+    uint64_t count = header.romCount;
+    uint64_t buckets = header.bucketCount;
+    bool layout = header.fileSize == m_file.size()
+        && std::has_single_bit(buckets) && buckets >= 2 * count
+        && header.entriesOffset == sizeof(RomPackHeader)
+        && header.hashBucketsOffset == header.entriesOffset + count * sizeof(RomPackEntry)
+        && header.nameBucketsOffset == header.hashBucketsOffset + buckets * sizeof(uint32_t)
+        && header.namesOffset == header.nameBucketsOffset + buckets * sizeof(uint32_t)
+        && header.dataOffset >= header.namesOffset && header.dataOffset <= header.fileSize;
+    if (!layout)
+    {
+        fmt::print("{} is damaged: bad layout\n", path);
+        return false;
+    }
+
+    std::span<const uint8_t> index = m_file.data().subspan(header.entriesOffset, header.dataOffset - header.entriesOffset);
+    if (crc32c(index) != header.checksum)
+    {
+        fmt::print("{} is damaged: index checksum mismatch\n", path);
+        return false;
+    }
+
+    const uint8_t* data = m_file.data().data();
+    auto entries = reinterpret_cast<const RomPackEntry*>(data + header.entriesOffset);
+    uint64_t namesSize = header.dataOffset - header.namesOffset;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        const RomPackEntry& entry = entries[i];
+        // Written so that no sum can wrap around
+        if (entry.offset < header.dataOffset || entry.offset > header.fileSize
+            || entry.size > header.fileSize - entry.offset
+            || uint64_t{entry.nameOffset} + entry.nameLength > namesSize)
+        {
+            fmt::print("{} is damaged: entry {} is out of bounds\n", path, i);
+            return false;
+        }
+    }
+    auto bucketWords = reinterpret_cast<const uint32_t*>(data + header.hashBucketsOffset);
+    for (uint64_t i = 0; i < 2 * buckets; i++)
+    {
+        if (bucketWords[i] > count)
+        {
+            fmt::print("{} is damaged: bad bucket\n", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+auto RomPack::close() -> void
+{
+    m_file.close();
+    m_header = nullptr;
+    m_entries = nullptr;
+    m_hashBuckets = nullptr;
+    m_nameBuckets = nullptr;
+    m_names = nullptr;
+}
+
+auto RomPack::isOpen() const -> bool
+{
+    return m_header != nullptr;
+}
+
+auto RomPack::size() const -> size_t
+{
+    return m_header != nullptr ? m_header->romCount : 0;
+}
+
+auto RomPack::name(size_t index) const -> std::string_view
+{
+    const RomPackEntry& entry = m_entries[index];
+    return {m_names + entry.nameOffset, entry.nameLength};
+}
+
+auto RomPack::hash(size_t index) const -> uint64_t
+{
+    return m_entries[index].hash;
+}
+
+auto RomPack::rom(size_t index) const -> std::span<const uint8_t>
+{
+    const RomPackEntry& entry = m_entries[index];
+    return m_file.data().subspan(entry.offset, entry.size);
+}
+
+auto RomPack::findHash(uint64_t hash, size_t& index) const -> bool
+{
+    if (m_header == nullptr)
+        return false;
+    uint32_t found = probe(m_hashBuckets, m_header->bucketCount, hash, [&](uint32_t i)
+    {
+        return m_entries[i].hash == hash;
+    });
+    index = found - 1;
+    return found != 0;
+}
+
+auto RomPack::findName(std::string_view name, size_t& index) const -> bool
+{
+    if (m_header == nullptr)
+        return false;
+    uint32_t found = probe(m_nameBuckets, m_header->bucketCount, nameHash(name), [&](uint32_t i)
+    {
+        return this->name(i) == name;
+    });
+    index = found - 1;
+    return found != 0;
+}
+
+auto RomPackBuilder::add(std::string_view name, std::span<const uint8_t> rom) -> void
+{
+    m_roms.push_back(Rom{std::string(name), std::vector<uint8_t>(rom.begin(), rom.end()), fnv1a64(rom)});
+}
+
+auto RomPackBuilder::size() const -> size_t
+{
+    return m_roms.size();
+}
+
+auto RomPackBuilder::write(std::string_view path) -> bool
+{
+    std::ranges::sort(m_roms, {}, &Rom::name);
+    auto duplicate = std::ranges::adjacent_find(m_roms, {}, &Rom::name);
+    if (duplicate != m_roms.end())
+    {
+        fmt::print("{} is in the pack twice\n", duplicate->name);
+        return false;
+    }
+
+    auto count = static_cast<uint32_t>(m_roms.size());
+    auto bucketCount = std::bit_ceil(std::max<uint32_t>(2 * count, 2));
+    uint64_t namesSize = 0;
+    for (const Rom& rom : m_roms)
+        namesSize += rom.name.size();
+
+    RomPackHeader header{};
+    header.magic = ROMPACK_MAGIC;
+    header.version = ROMPACK_VERSION;
+    header.romCount = count;
+    header.bucketCount = bucketCount;
+    header.entriesOffset = sizeof(RomPackHeader);
+    header.hashBucketsOffset = header.entriesOffset + uint64_t{count} * sizeof(RomPackEntry);
+    header.nameBucketsOffset = header.hashBucketsOffset + uint64_t{bucketCount} * sizeof(uint32_t);
+    header.namesOffset = header.nameBucketsOffset + uint64_t{bucketCount} * sizeof(uint32_t);
+    header.dataOffset = alignUp(header.namesOffset + namesSize);
+
+    // Identical ROMs point at the first copy
+    std::vector<RomPackEntry> entries(count);
+    std::vector<uint32_t> hashBuckets(bucketCount);
+    std::vector<uint32_t> nameBuckets(bucketCount);
+    std::unordered_map<uint64_t, uint32_t> placed;
+    std::vector<uint32_t> stored;
+    uint64_t end = header.dataOffset;
+    uint32_t nameOffset = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const Rom& rom = m_roms[i];
+        RomPackEntry& entry = entries[i];
+        entry.hash = rom.hash;
+        entry.size = static_cast<uint32_t>(rom.data.size());
+        entry.nameOffset = nameOffset;
+        entry.nameLength = static_cast<uint32_t>(rom.name.size());
+        nameOffset += entry.nameLength;
+
+        auto [first, fresh] = placed.try_emplace(rom.hash, i);
+        if (!fresh && m_roms[first->second].data == rom.data)
+        {
+            entry.offset = entries[first->second].offset;
+        }
+        else
+        {
+            entry.offset = end;
+            end = alignUp(end + rom.data.size());
+            stored.push_back(i);
+            if (fresh)
+                insert(hashBuckets, rom.hash, i + 1);
+        }
+        insert(nameBuckets, nameHash(rom.name), i + 1);
+    }
+    header.fileSize = end;
+
+    MappedFile file;
+    if (!file.open(path, MappedFile::Mode::ReadWrite, end))
+        return false;
+    std::span<uint8_t> out = file.writable();
+    // An existing file of the same size keeps its old bytes in the padding
+    std::ranges::fill(out, 0);
+    std::memcpy(out.data() + header.entriesOffset, entries.data(), entries.size() * sizeof(RomPackEntry));
+    std::memcpy(out.data() + header.hashBucketsOffset, hashBuckets.data(), hashBuckets.size() * sizeof(uint32_t));
+    std::memcpy(out.data() + header.nameBucketsOffset, nameBuckets.data(), nameBuckets.size() * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++)
+        std::ranges::copy(m_roms[i].name, out.begin() + static_cast<ptrdiff_t>(header.namesOffset + entries[i].nameOffset));
+    for (uint32_t i : stored)
+        std::ranges::copy(m_roms[i].data, out.begin() + static_cast<ptrdiff_t>(entries[i].offset));
+    header.checksum = crc32c(out.subspan(header.entriesOffset, header.dataOffset - header.entriesOffset));
+    std::memcpy(out.data(), &header, sizeof(header));
+    return file.flush();
+}
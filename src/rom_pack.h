@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "mapped_file.h"
+
+constexpr const uint32_t ROMPACK_MAGIC = 0x50523843; // "C8RP"
+constexpr const uint32_t ROMPACK_VERSION = 1;
+// ROM data starts on this boundary
+constexpr const size_t ROMPACK_ALIGNMENT = 64;
+
+// Many ROMs in one file, mapped once and loaded by copying straight out of
+// the mapping. In native byte order:
+//     header
+//     entries[romCount], sorted by name
+//     hashBuckets[bucketCount], nameBuckets[bucketCount]
+//     names
+//     ROM data, each aligned to ROMPACK_ALIGNMENT
+// Buckets are open addressed tables of entry index + 1, 0 when empty,
+// probed linearly from the low bits of the key's FNV-1a hash; a content
+// hash finds the first entry by name with it. Identical ROMs under
+// different names share their data.
+struct RomPackHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t romCount;
+    uint32_t bucketCount; // power of two, at least twice romCount
+    uint64_t entriesOffset;
+    uint64_t hashBucketsOffset;
+    uint64_t nameBucketsOffset;
+    uint64_t namesOffset;
+    uint64_t dataOffset;
+    uint64_t fileSize;
+    uint32_t checksum; // CRC-32C from the entries to dataOffset
+    uint32_t reserved;
+};
+
+struct RomPackEntry
+{
+    uint64_t hash;   // FNV-1a of the ROM
+    uint64_t offset; // of the ROM from the start of the file
+    uint32_t size;
+    uint32_t nameOffset; // into the names, which are not terminated
+    uint32_t nameLength;
+    uint32_t reserved;
+};
+
+static_assert(std::is_trivially_copyable_v<RomPackHeader> && sizeof(RomPackHeader) == 72);
+static_assert(std::is_trivially_copyable_v<RomPackEntry> && sizeof(RomPackEntry) == 32);
+
+// A pack opened read only. The index is checked once on open; after that
+// lookups only read the mapping.
+class RomPack
+{
+public:
+    auto open(std::string_view path) -> bool;
+    auto close() -> void;
+
+    [[nodiscard]] auto isOpen() const -> bool;
+    [[nodiscard]] auto size() const -> size_t;
+    [[nodiscard]] auto name(size_t index) const -> std::string_view;
+    [[nodiscard]] auto hash(size_t index) const -> uint64_t;
+    // Points into the mapping, valid until close
+    [[nodiscard]] auto rom(size_t index) const -> std::span<const uint8_t>;
+    // False when nothing matches
+    auto findHash(uint64_t hash, size_t& index) const -> bool;
+    auto findName(std::string_view name, size_t& index) const -> bool;
+
+private:
+    auto validate(std::string_view path) const -> bool;
+
+    MappedFile m_file;
+    const RomPackHeader* m_header{};
+    const RomPackEntry* m_entries{};
+    const uint32_t* m_hashBuckets{};
+    const uint32_t* m_nameBuckets{};
+    const char* m_names{};
+};
+
+// Collects ROMs in memory and writes them out as a pack
+class RomPackBuilder
+{
+public:
+    auto add(std::string_view name, std::span<const uint8_t> rom) -> void;
+    [[nodiscard]] auto size() const -> size_t;
+    // Fails on duplicate names
+    auto write(std::string_view path) -> bool;
+
+private:
+    struct Rom
+    {
+        std::string name;
+        std::vector<uint8_t> data;
+        uint64_t hash;
+    };
+
+    std::vector<Rom> m_roms;
+};
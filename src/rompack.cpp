@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "checksum.h"
+#include "chip8.h"
+#include "mapped_file.h"
+#include "rom_pack.h"
+
+// Builds ROM packs from a directory tree, lists them, checks that damaged
+// copies of one are refused, and times loading a corpus from a pack against
+// loading it one file at a time.
+
+struct PackOptions
+{
+    std::string_view command;
+    const char* directory{};
+    const char* pack{};
+    int rounds{5};
+};
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_rompack build <directory> <pack.c8p>\n"
+        "       ./chip8_rompack list <pack.c8p>\n"
+        "       ./chip8_rompack check <pack.c8p>\n"
+        "       ./chip8_rompack bench <directory> <pack.c8p> [--rounds N]\n");
+}
+
+auto parseOptions(int argc, char** argv, PackOptions& options) -> bool
+{
+    if (argc < 2)
+        return false;
+    options.command = argv[1];
+    std::vector<const char*> paths;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--rounds" && i + 1 < argc)
+            options.rounds = std::atoi(argv[++i]);
+        else if (!arg.starts_with("--"))
+            paths.push_back(argv[i]);
+        else
+            return false;
+    }
+
+    if ((options.command == "list" || options.command == "check") && paths.size() == 1)
+        options.pack = paths[0];
+    else if ((options.command == "build" || options.command == "bench") && paths.size() == 2)
+    {
+        options.directory = paths[0];
+        options.pack = paths[1];
+    }
+    else
+        return false;
+    return options.rounds > 0;
+}
+
+// Every regular file under directory, sorted so packs build reproducibly
+auto listFiles(const char* directory, std::vector<std::filesystem::path>& files) -> bool
+{
+    std::error_code error;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory, error))
+    {
+        if (entry.is_regular_file())
+            files.push_back(entry.path());
+    }
+    if (error)
+    {
+        fmt::print("Could not read the directory {}: {}\n", directory, error.message());
+        return false;
+    }
+    std::ranges::sort(files);
+    return true;
+}
+
+// Named by their path relative to the directory. Files too big for even
+// XO-CHIP memory are left out.
+auto build(const PackOptions& options) -> int
+{
+    std::vector<std::filesystem::path> files;
+    if (!listFiles(options.directory, files))
+        return 1;
+
+    RomPackBuilder builder;
+    uint64_t romBytes = 0;
+    for (const std::filesystem::path& path : files)
+    {
+        MappedFile file;
+        if (!file.open(path.string(), MappedFile::Mode::Read))
+            continue;
+        if (file.size() > MAX_MEM_SIZE - FIRST_MEM_ADDRESS)
+        {
+            fmt::print("Skipping {}, {} bytes is too big for a ROM\n", path.string(), file.size());
+            continue;
+        }
+        builder.add(std::filesystem::relative(path, options.directory).generic_string(), file.data());
+        romBytes += file.size();
+    }
+    if (!builder.write(options.pack))
+        return 1;
+
+    fmt::print("packed {} ROMs, {} bytes, into {}: {} bytes\n", builder.size(), romBytes, options.pack,
+        std::filesystem::file_size(options.pack));
+    return 0;
+}
+
+auto list(const PackOptions& options) -> int
+{
+    RomPack pack;
+    if (!pack.open(options.pack))
+        return 1;
+    for (size_t i = 0; i < pack.size(); i++)
+        fmt::print("{:016x} {:>6} {}\n", pack.hash(i), pack.rom(i).size(), pack.name(i));
+    fmt::print("{} ROMs\n", pack.size());
+    return 0;
+}
+
+// Writes copies of the pack with its first entry damaged and the index
+// checksum fixed up to match, so only the bounds checks stand between
+// each copy and a read outside the mapping, and expects open to refuse
+// every one of them
+auto check(const PackOptions& options) -> int
+{
+    RomPack pack;
+    if (!pack.open(options.pack))
+        return 1;
+    if (pack.size() == 0)
+    {
+        fmt::print("{} has no entries to damage\n", options.pack);
+        return 1;
+    }
+    pack.close();
+
+    MappedFile original;
+    if (!original.open(options.pack, MappedFile::Mode::Read))
+        return 1;
+    RomPackHeader header{};
+    std::memcpy(&header, original.data().data(), sizeof(header));
+
+    struct Damage
+    {
+        std::string_view what;
+        void (*apply)(RomPackEntry& entry, const RomPackHeader& header);
+    };
+    const std::array<Damage, 3> damages{{
+        {"offset + size wraps around", [](RomPackEntry& entry, const RomPackHeader&)
+            {
+                entry.offset = ~uint64_t{0} - 31;
+                entry.size = 64;
+            }},
+        {"ROM runs past the end", [](RomPackEntry& entry, const RomPackHeader& h)
+            {
+                entry.offset = h.fileSize - 1;
+                entry.size = 2;
+            }},
+        {"name runs past the names", [](RomPackEntry& entry, const RomPackHeader& h)
+            {
+                entry.nameOffset = static_cast<uint32_t>(h.dataOffset - h.namesOffset);
+                entry.nameLength = 1;
+            }},
+    }};
+
+    std::string damagedPath = std::string(options.pack) + ".damaged";
+    int accepted = 0;
+    for (const Damage& damage : damages)
+    {
+        {
+            MappedFile copy;
+            if (!copy.open(damagedPath, MappedFile::Mode::ReadWrite, original.size()))
+                return 1;
+            std::span<uint8_t> bytes = copy.writable();
+            std::ranges::copy(original.data(), bytes.begin());
+            RomPackEntry entry{};
+            std::memcpy(&entry, bytes.data() + header.entriesOffset, sizeof(entry));
+            damage.apply(entry, header);
+            std::memcpy(bytes.data() + header.entriesOffset, &entry, sizeof(entry));
+            RomPackHeader damaged = header;
+            damaged.checksum = crc32c(bytes.subspan(header.entriesOffset, header.dataOffset - header.entriesOffset));
+            std::memcpy(bytes.data(), &damaged, sizeof(damaged));
+        }
+        RomPack damaged;
+        bool refused = !damaged.open(damagedPath);
+        fmt::print("{}: {}\n", damage.what, refused ? "refused" : "ACCEPTED");
+        if (!refused)
+            accepted++;
+    }
+    std::error_code error;
+    std::filesystem::remove(damagedPath, error);
+
+    fmt::print("{} of {} damaged packs refused\n", damages.size() - accepted, damages.size());
+    return accepted == 0 ? 0 : 1;
+}
+
+// Best of the rounds, so both sides run from a warm page cache. The pack
+// side includes opening and checking it, and finds every ROM by name the
+// way a manifest would.
+auto bench(const PackOptions& options) -> int
+{
+    std::vector<std::filesystem::path> files;
+    if (!listFiles(options.directory, files))
+        return 1;
+    std::vector<std::string> paths;
+    std::vector<std::string> names;
+    for (const std::filesystem::path& path : files)
+    {
+        paths.push_back(path.string());
+        names.push_back(std::filesystem::relative(path, options.directory).generic_string());
+    }
+
+    Chip8 chip8;
+    chip8.setVariant(Variant::XOChip);
+    chip8.cpuReset();
+
+    using Clock = std::chrono::steady_clock;
+    double fileSeconds = 1e30;
+    double packSeconds = 1e30;
+    size_t loaded = 0;
+    for (int round = 0; round < options.rounds; round++)
+    {
+        auto start = Clock::now();
+        for (const std::string& path : paths)
+        {
+            if (!chip8.loadROM(path))
+                return 1;
+        }
+        fileSeconds = std::min(fileSeconds, std::chrono::duration<double>(Clock::now() - start).count());
+
+        start = Clock::now();
+        RomPack pack;
+        if (!pack.open(options.pack))
+            return 1;
+        loaded = 0;
+        for (const std::string& name : names)
+        {
+            size_t index = 0;
+            if (pack.findName(name, index) && chip8.loadROM(pack.rom(index)))
+                loaded++;
+        }
+        packSeconds = std::min(packSeconds, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    if (loaded != names.size())
+    {
+        fmt::print("{} of {} files are not in {}, rebuild it\n", names.size() - loaded, names.size(), options.pack);
+        return 1;
+    }
+
+    double count = static_cast<double>(paths.size());
+    fmt::print("{} ROMs, best of {} rounds\n", paths.size(), options.rounds);
+    fmt::print("files: {:>10.3f} ms  {:>8.3f} us/rom\n", fileSeconds * 1e3, fileSeconds * 1e6 / count);
+    fmt::print("pack:  {:>10.3f} ms  {:>8.3f} us/rom\n", packSeconds * 1e3, packSeconds * 1e6 / count);
+    fmt::print("speedup: {:.1f}x\n", packSeconds > 0.0 ? fileSeconds / packSeconds : 0.0);
+    return 0;
+}
+
+auto main(int argc, char** argv) -> int
+{
+    PackOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (options.command == "build")
+        return build(options);
+    if (options.command == "list")
+        return list(options);
+    if (options.command == "check")
+        return check(options);
+    return bench(options);
+}
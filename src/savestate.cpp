@@ -0,0 +1,46 @@
+#include "savestate.h"
+
+#include <fmt/core.h>
+
+auto SaveStateFile::create(std::string_view path, size_t slots) -> bool
+{
+    return m_file.open(path, MappedFile::Mode::ReadWrite, slots * SAVESTATE_SIZE);
+}
+
+auto SaveStateFile::open(std::string_view path) -> bool
+{
+    if (!m_file.open(path, MappedFile::Mode::Read))
+        return false;
+    if (m_file.size() % SAVESTATE_SIZE != 0)
+    {
+        fmt::print("{} is not a savestate file\n", path);
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+auto SaveStateFile::flush() -> bool
+{
+    return m_file.flush();
+}
+
+auto SaveStateFile::slots() const -> size_t
+{
+    return m_file.size() / SAVESTATE_SIZE;
+}
+
+auto SaveStateFile::save(size_t slot, const Chip8& chip8) -> bool
+{
+    auto data = m_file.writable();
+    if (slot >= slots() || data.empty())
+        return false;
+    return chip8.saveState(data.subspan(slot * SAVESTATE_SIZE, SAVESTATE_SIZE));
+}
+
+auto SaveStateFile::load(size_t slot, Chip8& chip8) const -> bool
+{
+    if (slot >= slots())
+        return false;
+    return chip8.loadState(m_file.data().subspan(slot * SAVESTATE_SIZE, SAVESTATE_SIZE));
+}
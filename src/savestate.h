@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#include "chip8.h"
+#include "mapped_file.h"
+
+constexpr const uint32_t SAVESTATE_MAGIC = 0x53533843; // "C8SS"
+constexpr const uint32_t SAVESTATE_VERSION = 3;
+
+// Everything a running machine needs besides its memory, in native byte
+// order. Largest fields first so the layout has no padding to leak or to
+// differ by compiler.
+// Pending queued key events, key latency timestamps and engine caches are
+// not part of the state, nor are the variant and quirks the machine runs.
+struct SaveStatePayload
+{
+    DisplayRows gfx;
+    uint64_t random;
+    std::array<uint16_t, STACK_SIZE> stack;
+    uint16_t I;
+    uint16_t PC;
+    std::array<uint8_t, REGISTER_SIZE> V;
+    std::array<uint8_t, KEY_SIZE> key;
+    std::array<uint8_t, RPL_FLAG_COUNT> rplFlags;
+    std::array<uint8_t, AUDIO_PATTERN_SIZE> audioPattern;
+    uint8_t SP;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t waitingForKey;
+    int8_t keyWaitResult;
+    uint8_t hires;
+    uint8_t planeMask;
+    uint8_t pitch;
+    std::array<uint8_t, 4> reserved;
+};
+
+struct SaveStateHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t payloadSize;
+    uint32_t memorySize; // the address space of the variant that saved it
+    uint32_t checksum;   // CRC-32C of the payload and the memory
+    uint32_t reserved;
+};
+
+static_assert(std::is_trivially_copyable_v<SaveStatePayload>);
+static_assert(sizeof(SaveStatePayload) == 2168, "savestate layout changed, bump SAVESTATE_VERSION");
+static_assert(sizeof(SaveStateHeader) == 24);
+
+// A state is the header, the payload and then memorySize bytes of memory,
+// rounded up to a cache line so slots in a file stay aligned
+constexpr auto savestateSize(size_t memorySize) -> size_t
+{
+    return (sizeof(SaveStateHeader) + sizeof(SaveStatePayload) + memorySize + 63) / 64 * 64;
+}
+
+// The largest state, that of XO-CHIP
+constexpr const size_t SAVESTATE_SIZE = savestateSize(MAX_MEM_SIZE);
+
+// A file of fixed size savestate slots, mapped once. Saving is a copy of
+// the state into the page cache; loading copies it back out. Slots hold
+// SAVESTATE_SIZE bytes so any variant fits, and the pages a smaller state
+// leaves untouched are never written.
+class SaveStateFile
+{
+public:
+    // Creates or resizes the file to hold slots states
+    auto create(std::string_view path, size_t slots) -> bool;
+    // Opens an existing file read only
+    auto open(std::string_view path) -> bool;
+    auto flush() -> bool;
+
+    [[nodiscard]] auto slots() const -> size_t;
+    auto save(size_t slot, const Chip8& chip8) -> bool;
+    auto load(size_t slot, Chip8& chip8) const -> bool;
+
+private:
+    MappedFile m_file;
+};
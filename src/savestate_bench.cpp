@@ -0,0 +1,162 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "chip8.h"
+#include "savestate.h"
+
+// Save and load throughput for many warmed up instances, to memory and
+// through a mapped savestate file.
+
+struct BenchOptions
+{
+    const char* rom{};
+    const char* file{"chip8_states.bin"};
+    size_t instances{1000};
+    uint64_t frames{600};
+    int rounds{10};
+};
+
+auto printUsage() -> void
+{
+    fmt::print("Usage: ./chip8_savestate_bench <rom> [--instances N] [--frames N] [--rounds N] [--file states.bin]\n");
+}
+
+auto parseOptions(int argc, char** argv, BenchOptions& options) -> bool
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--instances" && i + 1 < argc)
+            options.instances = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--frames" && i + 1 < argc)
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--rounds" && i + 1 < argc)
+            options.rounds = std::atoi(argv[++i]);
+        else if (arg == "--file" && i + 1 < argc)
+            options.file = argv[++i];
+        else if (options.rom == nullptr && !arg.starts_with("--"))
+            options.rom = argv[i];
+        else
+            return false;
+    }
+    return options.rom != nullptr && options.instances > 0 && options.rounds > 0;
+}
+
+template<typename F>
+auto measure(std::string_view name, size_t states, size_t stateBytes, int rounds, F&& body) -> bool
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        if (!body())
+        {
+            fmt::print("{}: failed\n", name);
+            return false;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double total = static_cast<double>(states) * rounds;
+    double seconds = elapsed.count();
+    fmt::print("{:<12} {:>10.0f} states/sec  {:>8.3f} us/state  {:>8.1f} MB/s\n", name, total / seconds,
+        seconds * 1e6 / total, total * static_cast<double>(stateBytes) / seconds / 1e6);
+    return true;
+}
+
+auto sameScreens(const std::vector<std::unique_ptr<Chip8>>& a, const std::vector<std::unique_ptr<Chip8>>& b) -> bool
+{
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i]->display().rows() != b[i]->display().rows())
+            return false;
+    }
+    return true;
+}
+
+auto main(int argc, char** argv) -> int
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Chip8>> machines;
+    std::vector<std::unique_ptr<Chip8>> restored;
+    for (size_t i = 0; i < options.instances; i++)
+    {
+        auto& chip8 = machines.emplace_back(std::make_unique<Chip8>());
+        chip8->cpuReset();
+        chip8->seedRandom(static_cast<uint32_t>(i));
+        if (!chip8->loadROM(options.rom))
+            return 1;
+        for (uint64_t f = 0; f < options.frames; f++)
+            chip8->tick();
+        restored.emplace_back(std::make_unique<Chip8>());
+    }
+    size_t stateBytes = machines.front()->saveStateSize();
+    fmt::print("{} instances, {} bytes per state\n", options.instances, stateBytes);
+
+    std::vector<uint8_t> buffer(options.instances * stateBytes);
+    auto slot = [&](size_t i) { return std::span(buffer).subspan(i * stateBytes, stateBytes); };
+
+    bool ok = measure("save memory", options.instances, stateBytes, options.rounds, [&]
+    {
+        for (size_t i = 0; i < machines.size(); i++)
+        {
+            if (!machines[i]->saveState(slot(i)))
+                return false;
+        }
+        return true;
+    });
+    ok = ok && measure("load memory", options.instances, stateBytes, options.rounds, [&]
+    {
+        for (size_t i = 0; i < restored.size(); i++)
+        {
+            if (!restored[i]->loadState(slot(i)))
+                return false;
+        }
+        return true;
+    });
+    ok = ok && sameScreens(machines, restored);
+
+    SaveStateFile file;
+    ok = ok && file.create(options.file, options.instances);
+    ok = ok && measure("save mmap", options.instances, stateBytes, options.rounds, [&]
+    {
+        for (size_t i = 0; i < machines.size(); i++)
+        {
+            if (!file.save(i, *machines[i]))
+                return false;
+        }
+        return true;
+    });
+    auto syncStart = std::chrono::steady_clock::now();
+    ok = ok && file.flush();
+    std::chrono::duration<double, std::milli> sync = std::chrono::steady_clock::now() - syncStart;
+    fmt::print("flush        {:.3f} ms\n", sync.count());
+
+    // A fresh read only mapping, as a separate process resuming would see it
+    SaveStateFile reopened;
+    ok = ok && reopened.open(options.file);
+    ok = ok && measure("load mmap", options.instances, stateBytes, options.rounds, [&]
+    {
+        for (size_t i = 0; i < restored.size(); i++)
+        {
+            if (!reopened.load(i, *restored[i]))
+                return false;
+        }
+        return true;
+    });
+    ok = ok && sameScreens(machines, restored);
+
+    fmt::print("{}\n", ok ? "restored state verified" : "savestate round trip failed");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <fmt/core.h>
+
+Scheduler::Scheduler(uint32_t cpuHz) : m_cpuHz(std::clamp(cpuHz, TIMER_HZ, MAX_CPU_HZ))
+{
+}
+
+auto Scheduler::setTurbo(bool turbo) -> void
+{
+    m_turbo = turbo;
+}
+
+auto Scheduler::turbo() const -> bool
+{
+    return m_turbo;
+}
+
+auto Scheduler::cpuHz() const -> uint32_t
+{
+    return m_cpuHz;
+}
+
+auto Scheduler::resync(int64_t nowNs) -> void
+{
+    m_started = true;
+    m_originFrame = m_frame;
+    m_originNs = nowNs;
+    m_lastNs = nowNs;
+}
+
+auto Scheduler::nextDeadlineNs() const -> int64_t
+{
+    return deadlineNs(m_frame);
+}
+
+auto Scheduler::frame() const -> uint64_t
+{
+    return m_frame;
+}
+
+auto Scheduler::effectiveHz() const -> double
+{
+    return m_activeNs > 0 ? m_stats.instructions * 1e9 / m_activeNs : 0.0;
+}
+
+auto Scheduler::stats() const -> const SchedulerStats&
+{
+    return m_stats;
+}
+
+auto Scheduler::jitter() const -> const LatencyHistogram&
+{
+    return m_jitter;
+}
+
+auto Scheduler::print() const -> void
+{
+    double seconds = m_activeNs / 1e9;
+    fmt::print("scheduler: {} Hz target, {:.1f} Hz effective, {:.2f} Hz timers over {:.1f} s\n", m_cpuHz, effectiveHz(),
+        seconds > 0.0 ? m_stats.frames / seconds : 0.0, seconds);
+    fmt::print("scheduler: {} frames, {} in turbo, {} stalls dropping {} frames\n", m_stats.frames, m_stats.turboFrames,
+        m_stats.stalls, m_stats.skippedFrames);
+    m_jitter.print("timer jitter");
+}
+
+auto Scheduler::deadlineNs(uint64_t frame) const -> int64_t
+{
+    return m_originNs + static_cast<int64_t>((frame - m_originFrame) * 1'000'000'000 / TIMER_HZ);
+}
+
+auto Scheduler::framesDue(int64_t nowNs) -> uint64_t
+{
+    if (nowNs < deadlineNs(m_frame))
+        return 0;
+
+    uint64_t due = m_originFrame + static_cast<uint64_t>((nowNs - m_originNs) * TIMER_HZ / 1'000'000'000) + 1 - m_frame;
+    if (due > maxCatchUpFrames)
+    {
+        // Too far behind to catch up without a visible burst, drop the gap
+        m_stats.stalls++;
+        m_stats.skippedFrames += due - 1;
+        m_originFrame = m_frame;
+        m_originNs = nowNs;
+        return 1;
+    }
+    return due;
+}
+
+auto Scheduler::finishFrame(int instructions, int64_t latenessNs) -> void
+{
+    if (!m_turbo)
+        m_jitter.record(latenessNs);
+    m_frame++;
+    m_stats.frames++;
+    m_stats.instructions += instructions;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+
+#include "input.h"
+#include "latency_histogram.h"
+
+constexpr const uint32_t TIMER_HZ = 60;
+constexpr const uint32_t DEFAULT_CPU_HZ = 480;
+// Keeps every frame's instruction slots within a movie event's 16 bits
+constexpr const uint32_t MAX_CPU_HZ = 65535 * TIMER_HZ;
+constexpr const int64_t TIMER_PERIOD_NS = 1'000'000'000 / TIMER_HZ;
+
+// Instructions in 60 Hz frame number frame. The fraction left over from
+// cpuHz / 60 is spread over the frames so every second of emulated time
+// holds exactly cpuHz instructions. Depends only on its arguments, so
+// replays reproduce the same split.
+constexpr auto instructionsInFrame(uint64_t frame, uint32_t cpuHz) -> int
+{
+    return static_cast<int>((frame + 1) * cpuHz / TIMER_HZ - frame * cpuHz / TIMER_HZ);
+}
+
+struct SchedulerStats
+{
+    uint64_t frames{};
+    uint64_t instructions{};
+    uint64_t stalls{};
+    uint64_t skippedFrames{};
+    uint64_t turboFrames{};
+};
+
+// Paces emulated frames, one 60 Hz timer step each plus the CPU
+// instructions that fall into it (see instructionsInFrame), against
+// steady_clock. Frame k is due at origin + k / 60 s, computed from the
+// frame number rather than accumulated, so sleeping late never adds up to
+// drift. After a stall of more than maxCatchUpFrames the missed time is
+// dropped instead of being replayed in a burst. Turbo runs frames back to
+// back for a slice of wall time and then picks the timeline back up from
+// the current time.
+class Scheduler
+{
+public:
+    explicit Scheduler(uint32_t cpuHz = DEFAULT_CPU_HZ);
+
+    auto setTurbo(bool turbo) -> void;
+    [[nodiscard]] auto turbo() const -> bool;
+    [[nodiscard]] auto cpuHz() const -> uint32_t;
+    // Restarts the timeline at nowNs, e.g. after a pause. Not a stall.
+    auto resync(int64_t nowNs) -> void;
+
+    // Runs every frame due by nowNs, or a turbo slice, through frame(),
+    // which returns the instructions it executed. Returns the number of
+    // frames run.
+    template<typename F>
+    auto run(int64_t nowNs, F&& frame) -> uint64_t;
+
+    // When the next frame is due; meaningless in turbo
+    [[nodiscard]] auto nextDeadlineNs() const -> int64_t;
+    [[nodiscard]] auto frame() const -> uint64_t;
+
+    [[nodiscard]] auto effectiveHz() const -> double;
+    [[nodiscard]] auto stats() const -> const SchedulerStats&;
+    // Lateness of each frame against its deadline
+    [[nodiscard]] auto jitter() const -> const LatencyHistogram&;
+    auto print() const -> void;
+
+private:
+    auto deadlineNs(uint64_t frame) const -> int64_t;
+    auto framesDue(int64_t nowNs) -> uint64_t;
+    auto finishFrame(int instructions, int64_t latenessNs) -> void;
+
+    constexpr static uint64_t maxCatchUpFrames = 15;
+    constexpr static int64_t turboSliceNs = TIMER_PERIOD_NS;
+
+    uint32_t m_cpuHz;
+    bool m_turbo{};
+    bool m_started{};
+
+    // Frames paced since the start of the run, not the emulated frame
+    // number, which rewinding moves backwards; the timeline counts from
+    // the last resync
+    uint64_t m_frame{};
+    uint64_t m_originFrame{};
+    int64_t m_originNs{};
+
+    int64_t m_activeNs{};
+    int64_t m_lastNs{};
+    SchedulerStats m_stats;
+    LatencyHistogram m_jitter;
+};
+
+template<typename F>
+auto Scheduler::run(int64_t nowNs, F&& frame) -> uint64_t
+{
+    if (!m_started)
+        resync(nowNs);
+
+    uint64_t ran = 0;
+    if (m_turbo)
+    {
+        int64_t endNs = nowNs + turboSliceNs;
+        do
+        {
+            finishFrame(frame(), 0);
+            m_stats.turboFrames++;
+            ran++;
+            nowNs = steadyNowNs();
+        } while (nowNs < endNs);
+        m_activeNs += nowNs - m_lastNs;
+        m_lastNs = nowNs;
+        // Real time pacing resumes from here when turbo is switched off
+        m_originFrame = m_frame;
+        m_originNs = nowNs;
+        return ran;
+    }
+
+    for (uint64_t due = framesDue(nowNs); due > 0; due--)
+    {
+        int64_t lateness = nowNs - deadlineNs(m_frame);
+        finishFrame(frame(), lateness);
+        ran++;
+    }
+    m_activeNs += nowNs - m_lastNs;
+    m_lastNs = nowNs;
+    return ran;
+}
@@ -0,0 +1,430 @@
+#include "session_server.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <fmt/core.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "scheduler.h"
+
+SessionServer::SessionServer(uint32_t cpuHz) : m_cpuHz(cpuHz)
+{
+}
+
+SessionServer::~SessionServer()
+{
+    for (const auto& [socket, client] : m_clients)
+        ::close(socket);
+    for (int fd : {m_epoll, m_listen, m_timer, m_signals})
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+    if (!m_socketPath.empty())
+        ::unlink(m_socketPath.c_str());
+}
+
+auto SessionServer::addSession(std::span<const uint8_t> rom, Variant variant, uint32_t seed) -> bool
+{
+    auto session = std::make_unique<Session>();
+    Chip8& chip8 = session->chip8;
+    chip8.setVariant(variant);
+    chip8.setQuirks(variantQuirks(variant));
+    // A ROM that goes wrong stops its session instead of the daemon
+    chip8.setChecked(true);
+    chip8.cpuReset();
+    chip8.seedRandom(seed);
+    if (!chip8.loadROM(rom))
+        return false;
+    m_sessions.push_back(std::move(session));
+    return true;
+}
+
+auto SessionServer::listen(std::string_view address) -> bool
+{
+    m_listen = listenStream(address);
+    if (m_listen < 0)
+        return false;
+    constexpr std::string_view unixPrefix = "unix:";
+    if (address.starts_with(unixPrefix))
+        m_socketPath = address.substr(unixPrefix.size());
+    return true;
+}
+
+auto SessionServer::run(int statsSeconds) -> bool
+{
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    ::sigprocmask(SIG_BLOCK, &stop, nullptr);
+    m_signals = ::signalfd(-1, &stop, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    m_timer = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec period{};
+    period.it_interval.tv_nsec = TIMER_PERIOD_NS;
+    period.it_value.tv_nsec = TIMER_PERIOD_NS;
+
+    m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    if (m_listen < 0 || m_signals < 0 || m_timer < 0 || m_epoll < 0 || ::timerfd_settime(m_timer, 0, &period, nullptr) != 0)
+    {
+        fmt::print("Could not set up the event loop: {}\n", std::strerror(errno));
+        return false;
+    }
+    for (int fd : {m_listen, m_timer, m_signals})
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    const uint64_t statsFrames = static_cast<uint64_t>(statsSeconds) * TIMER_HZ;
+    std::array<epoll_event, 64> events;
+    bool running = true;
+    while (running)
+    {
+        int count = ::epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fmt::print("Could not wait for events: {}\n", std::strerror(errno));
+            return false;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            uint32_t flags = events[i].events;
+            if (fd == m_timer)
+            {
+                uint64_t expirations = 0;
+                if (::read(m_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+                    continue;
+                uint64_t frames = std::min(expirations, MAX_CATCHUP_FRAMES);
+                m_stats.lateFrames += expirations - frames;
+                for (uint64_t f = 0; f < frames; f++)
+                    runFrame();
+
+                std::vector<int> failed;
+                for (auto& [socket, client] : m_clients)
+                {
+                    if (client.output.size() > client.sent && !client.waitingToWrite && !flush(client))
+                        failed.push_back(socket);
+                }
+                for (int socket : failed)
+                    closeClient(socket);
+                if (statsFrames != 0 && m_stats.frames / statsFrames != (m_stats.frames - frames) / statsFrames)
+                    print();
+            }
+            else if (fd == m_signals)
+            {
+                running = false;
+            }
+            else if (fd == m_listen)
+            {
+                accept();
+            }
+            else if (auto found = m_clients.find(fd); found != m_clients.end())
+            {
+                Client& client = found->second;
+                bool ok = (flags & EPOLLIN) == 0 || read(client);
+                if (ok && (flags & EPOLLOUT) != 0)
+                    ok = flush(client);
+                if (!ok || ((flags & (EPOLLERR | EPOLLHUP)) != 0 && (flags & EPOLLIN) == 0))
+                    closeClient(fd);
+            }
+        }
+    }
+    return true;
+}
+
+auto SessionServer::stats() const -> const ServerStats&
+{
+    return m_stats;
+}
+
+auto SessionServer::print() const -> void
+{
+    const ServerStats& s = m_stats;
+    double sessionFrames = static_cast<double>(std::max<uint64_t>(s.sessionFrames, 1));
+    double seconds = static_cast<double>(std::max<uint64_t>(s.frames, 1)) / TIMER_HZ;
+    fmt::print("daemon: {} sessions, {} clients, {:.2f} us emulating and {:.2f} us encoding per session frame, "
+        "{} frames late\n", m_sessions.size(), m_clients.size(), s.emulateNs / sessionFrames / 1e3,
+        s.encodeNs / sessionFrames / 1e3, s.lateFrames);
+    fmt::print("daemon: {:.1f} KiB/s out, {} frames sent, {} key frames, {} dropped for slow clients, "
+        "{} key events, {} connections, {} bad, {} sessions stopped\n", s.bytesSent / seconds / 1024.0, s.framesSent,
+        s.keyFrames, s.dropped, s.keyEvents, s.connections, s.badClients, s.faults);
+}
+
+// Every session runs, each watched one builds its message, then every
+// client takes the message of its session unless it is too far behind
+auto SessionServer::runFrame() -> void
+{
+    m_stats.frames++;
+    for (size_t i = 0; i < m_sessions.size(); i++)
+    {
+        Session& session = *m_sessions[i];
+        session.message.clear();
+        if (session.faulted)
+            continue;
+        Chip8& chip8 = session.chip8;
+        int64_t start = steadyNowNs();
+        try
+        {
+            chip8.tick(instructionsInFrame(session.frame, m_cpuHz));
+        }
+        catch (const std::exception& e)
+        {
+            fmt::print("Session {} stopped at frame {}: {}\n", i, session.frame, e.what());
+            session.faulted = true;
+            m_stats.faults++;
+        }
+        session.frame++;
+        uint64_t dirtyRows = chip8.takeDirtyRows();
+        int64_t ticked = steadyNowNs();
+        m_stats.emulateNs += ticked - start;
+        m_stats.sessionFrames++;
+
+        if (session.clients == 0)
+            continue;
+        m_delta.clear();
+        bool changed = session.encoder.encode(chip8.display(), dirtyRows, m_delta);
+        bool buzzing = chip8.buzzing();
+        if (changed || buzzing != session.buzzing)
+        {
+            auto flags = static_cast<uint8_t>((chip8.display().hires() ? FRAME_HIRES : 0) | (buzzing ? FRAME_BUZZ : 0));
+            appendStreamMessage(session.message, StreamMessage::Frame, flags,
+                {streamBytes(StreamFrame{session.frame}), m_delta});
+        }
+        session.buzzing = buzzing;
+        m_stats.encodeNs += steadyNowNs() - ticked;
+    }
+
+    for (auto& [socket, client] : m_clients)
+    {
+        if (client.session < 0)
+            continue;
+        Session& session = *m_sessions[client.session];
+        size_t backlog = client.output.size() - client.sent;
+        if (client.resync)
+        {
+            if (backlog != 0)
+                continue;
+            const std::vector<uint8_t>& message = keyFrame(session);
+            client.output.insert(client.output.end(), message.begin(), message.end());
+            client.resync = false;
+            m_stats.keyFrames++;
+        }
+        else if (!session.message.empty())
+        {
+            if (backlog + session.message.size() > MAX_CLIENT_BACKLOG)
+            {
+                client.resync = true;
+                m_stats.dropped++;
+                continue;
+            }
+            client.output.insert(client.output.end(), session.message.begin(), session.message.end());
+            m_stats.framesSent++;
+        }
+    }
+}
+
+auto SessionServer::keyFrame(Session& session) -> const std::vector<uint8_t>&
+{
+    if (session.keyFrameFrame != session.frame)
+    {
+        const Display& display = session.chip8.display();
+        m_delta.clear();
+        encodeKeyFrame(display, m_delta);
+        auto flags = static_cast<uint8_t>(FRAME_KEY | (display.hires() ? FRAME_HIRES : 0)
+            | (session.chip8.buzzing() ? FRAME_BUZZ : 0));
+        session.keyFrame.clear();
+        appendStreamMessage(session.keyFrame, StreamMessage::Frame, flags,
+            {streamBytes(StreamFrame{session.frame}), m_delta});
+        session.keyFrameFrame = session.frame;
+    }
+    return session.keyFrame;
+}
+
+auto SessionServer::accept() -> void
+{
+    while (true)
+    {
+        int socket = ::accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fmt::print("Could not accept a connection: {}\n", std::strerror(errno));
+            return;
+        }
+        // Fails harmlessly on Unix sockets
+        int on = 1;
+        ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = socket;
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, socket, &event) != 0)
+        {
+            ::close(socket);
+            continue;
+        }
+        m_stats.connections++;
+        Client& client = m_clients[socket];
+        client.socket = socket;
+        StreamWelcome welcome{STREAM_MAGIC, STREAM_VERSION, 0, static_cast<uint32_t>(m_sessions.size()), m_cpuHz};
+        appendStreamMessage(client.output, StreamMessage::Welcome, 0, {streamBytes(welcome)});
+        if (!flush(client))
+            closeClient(socket);
+    }
+}
+
+auto SessionServer::read(Client& client) -> bool
+{
+    bool open = client.input.fill(client.socket);
+    StreamHeader header{};
+    std::span<const uint8_t> payload;
+    while (client.input.next(header, payload))
+    {
+        if (!handleMessage(client, header, payload))
+        {
+            m_stats.badClients++;
+            return false;
+        }
+    }
+    if (client.input.bad())
+    {
+        m_stats.badClients++;
+        return false;
+    }
+    return open && flush(client);
+}
+
+auto SessionServer::handleMessage(Client& client, const StreamHeader& header, std::span<const uint8_t> payload) -> bool
+{
+    switch (static_cast<StreamMessage>(header.type))
+    {
+    case StreamMessage::Attach:
+    {
+        StreamAttach request{};
+        if (payload.size() != sizeof(request))
+            return false;
+        std::memcpy(&request, payload.data(), sizeof(request));
+        if (request.session >= m_sessions.size())
+            return false;
+        attach(client, request.session);
+        return true;
+    }
+    case StreamMessage::Keys:
+    {
+        if (client.session < 0 || payload.size() % sizeof(StreamKey) != 0)
+            return false;
+        Chip8& chip8 = m_sessions[client.session]->chip8;
+        int64_t now = steadyNowNs();
+        for (size_t at = 0; at < payload.size(); at += sizeof(StreamKey))
+        {
+            StreamKey key{};
+            std::memcpy(&key, payload.data() + at, sizeof(key));
+            if (key.key >= KEY_SIZE)
+                return false;
+            chip8.queueKeyEvent(KeyEvent{now, key.key, key.pressed != 0}, 0);
+            m_stats.keyEvents++;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// The first client of a session starts its deltas from the current
+// display, the one its key frame shows; later ones join a stream that is
+// already there
+auto SessionServer::attach(Client& client, uint32_t index) -> void
+{
+    if (client.session >= 0)
+        m_sessions[client.session]->clients--;
+    Session& session = *m_sessions[index];
+    if (session.clients++ == 0)
+    {
+        session.encoder.reset(session.chip8.display());
+        session.buzzing = session.chip8.buzzing();
+    }
+    client.session = static_cast<int>(index);
+    client.resync = true;
+    if (client.output.size() == client.sent)
+    {
+        const std::vector<uint8_t>& message = keyFrame(session);
+        client.output.insert(client.output.end(), message.begin(), message.end());
+        client.resync = false;
+        m_stats.keyFrames++;
+    }
+}
+
+auto SessionServer::flush(Client& client) -> bool
+{
+    while (client.sent < client.output.size())
+    {
+        ssize_t sent = ::send(client.socket, client.output.data() + client.sent, client.output.size() - client.sent,
+            MSG_NOSIGNAL);
+        if (sent >= 0)
+        {
+            client.sent += static_cast<size_t>(sent);
+            m_stats.bytesSent += static_cast<uint64_t>(sent);
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            watch(client, true);
+            return true;
+        }
+        else if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+    client.output.clear();
+    client.sent = 0;
+    watch(client, false);
+    return true;
+}
+
+// Only asks for EPOLLOUT while output is waiting, or an idle client would
+// wake the loop all the time
+auto SessionServer::watch(Client& client, bool write) -> void
+{
+    if (client.waitingToWrite == write)
+        return;
+    epoll_event event{};
+    event.events = write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = client.socket;
+    ::epoll_ctl(m_epoll, EPOLL_CTL_MOD, client.socket, &event);
+    client.waitingToWrite = write;
+}
+
+auto SessionServer::closeClient(int socket) -> void
+{
+    auto found = m_clients.find(socket);
+    if (found == m_clients.end())
+        return;
+    if (found->second.session >= 0)
+        m_sessions[found->second.session]->clients--;
+    ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, socket, nullptr);
+    ::close(socket);
+    m_clients.erase(found);
+}
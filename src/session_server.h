@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "chip8.h"
+#include "frame_delta.h"
+#include "stream_protocol.h"
+
+// Output a client may have waiting before its frames are dropped; it is
+// sent a key frame once it has caught up
+constexpr const size_t MAX_CLIENT_BACKLOG = 64 * 1024;
+// Frames run back to back after the loop fell behind, the rest are skipped
+constexpr const uint64_t MAX_CATCHUP_FRAMES = 4;
+
+struct ServerStats
+{
+    // 60 Hz ticks, and frames run over all sessions
+    uint64_t frames{};
+    uint64_t sessionFrames{};
+    int64_t emulateNs{};
+    int64_t encodeNs{};
+    uint64_t lateFrames{};
+    uint64_t connections{};
+    uint64_t framesSent{};
+    uint64_t keyFrames{};
+    uint64_t bytesSent{};
+    // Frames not sent to clients that fell MAX_CLIENT_BACKLOG behind
+    uint64_t dropped{};
+    uint64_t keyEvents{};
+    uint64_t badClients{};
+    uint64_t faults{};
+};
+
+// Runs headless sessions at 60 Hz and streams them to any number of
+// clients from one thread, around one epoll loop that also waits on the
+// frame timer and the stop signals. Each session encodes one delta per
+// frame and only while someone watches; a frame where nothing changed is
+// not sent at all, so an idle session costs a client nothing. Every
+// client watching a session gets the same bytes, copied into its own
+// output buffer and written as far as the socket takes without blocking.
+class SessionServer
+{
+public:
+    explicit SessionServer(uint32_t cpuHz);
+    SessionServer(const SessionServer& s) = delete;
+    SessionServer(SessionServer&& s) = delete;
+    auto operator=(const SessionServer& s) -> SessionServer& = delete;
+    auto operator=(SessionServer&& s) -> SessionServer& = delete;
+    ~SessionServer();
+
+    // Sessions are numbered from 0 in the order they are added
+    auto addSession(std::span<const uint8_t> rom, Variant variant, uint32_t seed) -> bool;
+    // See listenStream for the address
+    auto listen(std::string_view address) -> bool;
+    // Serves until SIGINT or SIGTERM, printing the stats every statsSeconds
+    // unless that is 0
+    auto run(int statsSeconds) -> bool;
+
+    [[nodiscard]] auto stats() const -> const ServerStats&;
+    auto print() const -> void;
+
+private:
+    struct Session
+    {
+        Chip8 chip8;
+        FrameDeltaEncoder encoder;
+        uint32_t frame{};
+        // Threw from a checked instruction; the display stays as it was
+        bool faulted{};
+        bool buzzing{};
+        int clients{};
+        // This frame's message for every client, empty when there is none
+        std::vector<uint8_t> message;
+        // Built once per frame, for the clients that need one
+        std::vector<uint8_t> keyFrame;
+        uint32_t keyFrameFrame{~uint32_t{0}};
+    };
+
+    struct Client
+    {
+        int socket{-1};
+        StreamReader input;
+        std::vector<uint8_t> output;
+        size_t sent{};
+        int session{-1};
+        // Frames were dropped, a key frame comes next
+        bool resync{};
+        bool waitingToWrite{};
+    };
+
+    auto runFrame() -> void;
+    auto keyFrame(Session& session) -> const std::vector<uint8_t>&;
+    auto accept() -> void;
+    auto read(Client& client) -> bool;
+    auto handleMessage(Client& client, const StreamHeader& header, std::span<const uint8_t> payload) -> bool;
+    auto attach(Client& client, uint32_t index) -> void;
+    auto flush(Client& client) -> bool;
+    auto watch(Client& client, bool write) -> void;
+    auto closeClient(int socket) -> void;
+
+    uint32_t m_cpuHz;
+    std::vector<std::unique_ptr<Session>> m_sessions;
+    std::unordered_map<int, Client> m_clients;
+    std::vector<uint8_t> m_delta;
+    int m_epoll{-1};
+    int m_listen{-1};
+    int m_timer{-1};
+    int m_signals{-1};
+    // Removed again on exit
+    std::string m_socketPath;
+    ServerStats m_stats;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer
+// thread. Each side caches the other's index so the shared cache lines are
+// only touched when the ring looks full or empty.
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(std::has_single_bit(Capacity), "capacity must be a power of two");
+
+public:
+    // Producer side, false when the ring is full
+    auto push(const T& value) -> bool
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_cachedTail == Capacity)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head - m_cachedTail == Capacity)
+                return false;
+        }
+        m_slots[head & mask] = value;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false when the ring is empty
+    auto pop(T& value) -> bool
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_cachedHead)
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail == m_cachedHead)
+                return false;
+        }
+        value = m_slots[tail & mask];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called concurrently with push or pop
+    [[nodiscard]] auto size() const -> size_t
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    constexpr static auto capacity() -> size_t
+    {
+        return Capacity;
+    }
+
+private:
+    constexpr static size_t mask = Capacity - 1;
+    constexpr static size_t cacheLine = 64;
+
+    std::array<T, Capacity> m_slots{};
+    alignas(cacheLine) std::atomic<size_t> m_head{0};
+    alignas(cacheLine) size_t m_cachedTail{0};
+    alignas(cacheLine) std::atomic<size_t> m_tail{0};
+    alignas(cacheLine) size_t m_cachedHead{0};
+};
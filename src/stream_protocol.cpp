@@ -0,0 +1,196 @@
+#include "stream_protocol.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <fmt/core.h>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "udp_transport.h"
+
+namespace
+{
+    // Per fill, so one busy peer cannot keep the loop to itself
+    constexpr const size_t maxFillBytes = 64 * 1024;
+
+    struct StreamAddress
+    {
+        sockaddr_storage storage{};
+        socklen_t length{};
+        bool local{};
+        std::string path;
+    };
+
+    auto resolve(std::string_view address, StreamAddress& out) -> bool
+    {
+        constexpr std::string_view unixPrefix = "unix:";
+        if (address.starts_with(unixPrefix))
+        {
+            out.path = address.substr(unixPrefix.size());
+            auto* un = reinterpret_cast<sockaddr_un*>(&out.storage);
+            if (out.path.empty() || out.path.size() >= sizeof(un->sun_path))
+            {
+                fmt::print("Could not use {} as a socket path\n", out.path);
+                return false;
+            }
+            un->sun_family = AF_UNIX;
+            std::memcpy(un->sun_path, out.path.c_str(), out.path.size() + 1);
+            out.length = sizeof(sockaddr_un);
+            out.local = true;
+            return true;
+        }
+
+        std::string_view host;
+        uint16_t port = 0;
+        if (!parseHostPort(address, host, port))
+        {
+            fmt::print("Could not parse {}, expected unix:PATH or host:port\n", address);
+            return false;
+        }
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        std::string name(host);
+        int err = ::getaddrinfo(name.c_str(), nullptr, &hints, &found);
+        if (err != 0 || found == nullptr)
+        {
+            fmt::print("Could not resolve {}: {}\n", host, gai_strerror(err));
+            return false;
+        }
+        auto* in = reinterpret_cast<sockaddr_in*>(&out.storage);
+        std::memcpy(in, found->ai_addr, sizeof(sockaddr_in));
+        ::freeaddrinfo(found);
+        in->sin_port = htons(port);
+        out.length = sizeof(sockaddr_in);
+        return true;
+    }
+}
+
+auto appendStreamMessage(std::vector<uint8_t>& out, StreamMessage type, uint8_t flags,
+    std::initializer_list<std::span<const uint8_t>> parts) -> void
+{
+    StreamHeader header{0, static_cast<uint8_t>(type), flags, 0};
+    for (std::span<const uint8_t> part : parts)
+        header.length += static_cast<uint32_t>(part.size());
+    std::span<const uint8_t> bytes = streamBytes(header);
+    out.insert(out.end(), bytes.begin(), bytes.end());
+    for (std::span<const uint8_t> part : parts)
+        out.insert(out.end(), part.begin(), part.end());
+}
+
+auto StreamReader::fill(int socket) -> bool
+{
+    if (m_start > 0)
+    {
+        m_bytes.erase(m_bytes.begin(), m_bytes.begin() + static_cast<ptrdiff_t>(m_start));
+        m_start = 0;
+    }
+
+    std::array<uint8_t, 16 * 1024> chunk;
+    size_t total = 0;
+    while (total < maxFillBytes)
+    {
+        ssize_t size = ::recv(socket, chunk.data(), chunk.size(), 0);
+        if (size > 0)
+        {
+            m_bytes.insert(m_bytes.end(), chunk.begin(), chunk.begin() + size);
+            total += static_cast<size_t>(size);
+        }
+        else if (size == 0)
+        {
+            return false;
+        }
+        else if (errno != EINTR)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+    return true;
+}
+
+auto StreamReader::next(StreamHeader& header, std::span<const uint8_t>& payload) -> bool
+{
+    size_t waiting = m_bytes.size() - m_start;
+    if (m_bad || waiting < sizeof(header))
+        return false;
+    std::memcpy(&header, m_bytes.data() + m_start, sizeof(header));
+    if (header.length > MAX_STREAM_PAYLOAD)
+    {
+        m_bad = true;
+        return false;
+    }
+    if (waiting < sizeof(header) + header.length)
+        return false;
+    payload = {m_bytes.data() + m_start + sizeof(header), header.length};
+    m_start += sizeof(header) + header.length;
+    return true;
+}
+
+auto StreamReader::bad() const -> bool
+{
+    return m_bad;
+}
+
+auto listenStream(std::string_view address) -> int
+{
+    StreamAddress resolved;
+    if (!resolve(address, resolved))
+        return -1;
+    // Only a socket left behind by an earlier run, never another file
+    struct stat status{};
+    if (resolved.local && ::stat(resolved.path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+        ::unlink(resolved.path.c_str());
+
+    int fd = ::socket(resolved.storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        fmt::print("Could not create a socket: {}\n", std::strerror(errno));
+        return -1;
+    }
+    int on = 1;
+    if (!resolved.local)
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&resolved.storage), resolved.length) != 0
+        || ::listen(fd, SOMAXCONN) != 0)
+    {
+        fmt::print("Could not listen on {}: {}\n", address, std::strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+auto connectStream(std::string_view address) -> int
+{
+    StreamAddress resolved;
+    if (!resolve(address, resolved))
+        return -1;
+    int fd = ::socket(resolved.storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        fmt::print("Could not create a socket: {}\n", std::strerror(errno));
+        return -1;
+    }
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&resolved.storage), resolved.length) != 0)
+    {
+        fmt::print("Could not connect to {}: {}\n", address, std::strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+    // Frames and key batches are small and should go out at once
+    int on = 1;
+    if (!resolved.local)
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
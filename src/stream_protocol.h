@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// The session daemon's protocol, over a Unix or TCP stream socket. Every
+// message is a StreamHeader and length bytes of payload. On connecting the
+// daemon sends Welcome; the client sends Attach to pick a session, which
+// is answered with a key frame, and from then on the daemon sends a Frame
+// for every frame whose display or buzzer changed. Keys go to the attached
+// session, any number per message.
+constexpr const uint32_t STREAM_MAGIC = 0x53453843; // "C8ES"
+constexpr const uint16_t STREAM_VERSION = 1;
+constexpr const size_t MAX_STREAM_PAYLOAD = 4096;
+
+enum class StreamMessage : uint8_t
+{
+    Welcome = 1, // daemon, StreamWelcome
+    Attach = 2,  // client, StreamAttach
+    Keys = 3,    // client, StreamKey per key change in order
+    Frame = 4,   // daemon, StreamFrame and a frame delta, see frame_delta.h
+};
+
+// Frame flags
+constexpr const uint8_t FRAME_KEY = 0x1;   // the delta starts from a blank screen
+constexpr const uint8_t FRAME_HIRES = 0x2;
+constexpr const uint8_t FRAME_BUZZ = 0x4;  // the sound timer was running
+
+struct StreamHeader
+{
+    uint32_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct StreamWelcome
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t sessions;
+    uint32_t cpuHz;
+};
+
+struct StreamAttach
+{
+    uint32_t session;
+};
+
+struct StreamKey
+{
+    uint8_t key;
+    uint8_t pressed;
+};
+
+struct StreamFrame
+{
+    uint32_t frame; // of the session, counting from 0
+};
+
+static_assert(std::is_trivially_copyable_v<StreamHeader> && sizeof(StreamHeader) == 8);
+static_assert(sizeof(StreamWelcome) == 16 && sizeof(StreamKey) == 2);
+
+// Appends a message whose payload is parts one after the other
+auto appendStreamMessage(std::vector<uint8_t>& out, StreamMessage type, uint8_t flags,
+    std::initializer_list<std::span<const uint8_t>> parts) -> void;
+
+template<typename T>
+auto streamBytes(const T& value) -> std::span<const uint8_t>
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    return {reinterpret_cast<const uint8_t*>(&value), sizeof(T)};
+}
+
+// Collects what arrives on a non-blocking stream socket and hands it back
+// message by message
+class StreamReader
+{
+public:
+    // Reads everything waiting. False when the peer has closed or the
+    // socket failed.
+    auto fill(int socket) -> bool;
+    // The next complete message, valid until the next fill
+    auto next(StreamHeader& header, std::span<const uint8_t>& payload) -> bool;
+    // A message longer than MAX_STREAM_PAYLOAD was announced
+    [[nodiscard]] auto bad() const -> bool;
+
+private:
+    std::vector<uint8_t> m_bytes;
+    size_t m_start{};
+    bool m_bad{};
+};
+
+// address is unix:PATH or host:port for TCP. Both return a non-blocking
+// socket, or -1 after printing why there is none. Listening on a path
+// replaces a stale socket there.
+auto listenStream(std::string_view address) -> int;
+auto connectStream(std::string_view address) -> int;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Single producer, single consumer handoff of the latest value. The
+// producer fills back() and publishes it, the consumer picks up the newest
+// published value with consume(); neither side ever blocks, and values the
+// consumer was too slow to see are overwritten.
+template<typename T>
+class TripleBuffer
+{
+public:
+    // Producer side
+    auto back() -> T&
+    {
+        return m_slots[m_back];
+    }
+
+    auto publish() -> void
+    {
+        uint8_t previous = m_middle.exchange(m_back | freshBit, std::memory_order_acq_rel);
+        m_back = previous & indexMask;
+    }
+
+    // Consumer side, returns true when front() changed
+    auto consume() -> bool
+    {
+        if ((m_middle.load(std::memory_order_relaxed) & freshBit) == 0)
+            return false;
+
+        uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = previous & indexMask;
+        return true;
+    }
+
+    auto front() const -> const T&
+    {
+        return m_slots[m_front];
+    }
+
+private:
+    constexpr static uint8_t indexMask = 0x3;
+    constexpr static uint8_t freshBit = 0x4;
+    constexpr static size_t cacheLine = 64;
+
+    std::array<T, 3> m_slots{};
+    alignas(cacheLine) uint8_t m_back{0};
+    alignas(cacheLine) uint8_t m_front{1};
+    alignas(cacheLine) std::atomic<uint8_t> m_middle{2};
+};
@@ -0,0 +1,119 @@
+#include "udp_transport.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <fmt/core.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+UdpTransport::~UdpTransport()
+{
+    close();
+}
+
+auto UdpTransport::open(uint16_t port) -> bool
+{
+    close();
+    m_socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_socket < 0)
+    {
+        fmt::print("Could not create a UDP socket: {}\n", std::strerror(errno));
+        return false;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::bind(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        fmt::print("Could not bind UDP port {}: {}\n", port, std::strerror(errno));
+        close();
+        return false;
+    }
+    return true;
+}
+
+auto UdpTransport::connect(std::string_view host, uint16_t port) -> bool
+{
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* found = nullptr;
+    std::string name(host);
+    int err = ::getaddrinfo(name.c_str(), nullptr, &hints, &found);
+    if (err != 0 || found == nullptr)
+    {
+        fmt::print("Could not resolve {}: {}\n", host, gai_strerror(err));
+        return false;
+    }
+    std::memcpy(&m_peer, found->ai_addr, sizeof(m_peer));
+    ::freeaddrinfo(found);
+    m_peer.sin_port = htons(port);
+    m_connected = true;
+    return true;
+}
+
+auto UdpTransport::close() -> void
+{
+    if (m_socket >= 0)
+        ::close(m_socket);
+    m_socket = -1;
+    m_connected = false;
+}
+
+auto UdpTransport::localPort() const -> uint16_t
+{
+    sockaddr_in address{};
+    socklen_t length = sizeof(address);
+    if (m_socket < 0 || ::getsockname(m_socket, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+        return 0;
+    return ntohs(address.sin_port);
+}
+
+// A full socket buffer drops the packet like the network would
+auto UdpTransport::send(std::span<const uint8_t> packet) -> bool
+{
+    if (m_socket < 0 || !m_connected)
+        return false;
+    ssize_t sent = ::sendto(m_socket, packet.data(), packet.size(), 0, reinterpret_cast<const sockaddr*>(&m_peer),
+        sizeof(m_peer));
+    return sent == static_cast<ssize_t>(packet.size());
+}
+
+auto UdpTransport::receive(std::span<uint8_t> buffer) -> size_t
+{
+    if (m_socket < 0)
+        return 0;
+    while (true)
+    {
+        sockaddr_in from{};
+        socklen_t length = sizeof(from);
+        // With MSG_TRUNC a datagram too big for buffer reports its full
+        // size, and is dropped like empty ones and strangers' are
+        ssize_t size = ::recvfrom(m_socket, buffer.data(), buffer.size(), MSG_TRUNC,
+            reinterpret_cast<sockaddr*>(&from), &length);
+        if (size < 0)
+            return 0;
+        bool peer = from.sin_addr.s_addr == m_peer.sin_addr.s_addr && from.sin_port == m_peer.sin_port;
+        if (peer && size > 0 && static_cast<size_t>(size) <= buffer.size())
+            return static_cast<size_t>(size);
+    }
+}
+
+auto parseHostPort(std::string_view address, std::string_view& host, uint16_t& port) -> bool
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string_view::npos || colon == 0)
+        return false;
+    host = address.substr(0, colon);
+    std::string_view digits = address.substr(colon + 1);
+    auto [end, err] = std::from_chars(digits.data(), digits.data() + digits.size(), port);
+    return err == std::errc() && end == digits.data() + digits.size();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include <netinet/in.h>
+
+#include "rollback.h"
+
+// A non-blocking IPv4 UDP socket talking to one peer. Datagrams from any
+// other address are dropped.
+class UdpTransport : public NetTransport
+{
+public:
+    UdpTransport() = default;
+    ~UdpTransport() override;
+
+    // Port 0 picks a free one, see localPort
+    auto open(uint16_t port) -> bool;
+    // host is a name or a dotted address
+    auto connect(std::string_view host, uint16_t port) -> bool;
+    auto close() -> void;
+    [[nodiscard]] auto localPort() const -> uint16_t;
+
+    auto send(std::span<const uint8_t> packet) -> bool override;
+    auto receive(std::span<uint8_t> buffer) -> size_t override;
+
+private:
+    int m_socket{-1};
+    sockaddr_in m_peer{};
+    bool m_connected{};
+};
+
+// Splits host:port, false when there is no port
+auto parseHostPort(std::string_view address, std::string_view& host, uint16_t& port) -> bool;
@@ -1,12 +1,11 @@
 #include "window.h"
 
+#include <fmt/core.h>
+
 //#include "dispatcher.h"
 //#include "event.h"
 //#include "keycodes.h"
 
-int Window::keyPressed = -1;
-int Window::keyReleased = -1;
-
 Window::Window()
 {
     glfwInit();
@@ -33,6 +32,7 @@ auto Window::createWindow(int width, int height, const char *name) -> void
         return;
     }
     glfwMakeContextCurrent(m_window);
+    glfwSetWindowUserPointer(m_window, this);
     glfwSetFramebufferSizeCallback(m_window, frameBufferCallback);
     glfwSetKeyCallback(m_window, keyboardCallback);
 
@@ -50,11 +50,21 @@ auto Window::isFocused() const -> bool
     return glfwGetWindowAttrib(m_window, GLFW_FOCUSED);
 }
 
+auto Window::isKeyDown(int key) const -> bool
+{
+    return glfwGetKey(m_window, key) == GLFW_PRESS;
+}
+
 auto Window::swapBuffers() const -> void
 {
     glfwSwapBuffers(m_window);
 }
 
+auto Window::close() -> void
+{
+    glfwSetWindowShouldClose(m_window, GLFW_TRUE);
+}
+
 auto Window::pollEvents() -> void
 {
     glfwPollEvents();
@@ -65,60 +75,59 @@ auto Window::frameBufferCallback(GLFWwindow* window, int width, int height) -> v
     glViewport(0, 0, width, height);
 }
 
+auto Window::mapKey(int key) -> int
+{
+    switch(key)
+    {
+        case GLFW_KEY_X: return 0;
+        case GLFW_KEY_1: return 1;
+        case GLFW_KEY_2: return 2;
+        case GLFW_KEY_3: return 3;
+        case GLFW_KEY_Q: return 4;
+        case GLFW_KEY_W: return 5;
+        case GLFW_KEY_E: return 6;
+        case GLFW_KEY_A: return 7;
+        case GLFW_KEY_S: return 8;
+        case GLFW_KEY_D: return 9;
+        case GLFW_KEY_Z: return 10;
+        case GLFW_KEY_C: return 11;
+        case GLFW_KEY_4: return 12;
+        case GLFW_KEY_R: return 13;
+        case GLFW_KEY_F: return 14;
+        case GLFW_KEY_V: return 15;
+        default: return -1;
+    }
+}
+
 auto Window::keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mods) -> void
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     {
         glfwSetWindowShouldClose(window, true);
+        return;
     }
-    
-    else if (action == GLFW_PRESS)
-    {
-        switch(key)
-        {
-            case GLFW_KEY_X: keyPressed = 0;  break;
-            case GLFW_KEY_1: keyPressed = 1;  break;
-            case GLFW_KEY_2: keyPressed = 2;  break;
-            case GLFW_KEY_3: keyPressed = 3;  break;
-            case GLFW_KEY_Q: keyPressed = 4;  break;
-            case GLFW_KEY_W: keyPressed = 5;  break;
-            case GLFW_KEY_E: keyPressed = 6;  break;
-            case GLFW_KEY_A: keyPressed = 7;  break;
-            case GLFW_KEY_S: keyPressed = 8;  break;
-            case GLFW_KEY_D: keyPressed = 9;  break;
-            case GLFW_KEY_Z: keyPressed = 10; break;
-            case GLFW_KEY_C: keyPressed = 11; break;
-            case GLFW_KEY_4: keyPressed = 12; break;
-            case GLFW_KEY_R: keyPressed = 13; break;
-            case GLFW_KEY_F: keyPressed = 14; break;
-            case GLFW_KEY_V: keyPressed = 15; break;
-        }
-    }
-    else if (action == GLFW_RELEASE)
-    {
-        switch(key)
-        {
-            case GLFW_KEY_X: keyReleased = 0;  break;
-            case GLFW_KEY_1: keyReleased = 1;  break;
-            case GLFW_KEY_2: keyReleased = 2;  break;
-            case GLFW_KEY_3: keyReleased = 3;  break;
-            case GLFW_KEY_Q: keyReleased = 4;  break;
-            case GLFW_KEY_W: keyReleased = 5;  break;
-            case GLFW_KEY_E: keyReleased = 6;  break;
-            case GLFW_KEY_A: keyReleased = 7;  break;
-            case GLFW_KEY_S: keyReleased = 8;  break;
-            case GLFW_KEY_D: keyReleased = 9;  break;
-            case GLFW_KEY_Z: keyReleased = 10; break;
-            case GLFW_KEY_C: keyReleased = 11; break;
-            case GLFW_KEY_4: keyReleased = 12; break;
-            case GLFW_KEY_R: keyReleased = 13; break;
-            case GLFW_KEY_F: keyReleased = 14; break;
-            case GLFW_KEY_V: keyReleased = 15; break;
-        }
-    }
+
+    // Held keys are already down, repeats carry no information
+    if (action == GLFW_REPEAT)
+        return;
+
+    int mapped = mapKey(key);
+    if (mapped == -1)
+        return;
+
+    auto* self = static_cast<Window*>(glfwGetWindowUserPointer(window));
+    KeyEvent event{steadyNowNs(), static_cast<uint8_t>(mapped), action == GLFW_PRESS};
+    if (!self->m_keyEvents.push(event))
+        fmt::print("key event queue full, dropping key {}\n", mapped);
 }
 
 auto Window::getWindow() -> GLFWwindow*
 {
     return m_window;
 }
+
+auto Window::keyEvents() -> KeyEventQueue&
+{
+    return m_keyEvents;
+}
+
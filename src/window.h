@@ -3,6 +3,8 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include "input.h"
+
 class Window
 {
 public:
@@ -16,16 +18,20 @@ public:
     auto createWindow(int width, int height, const char* name) -> void;
     [[nodiscard]] auto shouldClose() const -> bool;
     [[nodiscard]] auto isFocused() const -> bool;
+    [[nodiscard]] auto isKeyDown(int key) const -> bool;
     auto swapBuffers() const -> void;
+    // shouldClose returns true from now on
+    auto close() -> void;
     auto pollEvents() -> void;
     auto getWindow() -> GLFWwindow*;
-
-    static int keyPressed;
-    static int keyReleased;
+    // Filled by pollEvents, drained by whichever thread runs the emulator
+    auto keyEvents() -> KeyEventQueue&;
 
 private:
+    static auto mapKey(int key) -> int;
     static auto frameBufferCallback(GLFWwindow* window, int width, int height) -> void;
     static auto keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mods) -> void;
 
     GLFWwindow* m_window{};
+    KeyEventQueue m_keyEvents;
 };
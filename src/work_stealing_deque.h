@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Chase-Lev deque of small trivially copyable values with a fixed capacity.
+// The owning thread pushes and pops at the bottom, any other thread steals
+// from the top, so the owner works through recent items while thieves take
+// the oldest ones.
+template<typename T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(size_t capacity)
+        : m_mask(std::bit_ceil(capacity) - 1), m_slots(std::make_unique<std::atomic<T>[]>(m_mask + 1))
+    {
+    }
+
+    WorkStealingDeque(const WorkStealingDeque& d) = delete;
+    WorkStealingDeque(WorkStealingDeque&& d) = delete;
+    auto operator=(const WorkStealingDeque& d) -> WorkStealingDeque& = delete;
+    auto operator=(WorkStealingDeque&& d) -> WorkStealingDeque& = delete;
+    ~WorkStealingDeque() = default;
+
+    // Owner only, false when full
+    auto push(T value) -> bool
+    {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top = m_top.load(std::memory_order_acquire);
+        if (bottom - top > static_cast<int64_t>(m_mask))
+            return false;
+
+        m_slots[bottom & m_mask].store(value, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only, false when empty or the last item was stolen
+    auto pop(T& value) -> bool
+    {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = m_slots[bottom & m_mask].load(std::memory_order_relaxed);
+        if (top != bottom)
+            return true;
+
+        // Last item, race the thieves for it
+        bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    // Any thread, false when empty or another thread got there first
+    auto steal(T& value) -> bool
+    {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return false;
+
+        value = m_slots[top & m_mask].load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+private:
+    constexpr static size_t cacheLine = 64;
+
+    size_t m_mask;
+    std::unique_ptr<std::atomic<T>[]> m_slots;
+    alignas(cacheLine) std::atomic<int64_t> m_top{0};
+    alignas(cacheLine) std::atomic<int64_t> m_bottom{0};
+};